@@ -6,14 +6,14 @@ if(NOT TESTS)
     message(FATAL_ERROR "Cannot generate coverage report when tests are disabled")
 endif()
 
-find_program(LLVM_COV llvm-cov llvm-cov-7 llvm-cov-8 llvm-cov-5.0 HINTS /usr/bin)
+find_program(LLVM_COV llvm-cov llvm-cov-7 llvm-cov-8 llvm-cov-11 llvm-cov-5.0 HINTS /usr/bin)
 mark_as_advanced(LLVM_COV)
 
 if(NOT LLVM_COV)
     message(FATAL_ERROR "Cannot find llvm-cov")
 endif()
 
-find_program(LLVM_PROFDATA llvm-profdata llvm-profdata-7 llvm-profdata-8 HINTS /usr/bin)
+find_program(LLVM_PROFDATA llvm-profdata llvm-profdata-7 llvm-profdata-8 llvm-profdata-11 HINTS /usr/bin)
 mark_as_advanced(LLVM_PROFDATA)
 
 if(NOT LLVM_PROFDATA)
@@ -1,13 +1,14 @@
-pkg_check_modules(PC_FUSE REQUIRED fuse)
+# lseek (SEEK_DATA/SEEK_HOLE) is available since fuse 3.8
+pkg_check_modules(PC_FUSE REQUIRED fuse3>=3.8)
 
 find_path(FUSE_INCLUDE_DIR fuse.h
     HINTS ${PC_FUSE_INCLUDEDIR} ${PC_FUSE_INCLUDE_DIRS}
-    PATH_SUFFIXES fuse libfuse)
+    PATH_SUFFIXES fuse3)
 
 mark_as_advanced(FUSE_INCLUDE_DIR)
 
 find_library(FUSE_LDFLAGS
-        NAMES fuse libfuse
+        NAMES fuse3 libfuse3
         HINTS ${PC_FUSE_LIBDIR} ${PC_FUSE_LIBRARY_DIRS})
 mark_as_advanced(FUSE_LDFLAGS)
 
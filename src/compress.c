@@ -0,0 +1,365 @@
+#include "compress.h"
+#include "device.h"
+#include "logging.h"
+
+#include <string.h>
+
+const uint32_t EX_COMPRESS_MAGIC1 = 0x347a6c63;
+
+/** Minimum length of a match. */
+#define EX_LZ4_MIN_MATCH 4
+/** The last match must start at least this many bytes before the end. */
+#define EX_LZ4_MF_LIMIT 12
+/** The last bytes of the block are always literals. */
+#define EX_LZ4_LAST_LITERALS 5
+/** Maximum distance of a match. */
+#define EX_LZ4_MAX_OFFSET 65535
+/** Number of bits of the match finder hash. */
+#define EX_LZ4_HASH_LOG 12
+
+/** Decompressed cluster. */
+struct ex_compress_cache_entry {
+    /** Address of the compressed cluster. */
+    block_address address;
+    /** Number of decompressed blocks, zero if the entry is not used. */
+    size_t nblocks;
+    /** Decompressed data. */
+    char data[EX_COMPRESS_CLUSTER * EX_BLOCK_SIZE];
+};
+
+static struct ex_compress_cache_entry cache[EX_COMPRESS_CACHE_ENTRIES];
+
+/** Entry which is replaced by the next miss. */
+static size_t cache_next;
+
+static struct ex_compress_stats stats;
+
+static int enabled;
+
+void ex_compress_set_enabled(int enabled_) { enabled = enabled_; }
+
+int ex_compress_is_enabled(void) { return enabled; }
+
+static uint32_t ex_lz4_read32(const unsigned char *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static size_t ex_lz4_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - EX_LZ4_HASH_LOG);
+}
+
+/** Write the sequence of `nliterals` literals followed by the match.
+ *
+ * The last sequence of the block has no match (`match` is zero). It
+ * returns the new position in `dst`, or zero if the sequence doesn't fit.
+ */
+static size_t ex_lz4_sequence(unsigned char *dst, size_t op, size_t capacity,
+                              const unsigned char *literals, size_t nliterals,
+                              size_t offset, size_t match) {
+
+    size_t mlength = match ? match - EX_LZ4_MIN_MATCH : 0;
+
+    // the worst case size of the sequence
+    size_t needed = 1 + nliterals / 255 + 1 + nliterals;
+
+    if (match) {
+        needed += 2 + mlength / 255 + 1;
+    }
+
+    if (needed > capacity - op) {
+        return 0;
+    }
+
+    unsigned char *token = &dst[op++];
+
+    *token = (nliterals < 15 ? nliterals : 15) << 4;
+
+    if (nliterals >= 15) {
+        size_t rest = nliterals - 15;
+
+        for (; rest >= 255; rest -= 255) {
+            dst[op++] = 255;
+        }
+
+        dst[op++] = rest;
+    }
+
+    memcpy(dst + op, literals, nliterals);
+    op += nliterals;
+
+    if (!match) {
+        return op;
+    }
+
+    dst[op++] = offset & 0xff;
+    dst[op++] = offset >> 8;
+
+    *token |= mlength < 15 ? mlength : 15;
+
+    if (mlength >= 15) {
+        size_t rest = mlength - 15;
+
+        for (; rest >= 255; rest -= 255) {
+            dst[op++] = 255;
+        }
+
+        dst[op++] = rest;
+    }
+
+    return op;
+}
+
+size_t ex_lz4_compress(const char *src, size_t size, char *dst,
+                       size_t capacity) {
+
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *out = (unsigned char *)dst;
+
+    // positions of the last occurrences of hashed sequences
+    uint32_t table[1 << EX_LZ4_HASH_LOG];
+    memset(table, '\0', sizeof(table));
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+
+    if (size > EX_LZ4_MF_LIMIT) {
+
+        size_t match_limit = size - EX_LZ4_LAST_LITERALS;
+        size_t last_match = size - EX_LZ4_MF_LIMIT;
+
+        while (ip < last_match) {
+
+            uint32_t sequence = ex_lz4_read32(in + ip);
+            size_t hash = ex_lz4_hash(sequence);
+            size_t ref = table[hash];
+
+            table[hash] = ip;
+
+            if (ref >= ip || ip - ref > EX_LZ4_MAX_OFFSET ||
+                ex_lz4_read32(in + ref) != sequence) {
+                ip++;
+                continue;
+            }
+
+            size_t length = EX_LZ4_MIN_MATCH;
+
+            while (ip + length < match_limit &&
+                   in[ref + length] == in[ip + length]) {
+                length++;
+            }
+
+            op = ex_lz4_sequence(out, op, capacity, in + anchor, ip - anchor,
+                                 ip - ref, length);
+
+            if (!op) {
+                return 0;
+            }
+
+            ip += length;
+            anchor = ip;
+        }
+    }
+
+    op = ex_lz4_sequence(out, op, capacity, in + anchor, size - anchor, 0, 0);
+
+    return op;
+}
+
+/** Read the length extension of the token, it returns -1 on overflow. */
+static ssize_t ex_lz4_length(const unsigned char *in, size_t size, size_t *ip,
+                             size_t length) {
+
+    if (length != 15) {
+        return length;
+    }
+
+    unsigned char byte;
+
+    do {
+        if (*ip >= size) {
+            return -1;
+        }
+
+        byte = in[(*ip)++];
+        length += byte;
+    } while (byte == 255);
+
+    return length;
+}
+
+ssize_t ex_lz4_decompress(const char *src, size_t size, char *dst,
+                          size_t capacity) {
+
+    const unsigned char *in = (const unsigned char *)src;
+    unsigned char *out = (unsigned char *)dst;
+
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < size) {
+
+        unsigned char token = in[ip++];
+
+        ssize_t literals = ex_lz4_length(in, size, &ip, token >> 4);
+
+        if (literals < 0 || (size_t)literals > size - ip ||
+            (size_t)literals > capacity - op) {
+            return -1;
+        }
+
+        memcpy(out + op, in + ip, literals);
+        ip += literals;
+        op += literals;
+
+        // the last sequence has no match
+        if (ip == size) {
+            break;
+        }
+
+        if (size - ip < 2) {
+            return -1;
+        }
+
+        size_t offset = in[ip] | (in[ip + 1] << 8);
+        ip += 2;
+
+        if (!offset || offset > op) {
+            return -1;
+        }
+
+        ssize_t match = ex_lz4_length(in, size, &ip, token & 0xf);
+
+        if (match < 0 || (size_t)match + EX_LZ4_MIN_MATCH > capacity - op) {
+            return -1;
+        }
+
+        match += EX_LZ4_MIN_MATCH;
+
+        if (offset >= (size_t)match) {
+            memcpy(out + op, out + op - offset, match);
+            op += match;
+            continue;
+        }
+
+        // the match overlaps the output, it repeats the last bytes
+        for (ssize_t i = 0; i < match; i++, op++) {
+            out[op] = out[op - offset];
+        }
+    }
+
+    return op;
+}
+
+size_t ex_compress_cluster(const char *data, size_t nblocks, char *out) {
+
+    const size_t header = sizeof(struct ex_compress_header);
+
+    if (nblocks < 2) {
+        return 0;
+    }
+
+    // the compressed cluster must be at least one block shorter
+    size_t capacity = (nblocks - 1) * EX_BLOCK_SIZE - header;
+    size_t size = ex_lz4_compress(data, nblocks * EX_BLOCK_SIZE,
+                                  out + header, capacity);
+
+    if (!size) {
+        stats.incompressible++;
+        return 0;
+    }
+
+    struct ex_compress_header head = {.magic = EX_COMPRESS_MAGIC1,
+                                      .size = size};
+    memcpy(out, &head, header);
+
+    size_t stored = (header + size + EX_BLOCK_SIZE - 1) / EX_BLOCK_SIZE;
+
+    // the padding of the last block is not left uninitialized
+    memset(out + header + size, '\0', stored * EX_BLOCK_SIZE - header - size);
+
+    stats.compressed++;
+    stats.saved_blocks += nblocks - stored;
+
+    return stored;
+}
+
+const char *ex_compress_cache_get(block_address address, size_t stored,
+                                  size_t nblocks) {
+
+    static char buffer[EX_COMPRESS_CLUSTER * EX_BLOCK_SIZE];
+
+    if (!stored || stored > EX_COMPRESS_CLUSTER || !nblocks ||
+        nblocks > EX_COMPRESS_CLUSTER) {
+        warning("invalid compressed cluster at (%zu)", address);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < EX_COMPRESS_CACHE_ENTRIES; i++) {
+        if (cache[i].nblocks == nblocks && cache[i].address == address) {
+            stats.hits++;
+            return cache[i].data;
+        }
+    }
+
+    stats.misses++;
+
+    ex_status status = ex_device_read_to_buffer(NULL, buffer, address,
+                                                stored * EX_BLOCK_SIZE);
+
+    if (status != OK) {
+        warning("unable to read compressed cluster at (%zu)", address);
+        return NULL;
+    }
+
+    struct ex_compress_header head;
+    memcpy(&head, buffer, sizeof(head));
+
+    if (head.magic != EX_COMPRESS_MAGIC1 ||
+        head.size > stored * EX_BLOCK_SIZE - sizeof(head)) {
+        warning("compressed cluster at (%zu) is corrupted", address);
+        return NULL;
+    }
+
+    struct ex_compress_cache_entry *entry = &cache[cache_next];
+    cache_next = (cache_next + 1) % EX_COMPRESS_CACHE_ENTRIES;
+
+    ssize_t size = ex_lz4_decompress(buffer + sizeof(head), head.size,
+                                     entry->data, nblocks * EX_BLOCK_SIZE);
+
+    if (size != (ssize_t)(nblocks * EX_BLOCK_SIZE)) {
+        warning("compressed cluster at (%zu) is corrupted", address);
+        entry->nblocks = 0;
+        return NULL;
+    }
+
+    entry->address = address;
+    entry->nblocks = nblocks;
+
+    return entry->data;
+}
+
+void ex_compress_cache_forget(block_address address) {
+
+    for (size_t i = 0; i < EX_COMPRESS_CACHE_ENTRIES; i++) {
+        if (cache[i].address == address) {
+            cache[i].nblocks = 0;
+        }
+    }
+}
+
+void ex_compress_cache_clear(void) {
+
+    for (size_t i = 0; i < EX_COMPRESS_CACHE_ENTRIES; i++) {
+        cache[i].nblocks = 0;
+    }
+
+    cache_next = 0;
+    memset(&stats, '\0', sizeof(stats));
+}
+
+void ex_compress_get_stats(struct ex_compress_stats *result) {
+    *result = stats;
+}
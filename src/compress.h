@@ -0,0 +1,110 @@
+/**
+ * @file compress.h
+ *
+ * This file provides compression of file data and its API.
+ *
+ * Data of regular files can be compressed in clusters of up to
+ * EX_COMPRESS_CLUSTER blocks. A compressed cluster is mapped by a single
+ * extent with the EX_EXTENT_COMPRESSED flag, its physical blocks start with
+ * struct ex_compress_header followed by data in the LZ4 block format.
+ * A cluster is stored compressed only if it saves at least one block.
+ *
+ * Decompressed clusters are kept in a small cache, so sequential reads
+ * of a cluster decompress it only once.
+ */
+#ifndef EX_COMPRESS_H
+#define EX_COMPRESS_H
+
+#include "super.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/** Maximum number of blocks compressed together. */
+#define EX_COMPRESS_CLUSTER 16
+
+/** Number of decompressed clusters kept in memory. */
+#define EX_COMPRESS_CACHE_ENTRIES 8
+
+/** Compressed data magic constant used for sanity check. */
+extern const uint32_t EX_COMPRESS_MAGIC1;
+
+/** Header of the compressed cluster on the persistent storage. */
+struct ex_compress_header {
+    /** Compressed data magic number. */
+    uint32_t magic;
+    /** Size of the compressed data which follow the header. */
+    uint32_t size;
+};
+
+/** Statistics of the compression. */
+struct ex_compress_stats {
+    /** Number of clusters which were stored compressed. */
+    size_t compressed;
+    /** Number of clusters which did not compress and stayed raw. */
+    size_t incompressible;
+    /** Number of blocks saved by the compression. */
+    size_t saved_blocks;
+    /** Number of cluster reads served from the cache. */
+    size_t hits;
+    /** Number of cluster reads which had to decompress the cluster. */
+    size_t misses;
+};
+
+/** Enable or disable compression of newly written data.
+ *
+ * Compressed data are always readable, the setting affects only the
+ * writeback of new data.
+ */
+void ex_compress_set_enabled(int enabled);
+
+/** Check whether the compression of new data is enabled. */
+int ex_compress_is_enabled(void);
+
+/** Compress `size` bytes of `src` in the LZ4 block format.
+ *
+ * It returns the size of the compressed data, or zero if they do not fit
+ * into `capacity` bytes of `dst`.
+ */
+size_t ex_lz4_compress(const char *src, size_t size, char *dst,
+                       size_t capacity);
+
+/** Decompress `size` bytes of the LZ4 block `src` into `dst`.
+ *
+ * It returns the size of the decompressed data, or -1 if the block is
+ * malformed or it does not fit into `capacity` bytes of `dst`.
+ */
+ssize_t ex_lz4_decompress(const char *src, size_t size, char *dst,
+                          size_t capacity);
+
+/** Compress the cluster of `nblocks` blocks into `out`.
+ *
+ * The `out` buffer must hold `nblocks` blocks. It returns the number of
+ * blocks of the compressed cluster (with the header and zeroed padding),
+ * or zero if the compression does not save any block.
+ */
+size_t ex_compress_cluster(const char *data, size_t nblocks, char *out);
+
+/** Get the decompressed content of the compressed cluster.
+ *
+ * The cluster is stored in `stored` blocks at the `address`, it covers
+ * `nblocks` logical blocks. NULL is returned if the cluster cannot be read.
+ * The result is valid until the next call.
+ */
+const char *ex_compress_cache_get(block_address address, size_t stored,
+                                  size_t nblocks);
+
+/** Drop the cluster stored at the `address` from the cache.
+ *
+ * It must be called whenever a new cluster is written to the `address`.
+ */
+void ex_compress_cache_forget(block_address address);
+
+/** Drop all clusters from the cache and reset its statistics. */
+void ex_compress_cache_clear(void);
+
+/** Get statistics of the compression. */
+void ex_compress_get_stats(struct ex_compress_stats *stats);
+
+#endif /* EX_COMPRESS_H */
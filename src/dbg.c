@@ -1,18 +1,22 @@
 #include "dbg.h"
+#include "dir.h"
 #include "ex.h"
 #include "logging.h"
 #include "super.h"
 #include "device.h"
 
+#include <errno.h>
 #include <getopt.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 void ex_dbg_print_struct_sizes(void) {
 
     info("ex_super_block: %lu", sizeof(struct ex_super_block));
     info("ex_inode: %lu", sizeof(struct ex_inode));
+    info("ex_disk_inode: %lu", sizeof(struct ex_disk_inode));
     info("ex_dir_entry: %lu", sizeof(struct ex_dir_entry));
     info("ex_bitmap: %lu", sizeof(struct ex_bitmap));
 }
@@ -57,9 +61,21 @@ void ex_dbg_print_super(const char *device) {
     printf("super:\n");
     printf("\troot = %lu\n", super_block->root);
     printf("\tmagic = %x\n", super_block->magic);
+    printf("\tversion = %u\n", super_block->version);
+    printf("\tinode_size = %u\n", super_block->inode_size);
     printf("\tdevice_size = %lu (%s)\n", super_block->device_size, buffer);
     ex_dbg_print_bitmap("data_bitmap", &super_block->bitmap);
     ex_dbg_print_bitmap("inode_bitmap", &super_block->inode_bitmap);
+
+    printf("refcounts:\n");
+    printf("\thead = %lu\n", super_block->refcounts.head);
+    printf("\taddress = %lu\n", super_block->refcounts.address);
+    printf("\tsize = %lu\n", super_block->refcounts.size);
+    printf("\tshared = %lu\n", super_block->refcounts.shared);
+
+    printf("dedup index:\n");
+    printf("\taddress = %lu\n", super_block->dedup.address);
+    printf("\tsize = %lu\n", super_block->dedup.size);
 }
 
 void ex_dbg_print_info(const char *device) {
@@ -71,34 +87,45 @@ void ex_dbg_print_info(const char *device) {
     printf("info:\n");
 
     size_t max_dir_entries =
-        (EX_BLOCK_SIZE / sizeof(struct ex_dir_entry)) * (EX_DIRECT_BLOCKS - 2);
+        (EX_BLOCK_SIZE / sizeof(struct ex_dir_entry)) * ex_inode_max_blocks();
     printf("\tmax_dir_entries: %lu\n", max_dir_entries);
 
     printf("\tdir_entry_size: %luB\n", sizeof(struct ex_dir_entry));
 
-    size_t max_size = EX_DIRECT_BLOCKS * 4096;
+    size_t max_size = ex_inode_max_blocks() * EX_BLOCK_SIZE;
 
     char buffer[124];
     ex_readable_size(buffer, sizeof(buffer), max_size);
 
     printf("\tmax_file_size: %luB (%s)\n", max_size, buffer);
 
-    printf("\tinode_size: %luB\n", sizeof(struct ex_inode));
+    printf("\tinode_size: %uB\n", EX_INODE_SIZE);
+    printf("\tinodes_per_block: %u\n", EX_INODES_PER_BLOCK);
+    printf("\tinline_data_size: %uB\n", EX_INODE_INLINE_DATA_SIZE);
     printf("\tsuper_block_size: %luB\n", sizeof(struct ex_super_block));
 }
 
-void ex_dbg_print_directory_entries(struct ex_inode *inode) {
+static int ex_dbg_print_directory_entry(const struct ex_dir_entry *entry,
+                                        void *ctx) {
+    (void)ctx;
 
-    foreach_inode_block(inode, block) {
-        foreach_block_entry(block, entry) {
+    printf("\t\tname: '%s', address: %lu\n", entry->name, entry->address);
 
-            if (entry.free || entry.magic != EX_DIR_MAGIC1) {
-                continue;
-            }
+    return 0;
+}
 
-            printf("\t\tname: '%s', address: %lu\n", entry.name, entry.address);
-        }
+void ex_dbg_print_directory_entries(struct ex_inode *inode) {
+
+    if (inode->flags & EX_INODE_DIR_HASHED) {
+        printf("\t\tformat: hashed\n");
+    } else if (inode->flags & EX_INODE_DIR_BTREE) {
+        printf("\t\tformat: btree\n");
     }
+
+    printf("\t\tblocks: %u\n", inode->dir_blocks);
+    printf("\t\tcount: %u\n", inode->dir_entries);
+
+    ex_dir_iterate(inode, ex_dbg_print_directory_entry, NULL);
 }
 
 void ex_dbg_print_inode_data(const char *device, size_t address) {
@@ -113,6 +140,11 @@ void ex_dbg_print_inode_data(const char *device, size_t address) {
         return;
     }
 
+    if (inode.flags & EX_INODE_INLINE_DATA) {
+        write(fileno(stdout), inode.data, inode.size);
+        return;
+    }
+
     foreach_inode_block(&inode, block) {
         write(fileno(stdout), block.data, EX_BLOCK_SIZE);
     }
@@ -139,6 +171,18 @@ void ex_dbg_print_inode_attrs(const struct ex_inode *inode) {
     }
 }
 
+static int ex_dbg_print_extent(const struct ex_extent *extent, void *ctx) {
+    (void)ctx;
+
+    printf("\t\t[%u, %u): %lu (%lu blocks%s%s)\n", extent->logical,
+           extent->logical + extent->length, extent->physical,
+           ex_extent_stored_length(extent->flags, extent->length),
+           extent->flags & EX_EXTENT_COMPRESSED ? ", compressed" : "",
+           extent->flags & EX_EXTENT_SHARED ? ", shared" : "");
+
+    return 0;
+}
+
 void ex_dbg_print_inode(const char *device, size_t address) {
 
     ex_set_log_level(info);
@@ -168,6 +212,16 @@ void ex_dbg_print_inode(const char *device, size_t address) {
     printf("\tatime: %ld.%.9ld\n", inode.mtime.tv_sec, inode.mtime.tv_nsec);
     printf("\tctime: %ld.%.9ld\n", inode.mtime.tv_sec, inode.mtime.tv_nsec);
 
+    printf("\tflags: %x\n", inode.flags);
+    printf("\txattr_block: %lu\n", inode.xattr_block);
+
+    if (inode.flags & EX_INODE_INLINE_DATA) {
+        printf("\tinline data: %lu bytes\n", inode.size);
+    } else {
+        printf("\textents (depth %u):\n", inode.extents.header.depth);
+        ex_extent_walk(&inode.extents, ex_dbg_print_extent, NULL);
+    }
+
     if (inode.mode & S_IFDIR) {
         printf("\tentries:\n");
         ex_dbg_print_directory_entries(&inode);
@@ -176,21 +230,54 @@ void ex_dbg_print_inode(const char *device, size_t address) {
     ex_dbg_print_inode_attrs(&inode);
 }
 
+int ex_dbg_clone_file(const char *device, const char *src, const char *dst) {
+
+    ex_set_log_level(warning);
+
+    if (ex_init(device) != OK) {
+        printf("error: unable to load device %s\n", device);
+        return 1;
+    }
+
+    struct stat st;
+    int status = ex_getattr(src, &st);
+
+    if (status == 0 && ex_getattr(dst, &(struct stat){0}) == -ENOENT) {
+        status = ex_create(dst, st.st_mode & 0777, st.st_gid, st.st_uid);
+    }
+
+    if (status == 0) {
+        status = ex_clone_file(src, dst);
+    }
+
+    if (status) {
+        printf("error: unable to clone %s to %s: %s\n", src, dst,
+               strerror(-status));
+    }
+
+    ex_deinit();
+
+    return status ? 1 : 0;
+}
+
 void ex_dbg_help(void) {
     printf("exdbg: \n"
            "\t--bitmap-data\t\tdisplay bitmap data\n"
+           "\t--clone src\t\tclone the file src to the --target file\n"
            "\t--device\t\tspecify ex device\n"
            "\t--info\t\t\tdisplay info about ex filesystem\n"
            "\t--inode addr\t\tdisplay information about inode\n"
            "\t--inode-data\t\tdisplay inode data (binary)\n"
            "\t--struct-sizes\t\t\tdisplay sizes of filesystem structures\n"
-           "\t--super\t\t\tdisplay info about super block\n");
+           "\t--super\t\t\tdisplay info about super block\n"
+           "\t--target dst\t\ttarget of --clone, it's created if needed\n");
 }
 
 int ex_dbg_parse_options(struct ex_dbg_options *options, int argc, char **argv) {
 
     const struct option longopts[] = {
         {"bitmap-data", required_argument, 0, 'b'},
+        {"clone", required_argument, 0, 'c'},
         {"device", required_argument, 0, 'd'},
         {"help", no_argument, 0, 'h'},
         {"info", no_argument, 0, 'I'},
@@ -198,6 +285,7 @@ int ex_dbg_parse_options(struct ex_dbg_options *options, int argc, char **argv)
         {"inode-data", required_argument, 0, 'D'},
         {"struct-sizes", no_argument, 0, 'S'},
         {"super", no_argument, 0, 's'},
+        {"target", required_argument, 0, 't'},
         {0, 0, 0, 0}};
 
     int opt;
@@ -211,6 +299,15 @@ int ex_dbg_parse_options(struct ex_dbg_options *options, int argc, char **argv)
             }
             options->action = PRINT_BITMAP_DATA;
             break;
+        case 'c':
+            free(options->clone);
+            options->clone = strdup(optarg);
+            options->action = CLONE_FILE;
+            break;
+        case 't':
+            free(options->target);
+            options->target = strdup(optarg);
+            break;
         case 'd':
             options->device = strdup(optarg);
             break;
@@ -253,11 +350,19 @@ int ex_dbg_parse_options(struct ex_dbg_options *options, int argc, char **argv)
         return 1;
     }
 
+    if (options->action == CLONE_FILE && !options->target) {
+        printf("error: no --target supplied for --clone\n");
+        ex_dbg_help();
+        return 1;
+    }
+
     return 0;
 }
 
 int ex_dbg_run(struct ex_dbg_options *options) {
 
+    int status = 0;
+
     switch (options->action) {
     case PRINT_SUPER:
         ex_dbg_print_super(options->device);
@@ -277,12 +382,18 @@ int ex_dbg_run(struct ex_dbg_options *options) {
     case PRINT_SIZES:
         ex_dbg_print_struct_sizes();
         break;
+    case CLONE_FILE:
+        status = ex_dbg_clone_file(options->device, options->clone,
+                                   options->target);
+        break;
     default:
         ex_dbg_print_super(options->device);
     }
 
     free(options->device);
+    free(options->clone);
+    free(options->target);
 
-    return 0;
+    return status;
 }
 
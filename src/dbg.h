@@ -12,6 +12,7 @@ enum ex_dbg_action {
     PRINT_INODE_DATA,
     PRINT_BITMAP_DATA,
     PRINT_SIZES,
+    CLONE_FILE,
 };
 
 struct ex_dbg_options {
@@ -21,6 +22,8 @@ struct ex_dbg_options {
     size_t bitmap_data;
     int print_super;
     int print_info;
+    char *clone;
+    char *target;
     enum ex_dbg_action action;
 };
 
@@ -33,6 +36,7 @@ void ex_dbg_print_directory_entries(struct ex_inode *inode);
 void ex_dbg_print_inode_data(const char *device, size_t address);
 void ex_dbg_print_inode_attrs(const struct ex_inode *inode);
 void ex_dbg_print_inode(const char *device, size_t address);
+int ex_dbg_clone_file(const char *device, const char *src, const char *dst);
 void ex_dbg_help(void);
 int ex_dbg_parse_options(struct ex_dbg_options *, int argc, char **argv);
 int ex_dbg_run(struct ex_dbg_options *);
@@ -0,0 +1,195 @@
+#include "dcache.h"
+#include "dir.h"
+#include "logging.h"
+#include "util.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Cached directory entry. */
+struct ex_dcache_entry {
+    /** Address of the parent directory. */
+    inode_address dir;
+    /** Address of the child, or EX_DCACHE_NEGATIVE. */
+    inode_address address;
+    /** Name of the entry. */
+    char name[EX_NAME_LEN];
+    /** Next entry in the hash table bucket. */
+    struct ex_dcache_entry *next;
+    /** Neighbours in the LRU list. */
+    struct ex_dcache_entry *lru_prev;
+    struct ex_dcache_entry *lru_next;
+};
+
+static struct ex_dcache_entry *buckets[EX_DCACHE_BUCKETS];
+
+/** Most recently used entry. */
+static struct ex_dcache_entry *lru_head;
+/** Least recently used entry. */
+static struct ex_dcache_entry *lru_tail;
+
+static struct ex_dcache_stats stats;
+
+static size_t ex_dcache_hash(inode_address dir, const char *name) {
+    // fibonacci hashing of the parent, so equal names of different
+    // directories land in different buckets
+    uint64_t hash = (uint64_t)dir * 11400714819323198485ull;
+    return (size_t)((hash >> 32) ^ ex_dir_hash(name)) % EX_DCACHE_BUCKETS;
+}
+
+/** Get the link to the entry in its bucket, or the end of the bucket. */
+static struct ex_dcache_entry **ex_dcache_find(inode_address dir,
+                                               const char *name) {
+
+    struct ex_dcache_entry **link = &buckets[ex_dcache_hash(dir, name)];
+
+    for (; *link; link = &(*link)->next) {
+        if ((*link)->dir == dir && !strcmp((*link)->name, name)) {
+            break;
+        }
+    }
+
+    return link;
+}
+
+static void ex_dcache_lru_remove(struct ex_dcache_entry *entry) {
+
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head = entry->lru_next;
+    }
+
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail = entry->lru_prev;
+    }
+
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void ex_dcache_lru_push(struct ex_dcache_entry *entry) {
+
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+
+    if (lru_head) {
+        lru_head->lru_prev = entry;
+    } else {
+        lru_tail = entry;
+    }
+
+    lru_head = entry;
+}
+
+/** Remove the entry from the bucket and the LRU list and free it. */
+static void ex_dcache_drop(struct ex_dcache_entry **link) {
+
+    struct ex_dcache_entry *entry = *link;
+
+    *link = entry->next;
+    ex_dcache_lru_remove(entry);
+    free(entry);
+
+    stats.cached--;
+}
+
+static void ex_dcache_evict(void) {
+
+    struct ex_dcache_entry *entry = lru_tail;
+
+    ex_dcache_drop(ex_dcache_find(entry->dir, entry->name));
+
+    stats.evictions++;
+}
+
+int ex_dcache_lookup(inode_address dir, const char *name,
+                     inode_address *address) {
+
+    struct ex_dcache_entry *entry = *ex_dcache_find(dir, name);
+
+    if (!entry) {
+        stats.misses++;
+        return 0;
+    }
+
+    if (entry->address == EX_DCACHE_NEGATIVE) {
+        stats.negative_hits++;
+    } else {
+        stats.hits++;
+    }
+
+    ex_dcache_lru_remove(entry);
+    ex_dcache_lru_push(entry);
+
+    *address = entry->address;
+
+    return 1;
+}
+
+void ex_dcache_add(inode_address dir, const char *name,
+                   inode_address address) {
+
+    // names which do not fit into the entry are never found
+    if (strlen(name) >= EX_NAME_LEN) {
+        return;
+    }
+
+    struct ex_dcache_entry **link = ex_dcache_find(dir, name);
+    struct ex_dcache_entry *entry = *link;
+
+    if (entry) {
+        entry->address = address;
+        ex_dcache_lru_remove(entry);
+        ex_dcache_lru_push(entry);
+        return;
+    }
+
+    if (stats.cached >= EX_DCACHE_MAX_ENTRIES) {
+        ex_dcache_evict();
+        // the eviction may unlink the entry which precedes the end
+        link = ex_dcache_find(dir, name);
+    }
+
+    entry = ex_malloc(sizeof(struct ex_dcache_entry));
+
+    entry->dir = dir;
+    entry->address = address;
+    strcpy(entry->name, name);
+    entry->next = NULL;
+
+    *link = entry;
+    ex_dcache_lru_push(entry);
+
+    stats.cached++;
+}
+
+void ex_dcache_remove(inode_address dir, const char *name) {
+
+    struct ex_dcache_entry **link = ex_dcache_find(dir, name);
+
+    if (*link) {
+        ex_dcache_drop(link);
+    }
+}
+
+void ex_dcache_clear(void) {
+
+    debug("dropping %zu cached directory entries", stats.cached);
+
+    while (lru_tail) {
+        ex_dcache_drop(ex_dcache_find(lru_tail->dir, lru_tail->name));
+    }
+}
+
+void ex_dcache_reset_stats(void) {
+
+    size_t cached = stats.cached;
+
+    memset(&stats, '\0', sizeof(stats));
+    stats.cached = cached;
+}
+
+void ex_dcache_get_stats(struct ex_dcache_stats *dest) { *dest = stats; }
@@ -0,0 +1,75 @@
+/**
+ * @file dcache.h
+ *
+ * This file provides the in-memory cache of directory entries (dcache).
+ *
+ * Entries are keyed by the address of the parent directory and the name,
+ * they map the name to the address of the child inode. Names which are
+ * known not to exist are cached as negative entries, so repeated lookups
+ * of missing names do not read the directory.
+ *
+ * The cache is kept coherent by the directory operations (ex_dir_insert
+ * and ex_dir_remove), every change of the directory replaces the cached
+ * entry. The least recently used entries are evicted when the cache is
+ * full.
+ *
+ * The cache is not thread safe on its own, it relies on the super lock.
+ */
+#ifndef EX_DCACHE_H
+#define EX_DCACHE_H
+
+#include "inode.h"
+
+#include <stddef.h>
+
+/** Number of buckets of the hash table. */
+#define EX_DCACHE_BUCKETS 4096
+
+/** Maximum number of cached entries. */
+#define EX_DCACHE_MAX_ENTRIES 8192
+
+/** Address of the negative entry, no inode is stored at the address 0. */
+#define EX_DCACHE_NEGATIVE 0
+
+/** Statistics of the dentry cache. */
+struct ex_dcache_stats {
+    /** Number of lookups served by positive entries. */
+    size_t hits;
+    /** Number of lookups served by negative entries. */
+    size_t negative_hits;
+    /** Number of lookups of names which are not cached. */
+    size_t misses;
+    /** Number of evicted entries. */
+    size_t evictions;
+    /** Number of currently cached entries. */
+    size_t cached;
+};
+
+/** Find the entry `name` of the directory at `dir`.
+ *
+ * It returns non zero if the entry is cached, the address of the child
+ * (EX_DCACHE_NEGATIVE for the negative entry) is stored to `address`.
+ */
+int ex_dcache_lookup(inode_address dir, const char *name,
+                     inode_address *address);
+
+/** Cache the entry `name` of the directory at `dir`.
+ *
+ * The entry points to the inode at `address`, EX_DCACHE_NEGATIVE caches
+ * the negative entry. It replaces the entry if it's already cached.
+ */
+void ex_dcache_add(inode_address dir, const char *name, inode_address address);
+
+/** Drop the entry `name` of the directory at `dir` from the cache. */
+void ex_dcache_remove(inode_address dir, const char *name);
+
+/** Drop all entries from the cache. */
+void ex_dcache_clear(void);
+
+/** Reset statistics of the cache, the number of cached entries is kept. */
+void ex_dcache_reset_stats(void);
+
+/** Get statistics of the cache. */
+void ex_dcache_get_stats(struct ex_dcache_stats *stats);
+
+#endif /* EX_DCACHE_H */
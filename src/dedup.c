@@ -0,0 +1,208 @@
+#include "dedup.h"
+#include "device.h"
+#include "logging.h"
+
+#include <string.h>
+
+static struct ex_dedup_stats stats;
+
+static int enabled;
+
+void ex_dedup_set_enabled(int enabled_) { enabled = enabled_; }
+
+int ex_dedup_is_enabled(void) { return enabled; }
+
+static uint64_t ex_hash_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t ex_hash_fmix(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+void ex_hash128(const void *data, size_t size, uint64_t hash[2]) {
+
+    const unsigned char *in = data;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    uint64_t h1 = 0, h2 = 0;
+    size_t nblocks = size / 16;
+
+    for (size_t i = 0; i < nblocks; i++) {
+
+        uint64_t k1, k2;
+        memcpy(&k1, in + 16 * i, sizeof(k1));
+        memcpy(&k2, in + 16 * i + 8, sizeof(k2));
+
+        k1 *= c1;
+        k1 = ex_hash_rotl(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+
+        h1 = ex_hash_rotl(h1, 27);
+        h1 += h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2 = ex_hash_rotl(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+
+        h2 = ex_hash_rotl(h2, 31);
+        h2 += h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    // the tail is mixed in as two zero padded words
+    const unsigned char *tail = in + 16 * nblocks;
+    size_t rest = size % 16;
+
+    if (rest) {
+
+        unsigned char padded[16] = {0};
+        memcpy(padded, tail, rest);
+
+        uint64_t k1, k2;
+        memcpy(&k1, padded, sizeof(k1));
+        memcpy(&k2, padded + 8, sizeof(k2));
+
+        k2 *= c2;
+        k2 = ex_hash_rotl(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+
+        k1 *= c1;
+        k1 = ex_hash_rotl(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+    }
+
+    h1 ^= size;
+    h2 ^= size;
+
+    h1 += h2;
+    h2 += h1;
+
+    h1 = ex_hash_fmix(h1);
+    h2 = ex_hash_fmix(h2);
+
+    h1 += h2;
+    h2 += h1;
+
+    hash[0] = h1;
+    hash[1] = h2;
+}
+
+/** Get the address of the bucket of the `hash`. */
+static size_t ex_dedup_bucket(const uint64_t hash[2]) {
+    size_t nbuckets = super_block->dedup.size / EX_BLOCK_SIZE;
+    return super_block->dedup.address + (hash[0] % nbuckets) * EX_BLOCK_SIZE;
+}
+
+/** Load all entries of the bucket at the `address`. */
+static ex_status ex_dedup_bucket_load(size_t address,
+                                      struct ex_dedup_entry *entries) {
+
+    ex_status status = ex_device_read_to_buffer(
+        NULL, (char *)entries, address,
+        EX_DEDUP_BUCKET_ENTRIES * sizeof(struct ex_dedup_entry));
+
+    if (status != OK) {
+        error("unable to read dedup bucket at (%zu)", address);
+    }
+
+    return status;
+}
+
+int ex_dedup_lookup(const uint64_t hash[2], struct ex_dedup_entry *entry) {
+
+    struct ex_dedup_entry entries[EX_DEDUP_BUCKET_ENTRIES];
+
+    stats.lookups++;
+
+    if (!super_block->dedup.size ||
+        ex_dedup_bucket_load(ex_dedup_bucket(hash), entries) != OK) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < EX_DEDUP_BUCKET_ENTRIES; i++) {
+
+        if (entries[i].physical && entries[i].hash[0] == hash[0] &&
+            entries[i].hash[1] == hash[1]) {
+            *entry = entries[i];
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+ex_status ex_dedup_insert(const struct ex_dedup_entry *entry) {
+
+    struct ex_dedup_entry entries[EX_DEDUP_BUCKET_ENTRIES];
+
+    if (!super_block->dedup.size) {
+        return OK;
+    }
+
+    size_t bucket = ex_dedup_bucket(entry->hash);
+    ex_status status = ex_dedup_bucket_load(bucket, entries);
+
+    if (status != OK) {
+        return status;
+    }
+
+    // a full bucket loses the entry chosen by the second half of the hash
+    size_t slot = entry->hash[1] % EX_DEDUP_BUCKET_ENTRIES;
+    size_t empty = EX_DEDUP_BUCKET_ENTRIES;
+
+    for (size_t i = 0; i < EX_DEDUP_BUCKET_ENTRIES; i++) {
+
+        if (!entries[i].physical) {
+            empty = empty < i ? empty : i;
+            continue;
+        }
+
+        if (entries[i].hash[0] == entry->hash[0] &&
+            entries[i].hash[1] == entry->hash[1]) {
+            empty = i;
+            break;
+        }
+    }
+
+    if (empty != EX_DEDUP_BUCKET_ENTRIES) {
+        slot = empty;
+    }
+
+    status = ex_device_write(bucket + slot * sizeof(struct ex_dedup_entry),
+                             (const char *)entry,
+                             sizeof(struct ex_dedup_entry));
+
+    if (status != OK) {
+        error("unable to write dedup entry of block (%zu)", entry->physical);
+        return status;
+    }
+
+    stats.inserted++;
+
+    return OK;
+}
+
+void ex_dedup_account(int shared) {
+
+    if (shared) {
+        stats.hits++;
+    } else {
+        stats.stale++;
+    }
+}
+
+void ex_dedup_reset_stats(void) { memset(&stats, '\0', sizeof(stats)); }
+
+void ex_dedup_get_stats(struct ex_dedup_stats *result) { *result = stats; }
@@ -0,0 +1,91 @@
+/**
+ * @file dedup.h
+ *
+ * This file provides deduplication of file data and its API.
+ *
+ * Full data blocks of regular files are hashed by the writeback with
+ * a 128-bit hash. The hash is looked up in the persistent index and if
+ * an indexed block has the same content, it's shared (see
+ * ex_super_share_blocks) instead of keeping another copy.
+ *
+ * The index is a hash table stored in the region described by
+ * struct ex_dedup_index, every block of the region is a bucket of
+ * EX_DEDUP_BUCKET_ENTRIES entries. It's only a hint: an entry stores the
+ * inode and the logical block which mapped the block when it was indexed,
+ * so stale entries are detected by checking that the inode still maps the
+ * block. Contents of blocks are always compared before they're shared.
+ */
+#ifndef EX_DEDUP_H
+#define EX_DEDUP_H
+
+#include "super.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Entry of the dedup index on the persistent storage. */
+struct ex_dedup_entry {
+    /** Hash of the block content, see ex_hash128. */
+    uint64_t hash[2];
+    /** Address of the block, zero if the entry is not used. */
+    block_address physical;
+    /** Number of the inode which mapped the block. */
+    uint32_t inode;
+    /** Logical block of the inode which mapped the block. */
+    uint32_t logical;
+};
+
+/** Number of index entries in one block. */
+#define EX_DEDUP_BUCKET_ENTRIES                                                \
+    (EX_BLOCK_SIZE / sizeof(struct ex_dedup_entry))
+
+/** Statistics of the deduplication. */
+struct ex_dedup_stats {
+    /** Number of hashed blocks. */
+    size_t lookups;
+    /** Number of blocks which were shared with an indexed block. */
+    size_t hits;
+    /** Number of index entries which did not match their block anymore. */
+    size_t stale;
+    /** Number of blocks which were added to the index. */
+    size_t inserted;
+};
+
+/** Enable or disable deduplication of newly written data. */
+void ex_dedup_set_enabled(int enabled);
+
+/** Check whether the deduplication of new data is enabled. */
+int ex_dedup_is_enabled(void);
+
+/** Compute the 128-bit hash of `size` bytes of `data`.
+ *
+ * It's the MurmurHash3 x64 128-bit variant, it's not cryptographic.
+ */
+void ex_hash128(const void *data, size_t size, uint64_t hash[2]);
+
+/** Find the entry with the `hash` in the index.
+ *
+ * It returns 1 and fills the `entry` if the hash is indexed, 0 otherwise.
+ */
+int ex_dedup_lookup(const uint64_t hash[2], struct ex_dedup_entry *entry);
+
+/** Add the entry to the index.
+ *
+ * An entry with the same hash is replaced. If the bucket is full, an entry
+ * chosen by the hash is evicted.
+ */
+ex_status ex_dedup_insert(const struct ex_dedup_entry *entry);
+
+/** Account the entry found by ex_dedup_lookup.
+ *
+ * The `shared` is non zero if its block was shared, zero if it was stale.
+ */
+void ex_dedup_account(int shared);
+
+/** Reset statistics of the deduplication. */
+void ex_dedup_reset_stats(void);
+
+/** Get statistics of the deduplication. */
+void ex_dedup_get_stats(struct ex_dedup_stats *stats);
+
+#endif /* EX_DEDUP_H */
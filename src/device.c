@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include "device.h"
 #include "errors.h"
 #include "logging.h"
@@ -195,3 +197,144 @@ failure:
 
     return WRITE_FAILED;
 }
+
+ex_status ex_device_writev(size_t off, const struct iovec *iov, int iovcnt) {
+
+    int fd = -1;
+    ex_status status = OK;
+    size_t amount = 0;
+    ssize_t written = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        amount += iov[i].iov_len;
+    }
+
+    if ((status = ex_device_fd(&fd)) != OK) {
+        status = DEVICE_IS_NOT_OPEN;
+        goto failure;
+    }
+
+    if ((off_t)off < 0) {
+        status = INVALID_OFFSET;
+        goto failure;
+    }
+
+    written = pwritev(fd, iov, iovcnt, off);
+
+    if (written < 0 || (size_t)written != amount) {
+        status = WRITE_FAILED;
+        goto failure;
+    }
+
+    return status;
+
+failure:
+
+    switch (status) {
+    case DEVICE_IS_NOT_OPEN:
+        error("device is not opened");
+        break;
+    case INVALID_OFFSET:
+        error("pwritev: underthrow (off > max(int))");
+        break;
+    case WRITE_FAILED:
+        error("pwritev: written=%zd, amount=%lu", written, amount);
+        break;
+    default:
+        error("unhandled error: %i", status);
+    }
+
+    return WRITE_FAILED;
+}
+
+ex_status ex_device_sync(void) {
+
+    int fd = -1;
+
+    if (ex_device_fd(&fd) != OK) {
+        error("device is not opened");
+        return DEVICE_IS_NOT_OPEN;
+    }
+
+    if (fdatasync(fd) == -1) {
+        error("fdatasync: %s", strerror(errno));
+        return WRITE_FAILED;
+    }
+
+    return OK;
+}
+
+/** Copy the range through a memory buffer. */
+static ex_status ex_device_copy_buffered(int fd, size_t dst, size_t src,
+                                         size_t amount) {
+
+    size_t chunk = amount < EX_DEVICE_COPY_CHUNK ? amount : EX_DEVICE_COPY_CHUNK;
+    char *buffer = ex_malloc(chunk);
+    ex_status status = OK;
+
+    for (size_t done = 0; done < amount;) {
+
+        size_t length = amount - done < chunk ? amount - done : chunk;
+        ssize_t readed = pread(fd, buffer, length, src + done);
+
+        if (readed <= 0) {
+            error("pread: readed=%zd, errno: %s", readed, strerror(errno));
+            status = READ_FAILED;
+            break;
+        }
+
+        if (pwrite(fd, buffer, readed, dst + done) != readed) {
+            error("pwrite: errno: %s", strerror(errno));
+            status = WRITE_FAILED;
+            break;
+        }
+
+        done += readed;
+    }
+
+    free(buffer);
+
+    return status;
+}
+
+ex_status ex_device_copy(size_t dst, size_t src, size_t amount) {
+
+    int fd = -1;
+
+    if (ex_device_fd(&fd) != OK) {
+        error("device is not opened");
+        return DEVICE_IS_NOT_OPEN;
+    }
+
+    if ((off_t)dst < 0 || (off_t)src < 0) {
+        error("copy: underthrow (off > max(int))");
+        return INVALID_OFFSET;
+    }
+
+    size_t done = 0;
+
+    // the kernel copies the range without moving it through user space,
+    // it may even share the extents of the image file
+    while (done < amount) {
+
+        loff_t off_in = src + done;
+        loff_t off_out = dst + done;
+
+        ssize_t copied =
+            copy_file_range(fd, &off_in, fd, &off_out, amount - done, 0);
+
+        if (copied <= 0) {
+            break;
+        }
+
+        done += copied;
+    }
+
+    if (done == amount) {
+        return OK;
+    }
+
+    debug("copy_file_range: errno: %s, using buffered copy", strerror(errno));
+
+    return ex_device_copy_buffered(fd, dst + done, src + done, amount - done);
+}
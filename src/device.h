@@ -4,6 +4,7 @@
 #include "errors.h"
 #include <stdint.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 extern const char *const EX_DEVICE;
 
@@ -17,5 +18,13 @@ ex_status ex_device_read(void **data, size_t off, size_t amount);
 ex_status ex_device_read_to_buffer(ssize_t *readed, char *buffer, size_t off,
                                    size_t amount);
 ex_status ex_device_write(size_t off, const char *data, size_t amount);
+ex_status ex_device_writev(size_t off, const struct iovec *iov, int iovcnt);
+ex_status ex_device_sync(void);
+
+/** Size of the buffer used when the kernel cannot copy the range. */
+#define EX_DEVICE_COPY_CHUNK (1024 * 1024)
+
+/** Copy `amount` bytes from `src` to `dst`, the ranges must not overlap. */
+ex_status ex_device_copy(size_t dst, size_t src, size_t amount);
 
 #endif
@@ -0,0 +1,1582 @@
+#include "dir.h"
+#include "dcache.h"
+#include "device.h"
+#include "logging.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+const uint32_t EX_DIR_INDEX_MAGIC1 = 0x78646e69;
+const uint32_t EX_DIR_LEAF_MAGIC1 = 0x6661656c;
+const uint32_t EX_DIR_NODE_MAGIC1 = 0x65646f6e;
+
+/** Format flags of the directory inode. */
+#define EX_DIR_FORMAT_FLAGS (EX_INODE_DIR_HASHED | EX_INODE_DIR_BTREE)
+
+static struct ex_dir_stats stats;
+
+/** It's incremented by every change of any directory, so cursors know
+ *  that their buffered blocks are stale. */
+static uint64_t generation;
+
+static ex_dir_format format = EX_DIR_HASHED;
+
+void ex_dir_set_format(ex_dir_format format_) { format = format_; }
+
+ex_dir_format ex_dir_get_format(void) { return format; }
+
+uint32_t ex_dir_hash(const char *name) {
+
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+
+    for (; *name; name++) {
+        hash ^= (unsigned char)*name;
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static int ex_dir_is_hashed(const struct ex_inode *dir) {
+    return dir->flags & EX_INODE_DIR_HASHED;
+}
+
+static int ex_dir_is_btree(const struct ex_inode *dir) {
+    return dir->flags & EX_INODE_DIR_BTREE;
+}
+
+static int ex_dir_entry_is_used(const struct ex_dir_entry *entry) {
+    return entry->magic == EX_DIR_MAGIC1 && !entry->free;
+}
+
+static int ex_dir_entry_is_free(const struct ex_dir_entry *entry) {
+    return entry->magic == EX_ENTRY_MAGIC1 || entry->free;
+}
+
+static void ex_dir_entry_make(struct ex_dir_entry *entry, const char *name,
+                              inode_address address) {
+
+    memset(entry, '\0', sizeof(*entry));
+
+    entry->address = address;
+    entry->magic = EX_DIR_MAGIC1;
+    entry->free = 0;
+
+    strncpy(entry->name, name, EX_NAME_LEN - 1);
+}
+
+/** Read the `logical` block of the directory into `buffer`.
+ *
+ * The physical address of the block is stored to `address`.
+ */
+static ex_status ex_dir_read_block(struct ex_inode *dir, size_t logical,
+                                   void *buffer, block_address *address) {
+
+    *address = ex_inode_block_address(dir, logical);
+
+    if (*address == EX_BLOCK_INVALID_ADDRESS) {
+        return INODE_NOT_FOUND;
+    }
+
+    stats.block_reads++;
+
+    return ex_device_read_to_buffer(NULL, buffer, *address, EX_BLOCK_SIZE);
+}
+
+static ex_status ex_dir_write_entry(block_address block, size_t slot,
+                                    const struct ex_dir_entry *entry) {
+    return ex_device_write(block + slot * sizeof(*entry), (const char *)entry,
+                           sizeof(*entry));
+}
+
+/** Whether the block of the linear directory holds any entry. */
+static int ex_dir_block_is_used(const struct ex_dir_entry *entries) {
+
+    for (size_t i = 0; i < EX_DIR_BLOCK_ENTRIES; i++) {
+        if (ex_dir_entry_is_used(&entries[i])) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/** Find the entry `name` in the linear directory. */
+static ex_status ex_dir_linear_lookup(struct ex_inode *dir, const char *name,
+                                      struct ex_dir_entry *result,
+                                      block_address *result_address) {
+
+    struct ex_dir_entry entries[EX_DIR_BLOCK_ENTRIES];
+    block_address address;
+
+    // blocks after the high-water mark hold no entries
+    for (size_t logical = 0; logical < dir->dir_blocks; logical++) {
+
+        ex_status status = ex_dir_read_block(dir, logical, entries, &address);
+
+        if (status != OK) {
+            return status;
+        }
+
+        for (size_t i = 0; i < EX_DIR_BLOCK_ENTRIES; i++) {
+
+            // entries are used in order, the rest was never used
+            if (entries[i].magic == EX_ENTRY_MAGIC1) {
+                return INODE_NOT_FOUND;
+            }
+
+            if (!ex_dir_entry_is_used(&entries[i]) ||
+                strcmp(entries[i].name, name)) {
+                continue;
+            }
+
+            *result = entries[i];
+
+            if (result_address) {
+                *result_address = address + i * sizeof(entries[i]);
+            }
+
+            return OK;
+        }
+    }
+
+    return INODE_NOT_FOUND;
+}
+
+/** Find the position of the leaf which stores the `hash`. */
+static size_t ex_dir_index_position(const struct ex_dir_index_root *root,
+                                    uint32_t hash) {
+
+    size_t low = 0, high = root->count;
+
+    // the last entry whose hash is lower or equal to the `hash`
+    while (high - low > 1) {
+
+        size_t middle = low + (high - low) / 2;
+
+        if (root->entries[middle].hash <= hash) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static ex_status ex_dir_read_root(struct ex_inode *dir,
+                                  struct ex_dir_index_root *root,
+                                  block_address *address) {
+
+    ex_status status = ex_dir_read_block(dir, 0, root, address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    if (root->magic != EX_DIR_INDEX_MAGIC1 || !root->count ||
+        root->count > EX_DIR_INDEX_ENTRIES) {
+        warning("index root of directory (%lu) is corrupted", dir->number);
+        return READ_FAILED;
+    }
+
+    return OK;
+}
+
+static ex_status ex_dir_read_leaf(struct ex_inode *dir, size_t logical,
+                                  struct ex_dir_leaf *leaf,
+                                  block_address *address) {
+
+    ex_status status = ex_dir_read_block(dir, logical, leaf, address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    if (leaf->header.magic != EX_DIR_LEAF_MAGIC1) {
+        warning("leaf (%zu) of directory (%lu) is corrupted", logical,
+                dir->number);
+        return READ_FAILED;
+    }
+
+    return OK;
+}
+
+/** Find the entry `name` in the hashed directory.
+ *
+ * It reads the root and the leaf of the hash, other leaves are read
+ * only if the leaf has a collision chain.
+ */
+static ex_status ex_dir_hashed_lookup(struct ex_inode *dir, const char *name,
+                                      struct ex_dir_entry *result,
+                                      block_address *result_address) {
+
+    struct ex_dir_index_root root;
+    struct ex_dir_leaf leaf;
+    block_address address;
+
+    ex_status status = ex_dir_read_root(dir, &root, &address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    size_t position = ex_dir_index_position(&root, ex_dir_hash(name));
+    size_t logical = root.entries[position].block;
+
+    while (logical) {
+
+        if ((status = ex_dir_read_leaf(dir, logical, &leaf, &address)) != OK) {
+            return status;
+        }
+
+        for (size_t i = 0; i < EX_DIR_LEAF_ENTRIES; i++) {
+
+            if (!ex_dir_entry_is_used(&leaf.entries[i]) ||
+                strcmp(leaf.entries[i].name, name)) {
+                continue;
+            }
+
+            *result = leaf.entries[i];
+
+            if (result_address) {
+                // the header occupies the first slot
+                *result_address = address + (i + 1) * sizeof(leaf.entries[i]);
+            }
+
+            return OK;
+        }
+
+        logical = leaf.header.next;
+    }
+
+    return INODE_NOT_FOUND;
+}
+
+/** Append an empty leaf to the hashed directory.
+ *
+ * The number of blocks in the `root` is updated, the root is not written.
+ * It returns the logical block of the leaf or zero on failure.
+ */
+static size_t ex_dir_append_leaf(struct ex_inode *dir,
+                                 struct ex_dir_index_root *root,
+                                 block_address *address) {
+
+    size_t logical = root->nblocks;
+
+    *address = ex_inode_grow_dir(dir, logical);
+
+    if (*address == EX_BLOCK_INVALID_ADDRESS) {
+        return 0;
+    }
+
+    struct ex_dir_leaf_header header;
+    memset(&header, '\0', sizeof(header));
+    header.magic = EX_DIR_LEAF_MAGIC1;
+
+    if (ex_device_write(*address, (const char *)&header, sizeof(header)) !=
+        OK) {
+        return 0;
+    }
+
+    root->nblocks++;
+    dir->dir_blocks = root->nblocks;
+
+    return logical;
+}
+
+/** Entry of the split leaf with its hash. */
+struct ex_dir_hashed_entry {
+    uint32_t hash;
+    struct ex_dir_entry entry;
+};
+
+static int ex_dir_hashed_entry_cmp(const void *a, const void *b) {
+
+    const struct ex_dir_hashed_entry *x = a, *y = b;
+
+    return (x->hash > y->hash) - (x->hash < y->hash);
+}
+
+/** Split the full leaf at the `position` of the root into two leaves.
+ *
+ * Entries whose hash is at least the median hash are moved to a new leaf,
+ * which is added to the root after the `position`. It fails if all entries
+ * have the same hash, they can be stored only in a collision chain.
+ */
+static ex_status ex_dir_split_leaf(struct ex_inode *dir,
+                                   struct ex_dir_index_root *root,
+                                   block_address root_address, size_t position,
+                                   const struct ex_dir_leaf *leaf,
+                                   block_address leaf_address) {
+
+    struct ex_dir_hashed_entry sorted[EX_DIR_LEAF_ENTRIES];
+    size_t count = 0;
+
+    for (size_t i = 0; i < EX_DIR_LEAF_ENTRIES; i++) {
+
+        if (!ex_dir_entry_is_used(&leaf->entries[i])) {
+            continue;
+        }
+
+        sorted[count].hash = ex_dir_hash(leaf->entries[i].name);
+        sorted[count].entry = leaf->entries[i];
+        count++;
+    }
+
+    qsort(sorted, count, sizeof(sorted[0]), ex_dir_hashed_entry_cmp);
+
+    // find the boundary of two different hashes closest to the middle
+    size_t split = 0;
+
+    for (size_t distance = 0; distance <= count / 2 && !split; distance++) {
+
+        size_t before = count / 2 - distance, after = count / 2 + distance;
+
+        if (before > 0 && sorted[before - 1].hash != sorted[before].hash) {
+            split = before;
+        } else if (after > 0 && after < count &&
+                   sorted[after - 1].hash != sorted[after].hash) {
+            split = after;
+        }
+    }
+
+    if (!split) {
+        return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+    }
+
+    block_address new_address;
+    size_t new_logical = ex_dir_append_leaf(dir, root, &new_address);
+
+    if (!new_logical) {
+        return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+    }
+
+    struct ex_dir_leaf lower, upper;
+
+    memset(&lower, EX_ENTRY_MAGIC1, sizeof(lower));
+    memset(&upper, EX_ENTRY_MAGIC1, sizeof(upper));
+    lower.header = leaf->header;
+    memset(&upper.header, '\0', sizeof(upper.header));
+    upper.header.magic = EX_DIR_LEAF_MAGIC1;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i < split) {
+            lower.entries[i] = sorted[i].entry;
+        } else {
+            upper.entries[i - split] = sorted[i].entry;
+        }
+    }
+
+    memmove(&root->entries[position + 2], &root->entries[position + 1],
+            (root->count - position - 1) * sizeof(root->entries[0]));
+
+    root->entries[position + 1].hash = sorted[split].hash;
+    root->entries[position + 1].block = new_logical;
+    root->count++;
+
+    stats.splits++;
+
+    ex_status status;
+
+    if ((status = ex_device_write(new_address, (const char *)&upper,
+                                  sizeof(upper))) != OK ||
+        (status = ex_device_write(leaf_address, (const char *)&lower,
+                                  sizeof(lower))) != OK ||
+        (status = ex_device_write(root_address, (const char *)root,
+                                  sizeof(*root))) != OK) {
+        return status;
+    }
+
+    return OK;
+}
+
+static ex_status ex_dir_hashed_insert(struct ex_inode *dir, const char *name,
+                                      inode_address inode) {
+
+    struct ex_dir_index_root root;
+    struct ex_dir_leaf leaf;
+    block_address root_address, address;
+
+    ex_status status = ex_dir_read_root(dir, &root, &root_address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    size_t position = ex_dir_index_position(&root, ex_dir_hash(name));
+    size_t logical = root.entries[position].block;
+    size_t chain = 0;
+
+    struct ex_dir_entry entry;
+    ex_dir_entry_make(&entry, name, inode);
+
+    for (;; chain++) {
+
+        if ((status = ex_dir_read_leaf(dir, logical, &leaf, &address)) != OK) {
+            return status;
+        }
+
+        for (size_t i = 0; i < EX_DIR_LEAF_ENTRIES; i++) {
+            if (ex_dir_entry_is_free(&leaf.entries[i])) {
+                return ex_dir_write_entry(address, i + 1, &entry);
+            }
+        }
+
+        if (!leaf.header.next) {
+            break;
+        }
+
+        logical = leaf.header.next;
+    }
+
+    // the leaf is full, split it and try again
+    if (!chain && root.count < EX_DIR_INDEX_ENTRIES &&
+        ex_dir_split_leaf(dir, &root, root_address, position, &leaf,
+                          address) == OK) {
+        return ex_dir_hashed_insert(dir, name, inode);
+    }
+
+    // the leaf cannot be split, link a new leaf to its chain
+    block_address new_address;
+    size_t new_logical = ex_dir_append_leaf(dir, &root, &new_address);
+
+    if (!new_logical) {
+        return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+    }
+
+    leaf.header.next = new_logical;
+
+    if ((status = ex_device_write(address, (const char *)&leaf.header,
+                                  sizeof(leaf.header))) != OK ||
+        (status = ex_device_write(root_address, (const char *)&root,
+                                  sizeof(root))) != OK) {
+        return status;
+    }
+
+    return ex_dir_write_entry(new_address, 1, &entry);
+}
+
+static ex_status ex_dir_hashed_create(struct ex_inode *dir) {
+
+    struct ex_dir_index_root root;
+    memset(&root, '\0', sizeof(root));
+
+    root.magic = EX_DIR_INDEX_MAGIC1;
+    root.count = 1;
+    root.nblocks = 1;
+
+    block_address root_address = ex_inode_grow_dir(dir, 0);
+    block_address leaf_address;
+
+    dir->dir_blocks = 1;
+
+    if (root_address == EX_BLOCK_INVALID_ADDRESS ||
+        !(root.entries[0].block =
+              ex_dir_append_leaf(dir, &root, &leaf_address))) {
+        return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+    }
+
+    return ex_device_write(root_address, (const char *)&root, sizeof(root));
+}
+
+static const char *ex_dir_node_key(const struct ex_dir_node *node, size_t i) {
+    return node->header.level ? node->records[i].child.name
+                              : node->records[i].entry.name;
+}
+
+/** Find the first record of the node whose name is not lower than `name`. */
+static size_t ex_dir_node_lower_bound(const struct ex_dir_node *node,
+                                      const char *name) {
+
+    size_t low = 0, high = node->header.count;
+
+    while (low < high) {
+
+        size_t middle = low + (high - low) / 2;
+
+        if (strcmp(ex_dir_node_key(node, middle), name) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+/** Find the first record of the node whose name is greater than `name`. */
+static size_t ex_dir_node_upper_bound(const struct ex_dir_node *node,
+                                      const char *name) {
+
+    size_t low = 0, high = node->header.count;
+
+    while (low < high) {
+
+        size_t middle = low + (high - low) / 2;
+
+        if (strcmp(ex_dir_node_key(node, middle), name) <= 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+/** Find the child of the inner node which stores the `name`. */
+static size_t ex_dir_node_child(const struct ex_dir_node *node,
+                                const char *name) {
+
+    size_t upper = ex_dir_node_upper_bound(node, name);
+
+    return upper ? upper - 1 : 0;
+}
+
+static void ex_dir_node_init(struct ex_dir_node *node, uint16_t level) {
+
+    memset(node, '\0', sizeof(*node));
+
+    node->header.magic = EX_DIR_NODE_MAGIC1;
+    node->header.level = level;
+}
+
+static ex_status ex_dir_read_node(struct ex_inode *dir, size_t logical,
+                                  struct ex_dir_node *node,
+                                  block_address *address) {
+
+    ex_status status = ex_dir_read_block(dir, logical, node, address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    if (node->header.magic != EX_DIR_NODE_MAGIC1 ||
+        node->header.count > EX_DIR_NODE_ENTRIES ||
+        node->header.level >= EX_DIR_BTREE_MAX_DEPTH ||
+        (node->header.level && !node->header.count)) {
+        warning("node (%zu) of directory (%lu) is corrupted", logical,
+                dir->number);
+        return READ_FAILED;
+    }
+
+    return OK;
+}
+
+static ex_status ex_dir_write_node(block_address address,
+                                   const struct ex_dir_node *node) {
+    return ex_device_write(address, (const char *)node, sizeof(*node));
+}
+
+/** Read the child of the inner node which stores the `name`. */
+static ex_status ex_dir_read_child(struct ex_inode *dir, const char *name,
+                                   const struct ex_dir_node *node,
+                                   size_t *logical, struct ex_dir_node *child,
+                                   block_address *address) {
+
+    uint16_t level = node->header.level;
+
+    *logical = node->records[ex_dir_node_child(node, name)].child.block;
+
+    ex_status status = ex_dir_read_node(dir, *logical, child, address);
+
+    if (status == OK && child->header.level + 1 != level) {
+        warning("node (%zu) of directory (%lu) has bad level", *logical,
+                dir->number);
+        return READ_FAILED;
+    }
+
+    return status;
+}
+
+/** Find the leaf of the B+tree which stores the `name`.
+ *
+ * The leaf is read to the `node`, its logical block and address are stored
+ * to `logical` and `address`.
+ */
+static ex_status ex_dir_btree_find_leaf(struct ex_inode *dir, const char *name,
+                                        struct ex_dir_node *node,
+                                        size_t *logical,
+                                        block_address *address) {
+
+    *logical = 0;
+
+    ex_status status = ex_dir_read_node(dir, 0, node, address);
+
+    while (status == OK && node->header.level) {
+
+        struct ex_dir_node parent = *node;
+
+        status = ex_dir_read_child(dir, name, &parent, logical, node, address);
+    }
+
+    return status;
+}
+
+static ex_status ex_dir_btree_lookup(struct ex_inode *dir, const char *name,
+                                     struct ex_dir_entry *result,
+                                     block_address *result_address) {
+
+    struct ex_dir_node leaf;
+    block_address address;
+    size_t logical;
+
+    ex_status status =
+        ex_dir_btree_find_leaf(dir, name, &leaf, &logical, &address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    size_t i = ex_dir_node_lower_bound(&leaf, name);
+
+    if (i == leaf.header.count || strcmp(ex_dir_node_key(&leaf, i), name)) {
+        return INODE_NOT_FOUND;
+    }
+
+    *result = leaf.records[i].entry;
+
+    if (result_address) {
+        // the header occupies the first slot
+        *result_address = address + (i + 1) * sizeof(leaf.records[i]);
+    }
+
+    return OK;
+}
+
+/** Append a block to the B+tree.
+ *
+ * The number of blocks in the `root` is updated, the root is not written.
+ * It returns the logical block or zero on failure.
+ */
+static size_t ex_dir_btree_append(struct ex_inode *dir,
+                                  struct ex_dir_node *root,
+                                  block_address *address) {
+
+    size_t logical = root->header.nblocks;
+
+    *address = ex_inode_grow_dir(dir, logical);
+
+    if (*address == EX_BLOCK_INVALID_ADDRESS) {
+        return 0;
+    }
+
+    root->header.nblocks++;
+    dir->dir_blocks = root->header.nblocks;
+
+    return logical;
+}
+
+/** Distribute records of the full `node` and the `record` inserted at the
+ *  `position` to the `left` and `right` node, `left` may be the `node`. */
+static void ex_dir_node_split(const struct ex_dir_node *node, size_t position,
+                              const union ex_dir_node_record *record,
+                              struct ex_dir_node *left,
+                              struct ex_dir_node *right) {
+
+    union ex_dir_node_record all[EX_DIR_NODE_ENTRIES + 1];
+    const size_t size = sizeof(all[0]);
+    const size_t half = (EX_DIR_NODE_ENTRIES + 1) / 2;
+    uint16_t level = node->header.level;
+
+    memcpy(all, node->records, position * size);
+    all[position] = *record;
+    memcpy(all + position + 1, node->records + position,
+           (EX_DIR_NODE_ENTRIES - position) * size);
+
+    ex_dir_node_init(left, level);
+    ex_dir_node_init(right, level);
+
+    memcpy(left->records, all, half * size);
+    left->header.count = half;
+
+    memcpy(right->records, all + half, (EX_DIR_NODE_ENTRIES + 1 - half) * size);
+    right->header.count = EX_DIR_NODE_ENTRIES + 1 - half;
+}
+
+/** Split the full `node` which is not the root.
+ *
+ * The `record` is inserted at the `position`, the upper half of records is
+ * moved to a new node. The `record` is replaced by the child which points
+ * to the new node, it must be inserted into the parent.
+ */
+static ex_status ex_dir_btree_split(struct ex_inode *dir,
+                                    struct ex_dir_node *root,
+                                    struct ex_dir_node *node,
+                                    block_address address, size_t position,
+                                    union ex_dir_node_record *record) {
+
+    struct ex_dir_node right;
+    block_address right_address;
+    size_t right_logical = ex_dir_btree_append(dir, root, &right_address);
+
+    if (!right_logical) {
+        return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+    }
+
+    uint32_t next = node->header.next;
+
+    ex_dir_node_split(node, position, record, node, &right);
+
+    // leaves stay chained in the order of names
+    if (!node->header.level) {
+        right.header.next = next;
+        node->header.next = right_logical;
+    }
+
+    stats.splits++;
+
+    memset(record, '\0', sizeof(*record));
+    record->child.block = right_logical;
+    strcpy(record->child.name, ex_dir_node_key(&right, 0));
+
+    ex_status status;
+
+    if ((status = ex_dir_write_node(right_address, &right)) != OK ||
+        (status = ex_dir_write_node(address, node)) != OK) {
+        return status;
+    }
+
+    return OK;
+}
+
+/** Split the full root, the `record` is inserted at the `position`.
+ *
+ * The root must stay in the logical block 0, so both halves are moved
+ * to new nodes and the root becomes their parent. The root is not written.
+ */
+static ex_status ex_dir_btree_split_root(struct ex_inode *dir,
+                                         struct ex_dir_node *root,
+                                         size_t position,
+                                         const union ex_dir_node_record *record) {
+
+    if (root->header.level + 1 >= EX_DIR_BTREE_MAX_DEPTH) {
+        return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+    }
+
+    struct ex_dir_node left, right;
+    block_address left_address, right_address;
+
+    size_t left_logical = ex_dir_btree_append(dir, root, &left_address);
+    size_t right_logical =
+        left_logical ? ex_dir_btree_append(dir, root, &right_address) : 0;
+
+    if (!right_logical) {
+        return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+    }
+
+    uint32_t nblocks = root->header.nblocks;
+
+    ex_dir_node_split(root, position, record, &left, &right);
+
+    if (!left.header.level) {
+        left.header.next = right_logical;
+    }
+
+    ex_dir_node_init(root, left.header.level + 1);
+
+    root->header.nblocks = nblocks;
+    root->header.count = 2;
+    root->records[0].child.block = left_logical;
+    root->records[1].child.block = right_logical;
+    strcpy(root->records[1].child.name, ex_dir_node_key(&right, 0));
+
+    stats.splits++;
+
+    ex_status status;
+
+    if ((status = ex_dir_write_node(left_address, &left)) != OK ||
+        (status = ex_dir_write_node(right_address, &right)) != OK) {
+        return status;
+    }
+
+    return OK;
+}
+
+static ex_status ex_dir_btree_insert(struct ex_inode *dir, const char *name,
+                                     inode_address inode) {
+
+    // nodes on the path from the root to the leaf, splits go up the path
+    struct ex_dir_node path[EX_DIR_BTREE_MAX_DEPTH];
+    block_address addresses[EX_DIR_BTREE_MAX_DEPTH];
+    size_t positions[EX_DIR_BTREE_MAX_DEPTH];
+    size_t depth = 0, logical;
+
+    ex_status status = ex_dir_read_node(dir, 0, &path[0], &addresses[0]);
+
+    // levels decrease by one, so the path is shorter than the maximum depth
+    while (status == OK && path[depth].header.level) {
+
+        positions[depth] = ex_dir_node_child(&path[depth], name);
+
+        status = ex_dir_read_child(dir, name, &path[depth], &logical,
+                                   &path[depth + 1], &addresses[depth + 1]);
+        depth++;
+    }
+
+    if (status != OK) {
+        return status;
+    }
+
+    union ex_dir_node_record record;
+    ex_dir_entry_make(&record.entry, name, inode);
+
+    struct ex_dir_node *leaf = &path[depth];
+    size_t position = ex_dir_node_lower_bound(leaf, name);
+
+    // the name is already present, its entry is replaced
+    if (position < leaf->header.count &&
+        !strcmp(ex_dir_node_key(leaf, position), name)) {
+        leaf->records[position] = record;
+        return ex_dir_write_node(addresses[depth], leaf);
+    }
+
+    for (size_t level = depth;; level--) {
+
+        struct ex_dir_node *node = &path[level];
+        size_t count = node->header.count;
+
+        if (count < EX_DIR_NODE_ENTRIES) {
+
+            memmove(&node->records[position + 1], &node->records[position],
+                    (count - position) * sizeof(record));
+
+            node->records[position] = record;
+            node->header.count++;
+
+            // the root is written below
+            if (level) {
+                status = ex_dir_write_node(addresses[level], node);
+            }
+
+            break;
+        }
+
+        if (!level) {
+            status = ex_dir_btree_split_root(dir, node, position, &record);
+            break;
+        }
+
+        status = ex_dir_btree_split(dir, &path[0], node, addresses[level],
+                                    position, &record);
+
+        if (status != OK) {
+            break;
+        }
+
+        position = positions[level - 1] + 1;
+    }
+
+    // the root keeps the number of blocks, it's written after every insert
+    ex_status root_status = ex_dir_write_node(addresses[0], &path[0]);
+
+    return status != OK ? status : root_status;
+}
+
+/** Remove the entry from its leaf, nodes are not merged. */
+static ex_status ex_dir_btree_remove(struct ex_inode *dir, const char *name) {
+
+    struct ex_dir_node leaf;
+    block_address address;
+    size_t logical;
+
+    ex_status status =
+        ex_dir_btree_find_leaf(dir, name, &leaf, &logical, &address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    size_t i = ex_dir_node_lower_bound(&leaf, name);
+    size_t count = leaf.header.count;
+
+    if (i == count || strcmp(ex_dir_node_key(&leaf, i), name)) {
+        return INODE_NOT_FOUND;
+    }
+
+    memmove(&leaf.records[i], &leaf.records[i + 1],
+            (count - i - 1) * sizeof(leaf.records[i]));
+    memset(&leaf.records[count - 1], '\0', sizeof(leaf.records[i]));
+    leaf.header.count--;
+
+    return ex_dir_write_node(address, &leaf);
+}
+
+static ex_status ex_dir_btree_create(struct ex_inode *dir) {
+
+    struct ex_dir_node root;
+    block_address address = ex_inode_grow_dir(dir, 0);
+
+    if (address == EX_BLOCK_INVALID_ADDRESS) {
+        return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+    }
+
+    ex_dir_node_init(&root, 0);
+    root.header.nblocks = 1;
+    dir->dir_blocks = 1;
+
+    return ex_dir_write_node(address, &root);
+}
+
+static ex_status ex_dir_insert_entry(struct ex_inode *dir, const char *name,
+                                     inode_address inode);
+
+/** Collect all entries of the linear directory.
+ *
+ * It returns the malloc'ed array of entries, their number is stored to
+ * `count`.
+ */
+static struct ex_dir_entry *ex_dir_linear_entries(struct ex_inode *dir,
+                                                  size_t nblocks,
+                                                  size_t *count) {
+
+    struct ex_dir_entry *result =
+        ex_malloc(nblocks * EX_DIR_BLOCK_ENTRIES * sizeof(*result));
+    struct ex_dir_entry entries[EX_DIR_BLOCK_ENTRIES];
+    block_address address;
+
+    *count = 0;
+
+    for (size_t logical = 0; logical < nblocks; logical++) {
+
+        if (ex_dir_read_block(dir, logical, entries, &address) != OK) {
+            free(result);
+            return NULL;
+        }
+
+        for (size_t i = 0; i < EX_DIR_BLOCK_ENTRIES; i++) {
+            if (ex_dir_entry_is_used(&entries[i])) {
+                result[(*count)++] = entries[i];
+            }
+        }
+    }
+
+    return result;
+}
+
+/** Convert the linear directory of `nblocks` blocks to the format set by
+ *  ex_dir_set_format.
+ *
+ * The index is built in newly allocated blocks while the directory stays
+ * linear. Only when all entries are inserted, the directory is switched
+ * to the index and flushed, blocks of the linear directory are released
+ * after that. If the index cannot be built, the directory is kept linear.
+ */
+static ex_status ex_dir_convert(struct ex_inode *dir, size_t nblocks) {
+
+    size_t count;
+    struct ex_dir_entry *entries = ex_dir_linear_entries(dir, nblocks, &count);
+
+    if (!entries) {
+        return READ_FAILED;
+    }
+
+    // the copy of the inode maps the index, it's never flushed
+    struct ex_inode index = *dir;
+    struct ex_extent_root extents;
+
+    ex_extent_root_init(&extents);
+    ex_inode_set_blocks(&index, &extents);
+
+    index.dir_blocks = 0;
+    index.flags &= ~EX_DIR_FORMAT_FLAGS;
+
+    ex_status status;
+
+    if (format == EX_DIR_BTREE) {
+        index.flags |= EX_INODE_DIR_BTREE;
+        status = ex_dir_btree_create(&index);
+    } else {
+        index.flags |= EX_INODE_DIR_HASHED;
+        status = ex_dir_hashed_create(&index);
+    }
+
+    for (size_t i = 0; status == OK && i < count; i++) {
+        status = ex_dir_insert_entry(&index, entries[i].name,
+                                     entries[i].address);
+    }
+
+    free(entries);
+
+    if (status != OK) {
+        warning("unable to build index of directory (%lu), it stays linear",
+                dir->number);
+        ex_extent_free(&index.extents);
+        return status;
+    }
+
+    struct ex_extent_root linear = dir->extents;
+
+    ex_inode_set_blocks(dir, &index.extents);
+    dir->dir_blocks = index.dir_blocks;
+    dir->flags = index.flags;
+
+    if ((status = ex_inode_flush(dir)) != OK) {
+        // the directory on the storage still maps the linear blocks
+        ex_inode_set_blocks(dir, &linear);
+        dir->dir_blocks = nblocks;
+        dir->flags &= ~EX_DIR_FORMAT_FLAGS;
+        ex_extent_free(&index.extents);
+        return status;
+    }
+
+    ex_extent_free(&linear);
+
+    stats.conversions++;
+
+    return OK;
+}
+
+/** Add the entry to the first free slot of the linear directory.
+ *
+ * The search starts at the free slot hint, so it usually reads one block.
+ */
+static ex_status ex_dir_linear_insert(struct ex_inode *dir, const char *name,
+                                      inode_address inode) {
+
+    struct ex_dir_entry entries[EX_DIR_BLOCK_ENTRIES];
+    block_address address;
+    ex_status status;
+
+    struct ex_dir_entry entry;
+    ex_dir_entry_make(&entry, name, inode);
+
+    size_t first = dir->dir_free;
+
+    if (first > dir->dir_blocks * EX_DIR_BLOCK_ENTRIES) {
+        first = dir->dir_blocks * EX_DIR_BLOCK_ENTRIES;
+    }
+
+    size_t nblocks = first / EX_DIR_BLOCK_ENTRIES;
+
+    for (; nblocks < dir->dir_blocks; nblocks++) {
+
+        status = ex_dir_read_block(dir, nblocks, entries, &address);
+
+        if (status != OK) {
+            return status;
+        }
+
+        size_t i = nblocks == first / EX_DIR_BLOCK_ENTRIES
+                       ? first % EX_DIR_BLOCK_ENTRIES
+                       : 0;
+
+        for (; i < EX_DIR_BLOCK_ENTRIES; i++) {
+            if (ex_dir_entry_is_free(&entries[i])) {
+                dir->dir_free = nblocks * EX_DIR_BLOCK_ENTRIES + i + 1;
+                return ex_dir_write_entry(address, i, &entry);
+            }
+        }
+    }
+
+    if (nblocks >= EX_DIR_INDEX_THRESHOLD && format != EX_DIR_LINEAR) {
+
+        // a directory which cannot be converted keeps growing linearly
+        if (ex_dir_convert(dir, nblocks) == OK) {
+            return ex_dir_insert_entry(dir, name, inode);
+        }
+    }
+
+    // all entries are used, the block after the high-water mark is either
+    // still mapped and free or a new block is appended
+    address = ex_inode_block_address(dir, nblocks);
+
+    if (address == EX_BLOCK_INVALID_ADDRESS) {
+        address = ex_inode_grow_dir(dir, nblocks);
+    }
+
+    if (address == EX_BLOCK_INVALID_ADDRESS) {
+        return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+    }
+
+    dir->dir_blocks = nblocks + 1;
+    dir->dir_free = nblocks * EX_DIR_BLOCK_ENTRIES + 1;
+
+    return ex_dir_write_entry(address, 0, &entry);
+}
+
+/** Lower the high-water mark of the linear directory below its trailing
+ *  blocks without entries, `entries` hold its last block. */
+static void ex_dir_linear_shrink(struct ex_inode *dir,
+                                 struct ex_dir_entry *entries) {
+
+    block_address address;
+
+    // the first block always holds "." and ".."
+    while (dir->dir_blocks > 1 && !ex_dir_block_is_used(entries)) {
+
+        dir->dir_blocks--;
+
+        if (dir->dir_free > dir->dir_blocks * EX_DIR_BLOCK_ENTRIES) {
+            dir->dir_free = dir->dir_blocks * EX_DIR_BLOCK_ENTRIES;
+        }
+
+        if (ex_dir_read_block(dir, dir->dir_blocks - 1, entries, &address) !=
+            OK) {
+            break;
+        }
+    }
+}
+
+/** Remove the entry from the linear directory. */
+static ex_status ex_dir_linear_remove(struct ex_inode *dir,
+                                      const char *name) {
+
+    struct ex_dir_entry entries[EX_DIR_BLOCK_ENTRIES];
+    block_address address;
+
+    for (size_t logical = 0; logical < dir->dir_blocks; logical++) {
+
+        ex_status status = ex_dir_read_block(dir, logical, entries, &address);
+
+        if (status != OK) {
+            return status;
+        }
+
+        for (size_t i = 0; i < EX_DIR_BLOCK_ENTRIES; i++) {
+
+            if (entries[i].magic == EX_ENTRY_MAGIC1) {
+                return INODE_NOT_FOUND;
+            }
+
+            if (!ex_dir_entry_is_used(&entries[i]) ||
+                strcmp(entries[i].name, name)) {
+                continue;
+            }
+
+            entries[i].free = 1;
+
+            if ((status = ex_dir_write_entry(address, i, &entries[i])) != OK) {
+                return status;
+            }
+
+            // the freed slot is used by the next insert
+            if (dir->dir_free > logical * EX_DIR_BLOCK_ENTRIES + i) {
+                dir->dir_free = logical * EX_DIR_BLOCK_ENTRIES + i;
+            }
+
+            if (logical + 1 == dir->dir_blocks) {
+                ex_dir_linear_shrink(dir, entries);
+            }
+
+            return OK;
+        }
+    }
+
+    return INODE_NOT_FOUND;
+}
+
+static ex_status ex_dir_insert_entry(struct ex_inode *dir, const char *name,
+                                     inode_address inode) {
+
+    if (ex_dir_is_btree(dir)) {
+        return ex_dir_btree_insert(dir, name, inode);
+    }
+
+    if (ex_dir_is_hashed(dir)) {
+        return ex_dir_hashed_insert(dir, name, inode);
+    }
+
+    return ex_dir_linear_insert(dir, name, inode);
+}
+
+ex_status ex_dir_lookup(struct ex_inode *dir, const char *name,
+                        struct ex_dir_entry *entry, block_address *address) {
+
+    if (ex_dir_is_btree(dir)) {
+        return ex_dir_btree_lookup(dir, name, entry, address);
+    }
+
+    if (ex_dir_is_hashed(dir)) {
+        return ex_dir_hashed_lookup(dir, name, entry, address);
+    }
+
+    return ex_dir_linear_lookup(dir, name, entry, address);
+}
+
+ex_status ex_dir_insert(struct ex_inode *dir, const char *name,
+                        inode_address address) {
+
+    debug("inserting %s to directory (%lu)", name, dir->number);
+
+    generation++;
+
+    ex_status status = ex_dir_insert_entry(dir, name, address);
+
+    if (status == OK) {
+        dir->dir_entries++;
+        dir->size += sizeof(struct ex_dir_entry);
+        ex_dcache_add(dir->address, name, address);
+    } else {
+        ex_dcache_remove(dir->address, name);
+    }
+
+    // entries are written immediately, so are the counts, a stale
+    // high-water mark would hide entries
+    ex_inode_flush(dir);
+
+    return status;
+}
+
+static ex_status ex_dir_remove_entry(struct ex_inode *dir, const char *name) {
+
+    if (ex_dir_is_btree(dir)) {
+        return ex_dir_btree_remove(dir, name);
+    }
+
+    if (!ex_dir_is_hashed(dir)) {
+        return ex_dir_linear_remove(dir, name);
+    }
+
+    struct ex_dir_entry entry;
+    block_address address;
+
+    ex_status status = ex_dir_hashed_lookup(dir, name, &entry, &address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    entry.free = 1;
+
+    return ex_device_write(address, (const char *)&entry, sizeof(entry));
+}
+
+ex_status ex_dir_remove(struct ex_inode *dir, const char *name) {
+
+    generation++;
+
+    ex_status status = ex_dir_remove_entry(dir, name);
+
+    // the name is known not to exist until it's inserted again
+    if (status == OK) {
+        dir->dir_entries--;
+        dir->size -= sizeof(struct ex_dir_entry);
+        ex_dcache_add(dir->address, name, EX_DCACHE_NEGATIVE);
+        ex_inode_flush(dir);
+    } else {
+        ex_dcache_remove(dir->address, name);
+    }
+
+    return status;
+}
+
+size_t ex_dir_count_entries(const struct ex_inode *dir) {
+    return dir->dir_entries;
+}
+
+void ex_dir_cursor_open(struct ex_dir_cursor *cursor, struct ex_inode *dir,
+                        const char *prefix) {
+
+    cursor->offset = 0;
+    cursor->slot = 0;
+    cursor->flags = dir->flags & EX_DIR_FORMAT_FLAGS;
+    cursor->positioned = 0;
+    cursor->done = 0;
+    cursor->valid = 0;
+    cursor->has_pending = 0;
+
+    // leaves of the hashed directory start after the root
+    cursor->block = ex_dir_is_hashed(dir) ? 1 : 0;
+
+    memset(cursor->prefix, '\0', sizeof(cursor->prefix));
+    memset(cursor->last, '\0', sizeof(cursor->last));
+
+    if (prefix) {
+        strncpy(cursor->prefix, prefix, sizeof(cursor->prefix) - 1);
+    }
+}
+
+/** Read the `logical` block of the directory to the buffer of the cursor.
+ *
+ * The block is not read again until any directory changes.
+ */
+static ex_status ex_dir_cursor_load(struct ex_dir_cursor *cursor,
+                                    struct ex_inode *dir, size_t logical) {
+
+    if (cursor->valid && cursor->buffered == logical &&
+        cursor->generation == generation) {
+        return OK;
+    }
+
+    block_address address;
+    ex_status status;
+
+    cursor->valid = 0;
+
+    if (cursor->flags & EX_INODE_DIR_BTREE) {
+        status = ex_dir_read_node(dir, logical, &cursor->buffer.node, &address);
+    } else if (cursor->flags & EX_INODE_DIR_HASHED) {
+        status = ex_dir_read_leaf(dir, logical, &cursor->buffer.leaf, &address);
+    } else {
+        status = ex_dir_read_block(dir, logical, &cursor->buffer, &address);
+    }
+
+    if (status != OK) {
+        return status;
+    }
+
+    cursor->valid = 1;
+    cursor->buffered = logical;
+    cursor->generation = generation;
+
+    return OK;
+}
+
+static int ex_dir_cursor_matches(const struct ex_dir_cursor *cursor,
+                                 const char *name) {
+    return !strncmp(name, cursor->prefix, strlen(cursor->prefix));
+}
+
+static void ex_dir_cursor_return(struct ex_dir_cursor *cursor,
+                                 const struct ex_dir_entry *found,
+                                 struct ex_dir_entry *entry) {
+
+    *entry = *found;
+
+    memcpy(cursor->last, found->name, sizeof(cursor->last));
+    cursor->last[sizeof(cursor->last) - 1] = '\0';
+}
+
+/** Return the next entry of the linear or the hashed directory.
+ *
+ * Entries are returned in the order of their slots.
+ */
+static ex_status ex_dir_cursor_next_slot(struct ex_dir_cursor *cursor,
+                                         struct ex_inode *dir,
+                                         struct ex_dir_entry *entry) {
+
+    int hashed = cursor->flags & EX_INODE_DIR_HASHED;
+
+    for (;; cursor->block++, cursor->slot = 0) {
+
+        // blocks after the high-water mark hold no entries
+        if (cursor->block >= dir->dir_blocks) {
+            return INODE_NOT_FOUND;
+        }
+
+        ex_status status = ex_dir_cursor_load(cursor, dir, cursor->block);
+
+        if (status != OK) {
+            return status;
+        }
+
+        const struct ex_dir_entry *entries = cursor->buffer.entries;
+        size_t count = EX_DIR_BLOCK_ENTRIES;
+
+        if (hashed) {
+            entries = cursor->buffer.leaf.entries;
+            count = EX_DIR_LEAF_ENTRIES;
+        }
+
+        while (cursor->slot < count) {
+
+            const struct ex_dir_entry *found = &entries[cursor->slot++];
+
+            // entries of the linear directory are used in order
+            if (!hashed && found->magic == EX_ENTRY_MAGIC1) {
+                return INODE_NOT_FOUND;
+            }
+
+            if (ex_dir_entry_is_used(found) &&
+                ex_dir_cursor_matches(cursor, found->name)) {
+                ex_dir_cursor_return(cursor, found, entry);
+                return OK;
+            }
+        }
+    }
+}
+
+/** Position the cursor in the B+tree.
+ *
+ * The cursor is moved after the last returned name, or before the first
+ * name with the prefix if no entry was returned yet.
+ */
+static ex_status ex_dir_cursor_position(struct ex_dir_cursor *cursor,
+                                        struct ex_inode *dir) {
+
+    const char *key = cursor->offset ? cursor->last : cursor->prefix;
+    struct ex_dir_node *leaf = &cursor->buffer.node;
+    block_address address;
+    size_t logical;
+
+    cursor->valid = 0;
+
+    ex_status status =
+        ex_dir_btree_find_leaf(dir, key, leaf, &logical, &address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    cursor->valid = 1;
+    cursor->buffered = logical;
+    cursor->generation = generation;
+
+    cursor->block = logical;
+    cursor->slot = cursor->offset ? ex_dir_node_upper_bound(leaf, key)
+                                  : ex_dir_node_lower_bound(leaf, key);
+    cursor->positioned = 1;
+
+    return OK;
+}
+
+/** Return the next entry of the B+tree directory in the order of names. */
+static ex_status ex_dir_cursor_next_btree(struct ex_dir_cursor *cursor,
+                                          struct ex_inode *dir,
+                                          struct ex_dir_entry *entry) {
+
+    ex_status status;
+
+    // the tree changed since the last call, entries may have moved
+    if (!cursor->positioned || cursor->generation != generation) {
+        if ((status = ex_dir_cursor_position(cursor, dir)) != OK) {
+            return status;
+        }
+    }
+
+    for (;;) {
+
+        if ((status = ex_dir_cursor_load(cursor, dir, cursor->block)) != OK) {
+            return status;
+        }
+
+        const struct ex_dir_node *leaf = &cursor->buffer.node;
+
+        if (leaf->header.level) {
+            warning("leaf (%zu) of directory (%lu) is corrupted",
+                    cursor->block, dir->number);
+            return READ_FAILED;
+        }
+
+        if (cursor->slot < leaf->header.count) {
+
+            const struct ex_dir_entry *found =
+                &leaf->records[cursor->slot++].entry;
+
+            // names are sorted, no more names start with the prefix
+            if (!ex_dir_cursor_matches(cursor, found->name)) {
+                return INODE_NOT_FOUND;
+            }
+
+            ex_dir_cursor_return(cursor, found, entry);
+            return OK;
+        }
+
+        if (!leaf->header.next) {
+            return INODE_NOT_FOUND;
+        }
+
+        cursor->block = leaf->header.next;
+        cursor->slot = 0;
+    }
+}
+
+/** Open the cursor again and skip `offset` entries. */
+static ex_status ex_dir_cursor_skip(struct ex_dir_cursor *cursor,
+                                    struct ex_inode *dir, size_t offset) {
+
+    char prefix[EX_NAME_LEN];
+    memcpy(prefix, cursor->prefix, sizeof(prefix));
+
+    ex_dir_cursor_open(cursor, dir, prefix);
+
+    struct ex_dir_entry entry;
+
+    while (cursor->offset < offset) {
+
+        ex_status status = ex_dir_cursor_next(cursor, dir, &entry);
+
+        if (status == INODE_NOT_FOUND) {
+            break;
+        }
+
+        if (status != OK) {
+            return status;
+        }
+    }
+
+    return OK;
+}
+
+ex_status ex_dir_cursor_next(struct ex_dir_cursor *cursor,
+                             struct ex_inode *dir, struct ex_dir_entry *entry) {
+
+    ex_status status;
+
+    // the entry was returned already, the directory was read after it
+    if (cursor->has_pending) {
+        *entry = cursor->pending;
+        cursor->has_pending = 0;
+        cursor->offset++;
+        return OK;
+    }
+
+    // the directory was converted, its entries moved
+    if ((dir->flags & EX_DIR_FORMAT_FLAGS) != cursor->flags &&
+        (status = ex_dir_cursor_skip(cursor, dir, cursor->offset)) != OK) {
+        return status;
+    }
+
+    if (cursor->done) {
+        return INODE_NOT_FOUND;
+    }
+
+    if (cursor->flags & EX_INODE_DIR_BTREE) {
+        status = ex_dir_cursor_next_btree(cursor, dir, entry);
+    } else {
+        status = ex_dir_cursor_next_slot(cursor, dir, entry);
+    }
+
+    if (status == OK) {
+        cursor->offset++;
+    } else if (status == INODE_NOT_FOUND) {
+        cursor->done = 1;
+    }
+
+    return status;
+}
+
+void ex_dir_cursor_unget(struct ex_dir_cursor *cursor,
+                         const struct ex_dir_entry *entry) {
+
+    cursor->pending = *entry;
+    cursor->has_pending = 1;
+    cursor->offset--;
+}
+
+ex_status ex_dir_cursor_seek(struct ex_dir_cursor *cursor,
+                             struct ex_inode *dir, size_t offset) {
+
+    if (offset == cursor->offset &&
+        (dir->flags & EX_DIR_FORMAT_FLAGS) == cursor->flags) {
+        return OK;
+    }
+
+    return ex_dir_cursor_skip(cursor, dir, offset);
+}
+
+ex_status ex_dir_iterate(struct ex_inode *dir, ex_dir_callback callback,
+                         void *ctx) {
+
+    struct ex_dir_cursor cursor;
+    struct ex_dir_entry entry;
+    ex_status status;
+
+    ex_dir_cursor_open(&cursor, dir, NULL);
+
+    while ((status = ex_dir_cursor_next(&cursor, dir, &entry)) == OK) {
+        if (callback(&entry, ctx)) {
+            return OK;
+        }
+    }
+
+    return status == INODE_NOT_FOUND ? OK : status;
+}
+
+void ex_dir_reset_stats(void) { memset(&stats, '\0', sizeof(stats)); }
+
+void ex_dir_get_stats(struct ex_dir_stats *result) { *result = stats; }
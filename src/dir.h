@@ -0,0 +1,306 @@
+/**
+ * @file dir.h
+ *
+ * This file provides the directory formats and the directory entries' API.
+ *
+ * Small directories are linear: their blocks are arrays of struct
+ * ex_dir_entry which are searched slot by slot. Blocks after the
+ * high-water mark (ex_inode.dir_blocks) hold no entries, so scans stop
+ * there, the mark is lowered when the trailing blocks are emptied. Inserts
+ * start at the first slot which may be free (ex_inode.dir_free), removals
+ * move it back to the freed slot. When a linear directory needs more than
+ * EX_DIR_INDEX_THRESHOLD blocks, it's converted to the hashed format (the
+ * EX_INODE_DIR_HASHED flag is set):
+ *
+ * - the logical block 0 is struct ex_dir_index_root, a sorted array of
+ *   hashes of entry names, every hash is the lower bound of hashes stored
+ *   in one leaf block,
+ * - other blocks are leaves (struct ex_dir_leaf), they hold entries
+ *   in any order. A full leaf is split by the median hash, if it cannot be
+ *   split (all its entries have the same hash or the root is full),
+ *   another leaf is linked to it as a collision chain.
+ *
+ * So a lookup in the hashed directory reads the root and one leaf,
+ * regardless of the size of the directory.
+ *
+ * Directories can be converted to the B+tree format (the
+ * EX_INODE_DIR_BTREE flag is set) instead. Entries are sorted by names:
+ * leaves hold entries and they're chained in the order of names, inner
+ * nodes hold the lowest name of each child. The root is always the
+ * logical block 0, it moves its content to new blocks when it's split.
+ * Removed entries leave their leaves partially empty, nodes are not
+ * merged.
+ *
+ * All formats are iterated by struct ex_dir_cursor, B+tree directories
+ * are iterated in the order of names, so a cursor resumes after the last
+ * returned name even if the directory changed in between.
+ */
+#ifndef EX_DIR_H
+#define EX_DIR_H
+
+#include "inode.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/** Number of blocks of the linear directory which trigger the conversion. */
+#define EX_DIR_INDEX_THRESHOLD 4
+
+/** Index root magic constant used for sanity check. */
+extern const uint32_t EX_DIR_INDEX_MAGIC1;
+
+/** Index leaf magic constant used for sanity check. */
+extern const uint32_t EX_DIR_LEAF_MAGIC1;
+
+/** B+tree node magic constant used for sanity check. */
+extern const uint32_t EX_DIR_NODE_MAGIC1;
+
+/** Number of entries in one block of the linear directory. */
+#define EX_DIR_BLOCK_ENTRIES (EX_BLOCK_SIZE / sizeof(struct ex_dir_entry))
+
+/** Maximum depth of the B+tree. */
+#define EX_DIR_BTREE_MAX_DEPTH 8
+
+/** Format of directories which outgrow the linear format. */
+typedef enum {
+    /** Directories stay linear. */
+    EX_DIR_LINEAR,
+    /** Directories are indexed by hashes of the entry names. */
+    EX_DIR_HASHED,
+    /** Directories are B+trees sorted by the entry names. */
+    EX_DIR_BTREE,
+} ex_dir_format;
+
+/** Entry of the index root, it maps hashes to a leaf. */
+struct ex_dir_index_entry {
+    /** The lowest hash stored in the leaf. */
+    uint32_t hash;
+    /** Logical block of the leaf. */
+    uint32_t block;
+};
+
+/** Number of index entries in the root. */
+#define EX_DIR_INDEX_ENTRIES                                                   \
+    ((EX_BLOCK_SIZE - 4 * sizeof(uint32_t)) / sizeof(struct ex_dir_index_entry))
+
+/** Root of the hashed directory, it's stored in the logical block 0. */
+struct ex_dir_index_root {
+    /** Index root magic number. */
+    uint32_t magic;
+    /** Number of used index entries. */
+    uint32_t count;
+    /** Number of blocks of the directory. */
+    uint32_t nblocks;
+    uint32_t __padding;
+    /** Index entries sorted by hashes, the first hash is always zero. */
+    struct ex_dir_index_entry entries[EX_DIR_INDEX_ENTRIES];
+};
+
+/** Header of the leaf, it occupies the first entry slot of the block. */
+struct ex_dir_leaf_header {
+    /** Index leaf magic number. */
+    uint32_t magic;
+    /** Logical block of the next leaf of the collision chain, or zero. */
+    uint32_t next;
+    char __padding[sizeof(struct ex_dir_entry) - 2 * sizeof(uint32_t)];
+};
+
+/** Number of entries in one leaf. */
+#define EX_DIR_LEAF_ENTRIES                                                    \
+    (EX_BLOCK_SIZE / sizeof(struct ex_dir_entry) - 1)
+
+/** Leaf block of the hashed directory. */
+struct ex_dir_leaf {
+    struct ex_dir_leaf_header header;
+    struct ex_dir_entry entries[EX_DIR_LEAF_ENTRIES];
+};
+
+static_assert(sizeof(struct ex_dir_index_root) <= EX_BLOCK_SIZE,
+              "Index root must fit into one block");
+
+static_assert(sizeof(struct ex_dir_leaf) == EX_BLOCK_SIZE,
+              "Index leaf must fill one block");
+
+/** Header of the B+tree node, it occupies the first entry slot of the block. */
+struct ex_dir_node_header {
+    /** B+tree node magic number. */
+    uint32_t magic;
+    /** Level of the node, leaves have level zero. */
+    uint16_t level;
+    /** Number of used records. */
+    uint16_t count;
+    /** Logical block of the next leaf, or zero for the last leaf. */
+    uint32_t next;
+    /** Number of blocks of the directory, it's used only by the root. */
+    uint32_t nblocks;
+    char __padding[sizeof(struct ex_dir_entry) - 4 * sizeof(uint32_t)];
+};
+
+/** Child of the inner B+tree node. */
+struct ex_dir_node_entry {
+    /** Logical block of the child. */
+    uint32_t block;
+    /** The lowest name stored in the child. */
+    char name[EX_NAME_LEN];
+    char __padding[sizeof(struct ex_dir_entry) - sizeof(uint32_t) -
+                   EX_NAME_LEN];
+};
+
+/** Record of the B+tree node, leaves store entries, inner nodes children. */
+union ex_dir_node_record {
+    struct ex_dir_entry entry;
+    struct ex_dir_node_entry child;
+};
+
+/** Number of records in one B+tree node. */
+#define EX_DIR_NODE_ENTRIES (EX_BLOCK_SIZE / sizeof(struct ex_dir_entry) - 1)
+
+/** Node of the B+tree directory, its records are sorted by names. */
+struct ex_dir_node {
+    struct ex_dir_node_header header;
+    union ex_dir_node_record records[EX_DIR_NODE_ENTRIES];
+};
+
+static_assert(sizeof(struct ex_dir_node) == EX_BLOCK_SIZE,
+              "B+tree node must fill one block");
+
+/** Cursor over entries of the directory.
+ *
+ * The cursor does not reference the directory, it's passed to every call,
+ * so it can be kept between calls which release the directory. The cursor
+ * buffers one block of the directory, the buffer is dropped whenever any
+ * directory changes.
+ */
+struct ex_dir_cursor {
+    /** Ordinal number of the next entry, see ex_dir_cursor_seek. */
+    size_t offset;
+    /** Logical block of the next entry. */
+    size_t block;
+    /** Slot of the next entry in the `block`. */
+    size_t slot;
+    /** Format flags of the directory when the cursor was positioned. */
+    uint16_t flags;
+    /** Whether the `block` and `slot` are valid. */
+    int positioned;
+    /** Whether the cursor reached the end of the directory. */
+    int done;
+    /** Directories generation when the `buffer` was read. */
+    uint64_t generation;
+    /** Logical block stored in the `buffer`, if `valid` is set. */
+    size_t buffered;
+    /** Whether the `buffer` holds a block. */
+    int valid;
+    /** Only entries which start with the prefix are returned. */
+    char prefix[EX_NAME_LEN];
+    /** Name of the last returned entry. */
+    char last[EX_NAME_LEN];
+    /** Whether the `pending` entry is returned by the next call. */
+    int has_pending;
+    /** The entry returned back by ex_dir_cursor_unget. */
+    struct ex_dir_entry pending;
+    /** The buffered block. */
+    union {
+        struct ex_dir_entry entries[EX_DIR_BLOCK_ENTRIES];
+        struct ex_dir_leaf leaf;
+        struct ex_dir_node node;
+    } buffer;
+};
+
+/** Statistics of the directory operations. */
+struct ex_dir_stats {
+    /** Number of directory blocks read by lookups, inserts and removals. */
+    size_t block_reads;
+    /** Number of linear directories converted to the hashed or B+tree
+     *  format. */
+    size_t conversions;
+    /** Number of split leaves and B+tree nodes. */
+    size_t splits;
+};
+
+/** Callback used by ex_dir_iterate, non zero return value stops it. */
+typedef int (*ex_dir_callback)(const struct ex_dir_entry *entry, void *ctx);
+
+/** Set the format used by directories which outgrow the linear format.
+ *
+ * Existing directories keep their format, the default is EX_DIR_HASHED.
+ */
+void ex_dir_set_format(ex_dir_format format);
+
+/** Get the format used by directories which outgrow the linear format. */
+ex_dir_format ex_dir_get_format(void);
+
+/** Hash the name of the directory entry. */
+uint32_t ex_dir_hash(const char *name);
+
+/** Find the entry `name` in the directory.
+ *
+ * The entry is copied to `entry`, its address on the persistent storage
+ * is stored to `address` if it's not NULL. INODE_NOT_FOUND is returned if
+ * the directory does not contain the entry.
+ */
+ex_status ex_dir_lookup(struct ex_inode *dir, const char *name,
+                        struct ex_dir_entry *entry, block_address *address);
+
+/** Add the entry `name` which points to the inode at `address`.
+ *
+ * The directory grows if it has no free entry, it's converted to the
+ * format set by ex_dir_set_format when it outgrows the linear format. The caller must check
+ * that the directory does not contain `name`.
+ */
+ex_status ex_dir_insert(struct ex_inode *dir, const char *name,
+                        inode_address address);
+
+/** Remove the entry `name` from the directory. */
+ex_status ex_dir_remove(struct ex_inode *dir, const char *name);
+
+/** Get the number of entries of the directory, including "." and "..".
+ *
+ * The number is kept in the directory inode, so it does not read entries.
+ */
+size_t ex_dir_count_entries(const struct ex_inode *dir);
+
+/** Position the cursor before the first entry of the directory.
+ *
+ * If the `prefix` is not NULL, only entries whose names start with the
+ * `prefix` are returned. B+tree directories start the scan at the first
+ * such name and end it after the last one.
+ */
+void ex_dir_cursor_open(struct ex_dir_cursor *cursor, struct ex_inode *dir,
+                        const char *prefix);
+
+/** Copy the next entry of the directory to `entry`.
+ *
+ * INODE_NOT_FOUND is returned when there are no more entries.
+ */
+ex_status ex_dir_cursor_next(struct ex_dir_cursor *cursor,
+                             struct ex_inode *dir, struct ex_dir_entry *entry);
+
+/** Return the `entry` back to the cursor.
+ *
+ * The `entry` must be the last entry returned by ex_dir_cursor_next, the
+ * next call returns it again, e.g. when it did not fit into a buffer.
+ */
+void ex_dir_cursor_unget(struct ex_dir_cursor *cursor,
+                         const struct ex_dir_entry *entry);
+
+/** Position the cursor before the entry with the ordinal number `offset`.
+ *
+ * The `offset` is the value of `cursor->offset` after some entries were
+ * returned. Seeking to the current offset keeps the position, so entries
+ * added or removed since the last call do not shift B+tree directories.
+ * Other offsets are found by a scan from the first entry.
+ */
+ex_status ex_dir_cursor_seek(struct ex_dir_cursor *cursor,
+                             struct ex_inode *dir, size_t offset);
+
+/** Call `callback` for all entries of the directory. */
+ex_status ex_dir_iterate(struct ex_inode *dir, ex_dir_callback callback,
+                         void *ctx);
+
+/** Reset statistics of the directory operations. */
+void ex_dir_reset_stats(void);
+
+/** Get statistics of the directory operations. */
+void ex_dir_get_stats(struct ex_dir_stats *stats);
+
+#endif /* EX_DIR_H */
@@ -19,7 +19,9 @@ typedef enum {
     DATA_BITMAP_IS_FULL,
     BLOCK_ALLOCATION_FAILED,
     SUPER_BAD_MAGIC,
+    SUPER_BAD_VERSION,
     SUPER_LOCK_INIT_FAILED,
+    BLOCK_REFCOUNT_OVERFLOW,
     // mkfs errors
     ZEROING_OUTSIDE_OF_DEVICE_SPACE,
     DEVICE_STAT_FAILED,
@@ -4,6 +4,11 @@
 #include "super.h"
 #include "path.h"
 #include "inode.h"
+#include "icache.h"
+#include "dcache.h"
+#include "compress.h"
+#include "dedup.h"
+#include "dir.h"
 
 #include <math.h>
 #include <sys/xattr.h>
@@ -12,13 +17,71 @@
 #include <limits.h>
 #include <stdlib.h>
 
+static enum ex_atime_mode atime_mode = EX_ATIME_RELATIME;
+static int atime_lazy = 0;
+
+void ex_set_atime_mode(enum ex_atime_mode mode, int lazytime) {
+    atime_mode = mode;
+    atime_lazy = lazytime;
+    ex_inode_set_lazytime(lazytime);
+}
+
+void ex_set_compression(int enabled) { ex_compress_set_enabled(enabled); }
+
+void ex_set_dedup(int enabled) { ex_dedup_set_enabled(enabled); }
+
+void ex_set_dir_format(int format) { ex_dir_set_format(format); }
+
+static int single_threaded = 0;
+
+void ex_set_single_threaded(int single) { single_threaded = single; }
+
+static int ex_timespec_le(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec < b->tv_sec ||
+           (a->tv_sec == b->tv_sec && a->tv_nsec <= b->tv_nsec);
+}
+
+/** Update the access time of the inode according to the atime policy. */
+static void ex_inode_touch_atime(struct ex_inode *inode) {
+
+    struct timespec now = inode->atime;
+    ex_update_time_ns(&now);
+
+    switch (atime_mode) {
+        case EX_ATIME_NOATIME:
+            return;
+        case EX_ATIME_RELATIME:
+            if (!ex_timespec_le(&inode->atime, &inode->mtime) &&
+                !ex_timespec_le(&inode->atime, &inode->ctime) &&
+                now.tv_sec - inode->atime.tv_sec < EX_RELATIME_INTERVAL) {
+                return;
+            }
+            break;
+        case EX_ATIME_STRICT:
+        default:
+            break;
+    }
+
+    inode->atime = now;
+
+    if (atime_lazy) {
+        ex_inode_mark_time_dirty(inode);
+    } else {
+        ex_inode_mark_dirty(inode);
+    }
+}
+
 size_t ex_device_size(size_t ninodes) {
-    return ninodes * EX_DIRECT_BLOCKS *
-               EX_BLOCK_SIZE +             // space for n-1 inode data
-           ninodes * EX_DIRECT_BLOCKS +    // space for n-1 inodes
-           sizeof(struct ex_super_block) + // space for superblock
-           ninodes / 8 +                   // size of inode bitmap
-           ninodes * EX_DIRECT_BLOCKS / 8; // size of data bitmap
+    return ninodes * EX_DATA_BLOCKS_PER_INODE *
+               EX_BLOCK_SIZE +                     // space for n-1 inode data
+           ex_super_inode_table_size(ninodes) +    // space for n-1 inodes
+           sizeof(struct ex_super_block) +         // space for superblock
+           ninodes / 8 +                           // size of inode bitmap
+           ninodes * EX_DATA_BLOCKS_PER_INODE / 8 + // size of data bitmap
+           ninodes * EX_DATA_BLOCKS_PER_INODE *     // size of refcounts
+               sizeof(uint32_t) +
+           ninodes * EX_DATA_BLOCKS_PER_INODE *     // size of dedup index
+               sizeof(struct ex_dedup_entry);
 }
 
 ex_status ex_init(const char *device) {
@@ -41,6 +104,8 @@ ex_status ex_init(const char *device) {
         goto root_load_error;
     }
 
+    ex_icache_start_writeback();
+
     return status;
 
 root_load_error:
@@ -57,7 +122,13 @@ void ex_deinit(void) {
 
     info("deinitializing fs");
 
+    ex_icache_stop_writeback();
+
     if (ex_is_device_opened()) {
+        ex_icache_clear();
+        ex_dcache_clear();
+        ex_compress_cache_clear();
+
         ex_device_close();
     }
 
@@ -105,7 +176,7 @@ int ex_create(const char *pathname, mode_t mode, gid_t gid, uid_t uid) {
     }
 
 free_destdir:
-    ex_inode_free(destdir);
+    ex_inode_put(destdir);
     ex_path_free(path);
     ex_path_free(dirpath);
 
@@ -115,6 +186,26 @@ name_too_long:
     return rv;
 }
 
+/** Fill attributes of the inode to `st`. */
+static void ex_stat_inode(const struct ex_inode *inode, struct stat *st) {
+
+    st->st_nlink = inode->nlinks;
+    st->st_size = inode->size;
+    st->st_mode = inode->mode;
+    st->st_ino = inode->number;
+
+    st->st_mtim = inode->mtime;
+    st->st_atim = inode->atime;
+    st->st_ctim = inode->ctime;
+
+    st->st_uid = inode->uid;
+    st->st_gid = inode->gid;
+
+    st->st_blksize = EX_BLOCK_SIZE;
+    // st_blocks are counted in 512 byte units
+    st->st_blocks = ex_inode_allocated_blocks(inode) * (EX_BLOCK_SIZE / 512);
+}
+
 int ex_getattr(const char *pathname, struct stat *st) {
 
     ex_super_lock();
@@ -134,26 +225,12 @@ int ex_getattr(const char *pathname, struct stat *st) {
         goto free_path;
     }
 
-    st->st_nlink = inode->nlinks;
-    st->st_size = inode->size;
-    st->st_mode = inode->mode;
-    st->st_ino = inode->number;
-
-    st->st_mtim = inode->mtime;
-    st->st_atim = inode->atime;
-    st->st_ctim = inode->ctime;
-
-    st->st_uid = inode->uid;
-    st->st_gid = inode->gid;
-
-    st->st_blksize = EX_BLOCK_SIZE;
-    st->st_blocks = ceil(((float)inode->size)/EX_BLOCK_SIZE);
+    ex_stat_inode(inode, st);
 
     // update access time
-    ex_update_time_ns(&inode->atime);
-    ex_inode_flush(inode);
+    ex_inode_touch_atime(inode);
 
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
 free_path:
     ex_path_free(path);
@@ -195,7 +272,7 @@ free_all:
 
 free_dir:
     ex_path_free(dirpath);
-    ex_inode_free(dir);
+    ex_inode_put(dir);
 
 name_too_long:
     ex_super_unlock();
@@ -243,7 +320,7 @@ int ex_link(const char *src_pathname, const char *dest_pathname) {
 
     if (!(dest_dir_inode->mode & S_IFDIR)) {
         rv = -ENOTDIR;
-        goto free_src_inode;
+        goto free_dest_dir_inode;
     }
 
     struct ex_path *dest_path = ex_path_make(dest_pathname);
@@ -253,16 +330,16 @@ int ex_link(const char *src_pathname, const char *dest_pathname) {
     }
 
     src_inode->nlinks += 1;
-    ex_inode_flush(src_inode);
+    ex_inode_mark_dirty(src_inode);
 
     ex_path_free(dest_path);
 
 free_dest_dir_inode:
-    ex_inode_free(dest_dir_inode);
+    ex_inode_put(dest_dir_inode);
     ex_path_free(dest_dir_path);
 
 free_src_inode:
-    ex_inode_free(src_inode);
+    ex_inode_put(src_inode);
     ex_path_free(src_path);
 
 name_too_long:
@@ -306,11 +383,10 @@ int ex_read(const char *pathname, char *buffer, size_t amount, off_t offset) {
     }
 
     // update inode access time
-    ex_update_time_ns(&inode->atime);
-    ex_inode_flush(inode);
+    ex_inode_touch_atime(inode);
 
 free_inode:
-    ex_inode_free(inode);
+    ex_inode_put(inode);
     ex_path_free(path);
 
     debug("read rv=%i", rv);
@@ -320,6 +396,100 @@ free_inode:
     return rv;
 }
 
+int ex_read_runs_are_stable(void) {
+    return single_threaded && !ex_compress_is_enabled() &&
+           !ex_dedup_is_enabled();
+}
+
+/** Read data of the device ranges into memory of the runs. */
+static ex_status ex_read_runs_to_memory(struct ex_inode_run *runs,
+                                        size_t nruns) {
+
+    for (size_t i = 0; i < nruns; i++) {
+
+        if (runs[i].data) {
+            continue;
+        }
+
+        ssize_t readed = 0;
+        char *data = ex_malloc(runs[i].length);
+
+        ex_status status = ex_device_read_to_buffer(&readed, data,
+                                                    runs[i].address,
+                                                    runs[i].length);
+
+        if (status != OK || (size_t)readed != runs[i].length) {
+            free(data);
+            return READ_FAILED;
+        }
+
+        runs[i].data = data;
+        runs[i].address = EX_BLOCK_INVALID_ADDRESS;
+    }
+
+    return OK;
+}
+
+int ex_read_runs(const char *pathname, size_t amount, off_t offset,
+                 struct ex_inode_run **runs) {
+
+    ex_super_lock();
+
+    info("path=%s, offset=%lu, size=%lu", pathname, offset, amount);
+
+    int rv = 0;
+    *runs = NULL;
+
+    struct ex_path *path = ex_path_make(pathname);
+    struct ex_inode *inode = ex_inode_find(path);
+
+    if (!inode) {
+        rv = -ENOENT;
+        goto free_inode;
+    }
+
+    if (offset < 0) {
+        rv = -EINVAL;
+        goto free_inode;
+    }
+
+    size_t nruns = 0;
+
+    switch (ex_inode_read_runs(inode, offset, amount, runs, &nruns)) {
+        case READ_OFFSET_PAST_EOF:
+            rv = 0;
+            break;
+        case OK:
+            rv = nruns;
+            break;
+        default:
+            rv = -EIO;
+            break;
+    }
+
+    if (rv > 0 && !ex_read_runs_are_stable() &&
+        ex_read_runs_to_memory(*runs, nruns) != OK) {
+
+        for (size_t i = 0; i < nruns; i++) {
+            free((*runs)[i].data);
+        }
+
+        free(*runs);
+        *runs = NULL;
+        rv = -EIO;
+    }
+
+    ex_inode_touch_atime(inode);
+
+free_inode:
+    ex_inode_put(inode);
+    ex_path_free(path);
+
+    ex_super_unlock();
+
+    return rv;
+}
+
 int ex_write(const char *pathname, const char *buf, size_t size, off_t offset) {
 
     ex_super_lock();
@@ -338,22 +508,153 @@ int ex_write(const char *pathname, const char *buf, size_t size, off_t offset) {
 
     rv = ex_inode_write(inode, offset, buf, size);
 
-    if (!rv) {
+    if (!rv && size) {
         rv = -EIO;
         goto free_inode;
     }
 
-    if (rv == -1) { // ENOSPC?
-        rv = -EFBIG;
+free_inode:
+    ex_path_free(path);
+    ex_inode_put(inode);
+
+    ex_super_unlock();
+
+    return rv;
+}
+
+int ex_write_from(const char *pathname, size_t size, off_t offset,
+                  ex_inode_write_callback copy, void *ctx) {
+
+    ex_super_lock();
+
+    info("path=%s, off=%jd, size=%lu", pathname, offset, size);
+
+    ssize_t rv = 0;
+
+    struct ex_path *path = ex_path_make(pathname);
+    struct ex_inode *inode = ex_inode_find(path);
+
+    if (!inode) {
+        rv = -ENOENT;
         goto free_inode;
     }
 
-    ex_update_time_ns(&inode->mtime);
-    ex_inode_flush(inode);
+    rv = ex_inode_write_from(inode, offset, size, copy, ctx);
+
+    if (!rv && size) {
+        rv = -EIO;
+        goto free_inode;
+    }
 
 free_inode:
     ex_path_free(path);
-    ex_inode_free(inode);
+    ex_inode_put(inode);
+
+    ex_super_unlock();
+
+    return rv;
+}
+
+ssize_t ex_copy_range(const char *src_pathname, off_t src_offset,
+                      const char *dst_pathname, off_t dst_offset,
+                      size_t size) {
+
+    ex_super_lock();
+
+    info("src=%s, src_off=%jd, dst=%s, dst_off=%jd, size=%lu", src_pathname,
+         src_offset, dst_pathname, dst_offset, size);
+
+    ssize_t rv = 0;
+
+    struct ex_path *src_path = ex_path_make(src_pathname);
+    struct ex_path *dst_path = ex_path_make(dst_pathname);
+
+    struct ex_inode *src = ex_inode_find(src_path);
+    struct ex_inode *dst = ex_inode_find(dst_path);
+
+    if (!src || !dst) {
+        rv = -ENOENT;
+        goto free_inodes;
+    }
+
+    if (S_ISDIR(src->mode) || S_ISDIR(dst->mode)) {
+        rv = -EISDIR;
+        goto free_inodes;
+    }
+
+    if (src_offset < 0 || dst_offset < 0) {
+        rv = -EINVAL;
+        goto free_inodes;
+    }
+
+    // ranges of the same file must not overlap
+    if (src == dst && (size_t)src_offset < dst_offset + size &&
+        (size_t)dst_offset < src_offset + size) {
+        rv = -EINVAL;
+        goto free_inodes;
+    }
+
+    rv = ex_inode_copy_range(dst, dst_offset, src, src_offset, size);
+
+free_inodes:
+    ex_inode_put(dst);
+    ex_inode_put(src);
+    ex_path_free(dst_path);
+    ex_path_free(src_path);
+
+    ex_super_unlock();
+
+    return rv;
+}
+
+int ex_clone_file(const char *src_pathname, const char *dst_pathname) {
+
+    ex_super_lock();
+
+    info("src=%s, dst=%s", src_pathname, dst_pathname);
+
+    int rv = 0;
+
+    struct ex_path *src_path = ex_path_make(src_pathname);
+    struct ex_path *dst_path = ex_path_make(dst_pathname);
+
+    struct ex_inode *src = ex_inode_find(src_path);
+    struct ex_inode *dst = ex_inode_find(dst_path);
+
+    if (!src || !dst) {
+        rv = -ENOENT;
+        goto free_inodes;
+    }
+
+    if (S_ISDIR(src->mode) || S_ISDIR(dst->mode)) {
+        rv = -EISDIR;
+        goto free_inodes;
+    }
+
+    if (S_ISLNK(src->mode) || S_ISLNK(dst->mode)) {
+        rv = -EINVAL;
+        goto free_inodes;
+    }
+
+    switch (ex_inode_clone(dst, src)) {
+        case OK:
+            break;
+        case BLOCK_REFCOUNT_OVERFLOW:
+            rv = -EMLINK;
+            break;
+        case DATA_BITMAP_IS_FULL:
+        case INODE_BLOCK_ALLOCATION_FAILED:
+            rv = -ENOSPC;
+            break;
+        default:
+            rv = -EIO;
+    }
+
+free_inodes:
+    ex_inode_put(dst);
+    ex_inode_put(src);
+    ex_path_free(dst_path);
+    ex_path_free(src_path);
 
     ex_super_unlock();
 
@@ -398,7 +699,7 @@ int ex_open(const char *pathname, int flags, gid_t gid, uid_t uid) {
 
 free_inode:
     ex_path_free(path);
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
     ex_super_unlock();
 
@@ -434,13 +735,17 @@ int ex_mkdir(const char *pathname, mode_t mode, gid_t gid, uid_t uid) {
     }
 
     ex_inode_fill_dir(&dir, destdir);
-    ex_inode_set(destdir, dirpath->name, &dir);
+
+    // ".." of the new directory links its parent
+    if (ex_inode_set(destdir, dirpath->name, &dir)) {
+        ex_inode_link_dir(destdir, 1);
+    }
 
 free_all:
     ex_path_free(dirpath);
 
 free_inode:
-    ex_inode_free(destdir);
+    ex_inode_put(destdir);
     ex_path_free(destpath);
 
 name_too_long:
@@ -483,15 +788,19 @@ int ex_truncate(const char *pathname, off_t size) {
         goto free_inode;
     }
 
-
-    inode->size = size;
-    ex_update_time_ns(&inode->mtime);
-    inode->ctime = inode->mtime;
-
-    ex_inode_flush(inode);
+    switch (ex_inode_truncate(inode, size)) {
+        case OK:
+            break;
+        case INODE_DATA_BLOCKS_ALLOCATION_FAILED:
+            rv = -ENOSPC;
+            break;
+        default:
+            rv = -EIO;
+            break;
+    }
 
 free_inode:
-    ex_inode_free(inode);
+    ex_inode_put(inode);
     ex_path_free(path);
 
 name_too_long:
@@ -527,15 +836,208 @@ int ex_readdir(const char *pathname, struct ex_dir_entry ***entries) {
     *entries = ex_inode_get_all(inode);
 
     // update inode access time
-    ex_update_time_ns(&inode->atime);
-    ex_inode_flush(inode);
+    ex_inode_touch_atime(inode);
+
+free_inode:
+    ex_inode_put(inode);
+    ex_path_free(path);
+
+name_too_long:
+    ex_super_unlock();
+
+    return rv;
+}
+
+int ex_count_entries(const char *pathname, size_t *count) {
+
+    ex_super_lock();
+
+    int rv = 0;
+
+    if (!ex_super_check_path_len(pathname)) {
+        rv = -ENAMETOOLONG;
+        goto name_too_long;
+    }
+
+    struct ex_path *path = ex_path_make(pathname);
+    struct ex_inode *inode = ex_inode_find(path);
+
+    if (!inode) {
+        rv = -ENOENT;
+        goto free_path;
+    }
+
+    if (!S_ISDIR(inode->mode)) {
+        rv = -ENOTDIR;
+        goto free_inode;
+    }
+
+    *count = ex_dir_count_entries(inode);
+
+free_inode:
+    ex_inode_put(inode);
+
+free_path:
+    ex_path_free(path);
+
+name_too_long:
+    ex_super_unlock();
+
+    return rv;
+}
+
+/** Entry of the readdirplus batch and its inode. */
+struct ex_readdir_item {
+    struct ex_dir_entry entry;
+    struct ex_inode *inode;
+};
+
+static int ex_readdir_item_cmp(const void *a, const void *b) {
+
+    const struct ex_readdir_item *const *x = a, *const *y = b;
+    inode_address i = (*x)->entry.address, j = (*y)->entry.address;
+
+    return (i > j) - (i < j);
+}
+
+/** Pass entries with their attributes to the `filler`.
+ *
+ * Entries are read in batches of EX_READDIR_BATCH, inodes of the batch are
+ * loaded in the order of their addresses, so the inode table is read
+ * sequentially. If the `filler` does not accept an entry, the cursor is
+ * moved back before it.
+ */
+static ex_status ex_readdir_plus(struct ex_inode *dir,
+                                 struct ex_dir_cursor *cursor,
+                                 ex_readdir_filler filler, void *ctx) {
+
+    struct ex_readdir_item items[EX_READDIR_BATCH];
+    struct ex_readdir_item *order[EX_READDIR_BATCH];
+    struct ex_dir_cursor *saved = ex_malloc(sizeof(struct ex_dir_cursor));
+    ex_status status = OK;
+    size_t count, filled;
+
+    // batches continue while the filler accepts all their entries
+    do {
+        *saved = *cursor;
+        count = filled = 0;
+
+        while (count < EX_READDIR_BATCH &&
+               (status = ex_dir_cursor_next(cursor, dir,
+                                            &items[count].entry)) == OK) {
+            order[count] = &items[count];
+            count++;
+        }
+
+        if (status != OK && status != INODE_NOT_FOUND) {
+            free(saved);
+            return status;
+        }
+
+        status = OK;
+
+        qsort(order, count, sizeof(order[0]), ex_readdir_item_cmp);
+
+        for (size_t i = 0; i < count; i++) {
+            order[i]->inode = ex_icache_get(order[i]->entry.address);
+        }
+
+        for (; filled < count; filled++) {
+
+            struct stat st;
+            memset(&st, '\0', sizeof(st));
+
+            if (items[filled].inode) {
+                ex_stat_inode(items[filled].inode, &st);
+            }
+
+            if (filler(&items[filled].entry, saved->offset + filled + 1,
+                       items[filled].inode ? &st : NULL, ctx)) {
+                break;
+            }
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            ex_inode_put(items[i].inode);
+        }
+    } while (count == EX_READDIR_BATCH && filled == count);
+
+    // the cursor continues after the last accepted entry
+    if (filled < count) {
+
+        *cursor = *saved;
+
+        for (size_t i = 0; i < filled; i++) {
+            ex_dir_cursor_next(cursor, dir, &items[0].entry);
+        }
+    }
+
+    free(saved);
+
+    return status;
+}
+
+int ex_readdir_cursor(const char *pathname, struct ex_dir_cursor *cursor,
+                      off_t offset, int plus, ex_readdir_filler filler,
+                      void *ctx) {
+
+    ex_super_lock();
+
+    int rv = 0;
+
+    if (!ex_super_check_path_len(pathname)) {
+        rv = -ENAMETOOLONG;
+        goto name_too_long;
+    }
+
+    struct ex_path *path = ex_path_make(pathname);
+    struct ex_inode *inode = ex_inode_find(path);
+
+    if (!inode) {
+        rv = -ENOENT;
+        goto free_inode;
+    }
+
+    if (!(inode->mode & S_IFDIR)) {
+        rv = -ENOTDIR;
+        goto free_inode;
+    }
+
+    if (offset < 0) {
+        rv = -EINVAL;
+        goto free_inode;
+    }
+
+    if (!offset) {
+        ex_dir_cursor_open(cursor, inode, NULL);
+    } else if (ex_dir_cursor_seek(cursor, inode, offset) != OK) {
+        rv = -EIO;
+        goto free_inode;
+    }
+
+    struct ex_dir_entry entry;
+    ex_status status;
+
+    if (plus) {
+        status = ex_readdir_plus(inode, cursor, filler, ctx);
+    } else {
+        while ((status = ex_dir_cursor_next(cursor, inode, &entry)) == OK) {
+            if (filler(&entry, cursor->offset, NULL, ctx)) {
+                ex_dir_cursor_unget(cursor, &entry);
+                break;
+            }
+        }
+    }
+
+    if (status != OK && status != INODE_NOT_FOUND) {
+        rv = -EIO;
+    }
 
     // update inode access time
-    ex_update_time_ns(&inode->atime);
-    ex_inode_flush(inode);
+    ex_inode_touch_atime(inode);
 
 free_inode:
-    ex_inode_free(inode);
+    ex_inode_put(inode);
     ex_path_free(path);
 
 name_too_long:
@@ -569,10 +1071,10 @@ int ex_utimens(const char *pathname, const struct timespec tv[2]) {
     inode->atime = tv[ATIM];
     inode->mtime = tv[MTIM];
 
-    ex_inode_flush(inode);
+    ex_inode_mark_dirty(inode);
 
 free_inode:
-    ex_inode_free(inode);
+    ex_inode_put(inode);
     ex_path_free(path);
 
 name_too_long:
@@ -619,13 +1121,13 @@ int ex_rmdir(const char *pathname) {
 
 free_dir_inode:
     ex_path_free(dirpath);
-    ex_inode_free(dir);
+    ex_inode_put(dir);
 
 free_path:
     ex_path_free(path);
 
 free_inode:
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
 name_too_long:
     ex_super_unlock();
@@ -673,11 +1175,11 @@ int ex_chmod(const char *pathname, mode_t mode) {
 
     ex_log_mode(inode->mode);
 
-    ex_inode_flush(inode);
+    ex_inode_mark_dirty(inode);
 
 free_inode:
     ex_path_free(path);
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
 name_too_long:
     ex_super_unlock();
@@ -715,7 +1217,7 @@ int ex_access(const char *pathname, int mode) {
 
 free_inode:
     ex_path_free(path);
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
 name_too_long:
     ex_super_unlock();
@@ -762,6 +1264,7 @@ int ex_symlink(const char *target, const char *link) {
     struct ex_inode *link_inode = ex_inode_find(link_path);
 
     if (link_inode) {
+        ex_inode_put(link_inode);
         rv = -EEXIST;
         goto link_exists;
     }
@@ -793,18 +1296,18 @@ int ex_symlink(const char *target, const char *link) {
     }
 
 fail:
+    ex_inode_free(link_inode);
+
 link_exists:
     ex_path_free(link_path);
-    if (link_inode)
-        ex_inode_free(link_inode);
 
 link_dir_is_invalid:
     ex_path_free(link_dir_path);
-    ex_inode_free(link_dir_inode);
+    ex_inode_put(link_dir_inode);
 
 target_not_found:
     ex_path_free(target_path);
-    ex_inode_free(target_inode);
+    ex_inode_put(target_inode);
 
 name_too_long:
     ex_super_unlock();
@@ -830,7 +1333,7 @@ int ex_readlink(const char *pathname, char *buffer, size_t bufsize) {
     ssize_t readed = -1;
 
     ex_inode_read(&readed, inode, 0, buffer, maxread);
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
 invalid_path:
     ex_super_unlock();
@@ -877,11 +1380,11 @@ int ex_rename(const char *from, const char *to) {
 
 to_dir_is_invalid:
     ex_path_free(to_path_dir);
-    ex_inode_free(to_inode_dir);
+    ex_inode_put(to_inode_dir);
 
 from_not_found:
     ex_path_free(from_path_dir);
-    ex_inode_free(from_inode_dir);
+    ex_inode_put(from_inode_dir);
 
 name_too_long:
     ex_super_unlock();
@@ -906,8 +1409,8 @@ int ex_chown(const char *pathname, uid_t uid, gid_t gid) {
     inode->uid = uid;
     inode->gid = gid;
 
-    ex_inode_flush(inode);
-    ex_inode_free(inode);
+    ex_inode_mark_dirty(inode);
+    ex_inode_put(inode);
 
 invalid_path:
     ex_super_unlock();
@@ -925,6 +1428,8 @@ int ex_opendir(const char *path, mode_t mode, gid_t gid, uid_t uid) {
 
 int ex_setxattr(const char* pathname, const char* name, const char* value, size_t valuesize, int flags) {
 
+    ex_super_lock();
+
     int rv = 0;
 
     struct ex_path *path = ex_path_make(pathname);
@@ -946,11 +1451,11 @@ int ex_setxattr(const char* pathname, const char* name, const char* value, size_
     rv = ex_inode_setxattr(inode, &namespan, &valuespan);
 
     if (!rv) {
-        ex_inode_flush(inode);
+        ex_inode_mark_dirty(inode);
     }
 
 not_supported:
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
 invalid_path:
     ex_super_unlock();
@@ -961,6 +1466,8 @@ invalid_path:
 
 int ex_getxattr(const char* pathname, const char* name, void* value, size_t valuesize) {
 
+    ex_super_lock();
+
     int rv = 0;
 
     struct ex_path *path = ex_path_make(pathname);
@@ -988,7 +1495,7 @@ int ex_getxattr(const char* pathname, const char* name, void* value, size_t valu
     memcpy(value, attr.value, attr.valuelen);
 
 error:
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
 invalid_path:
     ex_super_unlock();
@@ -998,6 +1505,9 @@ invalid_path:
 }
 
 int ex_removexattr(const char *pathname, const char *attr) {
+
+    ex_super_lock();
+
     int rv = 0;
 
     struct ex_path *path = ex_path_make(pathname);
@@ -1012,10 +1522,10 @@ int ex_removexattr(const char *pathname, const char *attr) {
     rv = ex_inode_removexattr(inode, &namespan);
 
     if (!rv) {
-        ex_inode_flush(inode);
+        ex_inode_mark_dirty(inode);
     }
 
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
 invalid_path:
     ex_super_unlock();
@@ -1023,3 +1533,87 @@ invalid_path:
 
     return rv;
 }
+
+off_t ex_lseek(const char *pathname, off_t off, int whence) {
+
+    ex_super_lock();
+
+    off_t rv = 0;
+
+    if (!ex_super_check_path_len(pathname)) {
+        rv = -ENAMETOOLONG;
+        goto name_too_long;
+    }
+
+    struct ex_path *path = ex_path_make(pathname);
+    struct ex_inode *inode = ex_inode_find(path);
+
+    if (!inode) {
+        rv = -ENOENT;
+        goto free_path;
+    }
+
+    rv = ex_inode_seek(inode, off, whence);
+
+    ex_inode_put(inode);
+
+free_path:
+    ex_path_free(path);
+
+name_too_long:
+    ex_super_unlock();
+
+    return rv;
+}
+
+int ex_fsync(const char *pathname, int datasync) {
+
+    // data are written through, only the inode can be dirty
+    (void)datasync;
+
+    ex_super_lock();
+
+    int rv = 0;
+
+    if (!ex_super_check_path_len(pathname)) {
+        rv = -ENAMETOOLONG;
+        goto name_too_long;
+    }
+
+    struct ex_path *path = ex_path_make(pathname);
+    struct ex_inode *inode = ex_inode_find(path);
+
+    if (!inode) {
+        rv = -ENOENT;
+        goto free_path;
+    }
+
+    ex_inode_writeback(inode);
+
+    if (ex_inode_flush(inode) != OK || ex_device_sync() != OK) {
+        rv = -EIO;
+    }
+
+    ex_inode_put(inode);
+
+free_path:
+    ex_path_free(path);
+
+name_too_long:
+    ex_super_unlock();
+
+    return rv;
+}
+
+int ex_sync(void) {
+
+    ex_super_lock();
+
+    ex_icache_sync();
+
+    int rv = ex_device_sync() == OK ? 0 : -EIO;
+
+    ex_super_unlock();
+
+    return rv;
+}
@@ -8,7 +8,63 @@
 #include <sys/types.h>
 #include <time.h>
 
+struct ex_dir_cursor;
 struct ex_dir_entry;
+struct ex_inode_run;
+struct stat;
+
+/** Number of entries whose inodes are loaded together by readdirplus. */
+#define EX_READDIR_BATCH 64
+
+/** Callback of ex_readdir_cursor, it's called for every entry.
+ *
+ * The `next` is the offset of the entry after this one, `st` holds
+ * attributes of the entry with readdirplus, otherwise it's NULL. A non zero
+ * return value means that the entry was not accepted (e.g. the buffer is
+ * full), the listing stops and the entry is returned by the next call.
+ */
+typedef int (*ex_readdir_filler)(const struct ex_dir_entry *entry, off_t next,
+                                 const struct stat *st, void *ctx);
+
+/** Policy of the access time updates. */
+enum ex_atime_mode {
+    /** Update the access time on every access. */
+    EX_ATIME_STRICT,
+    /** Update the access time only if it's older than the modification or
+     *  change time, or older than EX_RELATIME_INTERVAL. */
+    EX_ATIME_RELATIME,
+    /** Never update the access time. */
+    EX_ATIME_NOATIME,
+};
+
+/** Maximum age of the access time with relatime (seconds). */
+#define EX_RELATIME_INTERVAL (24 * 60 * 60)
+
+/** Set the access time policy, relatime is the default.
+ *
+ * If `lazytime` is set, timestamp updates are kept in memory and they are
+ * written with other changes of the inode, on sync or on unmount. It
+ * applies to the modification time of writes which change nothing else
+ * too.
+ */
+void ex_set_atime_mode(enum ex_atime_mode mode, int lazytime);
+
+/** Enable compression of newly written file data, it's disabled by
+ *  default. Data are compressed by the writeback, see compress.h. */
+void ex_set_compression(int enabled);
+
+/** Enable deduplication of newly written full data blocks, it's disabled by
+ *  default. Blocks are shared by the writeback, see dedup.h. */
+void ex_set_dedup(int enabled);
+
+/** Declare that requests are processed one at a time, it's disabled by
+ *  default. Device ranges of ex_read_runs are returned only then, see
+ *  ex_read_runs. */
+void ex_set_single_threaded(int single);
+
+/** Set the format of directories which outgrow the linear format, it's one
+ *  of ex_dir_format values, see dir.h. Directories are hashed by default. */
+void ex_set_dir_format(int format);
 
 ex_status ex_init(const char *device);
 void ex_deinit(void);
@@ -17,10 +73,63 @@ int ex_create(const char *pathname, mode_t mode, gid_t gid, uid_t uid);
 int ex_getattr(const char *pathname, struct stat *st);
 int ex_unlink(const char *pathname);
 int ex_read(const char *pathname, char *buffer, size_t size, off_t offset);
+/** Resolve data of the file into ranges of the device, see ex_inode_read_runs.
+ *
+ * It returns the number of runs or negative errno. The array of runs and
+ * their `data` must be freed by the caller.
+ *
+ * Blocks may be freed or reused once the super lock is released, by other
+ * requests or by the writeback which compresses or deduplicates them. So
+ * the device ranges are returned only if requests are processed one at a
+ * time and the writeback does not move blocks. Otherwise all data are read
+ * into `data` of the runs.
+ */
+int ex_read_runs(const char *pathname, size_t amount, off_t offset,
+                 struct ex_inode_run **runs);
+/** Check whether blocks of files stay in place after the super lock is
+ *  released, until the next request, so ex_read_runs returns device
+ *  ranges rather than data. */
+int ex_read_runs_are_stable(void);
 int ex_write(const char *path, const char *buf, size_t size, off_t offset);
+/** Write data to the file, the payload is stored by the `copy` callback,
+ *  see ex_inode_write_from. */
+int ex_write_from(const char *pathname, size_t size, off_t offset,
+                  ssize_t (*copy)(const struct ex_inode_run *run, size_t pos,
+                                  void *ctx),
+                  void *ctx);
+/** Copy `size` bytes of the file `src` to the file `dst` inside the device.
+ *
+ * It returns the number of copied bytes or negative errno.
+ */
+ssize_t ex_copy_range(const char *src, off_t src_offset, const char *dst,
+                      off_t dst_offset, size_t size);
+/** Make the file `dst` a clone of the file `src`, see ex_inode_clone. */
+int ex_clone_file(const char *src, const char *dst);
+/** Find the next data or hole of the file, see ex_inode_seek.
+ *
+ * It returns the found offset or negative errno.
+ */
+off_t ex_lseek(const char *pathname, off_t off, int whence);
 int ex_open(const char *path, int mode, gid_t gid, uid_t uid);
 int ex_mkdir(const char *pathname, mode_t mode, gid_t gid, uid_t uid);
 int ex_readdir(const char *pathname, struct ex_dir_entry ***inodes);
+/** Store the number of entries of the directory to `count`.
+ *
+ * It includes "." and "..", the number is kept by the directory, so it's
+ * cheap to get before entries are read, e.g. to size a buffer for them.
+ */
+int ex_count_entries(const char *pathname, size_t *count);
+/** Pass entries of the directory from the `offset` to the `filler`.
+ *
+ * The `cursor` keeps the position between calls, so a call which continues
+ * at the offset where the previous one stopped does not read the directory
+ * from its beginning again. The offset zero opens the cursor. If `plus` is
+ * set, attributes of entries are passed too (readdirplus), their inodes
+ * are loaded during the scan instead of a lookup per entry.
+ */
+int ex_readdir_cursor(const char *pathname, struct ex_dir_cursor *cursor,
+                      off_t offset, int plus, ex_readdir_filler filler,
+                      void *ctx);
 int ex_utimens(const char *pathname, const struct timespec tv[2]);
 int ex_truncate(const char *path, off_t size);
 int ex_link(const char *src_pathname, const char *dest_pathname);
@@ -36,5 +145,7 @@ int ex_opendir(const char *path, mode_t mode, gid_t gid, uid_t uid);
 int ex_setxattr(const char* path, const char* name, const char* value, size_t valuesize, int flags);
 int ex_getxattr(const char* pathname, const char* name, void* value, size_t valuesize);
 int ex_removexattr(const char *pathname, const char *name);
+int ex_fsync(const char *pathname, int datasync);
+int ex_sync(void);
 
 #endif /* EX_H */
@@ -0,0 +1,698 @@
+#include "extent.h"
+#include "device.h"
+#include "errors.h"
+#include "logging.h"
+#include "super.h"
+
+#include <string.h>
+
+const uint16_t EX_EXTENT_MAGIC1 = 0xe7e7;
+
+/** Tree node stored in the node block. */
+struct ex_extent_node {
+    struct ex_extent_header header;
+    union {
+        struct ex_extent extents[EX_EXTENT_NODE_ENTRIES];
+        struct ex_extent_index indexes[EX_EXTENT_NODE_ENTRIES];
+    };
+};
+
+static_assert(sizeof(struct ex_extent_node) <= EX_BLOCK_SIZE,
+              "Size of the struct ex_extent_node must be less than "
+              "EX_BLOCK_SIZE");
+
+#define ex_extent_first(header) ((struct ex_extent *)((header) + 1))
+#define ex_extent_first_index(header) ((struct ex_extent_index *)((header) + 1))
+
+void ex_extent_root_init(struct ex_extent_root *root) {
+
+    memset(root, '\0', sizeof(struct ex_extent_root));
+
+    root->header.magic = EX_EXTENT_MAGIC1;
+    root->header.max = EX_EXTENT_ROOT_ENTRIES;
+}
+
+static size_t ex_extent_key(const struct ex_extent_header *header, size_t i) {
+
+    if (header->depth) {
+        return ex_extent_first_index(header)[i].logical;
+    }
+
+    return ex_extent_first(header)[i].logical;
+}
+
+/** Return the number of entries which starts at or before `logical`. */
+static size_t ex_extent_upper_bound(const struct ex_extent_header *header,
+                                    size_t logical) {
+
+    size_t lo = 0, hi = header->entries;
+
+    while (lo < hi) {
+
+        size_t mid = (lo + hi) / 2;
+
+        if (ex_extent_key(header, mid) <= logical) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static ex_status ex_extent_node_load(block_address address,
+                                     struct ex_extent_node *node) {
+
+    ex_status status = ex_device_read_to_buffer(NULL, (char *)node, address,
+                                                sizeof(struct ex_extent_node));
+
+    if (status != OK) {
+        warning("unable to read extent node at (%zu)", address);
+        return INODE_LOAD_FAILED;
+    }
+
+    if (node->header.magic != EX_EXTENT_MAGIC1 ||
+        node->header.entries > node->header.max ||
+        node->header.max != EX_EXTENT_NODE_ENTRIES) {
+        warning("extent node at (%zu) is corrupted", address);
+        return INODE_LOAD_FAILED;
+    }
+
+    return OK;
+}
+
+static ex_status ex_extent_node_flush(block_address address,
+                                      const struct ex_extent_node *node) {
+
+    ex_status status = ex_device_write(address, (const char *)node,
+                                       sizeof(struct ex_extent_node));
+
+    if (status != OK) {
+        error("unable to write extent node at (%zu)", address);
+        status = INODE_FLUSH_FAILED;
+    }
+
+    return status;
+}
+
+static ex_status ex_extent_node_allocate(block_address *address) {
+
+    struct ex_inode_block block;
+    size_t allocated = 0;
+
+    ex_status status = ex_super_allocate_data_blocks(EX_BLOCK_INVALID_ADDRESS,
+                                                     1, &block, &allocated);
+
+    if (status != OK) {
+        warning("unable to allocate extent node");
+        return INODE_BLOCK_ALLOCATION_FAILED;
+    }
+
+    *address = block.address;
+
+    return OK;
+}
+
+ex_status ex_extent_lookup(const struct ex_extent_root *root, size_t logical,
+                           struct ex_extent_mapping *mapping) {
+
+    struct ex_extent_node node;
+    const struct ex_extent_header *header = &root->header;
+
+    // the first mapped block after the `logical` one
+    size_t next = EX_EXTENT_MAX_LOGICAL;
+
+    for (size_t level = 0; header->depth; level++) {
+
+        if (!header->entries || level > EX_EXTENT_MAX_DEPTH) {
+            warning("extent tree is corrupted");
+            return INODE_LOAD_FAILED;
+        }
+
+        size_t pos = ex_extent_upper_bound(header, logical);
+
+        if (pos < header->entries && ex_extent_key(header, pos) < next) {
+            next = ex_extent_key(header, pos);
+        }
+
+        block_address child = ex_extent_first_index(header)[pos ? pos - 1 : 0].child;
+        ex_status status = ex_extent_node_load(child, &node);
+
+        if (status != OK) {
+            return status;
+        }
+
+        header = &node.header;
+    }
+
+    const struct ex_extent *extents = ex_extent_first(header);
+    size_t pos = ex_extent_upper_bound(header, logical);
+
+    if (pos && logical < (size_t)extents[pos - 1].logical +
+                             extents[pos - 1].length) {
+        mapping->logical = extents[pos - 1].logical;
+        mapping->length = extents[pos - 1].length;
+        mapping->physical = extents[pos - 1].physical;
+        mapping->flags = extents[pos - 1].flags;
+        return OK;
+    }
+
+    if (pos < header->entries && extents[pos].logical < next) {
+        next = extents[pos].logical;
+    }
+
+    mapping->logical = logical;
+    mapping->length = next > logical ? next - logical : 0;
+    mapping->physical = EX_BLOCK_INVALID_ADDRESS;
+    mapping->flags = 0;
+
+    return OK;
+}
+
+size_t ex_extent_stored_length(uint16_t flags, size_t length) {
+
+    if (flags & EX_EXTENT_COMPRESSED) {
+        return flags >> EX_EXTENT_STORED_SHIFT;
+    }
+
+    return length;
+}
+
+static int ex_extent_can_merge(const struct ex_extent *left,
+                               const struct ex_extent *right) {
+
+    if (left->flags || right->flags) {
+        return 0;
+    }
+
+    if ((size_t)left->length + right->length > EX_EXTENT_MAX_LENGTH) {
+        return 0;
+    }
+
+    return (size_t)left->logical + left->length == right->logical &&
+           left->physical + left->length * EX_BLOCK_SIZE == right->physical;
+}
+
+/** Put the entry to the position, node must have a free space. */
+static void ex_extent_put(struct ex_extent_header *header, size_t pos,
+                          const struct ex_extent *entry) {
+
+    struct ex_extent *entries = ex_extent_first(header);
+
+    memmove(&entries[pos + 1], &entries[pos],
+            (header->entries - pos) * sizeof(struct ex_extent));
+    memcpy(&entries[pos], entry, sizeof(struct ex_extent));
+
+    header->entries++;
+}
+
+static void ex_extent_remove(struct ex_extent_header *header, size_t pos) {
+
+    struct ex_extent *entries = ex_extent_first(header);
+
+    memmove(&entries[pos], &entries[pos + 1],
+            (header->entries - pos - 1) * sizeof(struct ex_extent));
+
+    header->entries--;
+}
+
+/** Move the upper half of the full node to a new node and put the entry.
+ *
+ * The index which points to the new node is stored to `split`.
+ */
+static ex_status ex_extent_split(struct ex_extent_header *header, size_t pos,
+                                 const struct ex_extent *entry,
+                                 struct ex_extent_index *split) {
+
+    block_address address;
+    ex_status status = ex_extent_node_allocate(&address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    size_t mid = header->entries / 2;
+    struct ex_extent_node right = {
+        .header = {.magic = EX_EXTENT_MAGIC1,
+                   .entries = header->entries - mid,
+                   .max = EX_EXTENT_NODE_ENTRIES,
+                   .depth = header->depth}};
+
+    memcpy(right.extents, &ex_extent_first(header)[mid],
+           right.header.entries * sizeof(struct ex_extent));
+    header->entries = mid;
+
+    if (pos <= mid) {
+        ex_extent_put(header, pos, entry);
+    } else {
+        ex_extent_put(&right.header, pos - mid, entry);
+    }
+
+    split->logical = ex_extent_key(&right.header, 0);
+    split->child = address;
+
+    return ex_extent_node_flush(address, &right);
+}
+
+/** Move entries of the full root to a new node and put the entry there.
+ *
+ * The root then contains only the index of the new node.
+ */
+static ex_status ex_extent_grow(struct ex_extent_header *root, size_t pos,
+                                const struct ex_extent *entry) {
+
+    if (root->depth >= EX_EXTENT_MAX_DEPTH) {
+        error("extent tree reached its maximum depth");
+        return INODE_BLOCK_ALLOCATION_FAILED;
+    }
+
+    block_address address;
+    ex_status status = ex_extent_node_allocate(&address);
+
+    if (status != OK) {
+        return status;
+    }
+
+    struct ex_extent_node child = {.header = {.magic = EX_EXTENT_MAGIC1,
+                                              .entries = root->entries,
+                                              .max = EX_EXTENT_NODE_ENTRIES,
+                                              .depth = root->depth}};
+
+    memcpy(child.extents, ex_extent_first(root),
+           root->entries * sizeof(struct ex_extent));
+    ex_extent_put(&child.header, pos, entry);
+
+    if ((status = ex_extent_node_flush(address, &child)) != OK) {
+        return status;
+    }
+
+    root->depth += 1;
+    root->entries = 1;
+
+    ex_extent_first_index(root)[0] = (struct ex_extent_index){
+        .logical = ex_extent_key(&child.header, 0), .child = address};
+
+    return OK;
+}
+
+static ex_status ex_extent_insert_node(struct ex_extent_header *header,
+                                       int is_root,
+                                       const struct ex_extent *extent,
+                                       struct ex_extent_index *split,
+                                       int *splitted) {
+
+    struct ex_extent entry;
+    size_t pos = ex_extent_upper_bound(header, extent->logical);
+
+    *splitted = 0;
+
+    if (!header->depth) {
+
+        struct ex_extent *extents = ex_extent_first(header);
+
+        if (pos && ex_extent_can_merge(&extents[pos - 1], extent)) {
+
+            extents[pos - 1].length += extent->length;
+
+            // the extent can fill the gap between its neighbours
+            if (pos < header->entries &&
+                ex_extent_can_merge(&extents[pos - 1], &extents[pos])) {
+                extents[pos - 1].length += extents[pos].length;
+                ex_extent_remove(header, pos);
+            }
+
+            return OK;
+        }
+
+        if (pos < header->entries &&
+            ex_extent_can_merge(extent, &extents[pos])) {
+
+            extents[pos].logical = extent->logical;
+            extents[pos].physical = extent->physical;
+            extents[pos].length += extent->length;
+
+            return OK;
+        }
+
+        entry = *extent;
+
+    } else {
+
+        struct ex_extent_index *indexes = ex_extent_first_index(header);
+        size_t idx = pos ? pos - 1 : 0;
+
+        struct ex_extent_node child;
+        ex_status status = ex_extent_node_load(indexes[idx].child, &child);
+
+        if (status != OK) {
+            return status;
+        }
+
+        struct ex_extent_index child_split;
+        int child_splitted = 0;
+
+        status = ex_extent_insert_node(&child.header, 0, extent, &child_split,
+                                       &child_splitted);
+
+        if (status != OK) {
+            return status;
+        }
+
+        if ((status = ex_extent_node_flush(indexes[idx].child, &child)) !=
+            OK) {
+            return status;
+        }
+
+        // keep the key of the index equal to the first key of the child
+        if (extent->logical < indexes[idx].logical) {
+            indexes[idx].logical = extent->logical;
+        }
+
+        if (!child_splitted) {
+            return OK;
+        }
+
+        memcpy(&entry, &child_split, sizeof(entry));
+        pos = idx + 1;
+    }
+
+    if (header->entries < header->max) {
+        ex_extent_put(header, pos, &entry);
+        return OK;
+    }
+
+    if (is_root) {
+        return ex_extent_grow(header, pos, &entry);
+    }
+
+    *splitted = 1;
+
+    return ex_extent_split(header, pos, &entry, split);
+}
+
+ex_status ex_extent_insert(struct ex_extent_root *root,
+                           const struct ex_extent *extent) {
+
+    struct ex_extent_index split;
+    int splitted = 0;
+
+    debug("mapping logical=%u, length=%u, physical=%zu", extent->logical,
+          extent->length, extent->physical);
+
+    return ex_extent_insert_node(&root->header, 1, extent, &split, &splitted);
+}
+
+/** Remove the extent which starts at the `logical` block.
+ *
+ * Child nodes which become empty are deallocated, `empty` is set when the
+ * node itself becomes empty.
+ */
+static ex_status ex_extent_delete_node(struct ex_extent_header *header,
+                                       size_t logical, int *empty) {
+
+    size_t pos = ex_extent_upper_bound(header, logical);
+
+    *empty = 0;
+
+    if (!header->depth) {
+
+        if (!pos || ex_extent_first(header)[pos - 1].logical != logical) {
+            warning("extent at logical block (%zu) not found", logical);
+            return INODE_LOAD_FAILED;
+        }
+
+        ex_extent_remove(header, pos - 1);
+        *empty = !header->entries;
+
+        return OK;
+    }
+
+    struct ex_extent_index *indexes = ex_extent_first_index(header);
+    size_t idx = pos ? pos - 1 : 0;
+
+    struct ex_extent_node child;
+    ex_status status = ex_extent_node_load(indexes[idx].child, &child);
+
+    if (status != OK) {
+        return status;
+    }
+
+    int child_empty = 0;
+
+    if ((status = ex_extent_delete_node(&child.header, logical,
+                                        &child_empty)) != OK) {
+        return status;
+    }
+
+    if (!child_empty) {
+        return ex_extent_node_flush(indexes[idx].child, &child);
+    }
+
+    ex_super_deallocate_blocks(indexes[idx].child, 1);
+
+    // index and extent entries have the same size
+    ex_extent_remove(header, idx);
+    *empty = !header->entries;
+
+    return OK;
+}
+
+ex_status ex_extent_unmap(struct ex_extent_root *root, size_t logical,
+                          size_t count, int deallocate) {
+
+    size_t end = logical + count;
+
+    while (logical < end) {
+
+        struct ex_extent_mapping mapping;
+        ex_status status = ex_extent_lookup(root, logical, &mapping);
+
+        if (status != OK) {
+            return status;
+        }
+
+        if (!mapping.length) {
+            break;
+        }
+
+        if (mapping.physical == EX_BLOCK_INVALID_ADDRESS) {
+            logical += mapping.length;
+            continue;
+        }
+
+        size_t mapping_end = mapping.logical + mapping.length;
+
+        if ((mapping.flags & EX_EXTENT_COMPRESSED) &&
+            (mapping.logical < logical || mapping_end > end)) {
+            warning("compressed extent at logical block (%zu) cannot be split",
+                    mapping.logical);
+            return INODE_LOAD_FAILED;
+        }
+
+        int empty = 0;
+
+        if ((status = ex_extent_delete_node(&root->header, mapping.logical,
+                                            &empty)) != OK) {
+            return status;
+        }
+
+        // the tree is empty, its root becomes a leaf again
+        if (empty) {
+            root->header.depth = 0;
+        }
+
+        size_t first = logical > mapping.logical ? logical : mapping.logical;
+        size_t last = mapping_end < end ? mapping_end : end;
+
+        // parts of the extent outside of the range stay mapped
+        if (mapping.logical < first) {
+            struct ex_extent head = {.logical = mapping.logical,
+                                     .length = first - mapping.logical,
+                                     .flags = mapping.flags,
+                                     .physical = mapping.physical};
+
+            if ((status = ex_extent_insert(root, &head)) != OK) {
+                return status;
+            }
+        }
+
+        if (last < mapping_end) {
+            struct ex_extent tail = {
+                .logical = last,
+                .length = mapping_end - last,
+                .flags = mapping.flags,
+                .physical = mapping.physical +
+                            (last - mapping.logical) * EX_BLOCK_SIZE};
+
+            if ((status = ex_extent_insert(root, &tail)) != OK) {
+                return status;
+            }
+        }
+
+        if (deallocate && (mapping.flags & EX_EXTENT_COMPRESSED)) {
+            ex_super_deallocate_blocks(
+                mapping.physical,
+                ex_extent_stored_length(mapping.flags, mapping.length));
+        } else if (deallocate) {
+            ex_super_deallocate_blocks(
+                mapping.physical + (first - mapping.logical) * EX_BLOCK_SIZE,
+                last - first);
+        }
+
+        logical = last;
+    }
+
+    return OK;
+}
+
+static ex_status ex_extent_set_flags_node(struct ex_extent_header *header,
+                                          uint16_t flags) {
+
+    for (size_t i = 0; i < header->entries; i++) {
+
+        if (!header->depth) {
+            ex_extent_first(header)[i].flags |= flags;
+            continue;
+        }
+
+        block_address child_address = ex_extent_first_index(header)[i].child;
+        struct ex_extent_node child;
+
+        ex_status status = ex_extent_node_load(child_address, &child);
+
+        if (status != OK) {
+            return status;
+        }
+
+        if ((status = ex_extent_set_flags_node(&child.header, flags)) != OK ||
+            (status = ex_extent_node_flush(child_address, &child)) != OK) {
+            return status;
+        }
+    }
+
+    return OK;
+}
+
+ex_status ex_extent_set_flags(struct ex_extent_root *root, uint16_t flags) {
+    return ex_extent_set_flags_node(&root->header, flags);
+}
+
+static ex_status ex_extent_add_flags_node(struct ex_extent_header *header,
+                                          size_t logical, uint16_t flags) {
+
+    size_t pos = ex_extent_upper_bound(header, logical);
+
+    if (!header->depth) {
+
+        struct ex_extent *extents = ex_extent_first(header);
+
+        if (!pos || logical >= (size_t)extents[pos - 1].logical +
+                                   extents[pos - 1].length) {
+            return INODE_LOAD_FAILED;
+        }
+
+        extents[pos - 1].flags |= flags;
+        return OK;
+    }
+
+    if (!header->entries) {
+        warning("extent tree is corrupted");
+        return INODE_LOAD_FAILED;
+    }
+
+    block_address child_address =
+        ex_extent_first_index(header)[pos ? pos - 1 : 0].child;
+    struct ex_extent_node child;
+
+    ex_status status = ex_extent_node_load(child_address, &child);
+
+    if (status != OK) {
+        return status;
+    }
+
+    if ((status = ex_extent_add_flags_node(&child.header, logical, flags)) !=
+        OK) {
+        return status;
+    }
+
+    return ex_extent_node_flush(child_address, &child);
+}
+
+ex_status ex_extent_add_flags(struct ex_extent_root *root, size_t logical,
+                              uint16_t flags) {
+    return ex_extent_add_flags_node(&root->header, logical, flags);
+}
+
+static int ex_extent_walk_node(const struct ex_extent_header *header,
+                               ex_extent_callback callback, void *ctx,
+                               ex_status *status) {
+
+    if (!header->depth) {
+
+        for (size_t i = 0; i < header->entries; i++) {
+            if (callback(&ex_extent_first(header)[i], ctx)) {
+                return 1;
+            }
+        }
+
+        return 0;
+    }
+
+    for (size_t i = 0; i < header->entries; i++) {
+
+        struct ex_extent_node child;
+
+        *status =
+            ex_extent_node_load(ex_extent_first_index(header)[i].child, &child);
+
+        if (*status != OK) {
+            return 1;
+        }
+
+        if (ex_extent_walk_node(&child.header, callback, ctx, status)) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+ex_status ex_extent_walk(const struct ex_extent_root *root,
+                         ex_extent_callback callback, void *ctx) {
+
+    ex_status status = OK;
+
+    (void)ex_extent_walk_node(&root->header, callback, ctx, &status);
+
+    return status;
+}
+
+static void ex_extent_free_node(const struct ex_extent_header *header) {
+
+    for (size_t i = 0; i < header->entries; i++) {
+
+        if (!header->depth) {
+            const struct ex_extent *extent = &ex_extent_first(header)[i];
+            ex_super_deallocate_blocks(
+                extent->physical,
+                ex_extent_stored_length(extent->flags, extent->length));
+            continue;
+        }
+
+        const struct ex_extent_index *index = &ex_extent_first_index(header)[i];
+        struct ex_extent_node child;
+
+        if (ex_extent_node_load(index->child, &child) == OK) {
+            ex_extent_free_node(&child.header);
+        }
+
+        ex_super_deallocate_blocks(index->child, 1);
+    }
+}
+
+void ex_extent_free(struct ex_extent_root *root) {
+
+    ex_extent_free_node(&root->header);
+    ex_extent_root_init(root);
+}
@@ -0,0 +1,172 @@
+/**
+ * @file extent.h
+ *
+ * This file provides the extent tree and its API. The extent tree maps
+ * logical blocks of an inode to physical blocks on the persistent storage.
+ *
+ * The root of the tree is stored directly in the inode, it can hold only
+ * a few entries. When the root is full, its entries are moved to a newly
+ * allocated node block and the root becomes an index node that points to
+ * it. Leaves contain extents, internal nodes contain indexes, both are
+ * sorted by the first logical block they cover.
+ */
+#ifndef EX_EXTENT_H
+#define EX_EXTENT_H
+
+#include "errors.h"
+#include "super.h"
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Extent node magic constant used for sanity check. */
+extern const uint16_t EX_EXTENT_MAGIC1;
+
+/** Number of entries in the root of the tree stored in the inode. */
+#define EX_EXTENT_ROOT_ENTRIES 10
+
+/** Maximum number of blocks covered by an extent. */
+#define EX_EXTENT_MAX_LENGTH UINT16_MAX
+
+/** Maximum depth of the tree. */
+#define EX_EXTENT_MAX_DEPTH 5
+
+/** Maximum number of logical blocks that can be mapped. */
+#define EX_EXTENT_MAX_LOGICAL ((size_t)UINT32_MAX)
+
+/** Blocks of the extent may be shared with other extents.
+ *
+ * It's only a hint, reference counts of the blocks must be checked.
+ */
+#define EX_EXTENT_SHARED 0x1
+
+/** The extent maps a compressed cluster, see compress.h.
+ *
+ * Its physical blocks are not mapped one by one, the whole extent must be
+ * decompressed. The number of its physical blocks is stored in the upper
+ * byte of flags, see ex_extent_stored_length.
+ */
+#define EX_EXTENT_COMPRESSED 0x2
+
+/** Shift of the number of physical blocks of a compressed extent. */
+#define EX_EXTENT_STORED_SHIFT 8
+
+/** Header of the tree node. */
+struct ex_extent_header {
+    /** Extent magic number. */
+    uint16_t magic;
+    /** Number of used entries. */
+    uint16_t entries;
+    /** Maximum number of entries. */
+    uint16_t max;
+    /** Depth of the tree under this node, leaves have zero depth. */
+    uint16_t depth;
+};
+
+/** Entry of the leaf, it maps continuous range of logical blocks. */
+struct ex_extent {
+    /** First logical block of the extent. */
+    uint32_t logical;
+    /** Number of blocks covered by the extent. */
+    uint16_t length;
+    /** Flags of the extent. */
+    uint16_t flags;
+    /** Address of the first physical block. */
+    block_address physical;
+};
+
+/** Entry of the internal node, it points to the node below. */
+struct ex_extent_index {
+    /** First logical block covered by the child node. */
+    uint32_t logical;
+    uint32_t __padding;
+    /** Address of the child node. */
+    block_address child;
+};
+
+static_assert(sizeof(struct ex_extent) == sizeof(struct ex_extent_index),
+              "Size of the leaf and the index entries must be the same");
+
+/** Number of entries in the node block. */
+#define EX_EXTENT_NODE_ENTRIES                                                 \
+    ((EX_BLOCK_SIZE - sizeof(struct ex_extent_header)) /                       \
+     sizeof(struct ex_extent))
+
+/** Root of the extent tree, it's stored in the inode. */
+struct ex_extent_root {
+    /** Header of the root node. */
+    struct ex_extent_header header;
+    union {
+        /** Extents if the root is a leaf. */
+        struct ex_extent extents[EX_EXTENT_ROOT_ENTRIES];
+        /** Indexes if the root is an internal node. */
+        struct ex_extent_index indexes[EX_EXTENT_ROOT_ENTRIES];
+    };
+};
+
+/** Result of the mapping lookup. */
+struct ex_extent_mapping {
+    /** First logical block of the mapping. */
+    size_t logical;
+    /** Number of blocks of the mapping. */
+    size_t length;
+    /** Address of the first physical block.
+     *
+     * It's EX_BLOCK_INVALID_ADDRESS if the mapping is a hole.
+     */
+    block_address physical;
+    /** Flags of the extent. */
+    uint16_t flags;
+};
+
+/** Get the number of physical blocks of the extent with `flags` which
+ *  covers `length` logical blocks. */
+size_t ex_extent_stored_length(uint16_t flags, size_t length);
+
+/** Callback used for the tree walk, non zero return value stops the walk. */
+typedef int (*ex_extent_callback)(const struct ex_extent *extent, void *ctx);
+
+/** Initialize an empty tree. */
+void ex_extent_root_init(struct ex_extent_root *root);
+
+/** Find the mapping of the logical block.
+ *
+ * If the block is mapped, the whole extent that contains it is returned.
+ * Otherwise the hole that starts at the `logical` block and ends at the
+ * next extent (or at EX_EXTENT_MAX_LOGICAL) is returned.
+ */
+ex_status ex_extent_lookup(const struct ex_extent_root *root, size_t logical,
+                           struct ex_extent_mapping *mapping);
+
+/** Map the extent, its logical blocks must not be mapped yet.
+ *
+ * The extent is merged with its neighbours when it's possible.
+ */
+ex_status ex_extent_insert(struct ex_extent_root *root,
+                           const struct ex_extent *extent);
+
+/** Unmap the logical blocks [logical, logical + count).
+ *
+ * Extents which cross the range are split, blocks of the range are
+ * deallocated if `deallocate` is set. Compressed extents cannot be split,
+ * they must be unmapped whole.
+ */
+ex_status ex_extent_unmap(struct ex_extent_root *root, size_t logical,
+                          size_t count, int deallocate);
+
+/** Add `flags` to all extents of the tree. */
+ex_status ex_extent_set_flags(struct ex_extent_root *root, uint16_t flags);
+
+/** Add `flags` to the extent which maps the `logical` block. */
+ex_status ex_extent_add_flags(struct ex_extent_root *root, size_t logical,
+                              uint16_t flags);
+
+/** Call `callback` for all extents sorted by logical blocks. */
+ex_status ex_extent_walk(const struct ex_extent_root *root,
+                         ex_extent_callback callback, void *ctx);
+
+/** Deallocate all mapped blocks and all node blocks of the tree. */
+void ex_extent_free(struct ex_extent_root *root);
+
+#endif /* EX_EXTENT_H */
@@ -0,0 +1,462 @@
+#include "icache.h"
+#include "logging.h"
+#include "super.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Cached inode, the inode must be the first member. */
+struct ex_icache_entry {
+    /** Cached inode, it's shared by all references. */
+    struct ex_inode inode;
+    /** Number of references. */
+    size_t refcount;
+    /** The inode was changed and it was not written yet. */
+    int dirty;
+    /** Only timestamps of the inode were changed (lazytime). */
+    int time_dirty;
+    /** Time when the inode became dirty (monotonic seconds). */
+    time_t dirtied_at;
+    /** The entry is in the hash table. */
+    int hashed;
+    /** Next entry in the hash table bucket. */
+    struct ex_icache_entry *next;
+    /** Neighbours in the LRU list, only entries without references are
+     *  in the list. */
+    struct ex_icache_entry *lru_prev;
+    struct ex_icache_entry *lru_next;
+    /** Neighbours in the dirty list. */
+    struct ex_icache_entry *dirty_prev;
+    struct ex_icache_entry *dirty_next;
+};
+
+static struct ex_icache_entry *buckets[EX_ICACHE_BUCKETS];
+
+/** Most recently used entry without a reference. */
+static struct ex_icache_entry *lru_head;
+/** Least recently used entry without a reference. */
+static struct ex_icache_entry *lru_tail;
+/** Number of entries in the LRU list. */
+static size_t lru_size;
+
+/** The oldest dirty entry, new dirty entries are appended to the tail. */
+static struct ex_icache_entry *dirty_head;
+static struct ex_icache_entry *dirty_tail;
+
+static struct ex_icache_stats stats;
+
+/** Writeback thread and its state. */
+static pthread_t writeback_thread;
+static pthread_mutex_t writeback_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writeback_cond = PTHREAD_COND_INITIALIZER;
+static int writeback_running;
+
+static time_t ex_icache_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static size_t ex_icache_hash(inode_address address) {
+    // fibonacci hashing, inode addresses share their low bits
+    return (size_t)(((uint64_t)address * 11400714819323198485ull) >> 32) %
+           EX_ICACHE_BUCKETS;
+}
+
+static struct ex_icache_entry *ex_icache_entry(const struct ex_inode *inode) {
+    return (struct ex_icache_entry *)inode;
+}
+
+static struct ex_icache_entry *ex_icache_lookup(inode_address address) {
+
+    struct ex_icache_entry *entry = buckets[ex_icache_hash(address)];
+
+    for (; entry; entry = entry->next) {
+        if (entry->inode.address == address) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void ex_icache_unhash(struct ex_icache_entry *entry) {
+
+    struct ex_icache_entry **link = &buckets[ex_icache_hash(entry->inode.address)];
+
+    for (; *link; link = &(*link)->next) {
+        if (*link == entry) {
+            *link = entry->next;
+            break;
+        }
+    }
+
+    entry->next = NULL;
+    entry->hashed = 0;
+    stats.cached--;
+}
+
+static void ex_icache_lru_remove(struct ex_icache_entry *entry) {
+
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head = entry->lru_next;
+    }
+
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail = entry->lru_prev;
+    }
+
+    entry->lru_prev = entry->lru_next = NULL;
+    lru_size--;
+}
+
+static void ex_icache_lru_push(struct ex_icache_entry *entry) {
+
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+
+    if (lru_head) {
+        lru_head->lru_prev = entry;
+    } else {
+        lru_tail = entry;
+    }
+
+    lru_head = entry;
+    lru_size++;
+}
+
+static void ex_icache_set_clean(struct ex_icache_entry *entry) {
+
+    entry->time_dirty = 0;
+
+    if (!entry->dirty) {
+        return;
+    }
+
+    if (entry->dirty_prev) {
+        entry->dirty_prev->dirty_next = entry->dirty_next;
+    } else {
+        dirty_head = entry->dirty_next;
+    }
+
+    if (entry->dirty_next) {
+        entry->dirty_next->dirty_prev = entry->dirty_prev;
+    } else {
+        dirty_tail = entry->dirty_prev;
+    }
+
+    entry->dirty_prev = entry->dirty_next = NULL;
+    entry->dirty = 0;
+    stats.dirty--;
+}
+
+/** Write the dirty inode, ex_inode_flush removes it from the dirty list.
+ *
+ * Its recently written data are deduplicated and compressed first, if it's
+ * enabled. */
+static void ex_icache_write(struct ex_icache_entry *entry) {
+
+    ex_inode_writeback(&entry->inode);
+
+    if (ex_inode_flush(&entry->inode) != OK) {
+        // keep the inode consistent with the cache, it's lost anyway
+        ex_icache_set_clean(entry);
+    }
+
+    stats.writebacks++;
+}
+
+/** Write the inode if it's dirty and remove it from the cache. */
+static void ex_icache_evict(struct ex_icache_entry *entry) {
+
+    if (entry->dirty || entry->time_dirty) {
+        ex_icache_write(entry);
+    }
+
+    ex_icache_lru_remove(entry);
+    ex_icache_unhash(entry);
+    free(entry);
+
+    stats.evictions++;
+}
+
+struct ex_inode *ex_icache_peek(inode_address address) {
+
+    struct ex_icache_entry *entry = ex_icache_lookup(address);
+
+    return entry ? &entry->inode : NULL;
+}
+
+struct ex_inode *ex_icache_get(inode_address address) {
+
+    struct ex_icache_entry *entry = ex_icache_lookup(address);
+
+    if (entry) {
+
+        if (!entry->refcount) {
+            ex_icache_lru_remove(entry);
+        }
+
+        entry->refcount++;
+        stats.hits++;
+
+        return &entry->inode;
+    }
+
+    stats.misses++;
+    entry = ex_malloc(sizeof(struct ex_icache_entry));
+
+    if (ex_inode_load(address, &entry->inode) != OK) {
+        free(entry);
+        return NULL;
+    }
+
+    size_t bucket = ex_icache_hash(address);
+
+    entry->refcount = 1;
+    entry->dirty = 0;
+    entry->time_dirty = 0;
+    entry->dirtied_at = 0;
+    entry->hashed = 1;
+    entry->next = buckets[bucket];
+    entry->lru_prev = entry->lru_next = NULL;
+    entry->dirty_prev = entry->dirty_next = NULL;
+
+    buckets[bucket] = entry;
+    stats.cached++;
+
+    return &entry->inode;
+}
+
+void ex_icache_put(struct ex_inode *inode) {
+
+    if (!inode) {
+        return;
+    }
+
+    struct ex_icache_entry *entry = ex_icache_entry(inode);
+
+    if (--entry->refcount) {
+        return;
+    }
+
+    // the inode was dropped from the cache while it was referenced
+    if (!entry->hashed) {
+        free(entry);
+        return;
+    }
+
+    ex_icache_lru_push(entry);
+
+    while (lru_size > EX_ICACHE_MAX_UNUSED) {
+        ex_icache_evict(lru_tail);
+    }
+}
+
+int ex_icache_mark_dirty(struct ex_inode *inode) {
+
+    struct ex_icache_entry *entry = ex_icache_lookup(inode->address);
+
+    if (!entry || &entry->inode != inode) {
+        return 0;
+    }
+
+    if (entry->dirty) {
+        return 1;
+    }
+
+    entry->dirty = 1;
+    entry->dirtied_at = ex_icache_now();
+
+    entry->dirty_next = NULL;
+    entry->dirty_prev = dirty_tail;
+
+    if (dirty_tail) {
+        dirty_tail->dirty_next = entry;
+    } else {
+        dirty_head = entry;
+    }
+
+    dirty_tail = entry;
+    stats.dirty++;
+
+    return 1;
+}
+
+int ex_icache_mark_time_dirty(struct ex_inode *inode) {
+
+    struct ex_icache_entry *entry = ex_icache_lookup(inode->address);
+
+    if (!entry || &entry->inode != inode) {
+        return 0;
+    }
+
+    entry->time_dirty = 1;
+
+    return 1;
+}
+
+void ex_icache_update(const struct ex_inode *inode) {
+
+    struct ex_icache_entry *entry = ex_icache_lookup(inode->address);
+
+    if (!entry) {
+        return;
+    }
+
+    if (&entry->inode != inode) {
+        ex_inode_copy_noalloc(inode, &entry->inode);
+    }
+
+    ex_icache_set_clean(entry);
+}
+
+void ex_icache_forget(inode_address address) {
+
+    struct ex_icache_entry *entry = ex_icache_lookup(address);
+
+    if (!entry) {
+        return;
+    }
+
+    ex_icache_set_clean(entry);
+
+    if (entry->refcount) {
+        ex_icache_unhash(entry);
+        return;
+    }
+
+    ex_icache_lru_remove(entry);
+    ex_icache_unhash(entry);
+    free(entry);
+}
+
+void ex_icache_sync(void) {
+
+    while (dirty_head) {
+        ex_icache_write(dirty_head);
+    }
+
+    // inodes with dirty timestamps are not in the dirty list
+    for (size_t i = 0; i < EX_ICACHE_BUCKETS; i++) {
+
+        struct ex_icache_entry *entry = buckets[i];
+
+        for (; entry; entry = entry->next) {
+            if (entry->time_dirty) {
+                ex_icache_write(entry);
+            }
+        }
+    }
+}
+
+void ex_icache_writeback(void) {
+
+    time_t now = ex_icache_now();
+
+    // the dirty list is sorted by the time when inodes became dirty
+    while (dirty_head &&
+           now - dirty_head->dirtied_at >= EX_ICACHE_WRITEBACK_INTERVAL) {
+        ex_icache_write(dirty_head);
+    }
+}
+
+static void *ex_icache_writeback_worker(void *arg) {
+
+    (void)arg;
+
+    pthread_mutex_lock(&writeback_lock);
+
+    while (writeback_running) {
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += EX_ICACHE_WRITEBACK_INTERVAL;
+
+        pthread_cond_timedwait(&writeback_cond, &writeback_lock, &deadline);
+
+        if (!writeback_running) {
+            break;
+        }
+
+        pthread_mutex_unlock(&writeback_lock);
+
+        ex_super_lock();
+        ex_icache_writeback();
+        ex_super_unlock();
+
+        pthread_mutex_lock(&writeback_lock);
+    }
+
+    pthread_mutex_unlock(&writeback_lock);
+
+    return NULL;
+}
+
+void ex_icache_start_writeback(void) {
+
+    pthread_mutex_lock(&writeback_lock);
+
+    if (!writeback_running) {
+        writeback_running = 1;
+
+        if (pthread_create(&writeback_thread, NULL, ex_icache_writeback_worker,
+                           NULL)) {
+            warning("unable to start the writeback thread");
+            writeback_running = 0;
+        }
+    }
+
+    pthread_mutex_unlock(&writeback_lock);
+}
+
+void ex_icache_stop_writeback(void) {
+
+    pthread_mutex_lock(&writeback_lock);
+
+    if (!writeback_running) {
+        pthread_mutex_unlock(&writeback_lock);
+        return;
+    }
+
+    writeback_running = 0;
+    pthread_cond_signal(&writeback_cond);
+    pthread_mutex_unlock(&writeback_lock);
+
+    pthread_join(writeback_thread, NULL);
+}
+
+void ex_icache_clear(void) {
+
+    ex_icache_sync();
+
+    for (size_t i = 0; i < EX_ICACHE_BUCKETS; i++) {
+
+        while (buckets[i]) {
+
+            struct ex_icache_entry *entry = buckets[i];
+
+            if (entry->refcount) {
+                warning("inode (%lu) is still referenced", entry->inode.number);
+                ex_icache_unhash(entry);
+                continue;
+            }
+
+            ex_icache_lru_remove(entry);
+            ex_icache_unhash(entry);
+            free(entry);
+        }
+    }
+
+    memset(&stats, '\0', sizeof(stats));
+}
+
+void ex_icache_get_stats(struct ex_icache_stats *result) { *result = stats; }
@@ -0,0 +1,110 @@
+/**
+ * @file icache.h
+ *
+ * This file provides the in-memory inode cache and its API.
+ *
+ * Cached inodes are keyed by their address and shared by all users, every
+ * user holds a reference. Inodes without references stay cached in the LRU
+ * list and the least recently used ones are evicted when the list is full.
+ * Dirty inodes are written before they are evicted.
+ *
+ * The cache is not thread safe on its own, it relies on the super lock.
+ */
+#ifndef EX_ICACHE_H
+#define EX_ICACHE_H
+
+#include "errors.h"
+#include "inode.h"
+
+#include <stddef.h>
+
+/** Number of buckets of the hash table. */
+#define EX_ICACHE_BUCKETS 1024
+
+/** Maximum number of cached inodes without a reference. */
+#define EX_ICACHE_MAX_UNUSED 1024
+
+/** Dirty inodes older than this are written by the writeback (seconds). */
+#define EX_ICACHE_WRITEBACK_INTERVAL 5
+
+/** Statistics of the inode cache. */
+struct ex_icache_stats {
+    /** Number of lookups served from the cache. */
+    size_t hits;
+    /** Number of lookups which had to load an inode. */
+    size_t misses;
+    /** Number of evicted inodes. */
+    size_t evictions;
+    /** Number of currently cached inodes. */
+    size_t cached;
+    /** Number of currently dirty inodes. */
+    size_t dirty;
+    /** Number of dirty inodes written by the cache. */
+    size_t writebacks;
+};
+
+/** Get a reference to the inode at the `address`.
+ *
+ * The inode is loaded when it is not cached, NULL is returned if it cannot
+ * be loaded. The reference must be released by ex_icache_put.
+ */
+struct ex_inode *ex_icache_get(inode_address address);
+
+/** Get the cached inode at the `address` without taking a reference.
+ *
+ * NULL is returned if the inode is not cached. The inode must not be used
+ * after the super lock is released.
+ */
+struct ex_inode *ex_icache_peek(inode_address address);
+
+/** Release the reference to the cached inode, NULL is ignored. */
+void ex_icache_put(struct ex_inode *inode);
+
+/** Mark the cached inode dirty.
+ *
+ * Dirty inodes are kept in the dirty list, repeated changes are written
+ * once by the writeback, on sync or before the inode is evicted. It returns
+ * zero if the inode is not owned by the cache, such inode is not marked.
+ */
+int ex_icache_mark_dirty(struct ex_inode *inode);
+
+/** Mark timestamps of the cached inode dirty.
+ *
+ * Such inode is not written by the writeback, it's written with its next
+ * change, on sync or before it's evicted. It returns zero if the inode is
+ * not owned by the cache, such inode is not marked.
+ */
+int ex_icache_mark_time_dirty(struct ex_inode *inode);
+
+/** Synchronize the cache with the inode that was just written.
+ *
+ * If the inode is a different copy than the cached one, the cached one is
+ * updated. In both cases the cached inode is not dirty anymore.
+ */
+void ex_icache_update(const struct ex_inode *inode);
+
+/** Drop the inode from the cache, it's used when the inode is deallocated.
+ *
+ * Existing references stay valid until they are released.
+ */
+void ex_icache_forget(inode_address address);
+
+/** Write all dirty inodes, including inodes with dirty timestamps. */
+void ex_icache_sync(void);
+
+/** Write dirty inodes which are dirty longer than the writeback interval. */
+void ex_icache_writeback(void);
+
+/** Start the thread that periodically calls ex_icache_writeback. */
+void ex_icache_start_writeback(void);
+
+/** Stop the writeback thread. */
+void ex_icache_stop_writeback(void);
+
+/** Write all dirty inodes and drop all inodes from the cache. */
+void ex_icache_clear(void);
+
+/** Get statistics of the cache. */
+void ex_icache_get_stats(struct ex_icache_stats *stats);
+
+#endif /* EX_ICACHE_H */
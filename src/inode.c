@@ -1,8 +1,14 @@
+#define _GNU_SOURCE
+#include "compress.h"
+#include "dcache.h"
+#include "dedup.h"
+#include "dir.h"
 #include "device.h"
 #include "errors.h"
 #include "logging.h"
 #include "util.h"
 #include "inode.h"
+#include "icache.h"
 #include <errno.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -35,6 +41,60 @@ ex_status ex_root_create(void) {
                            sizeof(struct ex_super_block));
 }
 
+/** Drop all cached mappings of the inode. */
+static void ex_inode_forget_mappings(struct ex_inode *inode) {
+    memset(&inode->mappings, '\0', sizeof(inode->mappings));
+}
+
+/** Find the mapping of the `logical` block, see ex_extent_lookup.
+ *
+ * Recently resolved mappings are served from the inode mapping cache.
+ */
+static ex_status ex_inode_map(struct ex_inode *inode, size_t logical,
+                              struct ex_extent_mapping *mapping) {
+
+    struct ex_inode_mappings *cache = &inode->mappings;
+
+    for (size_t i = 0; i < EX_INODE_MAPPINGS; i++) {
+
+        const struct ex_extent_mapping *entry = &cache->entries[i];
+
+        if (entry->length && logical >= entry->logical &&
+            logical - entry->logical < entry->length) {
+            *mapping = *entry;
+            return OK;
+        }
+    }
+
+    ex_status status = ex_extent_lookup(&inode->extents, logical, mapping);
+
+    if (status == OK && mapping->length) {
+        cache->entries[cache->next] = *mapping;
+        cache->next = (cache->next + 1) % EX_INODE_MAPPINGS;
+    }
+
+    return status;
+}
+
+block_address ex_inode_block_address(struct ex_inode *inode, size_t logical) {
+
+    struct ex_extent_mapping mapping;
+
+    if (ex_inode_map(inode, logical, &mapping) != OK ||
+        mapping.physical == EX_BLOCK_INVALID_ADDRESS) {
+        return EX_BLOCK_INVALID_ADDRESS;
+    }
+
+    return mapping.physical + (logical - mapping.logical) * EX_BLOCK_SIZE;
+}
+
+void ex_inode_set_blocks(struct ex_inode *inode,
+                         const struct ex_extent_root *extents) {
+
+    inode->extents = *extents;
+    ex_inode_forget_mappings(inode);
+}
+
 void ex_inode_copy_noalloc(const struct ex_inode *src, struct ex_inode *dest) {
 
     dest->number = src->number;
@@ -52,15 +112,18 @@ void ex_inode_copy_noalloc(const struct ex_inode *src, struct ex_inode *dest) {
     dest->gid = src->gid;
     dest->uid = src->uid;
 
-    for (size_t i = 0; i < EX_DIRECT_BLOCKS; i++) {
-        dest->blocks[i] = src->blocks[i];
-    }
+    dest->flags = src->flags;
+    dest->dir_free = src->dir_free;
+    memcpy(dest->data, src->data, EX_INODE_INLINE_DATA_SIZE);
 
-    memcpy(dest->attributes,
-           src->attributes,
-           src->number_of_attributes * EX_INODE_ATTRIBUTE_SIZE);
+    // attributes can use any slot, so all slots are copied
+    memcpy(dest->attributes, src->attributes, EX_INODE_ATTRIBUTES_SIZE);
 
     dest->number_of_attributes = src->number_of_attributes;
+    dest->xattr_block = src->xattr_block;
+
+    // the extent tree of `dest` may have changed
+    ex_inode_forget_mappings(dest);
 }
 
 ex_status ex_root_load(struct ex_inode *root) {
@@ -85,45 +148,23 @@ done:
     return status;
 }
 
-ex_status ex_inode_allocate_blocks(struct ex_inode *inode) {
-
-    ex_status status = OK;
-
-    debug("allocating blocks for inode (%lu)", inode->number);
-
-    for (size_t i = 0; i < EX_DIRECT_BLOCKS; i++) {
-
-        struct ex_inode_block block;
-
-        if ((status = ex_super_allocate_data_block(&block)) != OK) {
-            warning("failing to allocate nth (%lu) block", i);
-            goto done;
-        }
+void ex_inode_deallocate_blocks(struct ex_inode *inode) {
 
-        inode->blocks[i] = block.address;
+    if (!(inode->flags & EX_INODE_INLINE_DATA)) {
+        ex_extent_free(&inode->extents);
+        ex_inode_forget_mappings(inode);
     }
 
-done:
-
-    // we are unable to allocate next block, we should deallocate all
-    // already allocated blocks
-    if (status != OK) {
-        ex_inode_deallocate_blocks(inode);
-        status = INODE_BLOCK_ALLOCATION_FAILED;
+    if (inode->xattr_block) {
+        ex_super_deallocate_block(inode->xattr_block);
     }
 
-    return status;
-}
-
-void ex_inode_deallocate_blocks(struct ex_inode *inode) {
-
-    for (size_t i = 0; i < EX_DIRECT_BLOCKS; i++) {
-
-        if (inode->blocks[i] == EX_BLOCK_INVALID_ADDRESS) {
-            break;
-        }
+    ex_icache_forget(inode->address);
 
-        ex_super_deallocate_block(inode->blocks[i]);
+    // other entries of the removed directory were removed already
+    if (S_ISDIR(inode->mode)) {
+        ex_dcache_remove(inode->address, ".");
+        ex_dcache_remove(inode->address, "..");
     }
 
     ex_super_deallocate_inode_block(inode->number);
@@ -131,6 +172,8 @@ void ex_inode_deallocate_blocks(struct ex_inode *inode) {
 
 void ex_inode_free(struct ex_inode *inode) { free(inode); }
 
+void ex_inode_put(struct ex_inode *inode) { ex_icache_put(inode); }
+
 void ex_inode_print(const struct ex_inode *inode) {
 
     info("number: %lu", inode->number);
@@ -148,14 +191,137 @@ void ex_inode_print(const struct ex_inode *inode) {
     info("ctime: %ld.%.9ld", inode->mtime.tv_sec, inode->mtime.tv_nsec);
 }
 
+/** Convert the inode to its on-disk representation. */
+static void ex_inode_to_disk(const struct ex_inode *inode,
+                             struct ex_disk_inode *disk) {
+
+    memset(disk, '\0', sizeof(struct ex_disk_inode));
+
+    disk->magic = inode->magic;
+    disk->version = EX_INODE_VERSION;
+    disk->number_of_attributes = inode->number_of_attributes;
+    disk->number = inode->number;
+    disk->mode = inode->mode;
+    disk->uid = inode->uid;
+    disk->gid = inode->gid;
+    disk->nlinks = inode->nlinks;
+    disk->flags = inode->flags;
+    disk->dir_free = inode->dir_free;
+    disk->size = inode->size;
+
+    disk->mtime_sec = inode->mtime.tv_sec;
+    disk->mtime_nsec = inode->mtime.tv_nsec;
+    disk->atime_sec = inode->atime.tv_sec;
+    disk->atime_nsec = inode->atime.tv_nsec;
+    disk->ctime_sec = inode->ctime.tv_sec;
+    disk->ctime_nsec = inode->ctime.tv_nsec;
+
+    disk->xattr_block = inode->xattr_block;
+    memcpy(disk->data, inode->data, EX_INODE_INLINE_DATA_SIZE);
+}
+
+/** Convert the on-disk inode loaded from `address` to the inode. */
+static void ex_inode_from_disk(const struct ex_disk_inode *disk,
+                               inode_address address, struct ex_inode *inode) {
+
+    inode->number = disk->number;
+    inode->address = address;
+    inode->magic = disk->magic;
+    inode->number_of_attributes = disk->number_of_attributes;
+    inode->mode = disk->mode;
+    inode->uid = disk->uid;
+    inode->gid = disk->gid;
+    inode->nlinks = disk->nlinks;
+    inode->flags = disk->flags;
+    inode->dir_free = disk->dir_free;
+    inode->size = disk->size;
+
+    inode->mtime.tv_sec = disk->mtime_sec;
+    inode->mtime.tv_nsec = disk->mtime_nsec;
+    inode->atime.tv_sec = disk->atime_sec;
+    inode->atime.tv_nsec = disk->atime_nsec;
+    inode->ctime.tv_sec = disk->ctime_sec;
+    inode->ctime.tv_nsec = disk->ctime_nsec;
+
+    inode->xattr_block = disk->xattr_block;
+    memcpy(inode->data, disk->data, EX_INODE_INLINE_DATA_SIZE);
+
+    ex_inode_forget_mappings(inode);
+    inode->writeback_first = inode->writeback_end = 0;
+}
+
+/** Write extended attributes of the inode to its attribute block.
+ *
+ * The block is allocated with the first attribute and deallocated when
+ * the last one is removed, the inode itself is not flushed.
+ */
+static ex_status ex_inode_flush_xattrs(struct ex_inode *inode) {
+
+    if (!inode->number_of_attributes) {
+
+        if (inode->xattr_block) {
+            ex_super_deallocate_block(inode->xattr_block);
+            inode->xattr_block = 0;
+        }
+
+        return OK;
+    }
+
+    if (!inode->xattr_block) {
+
+        struct ex_inode_block block;
+        size_t allocated = 0;
+
+        ex_status status = ex_super_allocate_data_blocks(
+            EX_BLOCK_INVALID_ADDRESS, 1, &block, &allocated);
+
+        if (status != OK) {
+            return status;
+        }
+
+        inode->xattr_block = block.address;
+    }
+
+    return ex_device_write(inode->xattr_block, inode->attributes,
+                           EX_INODE_ATTRIBUTES_SIZE);
+}
+
+ex_status ex_inode_mark_dirty(struct ex_inode *inode) {
+
+    // only cached inodes can be written later
+    if (!ex_icache_mark_dirty(inode)) {
+        return ex_inode_flush(inode);
+    }
+
+    return OK;
+}
+
+static int lazytime;
+
+void ex_inode_set_lazytime(int enabled) { lazytime = enabled; }
+
+ex_status ex_inode_mark_time_dirty(struct ex_inode *inode) {
+
+    if (!ex_icache_mark_time_dirty(inode)) {
+        return ex_inode_flush(inode);
+    }
+
+    return OK;
+}
+
 ex_status ex_inode_flush(const struct ex_inode *inode) {
 
+    struct ex_disk_inode disk;
+    ex_inode_to_disk(inode, &disk);
+
     ex_status status =
-        ex_device_write(inode->address, (void *)inode, sizeof(struct ex_inode));
+        ex_device_write(inode->address, (void *)&disk, sizeof(disk));
 
     if (status != OK) {
         error("inode (%lu) flush failed", inode->number);
         status = INODE_FLUSH_FAILED;
+    } else {
+        ex_icache_update(inode);
     }
 
     return status;
@@ -180,15 +346,15 @@ struct ex_inode *ex_copy_inode(const struct ex_inode *inode) {
     copy->gid = inode->gid;
     copy->uid = inode->uid;
 
-    for (size_t i = 0; i < EX_DIRECT_BLOCKS; i++) {
-        copy->blocks[i] = inode->blocks[i];
-    }
+    copy->flags = inode->flags;
+    copy->dir_free = inode->dir_free;
+    memcpy(copy->data, inode->data, EX_INODE_INLINE_DATA_SIZE);
 
-    memcpy(copy->attributes,
-           inode->attributes,
-           inode->number_of_attributes * EX_INODE_ATTRIBUTE_SIZE);
+    // attributes can use any slot, so all slots are copied
+    memcpy(copy->attributes, inode->attributes, EX_INODE_ATTRIBUTES_SIZE);
 
     copy->number_of_attributes = inode->number_of_attributes;
+    copy->xattr_block = inode->xattr_block;
 
     return copy;
 }
@@ -223,7 +389,8 @@ ex_status ex_inode_create(struct ex_inode *inode, uint16_t mode, gid_t gid,
     inode->uid = uid;
 
     if (mode & S_IFDIR) {
-        inode->size = sizeof(struct ex_inode);
+        // grows with entries, starting by "." and ".."
+        inode->size = 0;
         inode->nlinks = 2;
     } else {
         inode->size = 0;
@@ -232,18 +399,27 @@ ex_status ex_inode_create(struct ex_inode *inode, uint16_t mode, gid_t gid,
 
     memset(inode->attributes, '\0', EX_INODE_ATTRIBUTES_SIZE);
     inode->number_of_attributes = 0;
+    inode->dir_free = 0;
+    inode->xattr_block = 0;
 
-    if (ex_inode_allocate_blocks(inode) != OK) {
-        goto free_inode_block;
+    // directories always use blocks, other inodes start with inline data
+    if (mode & S_IFDIR) {
+        inode->flags = 0;
+        ex_extent_root_init(&inode->extents);
+        inode->dir_blocks = 0;
+        inode->dir_entries = 0;
+    } else {
+        inode->flags = EX_INODE_INLINE_DATA;
+        memset(inode->data, '\0', EX_INODE_INLINE_DATA_SIZE);
     }
 
+    ex_inode_forget_mappings(inode);
+    inode->writeback_first = inode->writeback_end = 0;
+
     ex_inode_flush(inode);
 
     return OK;
 
-free_inode_block:
-    ex_super_deallocate_inode_block(block.address);
-
 inode_creation_failed:
 
     error("unable to create an inode");
@@ -251,34 +427,43 @@ inode_creation_failed:
     return INODE_CREATION_FAILED;
 }
 
-size_t ex_inode_find_free_entry_address(struct ex_inode *dir) {
+block_address ex_inode_grow_dir(struct ex_inode *dir, size_t nblocks) {
+
+    if (nblocks >= ex_inode_max_blocks()) {
+        return EX_BLOCK_INVALID_ADDRESS;
+    }
 
-    size_t address = 0;
+    struct ex_extent_mapping last = {.physical = EX_BLOCK_INVALID_ADDRESS};
 
-    foreach_inode_block(dir, block) {
-        foreach_block_entry(block, entry) {
+    if (nblocks) {
+        (void)ex_inode_map(dir, nblocks - 1, &last);
+    }
 
-            debug("free=%i, magic=%x, blockaddr=%lu", entry.free, entry.magic,
-                  block.address);
+    block_address goal = EX_BLOCK_INVALID_ADDRESS;
 
-            if (!entry.free && entry.magic != EX_ENTRY_MAGIC1) {
-                continue;
-            }
+    if (last.physical != EX_BLOCK_INVALID_ADDRESS) {
+        goal = last.physical + last.length * EX_BLOCK_SIZE;
+    }
 
-            debug("finded: block=%ld, i=%ld", block_iterator.block_number,
-                  entry_iterator.entry_number);
+    struct ex_inode_block block;
+    size_t allocated = 0;
+
+    if (ex_super_allocate_data_blocks(goal, 1, &block, &allocated) != OK) {
+        return EX_BLOCK_INVALID_ADDRESS;
+    }
 
-            address = block.address + (entry_iterator.entry_number *
-                                       sizeof(struct ex_dir_entry));
+    struct ex_extent extent = {
+        .logical = nblocks, .length = 1, .physical = block.address};
 
-            goto found;
-        }
+    if (ex_super_init_block(block.address, EX_ENTRY_MAGIC1) != OK ||
+        ex_extent_insert(&dir->extents, &extent) != OK) {
+        ex_super_deallocate_blocks(block.address, 1);
+        return EX_BLOCK_INVALID_ADDRESS;
     }
 
-found:
-    foreach_inode_block_cleanup(dir, block);
+    ex_inode_forget_mappings(dir);
 
-    return address;
+    return block.address;
 }
 
 void ex_inode_entry_update(size_t address, const char *name,
@@ -286,11 +471,13 @@ void ex_inode_entry_update(size_t address, const char *name,
 
     struct ex_dir_entry entry;
 
+    memset(&entry, '\0', sizeof(entry));
+
     entry.free = free;
     entry.address = inode_address;
     entry.magic = EX_DIR_MAGIC1;
 
-    strncpy(entry.name, name, EX_NAME_LEN);
+    strncpy(entry.name, name, EX_NAME_LEN - 1);
 
     debug("updating dir entry: address=%ld, name=%s", address, name);
 
@@ -301,14 +488,11 @@ struct ex_inode *ex_inode_set(struct ex_inode *dir, const char *name,
                               struct ex_inode *inode) {
 
     // XXX: we should check if `name' is not present in a `dir`
-    size_t entry_address = ex_inode_find_free_entry_address(dir);
-
-    if (!entry_address) {
+    if (ex_dir_insert(dir, name, inode->address) != OK) {
         info("unable to find space for inode in dirinode");
         return NULL;
     }
 
-    ex_inode_entry_update(entry_address, name, inode->address, 0);
     ex_inode_flush(inode);
 
     return inode;
@@ -316,25 +500,49 @@ struct ex_inode *ex_inode_set(struct ex_inode *dir, const char *name,
 
 ex_status ex_inode_load(inode_address address, struct ex_inode *inode) {
 
-    ex_status status = ex_device_read_to_buffer(NULL, (char *)inode, address,
-                                                sizeof(struct ex_inode));
+    struct ex_disk_inode disk;
+
+    ex_status status = ex_device_read_to_buffer(NULL, (char *)&disk, address,
+                                                sizeof(disk));
 
     if (status != OK) {
         warning("unable to read inode at (%zu)", address);
         goto error;
     }
 
-    if (inode->magic != EX_INODE_MAGIC1) {
-        warning("inode at (%zu) has bad magic (%x)", address, inode->magic);
+    if (disk.magic != EX_INODE_MAGIC1) {
+        warning("inode at (%zu) has bad magic (%x)", address, disk.magic);
+        goto error;
+    }
+
+    if (disk.version != EX_INODE_VERSION) {
+        warning("inode at (%zu) has unsupported version (%u)", address,
+                disk.version);
         goto error;
     }
 
-    if (inode->number_of_attributes > EX_INODE_MAX_ATTRIBUTES) {
+    if (disk.number_of_attributes > EX_INODE_MAX_ATTRIBUTES) {
         warning("inode at (%zu) has number of attributes higher than maximum (%u)",
                 address, EX_INODE_MAX_ATTRIBUTES);
         goto error;
     }
 
+    ex_inode_from_disk(&disk, address, inode);
+
+    if (!inode->xattr_block) {
+        memset(inode->attributes, '\0', EX_INODE_ATTRIBUTES_SIZE);
+        return OK;
+    }
+
+    status = ex_device_read_to_buffer(NULL, inode->attributes,
+                                      inode->xattr_block,
+                                      EX_INODE_ATTRIBUTES_SIZE);
+
+    if (status != OK) {
+        warning("unable to read attributes of inode at (%zu)", address);
+        goto error;
+    }
+
     return OK;
 
 error:
@@ -343,9 +551,14 @@ error:
 
 struct ex_inode *ex_inode_find(struct ex_path *path) {
 
-    struct ex_inode *root = ex_malloc(sizeof(struct ex_inode));
+    if (!super_block) {
+        error("Unable to search for inode, because super block is not loaded");
+        return NULL;
+    }
+
+    struct ex_inode *root = ex_icache_get(super_block->root);
 
-    if (ex_root_load(root) != OK) {
+    if (!root) {
         error("Unable to search for inode, because root cannot be loaded");
         return NULL;
     }
@@ -375,7 +588,7 @@ struct ex_inode *ex_inode_find(struct ex_path *path) {
         }
 
         debug("set current to %zu", current->number);
-        ex_inode_free(current);
+        ex_inode_put(current);
         current = next;
 
     }
@@ -383,7 +596,7 @@ struct ex_inode *ex_inode_find(struct ex_path *path) {
     return current;
 
 not_found:
-    ex_inode_free(current);
+    ex_inode_put(current);
 
     return NULL;
 }
@@ -395,60 +608,40 @@ struct ex_inode *ex_inode_get(struct ex_inode *dir, const char *name) {
         return NULL;
     }
 
-    struct ex_inode inode;
-    ex_status status = OK;
-
-    foreach_inode_block(dir, block) {
-        foreach_block_entry(block, entry) {
-
-            if (entry.free || entry.magic != EX_DIR_MAGIC1) {
-                continue;
-            }
+    struct ex_dir_entry entry;
+    struct ex_inode *inode = NULL;
+    inode_address address;
 
-            if (strcmp(entry.name, name)) {
-                continue;
-            }
+    if (!ex_dcache_lookup(dir->address, name, &address)) {
 
-            if ((status = ex_inode_load(entry.address, &inode)) != OK) {
-                error("unable to load inode at: %lu", entry.address);
-            }
+        ex_status status = ex_dir_lookup(dir, name, &entry, NULL);
 
-            goto finded;
+        // a failed read says nothing about the name, it's not cached
+        if (status != OK && status != INODE_NOT_FOUND) {
+            warning("unable to look up %s in directory (%zu)", name,
+                    dir->address);
+            return NULL;
         }
-    }
 
-    status = INODE_NOT_FOUND;
-    debug("inode=%ld does not contain=%s", dir->address, name);
-
-finded:
-    foreach_inode_block_cleanup(dir, block);
+        address = status == OK ? entry.address : EX_DCACHE_NEGATIVE;
+        ex_dcache_add(dir->address, name, address);
+    }
 
-    if (status == OK) {
-        return ex_copy_inode(&inode);
-    } else {
+    if (address == EX_DCACHE_NEGATIVE) {
+        debug("inode=%ld does not contain=%s", dir->address, name);
         return NULL;
     }
-}
-
-int ex_dir_is_empty(struct ex_inode *inode) {
-
-    struct ex_dir_entry **entries = ex_inode_get_all(inode);
-    size_t entries_count = 0;
 
-    for (; entries[entries_count] && entries_count <= 3; entries_count++)
-        ;
-
-    for (size_t i = 0; entries[i]; i++) {
-        free(entries[i]);
+    if (!(inode = ex_icache_get(address))) {
+        error("unable to load inode at: %lu", address);
     }
 
-    free(entries);
+    return inode;
+}
 
-    if (entries_count < 3) {
-        return 1;
-    } else {
-        return 0;
-    }
+int ex_dir_is_empty(struct ex_inode *inode) {
+    // only "." and ".." are left
+    return ex_dir_count_entries(inode) <= 2;
 }
 
 int ex_inode_is_unlinkable(struct ex_inode *inode) {
@@ -465,41 +658,6 @@ int ex_inode_is_unlinkable(struct ex_inode *inode) {
     return 0;
 }
 
-size_t ex_inode_find_entry_address(struct ex_inode *dir, const char *name) {
-
-    size_t address = 0;
-
-    foreach_inode_block(dir, block) {
-        foreach_block_entry(block, entry) {
-
-            debug("free=%i, magic=%i, name=%s", entry.free, entry.magic,
-                  entry.name);
-
-            if (entry.magic == EX_ENTRY_MAGIC1) {
-                goto not_found;
-            }
-
-            if (strcmp(name, entry.name)) {
-                continue;
-            }
-
-            debug("finded: block=%ld, i=%ld", block_iterator.block_number,
-                  entry_iterator.entry_number);
-
-            address = block.address + (entry_iterator.entry_number *
-                                       sizeof(struct ex_dir_entry));
-
-            goto found;
-        }
-    }
-
-not_found:
-found:
-    foreach_inode_block_cleanup(dir, block);
-
-    return address;
-}
-
 void ex_dir_entry_flush(size_t address, struct ex_dir_entry *entry) {
     ex_device_write(address, (void *)entry, sizeof(struct ex_dir_entry));
 }
@@ -513,46 +671,62 @@ struct ex_dir_entry *ex_dir_entry_load(size_t address) {
 
 void ex_dir_entry_free(struct ex_dir_entry *entry) { free(entry); }
 
+void ex_inode_link_dir(struct ex_inode *dir, int delta) {
+
+    if (delta < 0 && dir->nlinks <= 2) {
+        warning("directory (%zu) has no subdirectory to unlink",
+                dir->address);
+        return;
+    }
+
+    dir->nlinks += delta;
+
+    ex_inode_flush(dir);
+}
+
 ex_status ex_inode_unlink(struct ex_inode *dir, const char *name) {
 
     debug("trying to unlink %s from %zu", name, dir->address);
 
-    // XXX: do some checks
-    size_t entry_address = ex_inode_find_entry_address(dir, name);
-    struct ex_dir_entry *entry = ex_dir_entry_load(entry_address);
+    struct ex_dir_entry entry;
+
+    if (ex_dir_lookup(dir, name, &entry, NULL) != OK) {
+        debug("directory (%zu) does not contain %s", dir->address, name);
+        return INODE_NOT_FOUND;
+    }
 
-    struct ex_inode inode;
     ex_status status = OK;
+    struct ex_inode *inode = ex_icache_get(entry.address);
 
-    if ((status = ex_inode_load(entry->address, &inode)) != OK) {
-        error("unable to load inode from: %lu", entry->address);
-        goto done;
+    if (!inode) {
+        error("unable to load inode from: %lu", entry.address);
+        return INODE_LOAD_FAILED;
     }
 
-    if (!ex_inode_is_unlinkable(&inode)) {
-        debug("inode (%lu) is not unlinkable", inode.address);
+    if (!ex_inode_is_unlinkable(inode)) {
+        debug("inode (%lu) is not unlinkable", inode->address);
         status = INODE_IS_NOT_UNLINKABLE;
         goto done;
     }
 
-    if (inode.mode & S_IFDIR) {
-        inode.nlinks -= 2;
+    if (inode->mode & S_IFDIR) {
+        // the entry and "." of the empty directory
+        inode->nlinks = 0;
+        ex_inode_link_dir(dir, -1);
     } else {
-        inode.nlinks -= 1;
+        inode->nlinks -= 1;
     }
 
-    if (!inode.nlinks) {
+    if (!inode->nlinks) {
         debug("# of inode links reached 0, deallocating blocks");
-        ex_inode_deallocate_blocks(&inode);
+        ex_inode_deallocate_blocks(inode);
     }
 
-    entry->free = 1;
-
-    ex_inode_flush(&inode);
-    ex_dir_entry_flush(entry_address, entry);
+    ex_inode_flush(inode);
+    status = ex_dir_remove(dir, name);
 
 done:
-    free(entry);
+    ex_inode_put(inode);
     return status;
 }
 
@@ -568,6 +742,32 @@ struct ex_dir_entry *ex_dir_entry_copy(const struct ex_dir_entry *entry) {
     return new_entry;
 }
 
+/** Array of directory entries built by ex_inode_get_all. */
+struct ex_dir_entries {
+    struct ex_dir_entry **entries;
+    size_t count;
+    size_t capacity;
+};
+
+static int ex_inode_collect_entry(const struct ex_dir_entry *entry,
+                                  void *ctx) {
+
+    struct ex_dir_entries *result = ctx;
+
+    // one more slot is kept for the terminating NULL
+    if (result->count + 1 >= result->capacity) {
+        result->capacity <<= 1;
+        result->entries =
+            ex_realloc(result->entries,
+                       sizeof(struct ex_dir_entry *) * result->capacity);
+    }
+
+    result->entries[result->count++] = ex_dir_entry_copy(entry);
+    result->entries[result->count] = NULL;
+
+    return 0;
+}
+
 struct ex_dir_entry **ex_inode_get_all(struct ex_inode *dir) {
 
     if (!(dir->mode & S_IFDIR)) {
@@ -575,158 +775,1992 @@ struct ex_dir_entry **ex_inode_get_all(struct ex_inode *dir) {
         return NULL;
     }
 
-    size_t max_direntries = 16, dir_entry_no = 0;
-    struct ex_dir_entry **entries =
-        ex_malloc(sizeof(struct ex_dir_entry *) * max_direntries);
+    // the directory knows the number of its entries, so the array is not
+    // reallocated, unless entries are added during the scan
+    struct ex_dir_entries result = {.count = 0,
+                                    .capacity = ex_dir_count_entries(dir) + 1};
 
-    foreach_inode_block(dir, block) {
-        foreach_block_entry(block, entry) {
+    result.entries = ex_malloc(sizeof(struct ex_dir_entry *) * result.capacity);
+    result.entries[0] = NULL;
 
-            if (entry.free) {
-                continue;
-            }
+    ex_dir_iterate(dir, ex_inode_collect_entry, &result);
 
-            // no more entries are present in current block
-            if (entry.magic != EX_DIR_MAGIC1) {
-                break;
-            }
+    return result.entries;
+}
 
-            entries[dir_entry_no++] = ex_dir_entry_copy(&entry);
+/** Find the longest run of the inode data which is physically contiguous.
+ *
+ * The run starts at the offset `off` and it is at most `amount` bytes long,
+ * it returns the length of the run or zero if the mapping cannot be read.
+ * If the run is a hole, `address` is set to EX_BLOCK_INVALID_ADDRESS.
+ *
+ * Compressed runs have no address either, if `data` is not NULL they're
+ * decompressed and `data` points to their content. Otherwise, or if the
+ * run cannot be decompressed, zero is returned. Holes set `data` to NULL.
+ */
+static size_t ex_inode_next_run(struct ex_inode *ino, size_t off,
+                                size_t amount, block_address *address,
+                                const char **data) {
+
+    size_t logical = off / EX_BLOCK_SIZE;
+    size_t block_off = off % EX_BLOCK_SIZE;
+
+    struct ex_extent_mapping mapping;
+
+    if (ex_inode_map(ino, logical, &mapping) != OK || !mapping.length) {
+        return 0;
+    }
 
-            if (dir_entry_no >= max_direntries) {
-                max_direntries <<= 1;
-                entries = ex_realloc(entries, sizeof(struct ex_dir_entry *) *
-                                                  max_direntries);
-            }
+    size_t length =
+        (mapping.logical + mapping.length - logical) * EX_BLOCK_SIZE -
+        block_off;
 
-            entries[dir_entry_no] = NULL;
-        }
+    if (data) {
+        *data = NULL;
     }
 
-    foreach_inode_block_cleanup(dir, block);
+    if (mapping.physical == EX_BLOCK_INVALID_ADDRESS) {
+        *address = EX_BLOCK_INVALID_ADDRESS;
+        return length < amount ? length : amount;
+    }
 
-    return entries;
-}
+    if (mapping.flags & EX_EXTENT_COMPRESSED) {
 
-ssize_t ex_inode_write(struct ex_inode *ino, size_t off, const char *data,
-                       size_t amount) {
+        const char *cluster = NULL;
 
-    info("off=%lu, amount=%lu", off, amount);
+        if (data) {
+            cluster = ex_compress_cache_get(
+                mapping.physical,
+                ex_extent_stored_length(mapping.flags, mapping.length),
+                mapping.length);
+        }
 
-    size_t start_block_idx = off / EX_BLOCK_SIZE;
-    size_t start_block_off = off % EX_BLOCK_SIZE;
+        if (!cluster) {
+            return 0;
+        }
 
-    if (start_block_idx >= ex_inode_max_blocks() ||
-        (start_block_off + amount / EX_BLOCK_SIZE) >= ex_inode_max_blocks()) {
-        return -1;
-    }
+        *address = EX_BLOCK_INVALID_ADDRESS;
+        *data = cluster + (logical - mapping.logical) * EX_BLOCK_SIZE +
+                block_off;
 
-    if (off + amount > ino->size) {
-        ino->size += (off + amount) - ino->size;
+        return length < amount ? length : amount;
     }
 
-    block_address addr = ino->blocks[start_block_idx];
+    *address = mapping.physical + (logical - mapping.logical) * EX_BLOCK_SIZE +
+               block_off;
 
-    ex_device_write(ino->address, (void *)ino, sizeof(struct ex_inode));
-    ex_device_write(addr + start_block_off, data, amount);
+    // merge following extents as long as they are physically adjacent
+    while (length < amount) {
 
-    return (ssize_t)amount;
-}
-
-ex_status ex_inode_read(ssize_t *readed, struct ex_inode *ino, size_t off,
-                        char *buffer, size_t amount) {
+        size_t next = mapping.logical + mapping.length;
 
-    size_t start_block_idx = off / EX_BLOCK_SIZE;
-    size_t start_block_off = off % EX_BLOCK_SIZE;
+        if (ex_inode_map(ino, next, &mapping) != OK ||
+            (mapping.flags & EX_EXTENT_COMPRESSED) ||
+            mapping.physical != *address + length) {
+            break;
+        }
 
-    if (start_block_idx >= ex_inode_max_blocks()) {
-        return READ_OFFSET_PAST_EOF;
+        length += mapping.length * EX_BLOCK_SIZE;
     }
 
-    if ((off + amount) > ino->size) {
+    return length < amount ? length : amount;
+}
 
-        if (off >= ino->size) {
-            return READ_OFFSET_PAST_EOF;
-        }
+/** Find the address that should be used as an allocation goal.
+ *
+ * It's the address which follows the block mapped before the `logical` one,
+ * so sequentially written files stay physically contiguous.
+ */
+static block_address ex_inode_allocation_goal(struct ex_inode *ino,
+                                              size_t logical) {
 
-        size_t available = ino->size - off;
+    struct ex_extent_mapping mapping;
 
-        if (amount > available) {
-            amount = available;
-        }
+    if (!logical || ex_inode_map(ino, logical - 1, &mapping) != OK ||
+        mapping.physical == EX_BLOCK_INVALID_ADDRESS) {
+        return EX_BLOCK_INVALID_ADDRESS;
     }
 
-    size_t offset = ino->blocks[start_block_idx] + start_block_off;
+    if (mapping.flags & EX_EXTENT_COMPRESSED) {
+        return mapping.physical +
+               ex_extent_stored_length(mapping.flags, mapping.length) *
+                   EX_BLOCK_SIZE;
+    }
 
-    return ex_device_read_to_buffer(readed, buffer, offset, amount);
+    return mapping.physical + (logical - mapping.logical) * EX_BLOCK_SIZE;
 }
 
-int ex_inode_rename(struct ex_inode *from_inode, struct ex_inode *to_inode,
-                    const char *from_name, const char *to_name) {
+/** Blocks allocated by ex_inode_allocate_range. */
+struct ex_inode_allocation {
+    /** Number of newly allocated blocks. */
+    size_t blocks;
+    /** The first block of the range was newly allocated. */
+    int first_is_new;
+    /** The last block of the range was newly allocated. */
+    int last_is_new;
+};
+
+/** Allocate and map all unmapped blocks of the range [first, last].
+ *
+ * Newly allocated blocks are not initialized.
+ */
+static ex_status ex_inode_allocate_range(struct ex_inode *ino, size_t first,
+                                         size_t last,
+                                         struct ex_inode_allocation *alloc) {
+
+    size_t logical = first;
+
+    while (logical <= last) {
+
+        struct ex_extent_mapping mapping;
+        ex_status status = ex_inode_map(ino, logical, &mapping);
+
+        if (status != OK) {
+            return status;
+        }
 
-    if (!S_ISDIR(from_inode->mode) || !S_ISDIR(to_inode->mode)) {
-        return -ENOTDIR;
-    }
+        if (mapping.physical != EX_BLOCK_INVALID_ADDRESS) {
+            logical = mapping.logical + mapping.length;
+            continue;
+        }
 
-    size_t from_entry_address =
-        ex_inode_find_entry_address(from_inode, from_name);
+        size_t count = last - logical + 1;
 
-    if (!from_entry_address) {
-        debug("directory at (%lu) does not contain: %s", from_inode->address,
-              from_name);
-        return -ENOENT;
-    }
+        if (count > mapping.length) {
+            count = mapping.length;
+        }
 
-    size_t to_entry_address = ex_inode_find_entry_address(to_inode, to_name);
+        if (count > EX_EXTENT_MAX_LENGTH) {
+            count = EX_EXTENT_MAX_LENGTH;
+        }
 
-    if (!to_entry_address) {
-        debug("directory at (%lu) does not contain: %s, allocating new space",
-              from_inode->address, from_name);
+        struct ex_inode_block block;
+        size_t allocated = 0;
 
-        to_entry_address = ex_inode_find_free_entry_address(to_inode);
+        status = ex_super_allocate_data_blocks(
+            ex_inode_allocation_goal(ino, logical), count, &block, &allocated);
 
-        if (!to_entry_address) {
-            debug("unable to find a free entry address, inode: %ld",
-                  to_inode->number);
-            return -ENOSPC;
+        if (status != OK) {
+            return status;
         }
-    }
 
-    debug("from/to: %lu/%lu", from_entry_address, to_entry_address);
+        struct ex_extent extent = {.logical = logical,
+                                   .length = allocated,
+                                   .physical = block.address};
 
-    struct ex_dir_entry *from_entry = ex_dir_entry_load(from_entry_address);
+        if ((status = ex_extent_insert(&ino->extents, &extent)) != OK) {
+            ex_super_deallocate_blocks(block.address, allocated);
+            return status;
+        }
 
-    ex_inode_entry_update(to_entry_address, to_name, from_entry->address, 0);
+        ex_inode_forget_mappings(ino);
 
-    from_entry->free = 1;
-    ex_dir_entry_flush(from_entry_address, from_entry);
+        alloc->blocks += allocated;
 
-    return 0;
-}
+        if (logical == first) {
+            alloc->first_is_new = 1;
+        }
 
-struct ex_inode_block ex_inode_block_iterate(struct ex_inode *inode,
-                                             struct ex_block_iterator *it) {
+        if (logical + allocated > last) {
+            alloc->last_is_new = 1;
+        }
 
-    // not first iteration
-    if (it->last_block.data) {
-        it->block_number++;
+        logical += allocated;
     }
 
-    struct ex_inode_block block = {.data = NULL,
-                                   .id = EX_BLOCK_INVALID_ID,
-                                   .address = EX_BLOCK_INVALID_ADDRESS};
+    return OK;
+}
 
-    if (it->block_number >= EX_DIRECT_BLOCKS) {
-        goto done;
+/** Replace the compressed extent by raw blocks which can be written.
+ *
+ * The number of newly allocated blocks is added to `allocated`.
+ */
+static ex_status ex_inode_inflate(struct ex_inode *ino,
+                                  const struct ex_extent_mapping *mapping,
+                                  size_t *allocated) {
+
+    const char *cluster = ex_compress_cache_get(
+        mapping->physical,
+        ex_extent_stored_length(mapping->flags, mapping->length),
+        mapping->length);
+
+    if (!cluster) {
+        return READ_FAILED;
     }
 
-    block.address = inode->blocks[it->block_number];
-    block.data = it->buffer;
+    struct ex_extent pieces[EX_COMPRESS_CLUSTER];
+    size_t npieces = 0;
+    size_t done = 0;
 
-    // XXX: add buffer into ex_block_iterator and use ex_device_read_to_buffer
-    //      handle read error
-    ssize_t readed = 0;
-    // XXX: handle read error
+    block_address goal = ex_inode_allocation_goal(ino, mapping->logical);
+    ex_status status = OK;
+
+    while (done < mapping->length) {
+
+        struct ex_inode_block block;
+        size_t got = 0;
+
+        status = ex_super_allocate_data_blocks(goal, mapping->length - done,
+                                               &block, &got);
+
+        if (status != OK) {
+            break;
+        }
+
+        pieces[npieces++] = (struct ex_extent){
+            .logical = mapping->logical + done,
+            .length = got,
+            .physical = block.address};
+
+        status = ex_device_write(block.address,
+                                 cluster + done * EX_BLOCK_SIZE,
+                                 got * EX_BLOCK_SIZE);
+
+        if (status != OK) {
+            break;
+        }
+
+        done += got;
+        goal = block.address + got * EX_BLOCK_SIZE;
+    }
+
+    size_t inserted = 0;
+
+    // the compressed blocks lose the reference of this inode
+    if (status == OK &&
+        (status = ex_extent_unmap(&ino->extents, mapping->logical,
+                                  mapping->length, 1)) == OK) {
+
+        for (; inserted < npieces; inserted++) {
+            if ((status = ex_extent_insert(&ino->extents,
+                                           &pieces[inserted])) != OK) {
+                break;
+            }
+        }
+    }
+
+    for (size_t i = inserted; i < npieces; i++) {
+        ex_super_deallocate_blocks(pieces[i].physical, pieces[i].length);
+    }
+
+    ex_inode_forget_mappings(ino);
+
+    if (status == OK) {
+        *allocated += mapping->length;
+    }
+
+    return status;
+}
+
+/** Replace shared blocks of the range [first, last] by private copies.
+ *
+ * It's used before the range is written, so other inodes which share the
+ * blocks keep their content. Only the content of the first and the last
+ * block is copied, if they are not fully overwritten (`copy_first` and
+ * `copy_last`). Compressed extents which cross the range are decompressed
+ * into private blocks. The number of newly allocated blocks is added to
+ * `allocated`.
+ */
+static ex_status ex_inode_unshare_range(struct ex_inode *ino, size_t first,
+                                        size_t last, int copy_first,
+                                        int copy_last, size_t *allocated) {
+
+    size_t logical = first;
+
+    while (logical <= last) {
+
+        struct ex_extent_mapping mapping;
+        ex_status status = ex_inode_map(ino, logical, &mapping);
+
+        if (status != OK || !mapping.length) {
+            return status;
+        }
+
+        size_t end = mapping.logical + mapping.length;
+
+        if (end > last + 1) {
+            end = last + 1;
+        }
+
+        // compressed data cannot be written in place
+        if (mapping.physical != EX_BLOCK_INVALID_ADDRESS &&
+            (mapping.flags & EX_EXTENT_COMPRESSED)) {
+
+            if ((status = ex_inode_inflate(ino, &mapping, allocated)) != OK) {
+                return status;
+            }
+
+            continue;
+        }
+
+        if (mapping.physical == EX_BLOCK_INVALID_ADDRESS ||
+            !(mapping.flags & EX_EXTENT_SHARED)) {
+            logical = end;
+            continue;
+        }
+
+        block_address physical =
+            mapping.physical + (logical - mapping.logical) * EX_BLOCK_SIZE;
+
+        int shared = 0;
+        size_t count = ex_super_shared_run(physical, end - logical, &shared);
+
+        if (!shared) {
+            logical += count;
+            continue;
+        }
+
+        struct ex_inode_block block;
+        size_t got = 0;
+
+        status = ex_super_allocate_data_blocks(
+            ex_inode_allocation_goal(ino, logical), count, &block, &got);
+
+        if (status != OK) {
+            return status;
+        }
+
+        size_t got_last = logical + got - 1;
+
+        if (copy_first && logical == first) {
+            status = ex_device_copy(block.address, physical, EX_BLOCK_SIZE);
+        }
+
+        if (status == OK && copy_last && got_last == last) {
+            status = ex_device_copy(
+                block.address + (got - 1) * EX_BLOCK_SIZE,
+                physical + (got - 1) * EX_BLOCK_SIZE, EX_BLOCK_SIZE);
+        }
+
+        struct ex_extent extent = {
+            .logical = logical, .length = got, .physical = block.address};
+
+        // the old blocks lose the reference of this inode
+        if (status != OK ||
+            (status = ex_extent_unmap(&ino->extents, logical, got, 1)) !=
+                OK ||
+            (status = ex_extent_insert(&ino->extents, &extent)) != OK) {
+            ex_inode_forget_mappings(ino);
+            ex_super_deallocate_blocks(block.address, got);
+            return status;
+        }
+
+        ex_inode_forget_mappings(ino);
+
+        *allocated += got;
+        logical += got;
+    }
+
+    return OK;
+}
+
+/** Unshare blocks which are going to be written, see
+ *  ex_inode_unshare_range. */
+static ex_status ex_inode_unshare_write(struct ex_inode *ino, size_t off,
+                                        size_t amount, size_t *allocated) {
+
+    size_t first = off / EX_BLOCK_SIZE;
+    size_t last = (off + amount - 1) / EX_BLOCK_SIZE;
+
+    size_t head = off % EX_BLOCK_SIZE;
+    size_t tail = (off + amount) % EX_BLOCK_SIZE;
+
+    return ex_inode_unshare_range(ino, first, last,
+                                  head || (first == last && tail),
+                                  tail || (first == last && head), allocated);
+}
+
+/** Write the data into blocks of the inode, missing blocks are allocated.
+ *
+ * It returns the number of written bytes or negative errno, the number of
+ * newly allocated blocks is added to `allocated`. The inode is not flushed.
+ */
+static ssize_t ex_inode_write_blocks(struct ex_inode *ino, size_t off,
+                                     const char *data, size_t amount,
+                                     size_t *allocated) {
+
+    static const char zeros[EX_BLOCK_SIZE];
+
+    size_t first = off / EX_BLOCK_SIZE;
+    size_t last = (off + amount - 1) / EX_BLOCK_SIZE;
+
+    struct ex_inode_allocation alloc = {0};
+
+    // blocks shared with other inodes are copied on write
+    if (ex_inode_unshare_write(ino, off, amount, allocated) != OK) {
+        warning("unable to unshare blocks of inode (%lu)", ino->number);
+        return -ENOSPC;
+    }
+
+    ex_status status = ex_inode_allocate_range(ino, first, last, &alloc);
+    *allocated += alloc.blocks;
+
+    if (status != OK) {
+        warning("unable to allocate blocks for inode (%lu)", ino->number);
+        return -ENOSPC;
+    }
+
+    // newly allocated blocks must not expose their previous content, so
+    // their parts which are not written are zeroed by the same write
+    size_t head = alloc.first_is_new ? off % EX_BLOCK_SIZE : 0;
+    size_t tail = (off + amount) % EX_BLOCK_SIZE;
+
+    if (!alloc.last_is_new || !tail) {
+        tail = 0;
+    } else {
+        tail = EX_BLOCK_SIZE - tail;
+    }
+
+    size_t done = 0;
+
+    // split the payload into physically contiguous runs, every run is
+    // written by a single vectored device write
+    while (done < amount) {
+
+        block_address address;
+        size_t length =
+            ex_inode_next_run(ino, off + done, amount - done, &address, NULL);
+
+        if (!length || address == EX_BLOCK_INVALID_ADDRESS) {
+            error("unable to map inode (%lu) data at %lu", ino->number,
+                  off + done);
+            break;
+        }
+
+        struct iovec iov[3];
+        int iovcnt = 0;
+
+        if (!done && head) {
+            iov[iovcnt++] = (struct iovec){(void *)zeros, head};
+            address -= head;
+        }
+
+        iov[iovcnt++] = (struct iovec){(void *)(data + done), length};
+
+        if (done + length == amount && tail) {
+            iov[iovcnt++] = (struct iovec){(void *)zeros, tail};
+        }
+
+        if (ex_device_writev(address, iov, iovcnt) != OK) {
+            error("unable to write inode (%lu) data at %lu", ino->number,
+                  address);
+            break;
+        }
+
+        done += length;
+    }
+
+    return done ? (ssize_t)done : -EIO;
+}
+
+/** Move the inline data of the inode into blocks.
+ *
+ * The inode is not flushed, on failure the inline data are kept.
+ */
+static ex_status ex_inode_spill_inline_data(struct ex_inode *ino,
+                                            size_t *allocated) {
+
+    char data[EX_INODE_INLINE_DATA_SIZE];
+    size_t size = ino->size;
+
+    debug("moving inline data of inode (%lu) to blocks", ino->number);
+
+    memcpy(data, ino->data, size);
+
+    ino->flags &= ~EX_INODE_INLINE_DATA;
+    ex_extent_root_init(&ino->extents);
+    ex_inode_forget_mappings(ino);
+
+    if (!size) {
+        return OK;
+    }
+
+    size_t spilled = 0;
+
+    if (ex_inode_write_blocks(ino, 0, data, size, &spilled) == (ssize_t)size) {
+        *allocated += spilled;
+        return OK;
+    }
+
+    ex_extent_free(&ino->extents);
+    ex_inode_forget_mappings(ino);
+
+    ino->flags |= EX_INODE_INLINE_DATA;
+    memset(ino->data, '\0', EX_INODE_INLINE_DATA_SIZE);
+    memcpy(ino->data, data, size);
+
+    return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+}
+
+/** State of the inode before a write. */
+struct ex_inode_write_snapshot {
+    size_t size;
+    uint16_t flags;
+};
+
+static void ex_inode_write_begin(const struct ex_inode *ino,
+                                 struct ex_inode_write_snapshot *before) {
+    before->size = ino->size;
+    before->flags = ino->flags;
+}
+
+/** Update the size and timestamps after the write, the inode is marked
+ *  dirty if it was changed. */
+static void ex_inode_write_end(struct ex_inode *ino,
+                               const struct ex_inode_write_snapshot *before,
+                               size_t off, ssize_t written, size_t allocated) {
+
+    size_t done = written > 0 ? (size_t)written : 0;
+
+    if (off + done > ino->size) {
+        ino->size = off + done;
+    }
+
+    // the time is compared before it's stored, with the same precision
+    struct timespec now = ino->mtime;
+
+    if (done) {
+        ex_update_time_ns(&now);
+    }
+
+    int touched = now.tv_sec != ino->mtime.tv_sec ||
+                  now.tv_nsec != ino->mtime.tv_nsec;
+
+    if (touched) {
+        ino->mtime = now;
+        ino->ctime = now;
+    }
+
+    // written blocks are deduplicated and compressed by the writeback
+    if (done && (ex_dedup_is_enabled() || ex_compress_is_enabled()) &&
+        !(ino->flags & EX_INODE_INLINE_DATA) && !(ino->mode & S_IFDIR)) {
+
+        size_t first = off / EX_BLOCK_SIZE;
+        size_t end = (off + done + EX_BLOCK_SIZE - 1) / EX_BLOCK_SIZE;
+
+        if (ino->writeback_first >= ino->writeback_end) {
+            ino->writeback_first = first;
+            ino->writeback_end = end;
+        } else {
+            ino->writeback_first =
+                first < ino->writeback_first ? first : ino->writeback_first;
+            ino->writeback_end =
+                end > ino->writeback_end ? end : ino->writeback_end;
+        }
+    }
+
+    // the inode is written after its data, by the writeback
+    if (allocated || before->flags != ino->flags ||
+        before->size != ino->size) {
+        ex_inode_mark_dirty(ino);
+    } else if (touched && lazytime) {
+        ex_inode_mark_time_dirty(ino);
+    } else if (touched) {
+        ex_inode_mark_dirty(ino);
+    }
+}
+
+/** Check the range of the write, see ex_inode_write. */
+static ssize_t ex_inode_write_check(size_t off, size_t amount) {
+
+    size_t max_size = ex_inode_max_blocks() * EX_BLOCK_SIZE;
+
+    if (off >= max_size || amount > max_size - off) {
+        return -EFBIG;
+    }
+
+    return 0;
+}
+
+ssize_t ex_inode_write(struct ex_inode *ino, size_t off, const char *data,
+                       size_t amount) {
+
+    info("off=%lu, amount=%lu", off, amount);
+
+    if (ex_inode_write_check(off, amount)) {
+        return -EFBIG;
+    }
+
+    if (!amount) {
+        return 0;
+    }
+
+    struct ex_inode_write_snapshot before;
+    ex_inode_write_begin(ino, &before);
+
+    size_t allocated = 0;
+    ssize_t written;
+
+    if ((ino->flags & EX_INODE_INLINE_DATA) &&
+        off + amount <= EX_INODE_INLINE_DATA_SIZE) {
+        // bytes past the end of the inline data are always zero, so a gap
+        // between the size and the offset is read as a hole
+        memcpy(ino->data + off, data, amount);
+        written = amount;
+    } else if ((ino->flags & EX_INODE_INLINE_DATA) &&
+               ex_inode_spill_inline_data(ino, &allocated) != OK) {
+        written = -ENOSPC;
+    } else {
+        written = ex_inode_write_blocks(ino, off, data, amount, &allocated);
+    }
+
+    ex_inode_write_end(ino, &before, off, written, allocated);
+
+    return written;
+}
+
+/** Write the payload into blocks of the inode by the `copy` callback.
+ *
+ * It's a variant of ex_inode_write_blocks, parts of newly allocated blocks
+ * which are not covered by the payload are zeroed by separate writes.
+ */
+static ssize_t ex_inode_write_blocks_from(struct ex_inode *ino, size_t off,
+                                          size_t amount,
+                                          ex_inode_write_callback copy,
+                                          void *ctx, size_t *allocated) {
+
+    static const char zeros[EX_BLOCK_SIZE];
+
+    size_t first = off / EX_BLOCK_SIZE;
+    size_t last = (off + amount - 1) / EX_BLOCK_SIZE;
+
+    struct ex_inode_allocation alloc = {0};
+
+    // blocks shared with other inodes are copied on write
+    if (ex_inode_unshare_write(ino, off, amount, allocated) != OK) {
+        warning("unable to unshare blocks of inode (%lu)", ino->number);
+        return -ENOSPC;
+    }
+
+    ex_status status = ex_inode_allocate_range(ino, first, last, &alloc);
+    *allocated += alloc.blocks;
+
+    if (status != OK) {
+        warning("unable to allocate blocks for inode (%lu)", ino->number);
+        return -ENOSPC;
+    }
+
+    size_t done = 0;
+
+    while (done < amount) {
+
+        struct ex_inode_run run = {.data = NULL};
+        run.length = ex_inode_next_run(ino, off + done, amount - done,
+                                       &run.address, NULL);
+
+        if (!run.length || run.address == EX_BLOCK_INVALID_ADDRESS) {
+            error("unable to map inode (%lu) data at %lu", ino->number,
+                  off + done);
+            break;
+        }
+
+        size_t head = off % EX_BLOCK_SIZE;
+        size_t tail = (off + amount) % EX_BLOCK_SIZE;
+
+        if (!done && head && alloc.first_is_new &&
+            ex_device_write(run.address - head, zeros, head) != OK) {
+            break;
+        }
+
+        if (done + run.length == amount && tail && alloc.last_is_new &&
+            ex_device_write(run.address + run.length, zeros,
+                            EX_BLOCK_SIZE - tail) != OK) {
+            break;
+        }
+
+        ssize_t copied = copy(&run, done, ctx);
+
+        if (copied < 0) {
+            return done ? (ssize_t)done : copied;
+        }
+
+        done += copied;
+
+        if ((size_t)copied != run.length) {
+            break;
+        }
+    }
+
+    return done ? (ssize_t)done : -EIO;
+}
+
+ssize_t ex_inode_write_from(struct ex_inode *ino, size_t off, size_t amount,
+                            ex_inode_write_callback copy, void *ctx) {
+
+    info("off=%lu, amount=%lu", off, amount);
+
+    if (ex_inode_write_check(off, amount)) {
+        return -EFBIG;
+    }
+
+    if (!amount) {
+        return 0;
+    }
+
+    struct ex_inode_write_snapshot before;
+    ex_inode_write_begin(ino, &before);
+
+    size_t allocated = 0;
+    ssize_t written;
+
+    if ((ino->flags & EX_INODE_INLINE_DATA) &&
+        off + amount <= EX_INODE_INLINE_DATA_SIZE) {
+        struct ex_inode_run run = {.address = EX_BLOCK_INVALID_ADDRESS,
+                                   .length = amount,
+                                   .data = ino->data + off};
+        written = copy(&run, 0, ctx);
+    } else if ((ino->flags & EX_INODE_INLINE_DATA) &&
+               ex_inode_spill_inline_data(ino, &allocated) != OK) {
+        written = -ENOSPC;
+    } else {
+        written = ex_inode_write_blocks_from(ino, off, amount, copy, ctx,
+                                             &allocated);
+    }
+
+    ex_inode_write_end(ino, &before, off, written, allocated);
+
+    return written;
+}
+
+/** Source of ex_inode_copy_range. */
+struct ex_inode_copy_source {
+    struct ex_inode *inode;
+    size_t off;
+};
+
+/** Copy the source data to the run, see ex_inode_write_callback. */
+static ssize_t ex_inode_copy_run(const struct ex_inode_run *run, size_t pos,
+                                 void *ctx) {
+
+    static const char zeros[EX_BLOCK_SIZE];
+
+    struct ex_inode_copy_source *source = ctx;
+    struct ex_inode *src = source->inode;
+    size_t off = source->off + pos;
+
+    // inline data are small, they are copied through the memory
+    if (run->data) {
+        ssize_t readed = 0;
+        ex_status status = ex_inode_read(&readed, src, off, run->data,
+                                         run->length);
+        return status == OK ? readed : -EIO;
+    }
+
+    if (src->flags & EX_INODE_INLINE_DATA) {
+        ex_status status =
+            ex_device_write(run->address, src->data + off, run->length);
+        return status == OK ? (ssize_t)run->length : -EIO;
+    }
+
+    size_t done = 0;
+
+    while (done < run->length) {
+
+        block_address address;
+        const char *data;
+        size_t length = ex_inode_next_run(src, off + done, run->length - done,
+                                          &address, &data);
+
+        if (!length) {
+            error("unable to map inode (%lu) data at %lu", src->number,
+                  off + done);
+            break;
+        }
+
+        ex_status status = OK;
+
+        if (address != EX_BLOCK_INVALID_ADDRESS) {
+            status = ex_device_copy(run->address + done, address, length);
+        } else if (data) {
+            // compressed data are written decompressed
+            status = ex_device_write(run->address + done, data, length);
+        } else {
+            // holes are copied as zeros
+            for (size_t z = 0; z < length && status == OK;) {
+                size_t chunk = length - z < EX_BLOCK_SIZE ? length - z
+                                                          : EX_BLOCK_SIZE;
+                status = ex_device_write(run->address + done + z, zeros, chunk);
+                z += chunk;
+            }
+        }
+
+        if (status != OK) {
+            break;
+        }
+
+        done += length;
+    }
+
+    return done ? (ssize_t)done : -EIO;
+}
+
+/** Whether any compressed extent crosses the blocks [first, first + count).
+ *
+ * Compressed clusters cannot be split, so such ranges are not shared.
+ */
+static int ex_inode_range_is_compressed(struct ex_inode *ino, size_t first,
+                                        size_t count) {
+
+    size_t logical = first;
+
+    while (logical < first + count) {
+
+        struct ex_extent_mapping mapping;
+
+        if (ex_inode_map(ino, logical, &mapping) != OK || !mapping.length) {
+            return 1;
+        }
+
+        if (mapping.physical != EX_BLOCK_INVALID_ADDRESS &&
+            (mapping.flags & EX_EXTENT_COMPRESSED)) {
+            return 1;
+        }
+
+        logical = mapping.logical + mapping.length;
+    }
+
+    return 0;
+}
+
+/** Map `count` blocks of the `src` from the block `src_first` to the `dst`
+ *  from the block `dst_first`.
+ *
+ * Previous blocks of the destination range are released, blocks of the
+ * source get a new reference and both inodes map them by shared extents,
+ * so they are copied on write. Holes of the source stay holes.
+ */
+static ex_status ex_inode_share_range(struct ex_inode *dst, size_t dst_first,
+                                      struct ex_inode *src, size_t src_first,
+                                      size_t count) {
+
+    ex_status status =
+        ex_extent_unmap(&dst->extents, dst_first, count, 1);
+
+    ex_inode_forget_mappings(dst);
+
+    size_t done = 0;
+
+    while (status == OK && done < count) {
+
+        struct ex_extent_mapping mapping;
+        size_t logical = src_first + done;
+
+        if ((status = ex_inode_map(src, logical, &mapping)) != OK) {
+            break;
+        }
+
+        size_t length = mapping.logical + mapping.length - logical;
+
+        if (length > count - done) {
+            length = count - done;
+        }
+
+        if (mapping.physical == EX_BLOCK_INVALID_ADDRESS) {
+            done += length;
+            continue;
+        }
+
+        block_address physical =
+            mapping.physical + (logical - mapping.logical) * EX_BLOCK_SIZE;
+
+        struct ex_extent shared = {.logical = dst_first + done,
+                                   .length = length,
+                                   .flags = EX_EXTENT_SHARED,
+                                   .physical = physical};
+
+        if ((status = ex_super_share_blocks(physical, length)) != OK) {
+            break;
+        }
+
+        if ((status = ex_extent_insert(&dst->extents, &shared)) != OK) {
+            ex_super_deallocate_blocks(physical, length);
+            break;
+        }
+
+        // the source must copy the blocks on write too
+        status = ex_extent_add_flags(&src->extents, logical, EX_EXTENT_SHARED);
+
+        ex_inode_forget_mappings(dst);
+        ex_inode_forget_mappings(src);
+
+        done += length;
+    }
+
+    ex_inode_mark_dirty(src);
+
+    return status;
+}
+
+/** Share whole blocks of the source, see ex_inode_copy_range.
+ *
+ * Offsets of both ranges are aligned to blocks and `amount` is a multiple
+ * of the block size.
+ */
+static ssize_t ex_inode_share_blocks(struct ex_inode *dst, size_t dst_off,
+                                     struct ex_inode *src, size_t src_off,
+                                     size_t amount) {
+
+    if (ex_inode_write_check(dst_off, amount)) {
+        return -EFBIG;
+    }
+
+    struct ex_inode_write_snapshot before;
+    ex_inode_write_begin(dst, &before);
+
+    size_t allocated = 0;
+    ssize_t written = amount;
+
+    if ((dst->flags & EX_INODE_INLINE_DATA) &&
+        ex_inode_spill_inline_data(dst, &allocated) != OK) {
+        written = -ENOSPC;
+    } else if (ex_inode_share_range(dst, dst_off / EX_BLOCK_SIZE, src,
+                                    src_off / EX_BLOCK_SIZE,
+                                    amount / EX_BLOCK_SIZE) != OK) {
+        warning("unable to share blocks of inode (%lu)", src->number);
+        written = -ENOSPC;
+    }
+
+    // the extent tree of the destination was changed
+    ex_inode_mark_dirty(dst);
+    ex_inode_write_end(dst, &before, dst_off, written, allocated);
+
+    return written;
+}
+
+ssize_t ex_inode_copy_range(struct ex_inode *dst, size_t dst_off,
+                            struct ex_inode *src, size_t src_off,
+                            size_t amount) {
+
+    if (src_off >= src->size) {
+        return 0;
+    }
+
+    if (amount > src->size - src_off) {
+        amount = src->size - src_off;
+    }
+
+    struct ex_inode_copy_source source = {.inode = src, .off = src_off};
+
+    // whole blocks are shared only if both ranges start at the same offset
+    // in a block, parts of blocks are copied
+    size_t head = (EX_BLOCK_SIZE - src_off % EX_BLOCK_SIZE) % EX_BLOCK_SIZE;
+
+    if (head > amount) {
+        head = amount;
+    }
+
+    size_t blocks = (amount - head) / EX_BLOCK_SIZE;
+
+    if ((src->flags & EX_INODE_INLINE_DATA) || !blocks ||
+        src_off % EX_BLOCK_SIZE != dst_off % EX_BLOCK_SIZE ||
+        ex_inode_range_is_compressed(src, (src_off + head) / EX_BLOCK_SIZE,
+                                     blocks) ||
+        (!(dst->flags & EX_INODE_INLINE_DATA) &&
+         ex_inode_range_is_compressed(dst, (dst_off + head) / EX_BLOCK_SIZE,
+                                      blocks))) {
+        return ex_inode_write_from(dst, dst_off, amount, ex_inode_copy_run,
+                                   &source);
+    }
+
+    ssize_t done = 0;
+
+    if (head) {
+        done = ex_inode_write_from(dst, dst_off, head, ex_inode_copy_run,
+                                   &source);
+
+        if (done != (ssize_t)head) {
+            return done;
+        }
+    }
+
+    ssize_t shared = ex_inode_share_blocks(dst, dst_off + head, src,
+                                           src_off + head,
+                                           blocks * EX_BLOCK_SIZE);
+
+    if (shared < 0) {
+        return done ? done : shared;
+    }
+
+    done += shared;
+
+    if ((size_t)done < amount) {
+        source.off = src_off + done;
+
+        ssize_t tail = ex_inode_write_from(dst, dst_off + done, amount - done,
+                                           ex_inode_copy_run, &source);
+
+        if (tail < 0) {
+            return done;
+        }
+
+        done += tail;
+    }
+
+    return done;
+}
+
+/** State of ex_inode_clone. */
+struct ex_inode_clone_state {
+    struct ex_inode *dst;
+    ex_status status;
+};
+
+/** Share the extent of the source with the destination. */
+static int ex_inode_clone_extent(const struct ex_extent *extent, void *ctx) {
+
+    struct ex_inode_clone_state *state = ctx;
+
+    struct ex_extent shared = *extent;
+    shared.flags |= EX_EXTENT_SHARED;
+
+    size_t stored = ex_extent_stored_length(extent->flags, extent->length);
+
+    state->status = ex_super_share_blocks(extent->physical, stored);
+
+    if (state->status != OK) {
+        return 1;
+    }
+
+    state->status = ex_extent_insert(&state->dst->extents, &shared);
+
+    if (state->status != OK) {
+        ex_super_deallocate_blocks(extent->physical, stored);
+        return 1;
+    }
+
+    return 0;
+}
+
+ex_status ex_inode_clone(struct ex_inode *dst, struct ex_inode *src) {
+
+    if (dst == src) {
+        return OK;
+    }
+
+    // the previous content of the destination is dropped
+    if (!(dst->flags & EX_INODE_INLINE_DATA)) {
+        ex_extent_free(&dst->extents);
+    }
+
+    ex_inode_forget_mappings(dst);
+
+    ex_status status = OK;
+
+    if (src->flags & EX_INODE_INLINE_DATA) {
+        dst->flags |= EX_INODE_INLINE_DATA;
+        memcpy(dst->data, src->data, EX_INODE_INLINE_DATA_SIZE);
+    } else {
+        dst->flags &= ~EX_INODE_INLINE_DATA;
+        ex_extent_root_init(&dst->extents);
+
+        struct ex_inode_clone_state state = {.dst = dst, .status = OK};
+
+        status = ex_extent_walk(&src->extents, ex_inode_clone_extent, &state);
+
+        if (status == OK) {
+            status = state.status;
+        }
+
+        // blocks of the source are shared now, it must copy them on write
+        if (status == OK) {
+            status = ex_extent_set_flags(&src->extents, EX_EXTENT_SHARED);
+            ex_inode_forget_mappings(src);
+            ex_inode_mark_dirty(src);
+        }
+    }
+
+    if (status != OK) {
+        // leave the destination empty
+        if (!(dst->flags & EX_INODE_INLINE_DATA)) {
+            ex_extent_free(&dst->extents);
+        }
+
+        dst->flags |= EX_INODE_INLINE_DATA;
+        memset(dst->data, '\0', EX_INODE_INLINE_DATA_SIZE);
+        dst->size = 0;
+    } else {
+        dst->size = src->size;
+    }
+
+    ex_update_time_ns(&dst->mtime);
+    dst->ctime = dst->mtime;
+
+    ex_inode_mark_dirty(dst);
+
+    return status;
+}
+
+static_assert(EX_COMPRESS_CLUSTER < 1 << EX_EXTENT_STORED_SHIFT,
+              "The number of stored blocks must fit into extent flags");
+
+/** Compress the cluster which starts at the `start` block.
+ *
+ * The file has `eof` blocks, the cluster is stored compressed only if all
+ * its blocks are mapped to raw blocks owned by the inode.
+ */
+static ex_status ex_inode_compress_cluster(struct ex_inode *ino, size_t start,
+                                           size_t eof) {
+
+    static char raw[EX_COMPRESS_CLUSTER * EX_BLOCK_SIZE];
+    static char packed[EX_COMPRESS_CLUSTER * EX_BLOCK_SIZE];
+
+    size_t end = start + EX_COMPRESS_CLUSTER < eof ? start + EX_COMPRESS_CLUSTER
+                                                   : eof;
+
+    if (end <= start + 1) {
+        return OK;
+    }
+
+    struct ex_extent pieces[EX_COMPRESS_CLUSTER];
+    size_t npieces = 0;
+    size_t logical = start;
+
+    while (logical < end) {
+
+        struct ex_extent_mapping mapping;
+        ex_status status = ex_inode_map(ino, logical, &mapping);
+
+        if (status != OK || !mapping.length) {
+            return status;
+        }
+
+        if (mapping.physical == EX_BLOCK_INVALID_ADDRESS ||
+            (mapping.flags & EX_EXTENT_SHARED)) {
+            return OK;
+        }
+
+        if (mapping.flags & EX_EXTENT_COMPRESSED) {
+
+            if (mapping.logical + mapping.length >= end) {
+                return OK;
+            }
+
+            // data were appended to the compressed cluster, it's
+            // decompressed and the whole cluster is compressed again
+            size_t allocated = 0;
+
+            if ((status = ex_inode_inflate(ino, &mapping, &allocated)) != OK) {
+                return status;
+            }
+
+            npieces = 0;
+            logical = start;
+            continue;
+        }
+
+        size_t piece_end = mapping.logical + mapping.length;
+
+        if (piece_end > end) {
+            piece_end = end;
+        }
+
+        pieces[npieces++] = (struct ex_extent){
+            .logical = logical,
+            .length = piece_end - logical,
+            .physical = mapping.physical +
+                        (logical - mapping.logical) * EX_BLOCK_SIZE};
+
+        logical = piece_end;
+    }
+
+    size_t nblocks = end - start;
+    size_t amount = nblocks * EX_BLOCK_SIZE;
+
+    if (start * EX_BLOCK_SIZE + amount > ino->size) {
+        amount = ino->size - start * EX_BLOCK_SIZE;
+    }
+
+    // bytes past the end of the file are compressed as zeros
+    memset(raw, '\0', nblocks * EX_BLOCK_SIZE);
+
+    ssize_t readed = 0;
+    ex_status status =
+        ex_inode_read(&readed, ino, start * EX_BLOCK_SIZE, raw, amount);
+
+    if (status != OK || (size_t)readed != amount) {
+        return status != OK ? status : READ_FAILED;
+    }
+
+    size_t stored = ex_compress_cluster(raw, nblocks, packed);
+
+    if (!stored) {
+        return OK;
+    }
+
+    struct ex_inode_block block;
+    size_t got = 0;
+
+    status = ex_super_allocate_data_blocks(pieces[0].physical, stored, &block,
+                                           &got);
+
+    if (status != OK) {
+        return status;
+    }
+
+    // the compressed cluster must be contiguous
+    if (got != stored) {
+        ex_super_deallocate_blocks(block.address, got);
+        return OK;
+    }
+
+    if ((status = ex_device_write(block.address, packed,
+                                  stored * EX_BLOCK_SIZE)) != OK) {
+        ex_super_deallocate_blocks(block.address, stored);
+        return status;
+    }
+
+    ex_compress_cache_forget(block.address);
+
+    struct ex_extent extent = {
+        .logical = start,
+        .length = nblocks,
+        .flags = EX_EXTENT_COMPRESSED | stored << EX_EXTENT_STORED_SHIFT,
+        .physical = block.address};
+
+    status = ex_extent_unmap(&ino->extents, start, nblocks, 0);
+
+    if (status == OK &&
+        (status = ex_extent_insert(&ino->extents, &extent)) != OK) {
+        // the raw blocks stay mapped
+        for (size_t i = 0; i < npieces; i++) {
+            (void)ex_extent_insert(&ino->extents, &pieces[i]);
+        }
+    }
+
+    ex_inode_forget_mappings(ino);
+
+    if (status != OK) {
+        ex_super_deallocate_blocks(block.address, stored);
+        return status;
+    }
+
+    for (size_t i = 0; i < npieces; i++) {
+        ex_super_deallocate_blocks(pieces[i].physical, pieces[i].length);
+    }
+
+    return OK;
+}
+
+/** Compress clusters which contain blocks [first, end). */
+static void ex_inode_compress(struct ex_inode *ino, size_t first, size_t end) {
+
+    size_t eof = (ino->size + EX_BLOCK_SIZE - 1) / EX_BLOCK_SIZE;
+
+    if (end > eof) {
+        end = eof;
+    }
+
+    for (size_t start = first - first % EX_COMPRESS_CLUSTER; start < end;
+         start += EX_COMPRESS_CLUSTER) {
+
+        if (ex_inode_compress_cluster(ino, start, eof) != OK) {
+            warning("unable to compress inode (%lu) blocks at %lu",
+                    ino->number, start);
+        }
+    }
+}
+
+/** Share the indexed block described by the `entry` with the `logical`
+ *  block of the inode, which is mapped to the `physical` block.
+ *
+ * The entry is checked first: its inode must still map the block and the
+ * block must contain the `data`. INODE_NOT_FOUND is returned if the entry
+ * is stale.
+ */
+static ex_status ex_inode_dedup_share(struct ex_inode *ino, size_t logical,
+                                      block_address physical,
+                                      const struct ex_dedup_entry *entry,
+                                      const char *data) {
+
+    static char indexed[EX_BLOCK_SIZE];
+
+    if (!ex_super_inode_is_allocated(entry->inode)) {
+        return INODE_NOT_FOUND;
+    }
+
+    // the owner is not referenced, nothing can evict it under the lock
+    struct ex_inode loaded;
+    struct ex_inode *owner = ino;
+    inode_address address = ex_super_inode_address(entry->inode);
+
+    if (entry->inode != ino->number &&
+        !(owner = ex_icache_peek(address))) {
+
+        if (ex_inode_load(address, &loaded) != OK) {
+            return INODE_LOAD_FAILED;
+        }
+
+        owner = &loaded;
+    }
+
+    struct ex_extent_mapping mapping;
+
+    if ((owner->flags & EX_INODE_INLINE_DATA) || (owner->mode & S_IFDIR) ||
+        ex_inode_map(owner, entry->logical, &mapping) != OK ||
+        mapping.physical == EX_BLOCK_INVALID_ADDRESS ||
+        (mapping.flags & EX_EXTENT_COMPRESSED) ||
+        mapping.physical + (entry->logical - mapping.logical) * EX_BLOCK_SIZE !=
+            entry->physical) {
+        return INODE_NOT_FOUND;
+    }
+
+    ex_status status = ex_device_read_to_buffer(NULL, indexed, entry->physical,
+                                                EX_BLOCK_SIZE);
+
+    if (status != OK) {
+        return status;
+    }
+
+    if (memcmp(indexed, data, EX_BLOCK_SIZE)) {
+        return INODE_NOT_FOUND;
+    }
+
+    // the owner must not write the block in place anymore
+    if (!(mapping.flags & EX_EXTENT_SHARED)) {
+
+        status = ex_extent_add_flags(&owner->extents, entry->logical,
+                                     EX_EXTENT_SHARED);
+
+        if (status != OK) {
+            return status;
+        }
+
+        ex_inode_forget_mappings(owner);
+
+        if (owner == &loaded) {
+            status = ex_inode_flush(&loaded);
+        } else if (owner != ino) {
+            (void)ex_inode_mark_dirty(owner);
+        }
+
+        if (status != OK) {
+            return status;
+        }
+    }
+
+    if ((status = ex_super_share_blocks(entry->physical, 1)) != OK) {
+        return status;
+    }
+
+    struct ex_extent shared = {.logical = logical,
+                               .length = 1,
+                               .flags = EX_EXTENT_SHARED,
+                               .physical = entry->physical};
+
+    status = ex_extent_unmap(&ino->extents, logical, 1, 0);
+
+    if (status == OK &&
+        (status = ex_extent_insert(&ino->extents, &shared)) != OK) {
+        // the own block stays mapped
+        struct ex_extent own = {
+            .logical = logical, .length = 1, .physical = physical};
+        (void)ex_extent_insert(&ino->extents, &own);
+    }
+
+    ex_inode_forget_mappings(ino);
+
+    if (status != OK) {
+        ex_super_deallocate_blocks(entry->physical, 1);
+        return status;
+    }
+
+    ex_super_deallocate_blocks(physical, 1);
+
+    return OK;
+}
+
+/** Deduplicate the `logical` block of the inode, its content is `data`. */
+static ex_status ex_inode_dedup_block(struct ex_inode *ino, size_t logical,
+                                      const char *data) {
+
+    struct ex_extent_mapping mapping;
+    ex_status status = ex_inode_map(ino, logical, &mapping);
+
+    if (status != OK || mapping.physical == EX_BLOCK_INVALID_ADDRESS ||
+        (mapping.flags & EX_EXTENT_COMPRESSED)) {
+        return status;
+    }
+
+    block_address physical =
+        mapping.physical + (logical - mapping.logical) * EX_BLOCK_SIZE;
+
+    // blocks which are already shared are not indexed again
+    int shared = 0;
+
+    if (mapping.flags & EX_EXTENT_SHARED) {
+
+        (void)ex_super_shared_run(physical, 1, &shared);
+
+        if (shared) {
+            return OK;
+        }
+    }
+
+    struct ex_dedup_entry entry = {
+        .physical = physical, .inode = ino->number, .logical = logical};
+    struct ex_dedup_entry found;
+
+    ex_hash128(data, EX_BLOCK_SIZE, entry.hash);
+
+    if (!ex_dedup_lookup(entry.hash, &found)) {
+        return ex_dedup_insert(&entry);
+    }
+
+    if (found.physical == physical) {
+
+        if (found.inode == entry.inode && found.logical == entry.logical) {
+            return OK;
+        }
+
+        // the block was indexed by another inode, e.g. before a rename
+        return ex_dedup_insert(&entry);
+    }
+
+    status = ex_inode_dedup_share(ino, logical, physical, &found, data);
+
+    if (status != INODE_NOT_FOUND) {
+        ex_dedup_account(status == OK);
+        return status;
+    }
+
+    // the block replaces the stale entry
+    ex_dedup_account(0);
+
+    return ex_dedup_insert(&entry);
+}
+
+/** Deduplicate full blocks [first, end). */
+static void ex_inode_dedup(struct ex_inode *ino, size_t first, size_t end) {
+
+    static char data[EX_COMPRESS_CLUSTER * EX_BLOCK_SIZE];
+
+    // the last partial block can still change
+    size_t full = ino->size / EX_BLOCK_SIZE;
+
+    if (end > full) {
+        end = full;
+    }
+
+    for (size_t start = first; start < end; start += EX_COMPRESS_CLUSTER) {
+
+        size_t nblocks = end - start < EX_COMPRESS_CLUSTER ? end - start
+                                                           : EX_COMPRESS_CLUSTER;
+        ssize_t readed = 0;
+
+        if (ex_inode_read(&readed, ino, start * EX_BLOCK_SIZE, data,
+                          nblocks * EX_BLOCK_SIZE) != OK ||
+            (size_t)readed != nblocks * EX_BLOCK_SIZE) {
+            warning("unable to read inode (%lu) blocks at %lu", ino->number,
+                    start);
+            return;
+        }
+
+        for (size_t i = 0; i < nblocks; i++) {
+
+            if (ex_inode_dedup_block(ino, start + i, data + i * EX_BLOCK_SIZE) !=
+                OK) {
+                warning("unable to deduplicate inode (%lu) block %lu",
+                        ino->number, start + i);
+            }
+        }
+    }
+}
+
+void ex_inode_writeback(struct ex_inode *ino) {
+
+    size_t first = ino->writeback_first;
+    size_t end = ino->writeback_end;
+
+    ino->writeback_first = ino->writeback_end = 0;
+
+    if (first >= end || (ino->flags & EX_INODE_INLINE_DATA) ||
+        (ino->mode & S_IFDIR)) {
+        return;
+    }
+
+    // shared blocks are not compressed, so duplicates are found first
+    if (ex_dedup_is_enabled()) {
+        ex_inode_dedup(ino, first, end);
+    }
+
+    if (ex_compress_is_enabled()) {
+        ex_inode_compress(ino, first, end);
+    }
+}
+
+/** Release blocks past the new end of the file.
+ *
+ * All blocks after the `size` are unmapped by range frees and the rest of
+ * the last block is zeroed, so the file grows again by holes.
+ */
+static ex_status ex_inode_shrink(struct ex_inode *ino, size_t size) {
+
+    static const char zeros[EX_BLOCK_SIZE];
+
+    size_t keep = (size + EX_BLOCK_SIZE - 1) / EX_BLOCK_SIZE;
+    size_t tail = size % EX_BLOCK_SIZE;
+    size_t allocated = 0;
+
+    struct ex_extent_mapping mapping;
+    ex_status status = ex_inode_map(ino, keep, &mapping);
+
+    if (status != OK) {
+        return status;
+    }
+
+    // the compressed cluster which crosses the new end cannot be split
+    if (mapping.physical != EX_BLOCK_INVALID_ADDRESS &&
+        (mapping.flags & EX_EXTENT_COMPRESSED) && mapping.logical < keep &&
+        (status = ex_inode_inflate(ino, &mapping, &allocated)) != OK) {
+        return status;
+    }
+
+    if (tail) {
+
+        // the last block is written, so it must not be shared
+        if ((status = ex_inode_unshare_range(ino, keep - 1, keep - 1, 1, 1,
+                                             &allocated)) != OK ||
+            (status = ex_inode_map(ino, keep - 1, &mapping)) != OK) {
+            return status;
+        }
+
+        if (mapping.physical != EX_BLOCK_INVALID_ADDRESS &&
+            (status = ex_device_write(
+                 mapping.physical +
+                     (keep - 1 - mapping.logical) * EX_BLOCK_SIZE + tail,
+                 zeros, EX_BLOCK_SIZE - tail)) != OK) {
+            return status;
+        }
+    }
+
+    status = ex_extent_unmap(&ino->extents, keep, ex_inode_max_blocks() - keep,
+                             1);
+
+    ex_inode_forget_mappings(ino);
+
+    return status;
+}
+
+ex_status ex_inode_truncate(struct ex_inode *ino, size_t size) {
+
+    if (!(ino->flags & EX_INODE_INLINE_DATA) && size < ino->size &&
+        ex_inode_shrink(ino, size) != OK) {
+        warning("unable to release blocks of inode (%lu)", ino->number);
+        return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+    }
+
+    if (ino->flags & EX_INODE_INLINE_DATA) {
+
+        size_t allocated = 0;
+
+        if (size > EX_INODE_INLINE_DATA_SIZE &&
+            ex_inode_spill_inline_data(ino, &allocated) != OK) {
+            return INODE_DATA_BLOCKS_ALLOCATION_FAILED;
+        }
+
+        // keep bytes past the end of the inline data zeroed
+        if (size < ino->size) {
+            memset(ino->data + size, '\0', ino->size - size);
+        }
+    }
+
+    ino->size = size;
+    ex_update_time_ns(&ino->mtime);
+    ino->ctime = ino->mtime;
+
+    ex_inode_forget_mappings(ino);
+
+    return ex_inode_flush(ino);
+}
+
+off_t ex_inode_seek(struct ex_inode *ino, off_t off, int whence) {
+
+    if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+        return -EINVAL;
+    }
+
+    if (off < 0 || (size_t)off >= ino->size) {
+        return -ENXIO;
+    }
+
+    // inline data have no holes, the end of the file is the only one
+    if (ino->flags & EX_INODE_INLINE_DATA) {
+        return whence == SEEK_DATA ? off : (off_t)ino->size;
+    }
+
+    size_t logical = off / EX_BLOCK_SIZE;
+    size_t eof = (ino->size + EX_BLOCK_SIZE - 1) / EX_BLOCK_SIZE;
+
+    while (logical < eof) {
+
+        struct ex_extent_mapping mapping;
+
+        if (ex_inode_map(ino, logical, &mapping) != OK || !mapping.length) {
+            return -EIO;
+        }
+
+        int hole = mapping.physical == EX_BLOCK_INVALID_ADDRESS;
+
+        if (hole == (whence == SEEK_HOLE)) {
+            size_t found = logical * EX_BLOCK_SIZE;
+            return found > (size_t)off ? (off_t)found : off;
+        }
+
+        logical = mapping.logical + mapping.length;
+    }
+
+    // there is an implicit hole at the end of the file
+    return whence == SEEK_HOLE ? (off_t)ino->size : -ENXIO;
+}
+
+/** Sum lengths of blocks stored by the extent. */
+static int ex_inode_count_blocks(const struct ex_extent *extent, void *ctx) {
+    *(size_t *)ctx += ex_extent_stored_length(extent->flags, extent->length);
+    return 0;
+}
+
+size_t ex_inode_allocated_blocks(const struct ex_inode *ino) {
+
+    size_t nblocks = 0;
+
+    if (!(ino->flags & EX_INODE_INLINE_DATA)) {
+        (void)ex_extent_walk(&ino->extents, ex_inode_count_blocks, &nblocks);
+    }
+
+    return nblocks;
+}
+
+ex_status ex_inode_read(ssize_t *readed, struct ex_inode *ino, size_t off,
+                        char *buffer, size_t amount) {
+
+    size_t start_block_idx = off / EX_BLOCK_SIZE;
+
+    if (start_block_idx >= ex_inode_max_blocks()) {
+        return READ_OFFSET_PAST_EOF;
+    }
+
+    if ((off + amount) > ino->size) {
+
+        if (off >= ino->size) {
+            return READ_OFFSET_PAST_EOF;
+        }
+
+        size_t available = ino->size - off;
+
+        if (amount > available) {
+            amount = available;
+        }
+    }
+
+    // inline data are already loaded with the inode
+    if (ino->flags & EX_INODE_INLINE_DATA) {
+        memcpy(buffer, ino->data + off, amount);
+
+        if (readed != NULL) {
+            *readed = amount;
+        }
+
+        return OK;
+    }
+
+    ex_status status = OK;
+    size_t done = 0;
+
+    // gather the data run by run, every physically contiguous run
+    // is read by a single device read and holes are read as zeros
+    while (done < amount) {
+
+        block_address address;
+        const char *data;
+        size_t length =
+            ex_inode_next_run(ino, off + done, amount - done, &address, &data);
+
+        if (!length) {
+            error("unable to map inode (%lu) data at %lu", ino->number,
+                  off + done);
+            status = READ_FAILED;
+            break;
+        }
+
+        if (address == EX_BLOCK_INVALID_ADDRESS && data) {
+            memcpy(buffer + done, data, length);
+            done += length;
+            continue;
+        }
+
+        if (address == EX_BLOCK_INVALID_ADDRESS) {
+            memset(buffer + done, '\0', length);
+            done += length;
+            continue;
+        }
+
+        ssize_t readed_ = 0;
+        status = ex_device_read_to_buffer(&readed_, buffer + done, address,
+                                          length);
+
+        if (status != OK) {
+            error("unable to read inode (%lu) data at %lu", ino->number,
+                  address);
+            break;
+        }
+
+        if (readed_ <= 0) {
+            break;
+        }
+
+        done += readed_;
+
+        if ((size_t)readed_ != length) {
+            break;
+        }
+    }
+
+    if (readed != NULL) {
+        *readed = done;
+    }
+
+    return status;
+}
+
+ex_status ex_inode_read_runs(struct ex_inode *ino, size_t off, size_t amount,
+                             struct ex_inode_run **runs, size_t *nruns) {
+
+    *runs = NULL;
+    *nruns = 0;
+
+    if (off / EX_BLOCK_SIZE >= ex_inode_max_blocks() || off >= ino->size) {
+        return READ_OFFSET_PAST_EOF;
+    }
+
+    if (amount > ino->size - off) {
+        amount = ino->size - off;
+    }
+
+    if (ino->flags & EX_INODE_INLINE_DATA) {
+        *runs = ex_malloc(sizeof(struct ex_inode_run));
+        (*runs)[0].address = EX_BLOCK_INVALID_ADDRESS;
+        (*runs)[0].length = amount;
+        (*runs)[0].data = ex_malloc(amount);
+        memcpy((*runs)[0].data, ino->data + off, amount);
+
+        *nruns = 1;
+        return OK;
+    }
+
+    size_t capacity = 0;
+    size_t done = 0;
+
+    while (done < amount) {
+
+        block_address address;
+        const char *data;
+        size_t length =
+            ex_inode_next_run(ino, off + done, amount - done, &address, &data);
+
+        if (!length) {
+            error("unable to map inode (%lu) data at %lu", ino->number,
+                  off + done);
+            break;
+        }
+
+        if (*nruns == capacity) {
+            capacity = capacity ? capacity * 2 : 4;
+            *runs = ex_realloc(*runs, capacity * sizeof(struct ex_inode_run));
+        }
+
+        struct ex_inode_run *run = &(*runs)[(*nruns)++];
+
+        run->address = address;
+        run->length = length;
+        run->data = NULL;
+
+        // holes have no storage, they are read as zeros
+        if (address == EX_BLOCK_INVALID_ADDRESS) {
+            run->data = ex_malloc(length);
+        }
+
+        // compressed runs are served decompressed from the memory
+        if (data) {
+            memcpy(run->data, data, length);
+        }
+
+        done += length;
+    }
+
+    return done ? OK : READ_FAILED;
+}
+
+/** Drop the link of the inode replaced by the rename of the `inode`.
+ *
+ * The `entry` of the directory `dir` points to the replaced inode, a
+ * directory can replace only an empty directory and only a directory can
+ * replace it.
+ */
+static int ex_inode_rename_replace(struct ex_inode *dir,
+                                   const struct ex_dir_entry *entry,
+                                   const struct ex_inode *inode) {
+
+    struct ex_inode *target = ex_icache_get(entry->address);
+
+    if (!target) {
+        error("unable to load inode from: %lu", entry->address);
+        return -EIO;
+    }
+
+    int rv = 0;
+
+    if (S_ISDIR(target->mode)) {
+        if (!S_ISDIR(inode->mode)) {
+            rv = -EISDIR;
+        } else if (!ex_dir_is_empty(target)) {
+            rv = -ENOTEMPTY;
+        } else {
+            target->nlinks = 0;
+            ex_inode_link_dir(dir, -1);
+        }
+    } else if (S_ISDIR(inode->mode)) {
+        rv = -ENOTDIR;
+    } else {
+        target->nlinks -= 1;
+    }
+
+    if (!rv) {
+        if (!target->nlinks) {
+            ex_inode_deallocate_blocks(target);
+        }
+
+        ex_inode_flush(target);
+    }
+
+    ex_inode_put(target);
+
+    return rv;
+}
+
+/** Point ".." of the moved directory `inode` to its new parent `dir`. */
+static void ex_inode_rename_parent(struct ex_inode *inode,
+                                   struct ex_inode *dir) {
+
+    struct ex_dir_entry entry;
+    block_address address;
+
+    if (ex_dir_lookup(inode, "..", &entry, &address) != OK) {
+        warning("directory (%lu) does not contain ..", inode->number);
+        return;
+    }
+
+    ex_inode_entry_update(address, "..", dir->address, 0);
+    ex_dcache_add(inode->address, "..", dir->address);
+}
+
+int ex_inode_rename(struct ex_inode *from_inode, struct ex_inode *to_inode,
+                    const char *from_name, const char *to_name) {
+
+    if (!S_ISDIR(from_inode->mode) || !S_ISDIR(to_inode->mode)) {
+        return -ENOTDIR;
+    }
+
+    struct ex_dir_entry from_entry, to_entry;
+    block_address to_entry_address;
+
+    if (ex_dir_lookup(from_inode, from_name, &from_entry, NULL) != OK) {
+        debug("directory at (%lu) does not contain: %s", from_inode->address,
+              from_name);
+        return -ENOENT;
+    }
+
+    if (from_inode == to_inode && !strcmp(from_name, to_name)) {
+        return 0;
+    }
+
+    struct ex_inode *inode = ex_icache_get(from_entry.address);
+
+    if (!inode) {
+        error("unable to load inode from: %lu", from_entry.address);
+        return -EIO;
+    }
+
+    int rv = 0;
+
+    // entries are added by names, because an insert may move entries
+    // of the directory when it's converted or its leaf is split
+    if (ex_dir_lookup(to_inode, to_name, &to_entry, &to_entry_address) == OK) {
+
+        if (to_entry.address != from_entry.address &&
+            (rv = ex_inode_rename_replace(to_inode, &to_entry, inode))) {
+            goto done;
+        }
+
+        ex_inode_entry_update(to_entry_address, to_name, from_entry.address,
+                              0);
+        ex_dcache_add(to_inode->address, to_name, from_entry.address);
+    } else if (ex_dir_insert(to_inode, to_name, from_entry.address) != OK) {
+        debug("unable to find a free entry address, inode: %ld",
+              to_inode->number);
+        rv = -ENOSPC;
+        goto done;
+    }
+
+    ex_dir_remove(from_inode, from_name);
+
+    // ".." of the moved directory links the new parent
+    if (S_ISDIR(inode->mode) && from_inode->address != to_inode->address) {
+        ex_inode_rename_parent(inode, to_inode);
+        ex_inode_link_dir(from_inode, -1);
+        ex_inode_link_dir(to_inode, 1);
+    }
+
+done:
+    ex_inode_put(inode);
+
+    return rv;
+}
+
+struct ex_inode_block ex_inode_block_iterate(struct ex_inode *inode,
+                                             struct ex_block_iterator *it) {
+
+    // not first iteration
+    if (it->last_block.data) {
+        it->block_number++;
+    }
+
+    struct ex_inode_block block = {.data = NULL,
+                                   .id = EX_BLOCK_INVALID_ID,
+                                   .address = EX_BLOCK_INVALID_ADDRESS};
+
+    if (it->block_number >= ex_inode_max_blocks() ||
+        (inode->flags & EX_INODE_INLINE_DATA)) {
+        goto done;
+    }
+
+    struct ex_extent_mapping mapping;
+
+    if (ex_inode_map(inode, it->block_number, &mapping) != OK) {
+        goto done;
+    }
+
+    // skip the hole, iteration ends if there is no block after it
+    if (mapping.physical == EX_BLOCK_INVALID_ADDRESS) {
+
+        if (mapping.logical + mapping.length >= ex_inode_max_blocks()) {
+            goto done;
+        }
+
+        it->block_number = mapping.logical + mapping.length;
+
+        if (ex_inode_map(inode, it->block_number, &mapping) != OK) {
+            goto done;
+        }
+    }
+
+    block.address = mapping.physical +
+                    (it->block_number - mapping.logical) * EX_BLOCK_SIZE;
+    block.data = it->buffer;
+
+    // XXX: add buffer into ex_block_iterator and use ex_device_read_to_buffer
+    //      handle read error
+    ssize_t readed = 0;
+    // XXX: handle read error
     (void)ex_device_read_to_buffer(&readed, it->buffer, block.address,
                                    EX_BLOCK_SIZE);
 
@@ -760,7 +2794,7 @@ end:
     return it->last_entry;
 }
 
-size_t ex_inode_max_blocks(void) { return EX_DIRECT_BLOCKS; }
+size_t ex_inode_max_blocks(void) { return EX_EXTENT_MAX_LOGICAL; }
 
 int ex_inode_has_perm(struct ex_inode *ino, ex_permission perm, gid_t gid,
                       uid_t uid) {
@@ -838,6 +2872,12 @@ int ex_inode_setxattr(struct ex_inode *inode, const struct ex_span *name, const
         memcpy(freeattr->value, value->data, value->datalen);
 
         inode->number_of_attributes += 1;
+
+        if (ex_inode_flush_xattrs(inode) != OK) {
+            freeattr->in_use = 0;
+            inode->number_of_attributes -= 1;
+            return -ENOSPC;
+        }
     } else {
         // this is obviously bug, probablby because data stored on disk are corrupted
         error("we were unable to find free attribute even when we should have space for it");
@@ -884,7 +2924,9 @@ int ex_inode_removexattr(struct ex_inode *inode, const struct ex_span *name) {
 
         if (attr->in_use && !strncmp(name->data, attr->name, len)) {
             attr->in_use = 0;
-            return 0;
+            inode->number_of_attributes -= 1;
+
+            return ex_inode_flush_xattrs(inode) == OK ? 0 : -EIO;
         }
     }
 
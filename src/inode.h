@@ -7,6 +7,7 @@
 #define EX_INODE_H
 
 #include "errors.h"
+#include "extent.h"
 #include "util.h"
 #include "super.h"
 #include "path.h"
@@ -19,9 +20,6 @@
 #include <time.h>
 #include <unistd.h>
 
-/** Number of direct blocks in the inode. */
-#define EX_DIRECT_BLOCKS 256
-
 /** Inode magic constant used for sanity check. */
 extern const uint16_t EX_INODE_MAGIC1;
 
@@ -40,6 +38,36 @@ extern const uint8_t EX_ENTRY_MAGIC1;
 /** Maximum number of extended attributes. */
 #define EX_INODE_MAX_ATTRIBUTES EX_INODE_ATTRIBUTES_SIZE / EX_INODE_ATTRIBUTE_SIZE
 
+/** Size of the inode data that can be stored directly in the inode. */
+#define EX_INODE_INLINE_DATA_SIZE 176
+
+/** Version of the on-disk inode. */
+#define EX_INODE_VERSION 1
+
+/** The inode data are stored in the inode instead of the mapped blocks. */
+#define EX_INODE_INLINE_DATA 0x1
+
+/** The directory is indexed by hashes of the entry names, see dir.h. */
+#define EX_INODE_DIR_HASHED 0x2
+
+/** The directory is a B+tree sorted by the entry names, see dir.h. */
+#define EX_INODE_DIR_BTREE 0x4
+
+/** Number of recently resolved mappings cached by an inode. */
+#define EX_INODE_MAPPINGS 4
+
+/** Cache of recently resolved mappings of the inode.
+ *
+ * It's kept only in memory, it must be cleared whenever the extent tree of
+ * the inode changes. Entries with zero length are not used.
+ */
+struct ex_inode_mappings {
+    /** Cached mappings, holes are cached too. */
+    struct ex_extent_mapping entries[EX_INODE_MAPPINGS];
+    /** Entry that is replaced next. */
+    size_t next;
+};
+
 /** This class represents the inode store on the persistent storage.
  *
  * Most of the attributes has the same meaning as in the inode(7).
@@ -76,34 +104,145 @@ struct ex_inode {
     /** Address of the inode on the persistent storage. */
     inode_address address;
 
-    /** Number of hardlinks. */
+    /** Number of hardlinks.
+     *
+     * A directory is linked by its entry, by its "." and by ".." of every
+     * subdirectory.
+     */
     uint16_t nlinks;
 
     /** Size of the inodes data.
      *
      * It has two meanings:
      * 1. Size of file when inode is file
-     * 2. size of file metadata (struct ex_inode) if inode is directory
+     * 2. size of its entries (struct ex_dir_entry) if inode is directory
      */
     size_t size;
 
-    /** Inode data.
-     * If an inode is file content is saved here directly in these blocks
-     * If an inode is directory ex_dir_entries are saved in these blocks
-     */
-    block_address blocks[EX_DIRECT_BLOCKS];
+    /** Inode flags, e.g. EX_INODE_INLINE_DATA. */
+    uint16_t flags;
 
-    /** Address of block that contains extended attributes. */
+    /** The first slot of the linear directory which may be free.
+     *
+     * Slots are numbered from the first block, all slots before this one
+     * are used, so an insert starts its search here.
+     */
+    uint32_t dir_free;
+
+    union {
+        struct {
+            /** Root of the extent tree which maps the inode data.
+             * If an inode is file content is saved in the mapped blocks
+             * If an inode is directory ex_dir_entries are saved in the
+             * mapped blocks
+             */
+            struct ex_extent_root extents;
+
+            /** Number of blocks of the directory which can hold entries.
+             *
+             * Linear directories never use blocks after this high-water
+             * mark, so their scans stop there. It's the number of all
+             * blocks of hashed and B+tree directories.
+             */
+            uint32_t dir_blocks;
+
+            /** Number of entries of the directory, including "." and "..". */
+            uint32_t dir_entries;
+        };
+
+        /** Data of a small file or a symlink target.
+         *
+         * It's used instead of the extent tree when the EX_INODE_INLINE_DATA
+         * flag is set, the data are moved to blocks when they do not fit.
+         */
+        char data[EX_INODE_INLINE_DATA_SIZE];
+    };
+
+    /** Recently resolved mappings of the extent tree. */
+    struct ex_inode_mappings mappings;
+
+    /** Logical blocks [writeback_first, writeback_end) which were written
+     *  since the last writeback, see ex_inode_writeback. They're kept only
+     *  in the memory. */
+    size_t writeback_first;
+    size_t writeback_end;
+
+    /** Extended attributes, they're loaded from the `xattr_block`. */
     char attributes[EX_INODE_ATTRIBUTES_SIZE];
 
     /** Number of attributes. */
     uint8_t number_of_attributes;
+
+    /** Address of the block that contains extended attributes.
+     *
+     * It's zero when the inode has no extended attributes.
+     */
+    block_address xattr_block;
 };
 
-static_assert(
-    sizeof(struct ex_inode) <= EX_BLOCK_SIZE,
-    "Size of the struct ex_inode must be less than EX_BLOCK_SIZE"
-);
+/** The inode stored on the persistent storage.
+ *
+ * It's a compact form of struct ex_inode, EX_INODES_PER_BLOCK inodes are
+ * packed into one block of the inode table. Extended attributes are stored
+ * in a separate block.
+ */
+struct ex_disk_inode {
+    /** Inode magic number. */
+    uint16_t magic;
+    /** Version of the inode format, see EX_INODE_VERSION. */
+    uint8_t version;
+    /** Number of extended attributes. */
+    uint8_t number_of_attributes;
+    /** Number of the inode. */
+    uint32_t number;
+    /** File type and mode. */
+    uint32_t mode;
+    /** User id of owner. */
+    uint32_t uid;
+    /** Group id of owner. */
+    uint32_t gid;
+    /** Number of hardlinks. */
+    uint16_t nlinks;
+    /** Inode flags. */
+    uint16_t flags;
+    /** Size of the inodes data. */
+    uint64_t size;
+    /** Seconds of the modification, access and status change timestamps. */
+    int64_t mtime_sec;
+    int64_t atime_sec;
+    int64_t ctime_sec;
+    /** Nanoseconds of the timestamps. */
+    uint32_t mtime_nsec;
+    uint32_t atime_nsec;
+    uint32_t ctime_nsec;
+    /** The first slot of the linear directory which may be free. */
+    uint32_t dir_free;
+    /** Address of the block that contains extended attributes. */
+    uint64_t xattr_block;
+
+    union {
+        struct {
+            /** Root of the extent tree. */
+            struct ex_extent_root extents;
+            /** Number of blocks and entries of the directory. */
+            uint32_t dir_blocks;
+            uint32_t dir_entries;
+        };
+        /** Inline data. */
+        char data[EX_INODE_INLINE_DATA_SIZE];
+    };
+};
+
+static_assert(sizeof(struct ex_disk_inode) == EX_INODE_SIZE,
+              "Size of the struct ex_disk_inode must be EX_INODE_SIZE");
+
+static_assert(sizeof(struct ex_extent_root) + 2 * sizeof(uint32_t) <=
+                  EX_INODE_INLINE_DATA_SIZE,
+              "Root of the extent tree and directory counts must fit into "
+              "the inode");
+
+static_assert(EX_INODE_ATTRIBUTES_SIZE <= EX_BLOCK_SIZE,
+              "Extended attributes must fit into one block");
 
 /** Maximum size of attributes name. */
 #define EX_INODE_ATTR_NAME_MAX_SIZE 20
@@ -170,24 +309,68 @@ ex_status ex_root_create(void);
  */
 ex_status ex_root_load(struct ex_inode *root);
 
-/** Try to allocate direct blocks. */
-ex_status ex_inode_allocate_blocks(struct ex_inode *inode);
-
-/** Deallocate all direct blocks and block used by the inode. */
+/** Deallocate all data blocks and block used by the inode. */
 void ex_inode_deallocate_blocks(struct ex_inode *inode);
 
 /** Free memory used by inode. */
 void ex_inode_free(struct ex_inode *inode);
 
+/** Release the cached inode returned by ex_inode_find or ex_inode_get. */
+void ex_inode_put(struct ex_inode *inode);
+
 /** Print an inode. */
 void ex_inode_print(const struct ex_inode *inode);
 
 /** Write inodes' changes to the persitent storage. */
 ex_status ex_inode_flush(const struct ex_inode *inode);
 
-/** Return maximum number of inodes blocks. */
+/** Mark inodes' changes to be written later.
+ *
+ * Cached inodes are written by the inode cache writeback, other inodes
+ * are flushed immediately.
+ */
+ex_status ex_inode_mark_dirty(struct ex_inode *inode);
+
+/** Mark inodes' timestamps to be written with its next change.
+ *
+ * It's used for lazytime, cached inodes are written only when they are
+ * written for other reason, synced or evicted. Other inodes are flushed.
+ */
+ex_status ex_inode_mark_time_dirty(struct ex_inode *inode);
+
+/** Keep the modification time of writes which change nothing else in
+ *  memory, see ex_inode_mark_time_dirty. It's disabled by default. */
+void ex_inode_set_lazytime(int enabled);
+
+/** Return maximum number of inodes blocks.
+ *
+ * Blocks are allocated when they are written, so this is the limit of the
+ * file size rather than the space used by the inode.
+ */
 size_t ex_inode_max_blocks(void);
 
+/** Get the physical address of the `logical` block of the inode.
+ *
+ * EX_BLOCK_INVALID_ADDRESS is returned if the block is not mapped.
+ */
+block_address ex_inode_block_address(struct ex_inode *inode, size_t logical);
+
+/** Map data of the inode by the extent tree `extents`.
+ *
+ * The previous tree is neither released nor flushed, the caller owns it.
+ */
+void ex_inode_set_blocks(struct ex_inode *inode,
+                         const struct ex_extent_root *extents);
+
+/** Append a new block to the directory of `nblocks` blocks.
+ *
+ * The block is filled with EX_ENTRY_MAGIC1, so all its entries are
+ * considered as never used. It returns the address of the block or
+ * EX_BLOCK_INVALID_ADDRESS if it cannot be allocated. The directory is
+ * not flushed, ex_dir_insert flushes it after the entry is written.
+ */
+block_address ex_inode_grow_dir(struct ex_inode *dir, size_t nblocks);
+
 /** Copy runtime representation of a directory entry. */
 struct ex_dir_entry *ex_dir_entry_copy(const struct ex_dir_entry *entry);
 
@@ -197,9 +380,12 @@ void ex_dir_entry_free(struct ex_dir_entry *entry);
 /** Copy runtime representation of an inode. */
 struct ex_inode *ex_inode_copy(const struct ex_inode *inode);
 
+/** Copy runtime representation of an inode into an existing inode. */
+void ex_inode_copy_noalloc(const struct ex_inode *src, struct ex_inode *dest);
+
 /** Create an inode.
  *
- * It allocates the inode block and all its direct blocks.
+ * It allocates the inode block, data blocks are allocated on write.
  *
  * It flushes changes to the persistent storage.
  */
@@ -213,15 +399,29 @@ struct ex_inode *ex_inode_set(struct ex_inode *dir, const char *name,
 /** Load an inode from the persistent storage. */
 ex_status ex_inode_load(inode_address ino_addr, struct ex_inode *inode);
 
-/** Try to find an inode from the persitent storage. */
+/** Try to find an inode from the persitent storage.
+ *
+ * The inode is borrowed from the inode cache, it must be released
+ * by ex_inode_put.
+ */
 struct ex_inode *ex_inode_find(struct ex_path *path);
 
-/** Try to obtain the inode from the directory. */
+/** Try to obtain the inode from the directory.
+ *
+ * The inode is borrowed from the inode cache, it must be released
+ * by ex_inode_put.
+ */
 struct ex_inode *ex_inode_get(struct ex_inode *dir, const char *name);
 
 /** Set `.` and `..` to the directory. */
 void ex_inode_fill_dir(struct ex_inode *inode, struct ex_inode *parent);
 
+/** Add `delta` to the number of links of the directory `dir`.
+ *
+ * It's called when a subdirectory is added to or removed from the `dir`.
+ */
+void ex_inode_link_dir(struct ex_inode *dir, int delta);
+
 /** Try to remove the inode from the directory.
  *
  * It will unlink the inode if it's hardlink reaches 0.
@@ -231,7 +431,11 @@ ex_status ex_inode_unlink(struct ex_inode *dir, const char *name);
 /** Get all directory entries. */
 struct ex_dir_entry **ex_inode_get_all(struct ex_inode *inode);
 
-/** Rename the inode. */
+/** Rename the inode.
+ *
+ * An existing entry `to_name` is replaced, a replaced directory must be
+ * empty. It returns 0 or a negative errno value.
+ */
 int ex_inode_rename(struct ex_inode *from_inode, struct ex_inode *to_inode,
                     const char *from_name, const char *to_name);
 
@@ -239,10 +443,109 @@ int ex_inode_rename(struct ex_inode *from_inode, struct ex_inode *to_inode,
 ssize_t ex_inode_write(struct ex_inode *inode, size_t off, const char *data,
                        size_t amount);
 
+/** Part of the inode data resolved for a read or a write. */
+struct ex_inode_run {
+    /** Address of the data on the persistent storage.
+     *
+     * It's EX_BLOCK_INVALID_ADDRESS if the data are stored in `data`.
+     */
+    block_address address;
+    /** Length of the run. */
+    size_t length;
+    /** Memory of the run.
+     *
+     * Runs of a read contain zeros of a hole or a copy of inline data, they
+     * are owned by the caller. Runs of a write point to inline data.
+     */
+    char *data;
+};
+
+/** Callback used by ex_inode_write_from.
+ *
+ * It stores `run->length` bytes of the payload, starting at the payload
+ * offset `pos`, to the run. The run is either a range of the persistent
+ * storage or the memory in `data`. It returns the number of stored bytes
+ * or negative errno.
+ */
+typedef ssize_t (*ex_inode_write_callback)(const struct ex_inode_run *run,
+                                           size_t pos, void *ctx);
+
+/** Write data to the inode, the payload is stored by the `copy` callback.
+ *
+ * It allows to move the payload directly to the persistent storage without
+ * an intermediate buffer.
+ */
+ssize_t ex_inode_write_from(struct ex_inode *inode, size_t off, size_t amount,
+                            ex_inode_write_callback copy, void *ctx);
+
+/** Copy data of the `src` inode to the `dst` inode.
+ *
+ * Whole blocks are shared with the source when both offsets have the same
+ * position in a block, they are copied on write. Other data are copied
+ * between blocks of the persistent storage without passing through a user
+ * space buffer when it's possible. Holes of the source are read as zeros
+ * from the destination, the copy ends at the end of the source.
+ * It returns the number of copied bytes or negative errno.
+ */
+ssize_t ex_inode_copy_range(struct ex_inode *dst, size_t dst_off,
+                            struct ex_inode *src, size_t src_off,
+                            size_t amount);
+
+/** Find the next data or hole of the inode, see lseek(2).
+ *
+ * `whence` is SEEK_DATA or SEEK_HOLE, unmapped blocks are holes and there
+ * is an implicit hole at the end of the file. The offset of the first data
+ * or hole byte at or after `off` is returned, -ENXIO is returned if `off`
+ * is not before the end of the file or there are no data after it. Other
+ * `whence` values are rejected by -EINVAL.
+ */
+off_t ex_inode_seek(struct ex_inode *ino, off_t off, int whence);
+
+/** Get the number of data blocks allocated by the inode.
+ *
+ * Holes do not allocate blocks, compressed extents count their stored
+ * blocks and shared blocks are counted by every inode.
+ */
+size_t ex_inode_allocated_blocks(const struct ex_inode *ino);
+
+/** Process data of the inode which were written since the last call.
+ *
+ * It's called by the writeback. When deduplication is enabled, full blocks
+ * with the same content as an indexed block share that block. When
+ * compression is enabled, clusters are compressed, clusters which do not
+ * compress, contain holes or share blocks with other inodes stay raw.
+ * The inode is not flushed.
+ */
+void ex_inode_writeback(struct ex_inode *ino);
+
+/** Make the `dst` inode a clone of the `src` inode.
+ *
+ * The previous content of `dst` is dropped, blocks of `src` are shared by
+ * both inodes until they are written, so only the metadata are copied.
+ */
+ex_status ex_inode_clone(struct ex_inode *dst, struct ex_inode *src);
+
+/** Change the size of the inode and flush it.
+ *
+ * Inline data are moved to blocks when the new size does not fit
+ * into the inode. Blocks past the new size are released, the file grows
+ * by a hole without any device I/O.
+ */
+ex_status ex_inode_truncate(struct ex_inode *inode, size_t size);
+
 /** Read data from the inode. */
 ex_status ex_inode_read(ssize_t *readed, struct ex_inode *ino, size_t off,
                         char *buffer, size_t amount);
 
+/** Resolve the inode data into ranges of the persistent storage.
+ *
+ * It's a variant of ex_inode_read which does not read data stored in
+ * blocks, only holes and inline data are copied into memory. The array of
+ * runs is stored to `runs`, the number of runs to `nruns`.
+ */
+ex_status ex_inode_read_runs(struct ex_inode *ino, size_t off, size_t amount,
+                             struct ex_inode_run **runs, size_t *nruns);
+
 /** Check that inode has required permissions. */
 int ex_inode_has_perm(struct ex_inode *ino, ex_permission perm, gid_t gid,
                       uid_t uid);
@@ -2,9 +2,12 @@
 #include "errors.h"
 #include "ex.h"
 #include "logging.h"
+#include "dedup.h"
 #include "device.h"
 #include "util.h"
 #include "inode.h"
+#include "icache.h"
+#include "dcache.h"
 
 #include <getopt.h>
 #include <math.h>
@@ -16,7 +19,8 @@
 #include <unistd.h>
 
 // device layout:
-// super_block | inode_bitmap | data_bitmap | inode_blocks | data_blocks
+// super_block | inode_bitmap | data_bitmap | refcounts | dedup_index |
+// inode_blocks | data_blocks
 
 int ex_mkfs_check_device(struct ex_mkfs_params *params) {
 
@@ -135,10 +139,9 @@ size_t round_block(size_t size) {
 int ex_mkfs_check_dbitmap_params(struct ex_mkfs_params *params,
                                  struct ex_mkfs_context *ctx) {
 
-    // XXX: this works only because we allocate all blocks when we create
-    //      an inode, generally can be true that ex_inode_blocks can be
-    //      greater than a device size
-    size_t data_size = params->number_of_inodes * ex_inode_max_blocks();
+    // blocks are allocated on demand, the data area is sized for
+    // EX_DATA_BLOCKS_PER_INODE blocks per inode on average
+    size_t data_size = params->number_of_inodes * EX_DATA_BLOCKS_PER_INODE;
     size_t dbitmap_size = round_block(params->number_of_inodes / 8);
 
     if (ctx->free_device_space < 0) {
@@ -173,7 +176,7 @@ int ex_mkfs_dbitmap_create(struct ex_mkfs_params *params,
     ctx->data_bitmap.head = offsetof(struct ex_super_block, bitmap);
 
     ctx->data_bitmap.max_items =
-        params->number_of_inodes * ex_inode_max_blocks();
+        params->number_of_inodes * EX_DATA_BLOCKS_PER_INODE;
     ctx->data_bitmap.size = ctx->data_bitmap.max_items / 8;
 
     ctx->free_device_space -= ctx->data_bitmap.max_items * EX_BLOCK_SIZE;
@@ -182,6 +185,56 @@ int ex_mkfs_dbitmap_create(struct ex_mkfs_params *params,
     return 0;
 }
 
+int ex_mkfs_refcounts_create(struct ex_mkfs_params *params,
+                             struct ex_mkfs_context *ctx) {
+
+    (void)params;
+
+    // one reference count for every data block
+    size_t size = ctx->data_bitmap.max_items * sizeof(uint32_t);
+
+    if ((ssize_t)round_block(size) > ctx->free_device_space) {
+        error("not enough space for reference counts, got: %zi, need: %zu",
+              ctx->free_device_space, round_block(size));
+        return -ENOSPC;
+    }
+
+    // reference counts start after end of a dbitmap
+    ctx->refcounts.address =
+        ctx->data_bitmap.address + round_block(ctx->data_bitmap.size);
+    ctx->refcounts.head = offsetof(struct ex_super_block, refcounts);
+    ctx->refcounts.size = round_block(size);
+    ctx->refcounts.shared = 0;
+
+    ctx->free_device_space -= ctx->refcounts.size;
+
+    return 0;
+}
+
+int ex_mkfs_dedup_index_create(struct ex_mkfs_params *params,
+                               struct ex_mkfs_context *ctx) {
+
+    (void)params;
+
+    // one index entry for every data block
+    size_t size =
+        ctx->data_bitmap.max_items * sizeof(struct ex_dedup_entry);
+
+    if ((ssize_t)round_block(size) > ctx->free_device_space) {
+        error("not enough space for dedup index, got: %zi, need: %zu",
+              ctx->free_device_space, round_block(size));
+        return -ENOSPC;
+    }
+
+    // the index starts after end of reference counts
+    ctx->dedup.address = ctx->refcounts.address + ctx->refcounts.size;
+    ctx->dedup.size = round_block(size);
+
+    ctx->free_device_space -= ctx->dedup.size;
+
+    return 0;
+}
+
 int ex_mkfs_check_ibitmap_params(struct ex_mkfs_params *params,
                                  struct ex_mkfs_context *ctx) {
 
@@ -190,7 +243,7 @@ int ex_mkfs_check_ibitmap_params(struct ex_mkfs_params *params,
         return -EINVAL;
     }
 
-    ssize_t inodes_space = EX_BLOCK_SIZE * params->number_of_inodes;
+    ssize_t inodes_space = ex_super_inode_table_size(params->number_of_inodes);
     ssize_t bitmap_space = params->number_of_inodes / 8;
     ssize_t needed_space = inodes_space + bitmap_space;
 
@@ -223,7 +276,8 @@ int ex_mkfs_ibitmap_create(struct ex_mkfs_params *params,
     ctx->inode_bitmap.size = ctx->inode_bitmap.max_items / 8;
 
     // adjust free device space
-    ctx->free_device_space -= ctx->inode_bitmap.max_items * EX_BLOCK_SIZE;
+    ctx->free_device_space -=
+        ex_super_inode_table_size(ctx->inode_bitmap.max_items);
     ctx->free_device_space -= round_block(ctx->inode_bitmap.size);
 
     return 0;
@@ -231,6 +285,10 @@ int ex_mkfs_ibitmap_create(struct ex_mkfs_params *params,
 
 int ex_mkfs_put_layout(const char *device, struct ex_mkfs_context *ctx) {
 
+    // inodes of the previous filesystem must not be used anymore
+    ex_icache_clear();
+    ex_dcache_clear();
+
     if (ex_device_open(device) != OK) {
         return 1;
     }
@@ -250,6 +308,14 @@ int ex_mkfs_put_layout(const char *device, struct ex_mkfs_context *ctx) {
     size = round_block(ctx->data_bitmap.size);
     ex_mkfs_device_clear(ctx->data_bitmap.address, size);
 
+    debug("clearing reference counts space");
+    // clean reference counts space, no block is shared
+    ex_mkfs_device_clear(ctx->refcounts.address, ctx->refcounts.size);
+
+    debug("clearing dedup index space");
+    // clean dedup index space, no block is indexed
+    ex_mkfs_device_clear(ctx->dedup.address, ctx->dedup.size);
+
     debug("writing super block");
     // write super block
     size = sizeof(ctx->super_block);
@@ -283,7 +349,11 @@ int ex_mkfs_create_super_block(struct ex_mkfs_params *params,
         .device_size = params->device_size,
         .bitmap = ctx->data_bitmap,
         .inode_bitmap = ctx->inode_bitmap,
-        .magic = EX_SUPER_MAGIC};
+        .refcounts = ctx->refcounts,
+        .dedup = ctx->dedup,
+        .magic = EX_SUPER_MAGIC,
+        .version = EX_SUPER_VERSION,
+        .inode_size = EX_INODE_SIZE};
 
     // XXX: we should do at least some checks
     return 0;
@@ -314,6 +384,24 @@ int ex_mkfs_prepare(struct ex_mkfs_params *params,
         goto end;
     }
 
+    // create reference counts of data blocks
+    debug("available free space: %zi", ctx->free_device_space);
+    rv = ex_mkfs_refcounts_create(params, ctx);
+
+    if (rv) {
+        error("unable to create reference counts");
+        goto end;
+    }
+
+    // create hash index of data blocks
+    debug("available free space: %zi", ctx->free_device_space);
+    rv = ex_mkfs_dedup_index_create(params, ctx);
+
+    if (rv) {
+        error("unable to create dedup index");
+        goto end;
+    }
+
     // create super block
     debug("available free space: %zi", ctx->free_device_space);
     rv = ex_mkfs_create_super_block(params, ctx);
@@ -406,14 +494,20 @@ error:
 
 size_t ex_mkfs_get_size_for_inodes(size_t ninodes) {
 
-    // space for inodes
-    size_t required = ninodes * EX_BLOCK_SIZE;
+    // space for inodes, they are packed into the inode table
+    size_t required = ex_super_inode_table_size(ninodes);
     // space for inodes bitmap
     required += round_block(ninodes / 8);
     // space for data inodes
-    required += ninodes * ex_inode_max_blocks() * EX_BLOCK_SIZE;
+    required += ninodes * EX_DATA_BLOCKS_PER_INODE * EX_BLOCK_SIZE;
     // space for data bitmap
-    required += round_block(ninodes * ex_inode_max_blocks() / 8);
+    required += round_block(ninodes * EX_DATA_BLOCKS_PER_INODE / 8);
+    // space for reference counts of data blocks
+    required += round_block(ninodes * EX_DATA_BLOCKS_PER_INODE *
+                            sizeof(uint32_t));
+    // space for the hash index of data blocks
+    required += round_block(ninodes * EX_DATA_BLOCKS_PER_INODE *
+                            sizeof(struct ex_dedup_entry));
     // space for super block
     required += round_block(sizeof(struct ex_super_block));
 
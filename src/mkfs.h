@@ -5,7 +5,8 @@
 #include <stdint.h>
 
 // device layout:
-// super_block | inode_bitmap | data_bitmap | inode_blocks | data_blocks
+// super_block | inode_bitmap | data_bitmap | refcounts | dedup_index |
+// inode_blocks | data_blocks
 
 struct ex_mkfs_params {
     char *device;
@@ -18,6 +19,8 @@ struct ex_mkfs_context {
     ssize_t free_device_space;
     struct ex_bitmap inode_bitmap;
     struct ex_bitmap data_bitmap;
+    struct ex_refcount_table refcounts;
+    struct ex_dedup_index dedup;
     struct ex_super_block super_block;
 };
 
@@ -28,6 +31,10 @@ int ex_mkfs_check_dbitmap_params(struct ex_mkfs_params *params,
                                  struct ex_mkfs_context *ctx);
 int ex_mkfs_dbitmap_create(struct ex_mkfs_params *params,
                            struct ex_mkfs_context *ctx);
+int ex_mkfs_refcounts_create(struct ex_mkfs_params *params,
+                             struct ex_mkfs_context *ctx);
+int ex_mkfs_dedup_index_create(struct ex_mkfs_params *params,
+                               struct ex_mkfs_context *ctx);
 int ex_mkfs_check_ibitmap_params(struct ex_mkfs_params *params,
                                  struct ex_mkfs_context *ctx);
 int ex_mkfs_ibitmap_create(struct ex_mkfs_params *params,
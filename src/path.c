@@ -39,7 +39,7 @@ struct ex_path *ex_path_make_dirpath(const char *pathname) {
     // we need to make copy of pathname, because dirname
     // writes '\0' to the source string
     char copy_of_path[pathlen + 1];
-    memcpy(copy_of_path, pathname, pathlen);
+    memcpy(copy_of_path, pathname, pathlen + 1);
 
     return ex_path_make(dirname(copy_of_path));
 }
@@ -12,16 +12,24 @@
 
 struct ex_super_block *super_block = NULL;
 
-// super | inode bitmap | data bitmap | inodes | data
+// super | inode bitmap | data bitmap | refcounts | dedup index | inodes |
+// data
 #define inode_bitmap_end                                                       \
     (super_block->inode_bitmap.address + super_block->inode_bitmap.size)
 
 #define data_bitmap_end (super_block->bitmap.address + super_block->bitmap.size)
 
+#define refcounts_end                                                          \
+    (super_block->refcounts.address + super_block->refcounts.size)
+
+#define dedup_index_end                                                        \
+    (super_block->dedup.address + super_block->dedup.size)
+
 #define first_data_block                                                       \
-    (first_inode_block + (EX_BLOCK_SIZE * super_block->inode_bitmap.max_items))
+    (first_inode_block +                                                       \
+     ex_super_inode_table_size(super_block->inode_bitmap.max_items))
 
-#define first_inode_block (data_bitmap_end)
+#define first_inode_block (dedup_index_end)
 
 void ex_bitmap_free_bit(struct ex_bitmap *bitmap, size_t nth_bit) {
 
@@ -102,6 +110,105 @@ not_found:
     return bitpos;
 }
 
+/** Mark `count` bits starting at `first_bit` as free.
+ *
+ * All changed bytes are written by a single device write.
+ */
+void ex_bitmap_free_run(struct ex_bitmap *bitmap, size_t first_bit,
+                        size_t count) {
+
+    if (!count) {
+        return;
+    }
+
+    size_t first_byte = first_bit / 8;
+    size_t last_byte = (first_bit + count - 1) / 8;
+    size_t nbytes = last_byte - first_byte + 1;
+
+    char bitdata[nbytes];
+    ssize_t readed;
+
+    // XXX: ignore status for now
+    (void)ex_device_read_to_buffer(&readed, bitdata,
+                                   bitmap->address + first_byte, nbytes);
+
+    for (size_t bit = first_bit; bit < first_bit + count; bit++) {
+        bitdata[bit / 8 - first_byte] &= ~(1UL << (bit % 8));
+    }
+
+    bitmap->allocated -= bitmap->allocated < count ? bitmap->allocated : count;
+
+    ex_device_write(bitmap->address + first_byte, bitdata, nbytes);
+    ex_device_write(bitmap->head, (void *)bitmap, sizeof(struct ex_bitmap));
+}
+
+size_t ex_bitmap_find_free_run(struct ex_bitmap *bitmap, size_t goal,
+                               size_t count, size_t *found) {
+
+    *found = 0;
+
+    if (bitmap->allocated == bitmap->max_items || !count) {
+        info("bitmap is full");
+        return -1;
+    }
+
+    ssize_t readed = 0;
+    char bitdata[bitmap->size];
+
+    (void)ex_device_read_to_buffer(&readed, bitdata, bitmap->address,
+                                   bitmap->size);
+
+    if (goal >= bitmap->max_items) {
+        goal = 8 * bitmap->last;
+    }
+
+    // find the first free bit, start at the goal and wrap around once
+    size_t first = -1;
+
+    for (size_t n = 0; n < bitmap->max_items; n++) {
+
+        size_t bit = (goal + n) % bitmap->max_items;
+
+        // skip fully allocated bytes
+        if (!(bit % 8) && (uint8_t)bitdata[bit / 8] == 0xff) {
+            n += 7;
+            continue;
+        }
+
+        if (!(bitdata[bit / 8] & (1 << (bit % 8)))) {
+            first = bit;
+            break;
+        }
+    }
+
+    if (first == (size_t)-1) {
+        return -1;
+    }
+
+    // extend the run while the following bits are free
+    size_t last = first;
+
+    do {
+        bitdata[last / 8] |= (1 << (last % 8));
+        last++;
+    } while (last - first < count && last < bitmap->max_items &&
+             !(bitdata[last / 8] & (1 << (last % 8))));
+
+    *found = last - first;
+
+    bitmap->allocated += *found;
+    bitmap->last = (last - 1) / 8;
+
+    size_t first_byte = first / 8;
+    size_t nbytes = (last - 1) / 8 - first_byte + 1;
+
+    ex_device_write(bitmap->address + first_byte, bitdata + first_byte,
+                    nbytes);
+    ex_device_write(bitmap->head, (void *)bitmap, sizeof(struct ex_bitmap));
+
+    return first;
+}
+
 void ex_super_deallocate_block(block_address address) {
 
     // compute position of block in bitmap
@@ -113,6 +220,155 @@ void ex_super_deallocate_block(block_address address) {
     ex_bitmap_free_bit(&super_block->bitmap, nth_bit);
 }
 
+/** Load reference counts of `count` blocks starting at the `first` one. */
+static ex_status ex_super_refs_load(size_t first, size_t count,
+                                    uint32_t *refs) {
+
+    ex_status status = ex_device_read_to_buffer(
+        NULL, (char *)refs,
+        super_block->refcounts.address + first * sizeof(uint32_t),
+        count * sizeof(uint32_t));
+
+    if (status != OK) {
+        error("unable to read reference counts of blocks [%zu, %zu)", first,
+              first + count);
+    }
+
+    return status;
+}
+
+/** Write reference counts and the refcount table head. */
+static ex_status ex_super_refs_flush(size_t first, size_t count,
+                                     const uint32_t *refs) {
+
+    ex_status status = ex_device_write(
+        super_block->refcounts.address + first * sizeof(uint32_t),
+        (const char *)refs, count * sizeof(uint32_t));
+
+    if (status != OK) {
+        error("unable to write reference counts of blocks [%zu, %zu)", first,
+              first + count);
+        return status;
+    }
+
+    return ex_device_write(super_block->refcounts.head,
+                           (const char *)&super_block->refcounts,
+                           sizeof(struct ex_refcount_table));
+}
+
+void ex_super_deallocate_blocks(block_address address, size_t count) {
+
+    size_t first_bit = (address - first_data_block) / EX_BLOCK_SIZE;
+
+    // fast path, there are no shared blocks at all
+    if (!super_block->refcounts.shared) {
+        ex_bitmap_free_run(&super_block->bitmap, first_bit, count);
+        return;
+    }
+
+    uint32_t *refs = ex_malloc(count * sizeof(uint32_t));
+
+    if (ex_super_refs_load(first_bit, count, refs) != OK) {
+        // leaking blocks is better than freeing shared ones
+        free(refs);
+        return;
+    }
+
+    size_t dropped = 0;
+    size_t run = 0;
+
+    // shared blocks lose a reference, runs of other blocks are freed
+    for (size_t i = 0; i < count; i++) {
+
+        if (!refs[i]) {
+            run++;
+            continue;
+        }
+
+        ex_bitmap_free_run(&super_block->bitmap, first_bit + i - run, run);
+        run = 0;
+
+        refs[i]--;
+        dropped++;
+    }
+
+    ex_bitmap_free_run(&super_block->bitmap, first_bit + count - run, run);
+
+    if (dropped) {
+        super_block->refcounts.shared -= dropped;
+        ex_super_refs_flush(first_bit, count, refs);
+    }
+
+    free(refs);
+}
+
+ex_status ex_super_share_blocks(block_address address, size_t count) {
+
+    size_t first_bit = (address - first_data_block) / EX_BLOCK_SIZE;
+    uint32_t *refs = ex_malloc(count * sizeof(uint32_t));
+
+    ex_status status = OK;
+
+    if (!super_block->refcounts.shared) {
+        // the table contains only zeros
+    } else if ((status = ex_super_refs_load(first_bit, count, refs)) != OK) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+
+        if (refs[i] == UINT32_MAX) {
+            warning("block (%zu) has too many references",
+                    address + i * EX_BLOCK_SIZE);
+            status = BLOCK_REFCOUNT_OVERFLOW;
+            goto done;
+        }
+
+        refs[i]++;
+    }
+
+    super_block->refcounts.shared += count;
+
+    if ((status = ex_super_refs_flush(first_bit, count, refs)) != OK) {
+        super_block->refcounts.shared -= count;
+    }
+
+done:
+    free(refs);
+    return status;
+}
+
+size_t ex_super_shared_run(block_address address, size_t count, int *shared) {
+
+    *shared = 0;
+
+    if (!super_block->refcounts.shared || !count) {
+        return count;
+    }
+
+    size_t first_bit = (address - first_data_block) / EX_BLOCK_SIZE;
+    uint32_t *refs = ex_malloc(count * sizeof(uint32_t));
+
+    // treat blocks as shared if the table cannot be read, they are copied
+    if (ex_super_refs_load(first_bit, count, refs) != OK) {
+        *shared = 1;
+        free(refs);
+        return count;
+    }
+
+    *shared = refs[0] != 0;
+
+    size_t length = 1;
+
+    while (length < count && (refs[length] != 0) == *shared) {
+        length++;
+    }
+
+    free(refs);
+
+    return length;
+}
+
 ex_status ex_super_init_block(size_t address, char with) {
 
     char free_block[EX_BLOCK_SIZE];
@@ -165,9 +421,74 @@ ex_status ex_super_allocate_data_block(struct ex_inode_block *block) {
                                    first_data_block, 'a');
 }
 
+ex_status ex_super_allocate_data_blocks(block_address goal, size_t count,
+                                        struct ex_inode_block *block,
+                                        size_t *allocated) {
+
+    size_t goal_bit = -1;
+
+    if (goal != EX_BLOCK_INVALID_ADDRESS && goal >= first_data_block) {
+        goal_bit = (goal - first_data_block) / EX_BLOCK_SIZE;
+    }
+
+    size_t blockid =
+        ex_bitmap_find_free_run(&super_block->bitmap, goal_bit, count,
+                                allocated);
+
+    if (blockid == EX_BLOCK_INVALID_ID) {
+        warning("unable to find a free data block");
+        return DATA_BITMAP_IS_FULL;
+    }
+
+    block->id = blockid;
+    block->address = first_data_block + block->id * EX_BLOCK_SIZE;
+    block->data = NULL;
+
+    return OK;
+}
+
 ex_status ex_super_allocate_inode_block(struct ex_inode_block *block) {
-    return ex_super_allocate_block(&super_block->inode_bitmap, block,
-                                   first_inode_block, 0);
+
+    size_t number = ex_bitmap_find_free_bit(&super_block->inode_bitmap);
+
+    if (number == EX_BLOCK_INVALID_ID) {
+        warning("unable to find a free inode");
+        return INODE_BITMAP_IS_FULL;
+    }
+
+    // inodes are packed, EX_INODES_PER_BLOCK share one block of the table
+    block->id = number;
+    block->address = ex_super_inode_address(number);
+    block->data = NULL;
+
+    return OK;
+}
+
+inode_address ex_super_inode_address(size_t inode_number) {
+    return first_inode_block + inode_number * EX_INODE_SIZE;
+}
+
+int ex_super_inode_is_allocated(size_t inode_number) {
+
+    struct ex_bitmap *bitmap = &super_block->inode_bitmap;
+
+    if (inode_number >= bitmap->max_items) {
+        return 0;
+    }
+
+    char byte;
+
+    if (ex_device_read_to_buffer(NULL, &byte, bitmap->address + inode_number / 8,
+                                 sizeof(byte)) != OK) {
+        return 0;
+    }
+
+    return (byte >> (inode_number % 8)) & 1;
+}
+
+size_t ex_super_inode_table_size(size_t ninodes) {
+    size_t nblocks = (ninodes + EX_INODES_PER_BLOCK - 1) / EX_INODES_PER_BLOCK;
+    return nblocks * EX_BLOCK_SIZE;
 }
 
 void ex_super_print(const struct ex_super_block *block) {
@@ -216,6 +537,12 @@ ex_status ex_super_load(void) {
         goto error;
     }
 
+    if (super_block->version != EX_SUPER_VERSION ||
+        super_block->inode_size != EX_INODE_SIZE) {
+        status = SUPER_BAD_VERSION;
+        goto error;
+    }
+
     pthread_mutexattr_init(&super_lock_attr);
     pthread_mutexattr_settype(&super_lock_attr, PTHREAD_MUTEX_RECURSIVE);
 
@@ -229,6 +556,11 @@ error:
             fatal("invalid super block magic: %x, expected: %x", super_block->magic,
                   EX_SUPER_MAGIC);
             break;
+        case SUPER_BAD_VERSION:
+            fatal("unsupported format version: %u (inode size: %u), expected: "
+                  "%u (inode size: %u)", super_block->version,
+                  super_block->inode_size, EX_SUPER_VERSION, EX_INODE_SIZE);
+            break;
         case SUPER_LOCK_INIT_FAILED:
             fatal("unable to initialize lock: errno=%d", errno);
             break;
@@ -13,10 +13,18 @@
 
 /** This defines block size. */
 #define EX_BLOCK_SIZE 4096
+/** Number of data blocks reserved per inode when a device is created. */
+#define EX_DATA_BLOCKS_PER_INODE 256
 /** Maximum filename basename length. */
 #define EX_NAME_LEN 54
 /** Super block magic number */
 #define EX_SUPER_MAGIC 0xffaacc
+/** Version of the on-disk format. */
+#define EX_SUPER_VERSION 5
+/** Size of the on-disk inode. */
+#define EX_INODE_SIZE 256
+/** Number of inodes stored in one block of the inode table. */
+#define EX_INODES_PER_BLOCK (EX_BLOCK_SIZE / EX_INODE_SIZE)
 
 /** @deprecated functions should return ex_status instead of arbitraty return code. */
 #define EX_BLOCK_INVALID_ID ((size_t)-1)
@@ -59,6 +67,36 @@ struct ex_bitmap {
     size_t last;
 };
 
+/** Reference counts of data blocks.
+ *
+ * A data block can be shared by several inodes, e.g. after a clone. The
+ * table stores the number of extra references of every data block, so a
+ * block which is owned by a single inode has zero. A shared block is freed
+ * when its last reference is dropped.
+ */
+struct ex_refcount_table {
+    /** Address of this structure on the persistent storage. */
+    size_t head;
+    /** Address of the table data, one uint32_t per data block. */
+    size_t address;
+    /** Size of the table in bytes. */
+    size_t size;
+    /** Sum of all extra references, the table is not used when it's zero. */
+    size_t shared;
+};
+
+/** Persistent index of data block hashes.
+ *
+ * It's a hash table used by the deduplication, it has one entry for every
+ * data block, see dedup.h.
+ */
+struct ex_dedup_index {
+    /** Address of the index data. */
+    size_t address;
+    /** Size of the index in bytes. */
+    size_t size;
+};
+
 /** The super block.
  *
  * It's written to the offset 0 on the persistent device.
@@ -72,8 +110,16 @@ struct ex_super_block {
     struct ex_bitmap bitmap;
     /** Inode allocation bitmap. */
     struct ex_bitmap inode_bitmap;
+    /** Reference counts of data blocks. */
+    struct ex_refcount_table refcounts;
+    /** Hash index of data blocks. */
+    struct ex_dedup_index dedup;
     /** Magic number for fs checking. */
     uint32_t magic;
+    /** Version of the on-disk format, see EX_SUPER_VERSION. */
+    uint32_t version;
+    /** Size of the on-disk inode, see EX_INODE_SIZE. */
+    uint32_t inode_size;
 };
 
 /** Representation of continuous memory of fixed size. */
@@ -96,18 +142,70 @@ void ex_bitmap_free_bit(struct ex_bitmap *bitmap, size_t nth_bit);
 /** Try to find free block. */
 size_t ex_bitmap_find_free_bit(struct ex_bitmap *bitmap);
 
+/** Mark `count` bits starting at `first_bit` as free. */
+void ex_bitmap_free_run(struct ex_bitmap *bitmap, size_t first_bit,
+                        size_t count);
+
+/** Try to find up to `count` consecutive free bits near the `goal` bit.
+ *
+ * Found bits are marked as used, their number is stored to `found`.
+ */
+size_t ex_bitmap_find_free_run(struct ex_bitmap *bitmap, size_t goal,
+                               size_t count, size_t *found);
+
 /** Try to allocate data block. */
 ex_status ex_super_allocate_data_block(struct ex_inode_block *block);
 
+/** Try to allocate up to `count` physically contiguous data blocks.
+ *
+ * The allocation starts as close to the `goal` address as possible, blocks
+ * are not initialized. The number of allocated blocks is stored to
+ * `allocated`.
+ */
+ex_status ex_super_allocate_data_blocks(block_address goal, size_t count,
+                                        struct ex_inode_block *block,
+                                        size_t *allocated);
+
+/** Fill the whole block with the `with` byte. */
+ex_status ex_super_init_block(size_t address, char with);
+
 /** Deallocate data block. */
 void ex_super_deallocate_block(block_address address);
 
-/** Try to allocate data block. */
+/** Drop a reference of `count` physically contiguous data blocks.
+ *
+ * Blocks without other references are deallocated.
+ */
+void ex_super_deallocate_blocks(block_address address, size_t count);
+
+/** Add a reference to `count` physically contiguous data blocks. */
+ex_status ex_super_share_blocks(block_address address, size_t count);
+
+/** Find how many blocks starting at `address` are shared or not shared.
+ *
+ * It returns the length (at most `count`) of the run of blocks which are
+ * all shared or all not shared, `shared` is set accordingly.
+ */
+size_t ex_super_shared_run(block_address address, size_t count, int *shared);
+
+/** Try to allocate an inode in the inode table.
+ *
+ * The inode is not initialized, `block` contains its number and address.
+ */
 ex_status ex_super_allocate_inode_block(struct ex_inode_block *block);
 
-/** Deallocate data block. */
+/** Deallocate the inode. */
 void ex_super_deallocate_inode_block(size_t inode_number);
 
+/** Get the address of the inode with the `inode_number`. */
+inode_address ex_super_inode_address(size_t inode_number);
+
+/** Check whether the inode with the `inode_number` is allocated. */
+int ex_super_inode_is_allocated(size_t inode_number);
+
+/** Get the size of the inode table for `ninodes` inodes (in bytes). */
+size_t ex_super_inode_table_size(size_t ninodes);
+
 /** Print the super block to the stdout. */
 void ex_super_print(const struct ex_super_block *block);
 
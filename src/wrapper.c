@@ -1,11 +1,12 @@
-#define FUSE_USE_VERSION 30
+#define FUSE_USE_VERSION 35
 
 #include "ex.h"
+#include "device.h"
+#include "dir.h"
 #include "util.h"
 #include "path.h"
 #include "inode.h"
 
-#include <assert.h>
 #include <err.h>
 #include <errno.h>
 #include <fuse.h>
@@ -26,6 +27,12 @@ struct ex_args {
     char *loglevel;
     char *device;
     int foreground;
+    int single_threaded;
+    int atime;
+    int lazytime;
+    int compress;
+    int dedup;
+    int dirindex;
 };
 
 static int do_create(const char *pathname, mode_t mode,
@@ -35,7 +42,9 @@ static int do_create(const char *pathname, mode_t mode,
     return ex_create(pathname, mode, ctx->gid, ctx->uid);
 }
 
-static int do_getattr(const char *pathname, struct stat *st) {
+static int do_getattr(const char *pathname, struct stat *st,
+                      struct fuse_file_info *fi) {
+    (void)fi;
     return ex_getattr(pathname, st);
 }
 
@@ -51,44 +60,203 @@ static int do_open(const char *pathname, struct fuse_file_info *fi) {
     return ex_open(pathname, fuse_fucking_mode, ctx->gid, ctx->uid);
 }
 
+/** Buffer of the readdir request and its filler. */
+struct ex_readdir_buffer {
+    void *buffer;
+    fuse_fill_dir_t filler;
+};
+
+static int do_fill_entry(const struct ex_dir_entry *entry, off_t next,
+                         const struct stat *st, void *ctx) {
+
+    struct ex_readdir_buffer *buffer = ctx;
+
+    debug("inode name=%s", entry->name);
+
+    // non zero means that the buffer is full
+    return buffer->filler(buffer->buffer, entry->name, st, next,
+                          st ? FUSE_FILL_DIR_PLUS : 0);
+}
+
+static int ex_readdir_to(const char *pathname, void *buffer,
+                         fuse_fill_dir_t filler, off_t offset,
+                         struct fuse_file_info *fi, int plus) {
+
+    struct ex_readdir_buffer ctx = {.buffer = buffer, .filler = filler};
+    struct ex_dir_cursor *cursor = (struct ex_dir_cursor *)(uintptr_t)fi->fh;
+    struct ex_dir_cursor local;
+
+    // the directory was not opened by opendir, the offset is found by
+    // a scan from the beginning
+    if (!cursor) {
+        memset(&local, '\0', sizeof(local));
+        cursor = &local;
+    }
+
+    return ex_readdir_cursor(pathname, cursor, offset, plus, do_fill_entry,
+                             &ctx);
+}
+
 static int do_readdir(const char *pathname, void *buffer,
                       fuse_fill_dir_t filler, off_t offset,
-                      struct fuse_file_info *fi) {
+                      struct fuse_file_info *fi,
+                      enum fuse_readdir_flags flags) {
+    // attributes are returned with entries, so there is no getattr per entry
+    return ex_readdir_to(pathname, buffer, filler, offset, fi,
+                         flags & FUSE_READDIR_PLUS);
+}
+
+static int do_read(const char *pathname, char *buffer, size_t size,
+                   off_t offset, struct fuse_file_info *fi) {
     (void)fi;
 
-    assert(!offset);
+    return ex_read(pathname, buffer, size, offset);
+}
 
-    struct ex_dir_entry **entries;
-    int rv = ex_readdir(pathname, &entries);
+static int do_read_buf(const char *pathname, struct fuse_bufvec **bufp,
+                       size_t size, off_t offset, struct fuse_file_info *fi) {
+    (void)fi;
 
-    if (rv) {
-        goto free_entries;
+    // data would be read into memory run by run, a single buffer costs
+    // no more than the plain read
+    if (!ex_read_runs_are_stable()) {
+
+        struct fuse_bufvec *bufv = ex_malloc(sizeof(struct fuse_bufvec));
+        *bufv = FUSE_BUFVEC_INIT(size);
+        bufv->buf[0].mem = ex_malloc(size ? size : 1);
+
+        int rv = ex_read(pathname, bufv->buf[0].mem, size, offset);
+
+        if (rv < 0) {
+            free(bufv->buf[0].mem);
+            free(bufv);
+            return rv;
+        }
+
+        bufv->buf[0].size = rv;
+        *bufp = bufv;
+
+        return 0;
     }
 
-    for (size_t i = 0; entries[i]; i++) {
-        debug("inode name=%s", entries[i]->name);
-        filler(buffer, entries[i]->name, NULL, 0);
+    struct ex_inode_run *runs;
+    int nruns = ex_read_runs(pathname, size, offset, &runs);
+
+    if (nruns < 0) {
+        return nruns;
     }
 
-free_entries:
+    int fd = -1;
+
+    if (ex_device_fd(&fd) != OK) {
+        for (int i = 0; i < nruns; i++) {
+            free(runs[i].data);
+        }
 
-    for (size_t i = 0; entries[i]; i++) {
-        ex_dir_entry_free(entries[i]);
+        free(runs);
+        return -EIO;
     }
 
-    free(entries);
+    size_t extra = nruns > 1 ? nruns - 1 : 0;
+    struct fuse_bufvec *bufv =
+        ex_malloc(sizeof(struct fuse_bufvec) + extra * sizeof(struct fuse_buf));
 
-    return rv;
+    *bufv = FUSE_BUFVEC_INIT(0);
+
+    // data stored in blocks are spliced directly from the device, memory
+    // buffers (holes, inline data, data of blocks which may be released
+    // concurrently) are freed by libfuse
+    for (int i = 0; i < nruns; i++) {
+
+        struct fuse_buf *buf = &bufv->buf[i];
+
+        buf->size = runs[i].length;
+
+        if (runs[i].data) {
+            buf->flags = 0;
+            buf->mem = runs[i].data;
+            buf->fd = -1;
+        } else {
+            buf->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+            buf->mem = NULL;
+            buf->fd = fd;
+            buf->pos = runs[i].address;
+        }
+    }
+
+    if (nruns) {
+        bufv->count = nruns;
+    }
+
+    free(runs);
+    *bufp = bufv;
+
+    return 0;
 }
 
-static int do_read(const char *pathname, char *buffer, size_t size,
-                   off_t offset, struct fuse_file_info *fi) {
+/** Source of the write_buf payload. */
+struct ex_write_buf_source {
+    struct fuse_bufvec *buf;
+    int fd;
+};
+
+/** Move the part of the payload to the run, the payload is consumed
+ *  sequentially, so fuse_buf_copy keeps the position in `buf`. */
+static ssize_t ex_write_buf_copy(const struct ex_inode_run *run, size_t pos,
+                                 void *ctx) {
+    (void)pos;
+
+    struct ex_write_buf_source *source = ctx;
+    struct fuse_bufvec dst = FUSE_BUFVEC_INIT(run->length);
+
+    if (run->data) {
+        dst.buf[0].mem = run->data;
+    } else {
+        dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        dst.buf[0].fd = source->fd;
+        dst.buf[0].pos = run->address;
+    }
+
+    return fuse_buf_copy(&dst, source->buf, 0);
+}
+
+static int do_write_buf(const char *pathname, struct fuse_bufvec *buf,
+                        off_t offset, struct fuse_file_info *fi) {
     (void)fi;
 
-    return ex_read(pathname, buffer, size, offset);
+    struct ex_write_buf_source source = {.buf = buf, .fd = -1};
+
+    if (ex_device_fd(&source.fd) != OK) {
+        return -EIO;
+    }
+
+    return ex_write_from(pathname, fuse_buf_size(buf), offset,
+                         ex_write_buf_copy, &source);
 }
 
-static int do_truncate(const char *pathname, off_t off) {
+static ssize_t do_copy_file_range(const char *src, struct fuse_file_info *fi_in,
+                                  off_t src_offset, const char *dst,
+                                  struct fuse_file_info *fi_out,
+                                  off_t dst_offset, size_t size, int flags) {
+    (void)fi_in;
+    (void)fi_out;
+
+    if (flags) {
+        return -EINVAL;
+    }
+
+    return ex_copy_range(src, src_offset, dst, dst_offset, size);
+}
+
+static off_t do_lseek(const char *path, off_t off, int whence,
+                      struct fuse_file_info *fi) {
+    (void)fi;
+    return ex_lseek(path, off, whence);
+}
+
+static int do_truncate(const char *pathname, off_t off,
+                       struct fuse_file_info *fi) {
+    (void)fi;
     return ex_truncate(pathname, off);
 }
 
@@ -101,7 +269,9 @@ static int do_write(const char *path, const char *buf, size_t size,
 
 static int do_unlink(const char *pathname) { return ex_unlink(pathname); }
 
-static int do_utimens(const char *pathname, const struct timespec tv[2]) {
+static int do_utimens(const char *pathname, const struct timespec tv[2],
+                      struct fuse_file_info *fi) {
+    (void)fi;
     return ex_utimens(pathname, tv);
 }
 
@@ -116,7 +286,8 @@ static int do_statfs(const char *pathname, struct statvfs *statbuffer) {
     return ex_statfs(statbuffer);
 }
 
-static void *do_init(struct fuse_conn_info *info_) {
+static void *do_init(struct fuse_conn_info *info_, struct fuse_config *cfg) {
+    (void)cfg;
 
     struct fuse_context *ctx = fuse_get_context();
 
@@ -127,10 +298,22 @@ static void *do_init(struct fuse_conn_info *info_) {
     struct ex_args *args = (struct ex_args *)ctx->private_data;
 
     ex_logging_init(args->loglevel, args->foreground);
+    ex_set_atime_mode(args->atime, args->lazytime);
+    ex_set_compression(args->compress);
+    ex_set_dedup(args->dedup);
+    ex_set_dir_format(args->dirindex);
+    ex_set_single_threaded(args->single_threaded);
     ex_init(args->device);
 
     info("fuse protocol version: %u.%u", info_->proto_major, info_->proto_minor);
 
+    // libfuse copies descriptor buffers of read_buf through memory unless
+    // the reply may be spliced to /dev/fuse
+    if (ex_read_runs_are_stable() && (info_->capable & FUSE_CAP_SPLICE_WRITE)) {
+        info_->want |= FUSE_CAP_SPLICE_WRITE;
+        info("reads are spliced from the device");
+    }
+
     return args;
 }
 
@@ -143,7 +326,9 @@ static void do_destroy(void *private_data) {
     free(args->device);
 }
 
-static int do_chmod(const char *pathname, mode_t mode) {
+static int do_chmod(const char *pathname, mode_t mode,
+                    struct fuse_file_info *fi) {
+    (void)fi;
     return ex_chmod(pathname, mode);
 }
 
@@ -159,11 +344,19 @@ static int do_readlink(const char *link, char *buffer, size_t bufsize) {
     return ex_readlink(link, buffer, bufsize);
 }
 
-static int do_rename(const char *from, const char *to) {
+static int do_rename(const char *from, const char *to, unsigned int flags) {
+
+    // RENAME_NOREPLACE and RENAME_EXCHANGE are not supported
+    if (flags) {
+        return -EINVAL;
+    }
+
     return ex_rename(from, to);
 }
 
-static int do_chown(const char *path, uid_t uid, gid_t gid) {
+static int do_chown(const char *path, uid_t uid, gid_t gid,
+                    struct fuse_file_info *fi) {
+    (void)fi;
     return ex_chown(path, uid, gid);
 }
 
@@ -171,7 +364,28 @@ static int do_opendir(const char *path, struct fuse_file_info *info) {
     struct fuse_context *ctx = fuse_get_context();
     // I have no idea why are flags shifted by 14 bits...
     mode_t mode = info->flags >> 14;
-    return ex_opendir(path, mode, ctx->gid, ctx->uid);
+    int rv = ex_opendir(path, mode, ctx->gid, ctx->uid);
+
+    if (rv) {
+        return rv;
+    }
+
+    // the cursor keeps the position of readdir between its calls
+    struct ex_dir_cursor *cursor = ex_malloc(sizeof(struct ex_dir_cursor));
+    memset(cursor, '\0', sizeof(*cursor));
+
+    info->fh = (uintptr_t)cursor;
+
+    return 0;
+}
+
+static int do_releasedir(const char *path, struct fuse_file_info *info) {
+    (void)path;
+
+    free((void *)(uintptr_t)info->fh);
+    info->fh = 0;
+
+    return 0;
 }
 
 static int do_setxattr(const char* path, const char* name, const char* value,
@@ -187,10 +401,24 @@ static int do_removexattr(const char *path, const char *name) {
     return ex_removexattr(path, name);
 }
 
+static int do_fsync(const char *path, int datasync,
+                    struct fuse_file_info *fi) {
+    (void)fi;
+    return ex_fsync(path, datasync);
+}
+
+static int do_fsyncdir(const char *path, int datasync,
+                       struct fuse_file_info *fi) {
+    (void)fi;
+    return ex_fsync(path, datasync);
+}
+
 static struct fuse_operations operations = {
     .getattr = do_getattr,
     .readdir = do_readdir,
     .read = do_read,
+    .read_buf = do_read_buf,
+    .write_buf = do_write_buf,
     .create = do_create,
     .open = do_open,
     .write = do_write,
@@ -210,15 +438,26 @@ static struct fuse_operations operations = {
     .rename = do_rename,
     .chown = do_chown,
     .opendir = do_opendir,
+    .releasedir = do_releasedir,
     .setxattr = do_setxattr,
     .getxattr = do_getxattr,
     .removexattr = do_removexattr,
+    .fsync = do_fsync,
+    .fsyncdir = do_fsyncdir,
+    .copy_file_range = do_copy_file_range,
+    .lseek = do_lseek,
 };
 
 static void ex_args_init(struct ex_args *args) {
     args->loglevel = "info";
     args->device = NULL;
     args->foreground = 0;
+    args->single_threaded = 0;
+    args->atime = EX_ATIME_RELATIME;
+    args->lazytime = 0;
+    args->compress = 0;
+    args->dedup = 0;
+    args->dirindex = EX_DIR_HASHED;
 }
 
 static void ex_args_finalize(struct ex_args *args) {
@@ -252,7 +491,17 @@ static int ex_check_foreground_option(void *data, const char *arg, int key,
         fprintf(stderr,
                 "\nExfuse options:\n"
                 "    --log-level            {error, warning, info, debug}\n"
-                "    --device device        used device\n");
+                "    --device device        used device\n"
+                "    -o strictatime         update atime on every access\n"
+                "    -o relatime            update atime if it's older than mtime,\n"
+                "                           ctime or one day (default)\n"
+                "    -o noatime             never update atime\n"
+                "    -o lazytime            write timestamps with other changes\n"
+                "    -o compress            compress written data (lz4)\n"
+                "    -o dedup               share written blocks with the same\n"
+                "                           content\n"
+                "    -o dirindex=FORMAT     format of large directories\n"
+                "                           {hash (default), btree, linear}\n");
         exit(0);
     }
 
@@ -266,12 +515,30 @@ static int ex_check_foreground_option(void *data, const char *arg, int key,
         ((struct ex_args *)data)->foreground = 1;
     }
 
+    // data of reads are spliced from the device only if no other request
+    // can free their blocks before libfuse consumes them
+    if (!strcmp(arg, "-s")) {
+        ((struct ex_args *)data)->single_threaded = 1;
+    }
+
     return 1;
 }
 
 static struct fuse_opt ex_opts[] = {
     {"--log-level %s", offsetof(struct ex_args, loglevel), FUSE_OPT_KEY_OPT},
     {"--device %s", offsetof(struct ex_args, device), FUSE_OPT_KEY_OPT},
+    {"strictatime", offsetof(struct ex_args, atime), EX_ATIME_STRICT},
+    {"relatime", offsetof(struct ex_args, atime), EX_ATIME_RELATIME},
+    {"noatime", offsetof(struct ex_args, atime), EX_ATIME_NOATIME},
+    {"lazytime", offsetof(struct ex_args, lazytime), 1},
+    {"nolazytime", offsetof(struct ex_args, lazytime), 0},
+    {"compress", offsetof(struct ex_args, compress), 1},
+    {"nocompress", offsetof(struct ex_args, compress), 0},
+    {"dedup", offsetof(struct ex_args, dedup), 1},
+    {"nodedup", offsetof(struct ex_args, dedup), 0},
+    {"dirindex=hash", offsetof(struct ex_args, dirindex), EX_DIR_HASHED},
+    {"dirindex=btree", offsetof(struct ex_args, dirindex), EX_DIR_BTREE},
+    {"dirindex=linear", offsetof(struct ex_args, dirindex), EX_DIR_LINEAR},
     {"--help", -1U, EXFUSE_KEY_HELP},
     {"-h", -1U, EXFUSE_KEY_HELP},
     {NULL, 0, 0}};
@@ -0,0 +1,138 @@
+#include "../src/compress.h"
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/super.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Size of the benchmarked file. */
+#define BENCH_FILE_SIZE (64 * 1024 * 1024)
+/** Size of a single read or write, it's the default fuse request size. */
+#define BENCH_CHUNK (128 * 1024)
+
+static const char *DEVNAME = "bench_compress";
+
+static double bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static size_t bench_used_blocks(void) {
+    struct statvfs st;
+    ex_statfs(&st);
+    return st.f_blocks - st.f_bfree;
+}
+
+static void bench_fill_text(char *buffer, size_t size) {
+
+    size_t done = 0;
+
+    for (size_t line = 0; done < size; line++) {
+
+        char text[160];
+        int length = snprintf(
+            text, sizeof(text),
+            "{\"ts\": %zu, \"level\": \"%s\", \"path\": \"/api/v1/items/%zu\", "
+            "\"status\": %d}\n",
+            1700000000 + line, line % 7 ? "info" : "warning", line % 1000,
+            line % 13 ? 200 : 404);
+
+        for (int i = 0; i < length && done < size; i++) {
+            buffer[done++] = text[i];
+        }
+    }
+}
+
+static void bench_fill_random(char *buffer, size_t size) {
+
+    srand(42);
+
+    for (size_t i = 0; i < size; i++) {
+        buffer[i] = rand();
+    }
+}
+
+static void bench_run(const char *name, const char *data, int compress) {
+
+    static char buffer[BENCH_CHUNK];
+
+    unlink(DEVNAME);
+
+    struct ex_mkfs_params params;
+    memset(&params, '\0', sizeof(params));
+
+    params.device = (char *)DEVNAME;
+    params.create = 1;
+    params.number_of_inodes =
+        2 * BENCH_FILE_SIZE / EX_BLOCK_SIZE / EX_DATA_BLOCKS_PER_INODE;
+
+    ex_mkfs_check_params(&params);
+    ex_mkfs(&params);
+    ex_set_compression(compress);
+
+    ex_create("/file", S_IRWXU, getgid(), getuid());
+
+    size_t used = bench_used_blocks();
+    double start = bench_now();
+
+    for (size_t off = 0; off < BENCH_FILE_SIZE; off += BENCH_CHUNK) {
+        ex_write("/file", data + off, BENCH_CHUNK, off);
+    }
+
+    // the data are compressed by the writeback
+    ex_sync();
+
+    double written = bench_now();
+
+    for (size_t off = 0; off < BENCH_FILE_SIZE; off += BENCH_CHUNK) {
+        ex_read("/file", buffer, BENCH_CHUNK, off);
+
+        if (memcmp(buffer, data + off, BENCH_CHUNK)) {
+            fprintf(stderr, "%s: data mismatch at %zu\n", name, off);
+            exit(1);
+        }
+    }
+
+    double readed = bench_now();
+    double device = (double)(bench_used_blocks() - used) * EX_BLOCK_SIZE;
+    double mib = BENCH_FILE_SIZE / (1024.0 * 1024.0);
+
+    printf("%-14s %-5s write %8.1f MiB/s  read %8.1f MiB/s  "
+           "device bytes per byte %.3f\n",
+           name, compress ? "lz4" : "raw", mib / (written - start),
+           mib / (readed - written), device / BENCH_FILE_SIZE);
+
+    ex_set_compression(0);
+    ex_deinit();
+    unlink(DEVNAME);
+}
+
+int main(void) {
+
+    ex_set_log_level(fatal);
+
+    char *data = malloc(BENCH_FILE_SIZE);
+
+    if (!data) {
+        return 1;
+    }
+
+    bench_fill_text(data, BENCH_FILE_SIZE);
+    bench_run("compressible", data, 0);
+    bench_run("compressible", data, 1);
+
+    bench_fill_random(data, BENCH_FILE_SIZE);
+    bench_run("incompressible", data, 0);
+    bench_run("incompressible", data, 1);
+
+    free(data);
+
+    return 0;
+}
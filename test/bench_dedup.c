@@ -0,0 +1,126 @@
+#include "../src/dedup.h"
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/super.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+/** Number of written files. */
+#define BENCH_FILES 64
+/** Size of every file. */
+#define BENCH_FILE_SIZE (1024 * 1024)
+/** Size of a single write, it's the default fuse request size. */
+#define BENCH_CHUNK (128 * 1024)
+/** Number of files with a distinct content. */
+#define BENCH_UNIQUE_MAX BENCH_FILES
+
+static const char *DEVNAME = "bench_dedup";
+
+static double bench_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static size_t bench_used_blocks(void) {
+    struct statvfs st;
+    ex_statfs(&st);
+    return st.f_blocks - st.f_bfree;
+}
+
+static void bench_fill_random(char *buffer, size_t size) {
+
+    srand(42);
+
+    for (size_t i = 0; i < size; i++) {
+        buffer[i] = rand();
+    }
+}
+
+/** Write BENCH_FILES files, only `unique` of them have a distinct content,
+ *  the others are copies, like vendored files in container images. */
+static void bench_run(const char *data, size_t unique, int dedup) {
+
+    unlink(DEVNAME);
+
+    struct ex_mkfs_params params;
+    memset(&params, '\0', sizeof(params));
+
+    params.device = (char *)DEVNAME;
+    params.create = 1;
+    params.number_of_inodes =
+        2 * BENCH_FILES * BENCH_FILE_SIZE / EX_BLOCK_SIZE /
+        EX_DATA_BLOCKS_PER_INODE;
+
+    ex_mkfs_check_params(&params);
+    ex_mkfs(&params);
+    ex_set_dedup(dedup);
+    ex_dedup_reset_stats();
+
+    size_t used = bench_used_blocks();
+    double start = bench_now();
+
+    for (size_t file = 0; file < BENCH_FILES; file++) {
+
+        char path[32];
+        snprintf(path, sizeof(path), "/file%zu", file);
+        ex_create(path, S_IRWXU, getgid(), getuid());
+
+        const char *content = data + (file % unique) * BENCH_FILE_SIZE;
+
+        for (size_t off = 0; off < BENCH_FILE_SIZE; off += BENCH_CHUNK) {
+            ex_write(path, content + off, BENCH_CHUNK, off);
+        }
+    }
+
+    // the data are deduplicated by the writeback
+    ex_sync();
+
+    double written = bench_now();
+    double device = (double)(bench_used_blocks() - used) * EX_BLOCK_SIZE;
+    double mib = BENCH_FILES * BENCH_FILE_SIZE / (1024.0 * 1024.0);
+
+    struct ex_dedup_stats stats;
+    ex_dedup_get_stats(&stats);
+
+    printf("unique %3zu/%d %-7s write %8.1f MiB/s  hit ratio %.3f  "
+           "device bytes per byte %.3f\n",
+           unique, BENCH_FILES, dedup ? "dedup" : "nodedup",
+           mib / (written - start),
+           stats.lookups ? (double)stats.hits / stats.lookups : 0.0,
+           device / (BENCH_FILES * BENCH_FILE_SIZE));
+
+    ex_set_dedup(0);
+    ex_deinit();
+    unlink(DEVNAME);
+}
+
+int main(void) {
+
+    ex_set_log_level(fatal);
+
+    char *data = malloc(BENCH_UNIQUE_MAX * BENCH_FILE_SIZE);
+
+    if (!data) {
+        return 1;
+    }
+
+    bench_fill_random(data, BENCH_UNIQUE_MAX * BENCH_FILE_SIZE);
+
+    const size_t uniques[] = {BENCH_FILES, BENCH_FILES / 2, BENCH_FILES / 8};
+
+    for (size_t i = 0; i < sizeof(uniques) / sizeof(uniques[0]); i++) {
+        bench_run(data, uniques[i], 0);
+        bench_run(data, uniques[i], 1);
+    }
+
+    free(data);
+
+    return 0;
+}
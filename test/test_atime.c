@@ -0,0 +1,114 @@
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/icache.h"
+
+#include <err.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static struct timespec read_atime(const char *pathname) {
+
+    char buffer[4];
+    int rv = ex_read(pathname, buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(buffer));
+
+    struct stat st;
+    rv = ex_getattr(pathname, &st);
+    g_assert(!rv);
+
+    return st.st_atim;
+}
+
+static int same_time(struct timespec a, struct timespec b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static void create_file(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_write("/file", "data", 4, 0);
+    g_assert_cmpint(rv, ==, 4);
+
+    rv = ex_sync();
+    g_assert(!rv);
+}
+
+void test_atime_relatime(void) {
+
+    create_file();
+
+    // atime is older than mtime, the first read updates it
+    struct timespec first = read_atime("/file");
+    struct timespec second = read_atime("/file");
+
+    g_assert(same_time(first, second));
+
+    // a modification allows the next update
+    int rv = ex_write("/file", "data", 4, 0);
+    g_assert_cmpint(rv, ==, 4);
+
+    struct timespec third = read_atime("/file");
+    g_assert(!same_time(second, third));
+
+    ex_deinit();
+}
+
+void test_atime_noatime(void) {
+
+    ex_set_atime_mode(EX_ATIME_NOATIME, 0);
+    create_file();
+
+    struct stat st;
+    int rv = ex_getattr("/file", &st);
+    g_assert(!rv);
+
+    struct ex_icache_stats stats;
+    ex_icache_get_stats(&stats);
+    g_assert_cmpint(stats.dirty, ==, 0);
+
+    struct timespec atime = read_atime("/file");
+    g_assert(same_time(st.st_atim, atime));
+
+    ex_icache_get_stats(&stats);
+    g_assert_cmpint(stats.dirty, ==, 0);
+
+    ex_deinit();
+    ex_set_atime_mode(EX_ATIME_RELATIME, 0);
+}
+
+void test_atime_lazytime(void) {
+
+    ex_set_atime_mode(EX_ATIME_STRICT, 1);
+    create_file();
+
+    struct timespec first = read_atime("/file");
+    struct timespec second = read_atime("/file");
+    g_assert(!same_time(first, second));
+
+    // timestamps alone do not make the inode dirty
+    struct ex_icache_stats stats;
+    ex_icache_get_stats(&stats);
+    g_assert_cmpint(stats.dirty, ==, 0);
+
+    // but they are written on unmount
+    ex_set_atime_mode(EX_ATIME_NOATIME, 0);
+    struct timespec cached = read_atime("/file");
+
+    ex_deinit();
+
+    g_assert_cmpint(ex_init(EX_DEVICE), ==, OK);
+
+    struct timespec reloaded = read_atime("/file");
+    g_assert(same_time(cached, reloaded));
+
+    ex_deinit();
+    ex_set_atime_mode(EX_ATIME_RELATIME, 0);
+}
@@ -0,0 +1,101 @@
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/super.h"
+#include "test_helpers.h"
+
+#include <errno.h>
+#include <err.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+void test_clone(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/src", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_create("/dst", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    fsblkcnt_t baseline = ex_test_free_blocks();
+
+    static char data[4 * EX_BLOCK_SIZE];
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = i % 251;
+    }
+
+    rv = ex_write("/src", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    fsblkcnt_t written = ex_test_free_blocks();
+
+    // the clone shares blocks of the source
+    rv = ex_clone_file("/src", "/dst");
+    g_assert(!rv);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, written);
+
+    static char buffer[sizeof(data)];
+    rv = ex_read("/dst", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    // a partial write copies the shared block, the source is not changed
+    rv = ex_write("/dst", "clone", 5, EX_BLOCK_SIZE + 10);
+    g_assert_cmpint(rv, ==, 5);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, written - 1);
+
+    rv = ex_read("/dst", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer + EX_BLOCK_SIZE + 10, "clone", 5));
+    g_assert(!memcmp(buffer, data, EX_BLOCK_SIZE + 10));
+    g_assert(!memcmp(buffer + EX_BLOCK_SIZE + 15, data + EX_BLOCK_SIZE + 15,
+                     sizeof(data) - EX_BLOCK_SIZE - 15));
+
+    rv = ex_read("/src", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    // only the block replaced in the clone is freed with the source
+    rv = ex_unlink("/src");
+    g_assert(!rv);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, written);
+
+    rv = ex_read("/dst", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, EX_BLOCK_SIZE + 10));
+
+    rv = ex_unlink("/dst");
+    g_assert(!rv);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, baseline);
+
+    // small files are cloned through inline data
+    rv = ex_create("/small", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_create("/small-clone", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_write("/small", "inline", 6, 0);
+    g_assert_cmpint(rv, ==, 6);
+
+    rv = ex_clone_file("/small", "/small-clone");
+    g_assert(!rv);
+
+    rv = ex_read("/small-clone", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, 6);
+    g_assert(!memcmp(buffer, "inline", 6));
+
+    rv = ex_clone_file("/", "/small-clone");
+    g_assert_cmpint(rv, ==, -EISDIR);
+
+    rv = ex_clone_file("/none", "/small-clone");
+    g_assert_cmpint(rv, ==, -ENOENT);
+
+    ex_deinit();
+}
@@ -0,0 +1,195 @@
+#include "../src/compress.h"
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/super.h"
+#include "test_helpers.h"
+
+#include <errno.h>
+#include <err.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/** Fill the buffer with text which compresses well. */
+static void ex_test_fill_text(char *buffer, size_t size) {
+
+    size_t done = 0;
+
+    for (size_t line = 0; done < size; line++) {
+
+        char text[128];
+        int length = snprintf(text, sizeof(text),
+                              "{\"id\": %zu, \"level\": \"info\", "
+                              "\"message\": \"request served\"}\n",
+                              line);
+
+        for (int i = 0; i < length && done < size; i++) {
+            buffer[done++] = text[i];
+        }
+    }
+}
+
+void test_lz4_roundtrip(void) {
+
+    static char data[3 * EX_BLOCK_SIZE];
+    static char packed[2 * sizeof(data)];
+    static char unpacked[sizeof(data)];
+
+    ex_test_fill_text(data, sizeof(data));
+
+    // inputs shorter than the minimal match are stored as literals
+    const size_t sizes[] = {0, 1, 12, 13, 100, sizeof(data)};
+
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+
+        size_t size = ex_lz4_compress(data, sizes[i], packed, sizeof(packed));
+        g_assert_cmpuint(size, >, 0);
+
+        ssize_t unsize =
+            ex_lz4_decompress(packed, size, unpacked, sizeof(unpacked));
+        g_assert_cmpint(unsize, ==, sizes[i]);
+        g_assert(!memcmp(unpacked, data, sizes[i]));
+    }
+
+    size_t size = ex_lz4_compress(data, sizeof(data), packed, sizeof(packed));
+    g_assert_cmpuint(size, <, sizeof(data) / 4);
+
+    // long runs of the same byte are overlapping matches
+    memset(data, 'x', sizeof(data));
+
+    size = ex_lz4_compress(data, sizeof(data), packed, sizeof(packed));
+    g_assert_cmpuint(size, <, 100);
+    g_assert_cmpint(ex_lz4_decompress(packed, size, unpacked, sizeof(unpacked)),
+                    ==, sizeof(data));
+    g_assert(!memcmp(unpacked, data, sizeof(data)));
+
+    // random data do not fit into a smaller buffer
+    srand(42);
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = rand();
+    }
+
+    g_assert_cmpuint(ex_lz4_compress(data, sizeof(data), packed,
+                                     sizeof(data) - EX_BLOCK_SIZE),
+                     ==, 0);
+
+    // malformed blocks are rejected
+    g_assert_cmpint(ex_lz4_decompress("\xf0", 1, unpacked, sizeof(unpacked)),
+                    ==, -1);
+    g_assert_cmpint(
+        ex_lz4_decompress("\x10" "a" "\x05\x00", 4, unpacked, sizeof(unpacked)),
+        ==, -1);
+}
+
+void test_compress(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+    ex_set_compression(1);
+
+    int rv = ex_create("/log", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    fsblkcnt_t baseline = ex_test_free_blocks();
+
+    // two full clusters and a partial one
+    static char data[(2 * EX_COMPRESS_CLUSTER + 5) * EX_BLOCK_SIZE + 100];
+    static char buffer[sizeof(data)];
+
+    ex_test_fill_text(data, sizeof(data));
+
+    rv = ex_write("/log", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    fsblkcnt_t written = ex_test_free_blocks();
+
+    // the writeback compresses the data
+    g_assert(!ex_sync());
+    g_assert_cmpuint(ex_test_free_blocks(), >, written);
+    g_assert_cmpuint(baseline - ex_test_free_blocks(), <,
+                     (baseline - written) / 2);
+
+    struct ex_compress_stats stats;
+    ex_compress_get_stats(&stats);
+    g_assert_cmpuint(stats.compressed, ==, 3);
+
+    rv = ex_read("/log", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    // an unaligned write decompresses only the cluster it touches
+    memcpy(data + EX_COMPRESS_CLUSTER * EX_BLOCK_SIZE + 10, "overwritten", 11);
+
+    rv = ex_write("/log", "overwritten", 11,
+                  EX_COMPRESS_CLUSTER * EX_BLOCK_SIZE + 10);
+    g_assert_cmpint(rv, ==, 11);
+
+    rv = ex_read("/log", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    // appended data are compressed with the partial cluster
+    rv = ex_write("/log", data, 2 * EX_BLOCK_SIZE, sizeof(data));
+    g_assert_cmpint(rv, ==, 2 * EX_BLOCK_SIZE);
+    g_assert(!ex_sync());
+
+    rv = ex_read("/log", buffer, 2 * EX_BLOCK_SIZE, sizeof(data));
+    g_assert_cmpint(rv, ==, 2 * EX_BLOCK_SIZE);
+    g_assert(!memcmp(buffer, data, 2 * EX_BLOCK_SIZE));
+
+    rv = ex_read("/log", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    // clones share the compressed blocks
+    rv = ex_create("/copy", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_clone_file("/log", "/copy");
+    g_assert(!rv);
+
+    rv = ex_read("/copy", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    rv = ex_unlink("/copy");
+    g_assert(!rv);
+
+    // random data stay raw
+    rv = ex_create("/random", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    srand(42);
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = rand();
+    }
+
+    rv = ex_write("/random", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    written = ex_test_free_blocks();
+    g_assert(!ex_sync());
+    g_assert_cmpuint(ex_test_free_blocks(), ==, written);
+
+    rv = ex_read("/random", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    // compressed blocks are freed with the file
+    rv = ex_unlink("/random");
+    g_assert(!rv);
+
+    rv = ex_unlink("/log");
+    g_assert(!rv);
+
+    g_assert_cmpuint(ex_test_free_blocks(), ==, baseline);
+
+    ex_set_compression(0);
+    ex_deinit();
+}
@@ -0,0 +1,112 @@
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/super.h"
+#include "test_helpers.h"
+
+#include <errno.h>
+#include <err.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+void test_copy_range(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/src", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_create("/dst", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    // the source has a hole in the second block
+    static char data[4 * EX_BLOCK_SIZE];
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = i % 251;
+    }
+
+    memset(data + EX_BLOCK_SIZE, '\0', EX_BLOCK_SIZE);
+
+    rv = ex_write("/src", data, EX_BLOCK_SIZE, 0);
+    g_assert_cmpint(rv, ==, EX_BLOCK_SIZE);
+
+    rv = ex_write("/src", data + 2 * EX_BLOCK_SIZE, 2 * EX_BLOCK_SIZE,
+                  2 * EX_BLOCK_SIZE);
+    g_assert_cmpint(rv, ==, 2 * EX_BLOCK_SIZE);
+
+    // unaligned copy, it ends at the end of the source
+    ssize_t copied = ex_copy_range("/src", 5, "/dst", 3, sizeof(data));
+    g_assert_cmpint(copied, ==, sizeof(data) - 5);
+
+    static char buffer[sizeof(data)];
+    rv = ex_read("/dst", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data) - 2);
+    g_assert(!memcmp(buffer, "\0\0\0", 3));
+    g_assert(!memcmp(buffer + 3, data + 5, sizeof(data) - 5));
+
+    // small files are copied through inline data
+    rv = ex_create("/small", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    copied = ex_copy_range("/src", 0, "/small", 0, 16);
+    g_assert_cmpint(copied, ==, 16);
+
+    rv = ex_read("/small", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, 16);
+    g_assert(!memcmp(buffer, data, 16));
+
+    copied = ex_copy_range("/small", 0, "/dst", EX_BLOCK_SIZE, 16);
+    g_assert_cmpint(copied, ==, 16);
+
+    rv = ex_read("/dst", buffer, 16, EX_BLOCK_SIZE);
+    g_assert_cmpint(rv, ==, 16);
+    g_assert(!memcmp(buffer, data, 16));
+
+    // aligned ranges share whole blocks instead of copying them
+    rv = ex_create("/shared", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    fsblkcnt_t baseline = ex_test_free_blocks();
+
+    copied = ex_copy_range("/src", 0, "/shared", 0, sizeof(data));
+    g_assert_cmpint(copied, ==, sizeof(data));
+
+    g_assert_cmpuint(ex_test_free_blocks(), ==, baseline);
+
+    rv = ex_read("/shared", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    // the shared blocks are copied on write
+    rv = ex_write("/shared", "x", 1, 2 * EX_BLOCK_SIZE);
+    g_assert_cmpint(rv, ==, 1);
+
+    rv = ex_read("/src", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    // the unaligned head and tail are copied, blocks between are shared
+    copied = ex_copy_range("/src", 100, "/shared", 100,
+                           2 * EX_BLOCK_SIZE + 100);
+    g_assert_cmpint(copied, ==, 2 * EX_BLOCK_SIZE + 100);
+
+    rv = ex_read("/shared", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    // overlapping ranges of the same file are rejected
+    copied = ex_copy_range("/src", 0, "/src", 10, 100);
+    g_assert_cmpint(copied, ==, -EINVAL);
+
+    copied = ex_copy_range("/src", 0, "/", 0, 100);
+    g_assert_cmpint(copied, ==, -EISDIR);
+
+    copied = ex_copy_range("/none", 0, "/dst", 0, 100);
+    g_assert_cmpint(copied, ==, -ENOENT);
+
+    ex_deinit();
+}
@@ -0,0 +1,182 @@
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/dcache.h"
+#include "../src/dir.h"
+#include "../src/inode.h"
+#include "../src/path.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+void test_dcache_negative(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_mkdir("/include", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    struct stat st;
+    rv = ex_getattr("/include/missing.h", &st);
+    g_assert_cmpint(rv, ==, -ENOENT);
+
+    struct ex_dcache_stats stats;
+    struct ex_dir_stats dir_stats;
+
+    ex_dcache_reset_stats();
+    ex_dir_reset_stats();
+
+    // probes of a missing name do not read the directory
+    for (size_t i = 0; i < 16; i++) {
+        rv = ex_getattr("/include/missing.h", &st);
+        g_assert_cmpint(rv, ==, -ENOENT);
+    }
+
+    ex_dcache_get_stats(&stats);
+    ex_dir_get_stats(&dir_stats);
+
+    g_assert_cmpuint(stats.misses, ==, 0);
+    g_assert_cmpuint(stats.negative_hits, ==, 16);
+    g_assert_cmpuint(stats.hits, ==, 16);
+    g_assert_cmpuint(dir_stats.block_reads, ==, 0);
+
+    // the negative entry is replaced by the created one
+    rv = ex_create("/include/missing.h", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_getattr("/include/missing.h", &st);
+    g_assert(!rv);
+
+    rv = ex_link("/include/missing.h", "/include/link.h");
+    g_assert(!rv);
+
+    rv = ex_getattr("/include/link.h", &st);
+    g_assert(!rv);
+
+    rv = ex_symlink("/include/missing.h", "/include/symlink.h");
+    g_assert(!rv);
+
+    rv = ex_getattr("/include/symlink.h", &st);
+    g_assert(!rv);
+
+    // removed names become negative entries
+    rv = ex_unlink("/include/missing.h");
+    g_assert(!rv);
+
+    rv = ex_getattr("/include/missing.h", &st);
+    g_assert_cmpint(rv, ==, -ENOENT);
+
+    rv = ex_rename("/include/link.h", "/include/renamed.h");
+    g_assert(!rv);
+
+    rv = ex_getattr("/include/link.h", &st);
+    g_assert_cmpint(rv, ==, -ENOENT);
+
+    rv = ex_getattr("/include/renamed.h", &st);
+    g_assert(!rv);
+
+    // rename over an existing name points it to the moved inode
+    rv = ex_create("/include/other.h", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    struct stat renamed;
+    rv = ex_getattr("/include/renamed.h", &renamed);
+    g_assert(!rv);
+
+    rv = ex_getattr("/include/other.h", &st);
+    g_assert(!rv);
+
+    rv = ex_rename("/include/renamed.h", "/include/other.h");
+    g_assert(!rv);
+
+    rv = ex_getattr("/include/other.h", &st);
+    g_assert(!rv);
+    g_assert_cmpuint(st.st_ino, ==, renamed.st_ino);
+
+    // a removed directory does not leave its entries behind
+    rv = ex_mkdir("/tmp", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_create("/tmp/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_unlink("/tmp/file");
+    g_assert(!rv);
+
+    rv = ex_rmdir("/tmp");
+    g_assert(!rv);
+
+    rv = ex_getattr("/tmp", &st);
+    g_assert_cmpint(rv, ==, -ENOENT);
+
+    rv = ex_create("/tmp", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_getattr("/tmp/file", &st);
+    g_assert_cmpint(rv, ==, -ENOENT);
+
+    ex_deinit();
+
+    ex_dcache_get_stats(&stats);
+    g_assert_cmpuint(stats.cached, ==, 0);
+}
+
+void test_dcache_read_error(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_mkdir("/dir", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_create("/dir/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    // make the directory hashed, so it has an index root to corrupt
+    char name[64];
+
+    for (size_t i = 0; i < EX_DIR_INDEX_THRESHOLD * EX_DIR_BLOCK_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "/dir/link-%04zu", i);
+        rv = ex_link("/dir/file", name);
+        g_assert(!rv);
+    }
+
+    struct ex_path *path = ex_path_make("/dir");
+    struct ex_inode *dir = ex_inode_find(path);
+    g_assert(dir);
+    g_assert(dir->flags & EX_INODE_DIR_HASHED);
+
+    block_address root = ex_inode_block_address(dir, 0);
+    g_assert_cmpuint(root, !=, EX_BLOCK_INVALID_ADDRESS);
+
+    char saved[EX_BLOCK_SIZE];
+    char garbage[EX_BLOCK_SIZE];
+    memset(garbage, 0xff, sizeof(garbage));
+
+    g_assert_cmpint(ex_device_read_to_buffer(NULL, saved, root, EX_BLOCK_SIZE),
+                    ==, OK);
+    g_assert_cmpint(ex_device_write(root, garbage, sizeof(garbage)), ==, OK);
+
+    ex_dcache_clear();
+
+    struct stat st;
+    rv = ex_getattr("/dir/file", &st);
+    g_assert_cmpint(rv, ==, -ENOENT);
+
+    // the failed lookup is not remembered as a missing name
+    g_assert_cmpint(ex_device_write(root, saved, sizeof(saved)), ==, OK);
+
+    rv = ex_getattr("/dir/file", &st);
+    g_assert(!rv);
+
+    ex_inode_put(dir);
+    ex_path_free(path);
+
+    ex_deinit();
+}
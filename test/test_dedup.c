@@ -0,0 +1,170 @@
+#include "../src/dedup.h"
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/super.h"
+#include "test_helpers.h"
+
+#include <errno.h>
+#include <err.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/** Fill every block of the buffer with a different content. */
+static void ex_test_fill_blocks(char *buffer, size_t nblocks, int seed) {
+
+    for (size_t i = 0; i < nblocks * EX_BLOCK_SIZE; i++) {
+        buffer[i] = (i / EX_BLOCK_SIZE * 31 + i + seed) % 251;
+    }
+}
+
+void test_hash128(void) {
+
+    uint64_t hash[2], other[2];
+
+    ex_hash128("", 0, hash);
+    g_assert_cmpuint(hash[0], ==, 0);
+    g_assert_cmpuint(hash[1], ==, 0);
+
+    static char data[EX_BLOCK_SIZE];
+    ex_test_fill_blocks(data, 1, 0);
+
+    ex_hash128(data, sizeof(data), hash);
+    ex_hash128(data, sizeof(data), other);
+    g_assert_cmpuint(hash[0], ==, other[0]);
+    g_assert_cmpuint(hash[1], ==, other[1]);
+
+    // a single changed bit changes both halves
+    data[100] ^= 1;
+
+    ex_hash128(data, sizeof(data), other);
+    g_assert_cmpuint(hash[0], !=, other[0]);
+    g_assert_cmpuint(hash[1], !=, other[1]);
+
+    // the tail is hashed as well
+    ex_hash128(data, 17, hash);
+    ex_hash128(data, 18, other);
+    g_assert_cmpuint(hash[0], !=, other[0]);
+}
+
+void test_dedup(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+    ex_set_dedup(1);
+    ex_dedup_reset_stats();
+
+    int rv = ex_create("/a", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_create("/b", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    fsblkcnt_t baseline = ex_test_free_blocks();
+
+    static char data[8 * EX_BLOCK_SIZE];
+    static char buffer[sizeof(data)];
+
+    ex_test_fill_blocks(data, 8, 0);
+
+    rv = ex_write("/a", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!ex_sync());
+
+    fsblkcnt_t written = ex_test_free_blocks();
+
+    // the copy shares all blocks of the original
+    rv = ex_write("/b", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!ex_sync());
+    g_assert_cmpuint(ex_test_free_blocks(), ==, written);
+
+    struct ex_dedup_stats stats;
+    ex_dedup_get_stats(&stats);
+    g_assert_cmpuint(stats.lookups, ==, 16);
+    g_assert_cmpuint(stats.hits, ==, 8);
+
+    rv = ex_read("/b", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    // a write to the shared block copies it, the original is not changed
+    rv = ex_write("/b", "dedup", 5, 2 * EX_BLOCK_SIZE + 10);
+    g_assert_cmpint(rv, ==, 5);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, written - 1);
+
+    rv = ex_read("/a", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    rv = ex_read("/b", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer + 2 * EX_BLOCK_SIZE + 10, "dedup", 5));
+
+    // only the block replaced in the copy is freed with the original
+    rv = ex_unlink("/a");
+    g_assert(!rv);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, written);
+
+    rv = ex_unlink("/b");
+    g_assert(!rv);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, baseline);
+
+    // blocks of the same file are shared too
+    rv = ex_create("/zeros", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    memset(data, '\0', sizeof(data));
+
+    rv = ex_write("/zeros", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!ex_sync());
+    g_assert_cmpuint(baseline - ex_test_free_blocks(), ==, 1);
+
+    rv = ex_read("/zeros", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    rv = ex_unlink("/zeros");
+    g_assert(!rv);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, baseline);
+
+    // an entry of a block which was overwritten is not used
+    rv = ex_create("/old", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_create("/new", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    ex_test_fill_blocks(data, 1, 1);
+
+    rv = ex_write("/old", data, EX_BLOCK_SIZE, 0);
+    g_assert_cmpint(rv, ==, EX_BLOCK_SIZE);
+    g_assert(!ex_sync());
+
+    rv = ex_write("/old", "changed", 7, 0);
+    g_assert_cmpint(rv, ==, 7);
+    g_assert(!ex_sync());
+
+    ex_dedup_reset_stats();
+
+    rv = ex_write("/new", data, EX_BLOCK_SIZE, 0);
+    g_assert_cmpint(rv, ==, EX_BLOCK_SIZE);
+    g_assert(!ex_sync());
+
+    ex_dedup_get_stats(&stats);
+    g_assert_cmpuint(stats.hits, ==, 0);
+    g_assert_cmpuint(stats.stale, ==, 1);
+    g_assert_cmpuint(baseline - ex_test_free_blocks(), ==, 2);
+
+    rv = ex_read("/new", buffer, EX_BLOCK_SIZE, 0);
+    g_assert_cmpint(rv, ==, EX_BLOCK_SIZE);
+    g_assert(!memcmp(buffer, data, EX_BLOCK_SIZE));
+
+    ex_set_dedup(0);
+    ex_deinit();
+}
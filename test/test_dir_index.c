@@ -0,0 +1,626 @@
+#include "../src/dir.h"
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/inode.h"
+#include "../src/path.h"
+#include "test_helpers.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/** Number of entries of the big directory. */
+#define EX_TEST_DIR_ENTRIES 10000
+
+static struct ex_inode *ex_test_find(const char *pathname) {
+
+    struct ex_path *path = ex_path_make(pathname);
+    struct ex_inode *inode = ex_inode_find(path);
+
+    ex_path_free(path);
+
+    return inode;
+}
+
+static size_t ex_test_count_entries(const char *pathname) {
+
+    struct ex_dir_entry **entries;
+    g_assert(!ex_readdir(pathname, &entries));
+
+    size_t count = 0;
+
+    for (; entries[count]; count++) {
+        ex_dir_entry_free(entries[count]);
+    }
+
+    free(entries);
+
+    return count;
+}
+
+/** Get the number of directory blocks read by the lookup of `name`. */
+static size_t ex_test_lookup_reads(struct ex_inode *dir, const char *name,
+                                   int exists) {
+
+    struct ex_dir_stats stats;
+    struct ex_dir_entry entry;
+
+    ex_dir_reset_stats();
+
+    ex_status status = ex_dir_lookup(dir, name, &entry, NULL);
+    g_assert_cmpint(status, ==, exists ? OK : INODE_NOT_FOUND);
+
+    ex_dir_get_stats(&stats);
+
+    return stats.block_reads;
+}
+
+void test_dir_index(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_mkdir("/big", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    char name[64];
+
+    for (size_t i = 0; i < EX_TEST_DIR_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "/big/entry-%05zu", i);
+        rv = ex_link("/file", name);
+        g_assert(!rv);
+    }
+
+    // the directory outgrew the linear format
+    struct ex_inode *dir = ex_test_find("/big");
+    g_assert(dir);
+    g_assert(dir->flags & EX_INODE_DIR_HASHED);
+
+    // lookups read the root and one leaf
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "entry-00000", 1), <=, 2);
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "entry-09999", 1), <=, 2);
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "entry-04242", 1), <=, 2);
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "missing", 0), <=, 2);
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "..", 1), <=, 2);
+
+    ex_inode_put(dir);
+
+    g_assert_cmpuint(ex_test_count_entries("/big"), ==,
+                     EX_TEST_DIR_ENTRIES + 2);
+
+    // removed entries are not found, their slots are reused
+    for (size_t i = 0; i < EX_TEST_DIR_ENTRIES; i += 2) {
+        snprintf(name, sizeof(name), "/big/entry-%05zu", i);
+        rv = ex_unlink(name);
+        g_assert(!rv);
+    }
+
+    struct stat st;
+
+    rv = ex_getattr("/big/entry-00100", &st);
+    g_assert_cmpint(rv, ==, -ENOENT);
+
+    rv = ex_getattr("/big/entry-00101", &st);
+    g_assert(!rv);
+
+    g_assert_cmpuint(ex_test_count_entries("/big"), ==,
+                     EX_TEST_DIR_ENTRIES / 2 + 2);
+
+    // entries are moved between linear and hashed directories
+    rv = ex_mkdir("/small", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_rename("/big/entry-00101", "/small/moved");
+    g_assert(!rv);
+
+    rv = ex_rename("/small/moved", "/big/entry-00100");
+    g_assert(!rv);
+
+    rv = ex_getattr("/big/entry-00100", &st);
+    g_assert(!rv);
+
+    rv = ex_getattr("/big/entry-00101", &st);
+    g_assert_cmpint(rv, ==, -ENOENT);
+
+    g_assert_cmpuint(ex_test_count_entries("/small"), ==, 2);
+
+    // directories stay linear when the index is disabled
+    ex_dir_set_format(EX_DIR_LINEAR);
+
+    for (size_t i = 0; i < 2 * EX_DIR_INDEX_THRESHOLD * EX_BLOCK_SIZE /
+                                sizeof(struct ex_dir_entry);
+         i++) {
+        snprintf(name, sizeof(name), "/small/entry-%05zu", i);
+        rv = ex_link("/file", name);
+        g_assert(!rv);
+    }
+
+    dir = ex_test_find("/small");
+    g_assert(dir);
+    g_assert(!(dir->flags & EX_INODE_DIR_HASHED));
+    ex_inode_put(dir);
+
+    rv = ex_getattr("/small/entry-00300", &st);
+    g_assert(!rv);
+
+    ex_dir_set_format(EX_DIR_HASHED);
+    ex_deinit();
+}
+
+/** Number of entries of the B+tree directory. */
+#define EX_TEST_BTREE_ENTRIES 5000
+
+void test_dir_btree(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+    ex_dir_set_format(EX_DIR_BTREE);
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_mkdir("/tree", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    char name[64];
+
+    // names are not inserted in their order
+    for (size_t i = 0; i < EX_TEST_BTREE_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "/tree/n%05zu",
+                 i * 7919 % EX_TEST_BTREE_ENTRIES);
+        rv = ex_link("/file", name);
+        g_assert(!rv);
+    }
+
+    struct ex_inode *dir = ex_test_find("/tree");
+    g_assert(dir);
+    g_assert(dir->flags & EX_INODE_DIR_BTREE);
+
+    // lookups read one node per level
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "n00000", 1), <=, 3);
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "n04999", 1), <=, 3);
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "n05000", 0), <=, 3);
+
+    // entries are iterated in the order of names
+    struct ex_dir_cursor cursor;
+    struct ex_dir_entry entry;
+    char last[EX_NAME_LEN] = "";
+    size_t count = 0;
+
+    ex_dir_cursor_open(&cursor, dir, NULL);
+
+    while (ex_dir_cursor_next(&cursor, dir, &entry) == OK) {
+        g_assert_cmpint(strcmp(last, entry.name), <, 0);
+        strcpy(last, entry.name);
+        count++;
+    }
+
+    g_assert_cmpuint(count, ==, EX_TEST_BTREE_ENTRIES + 2);
+    g_assert_cmpuint(cursor.offset, ==, count);
+
+    // a seek finds the entry by its ordinal number
+    ex_dir_cursor_open(&cursor, dir, NULL);
+    g_assert(ex_dir_cursor_seek(&cursor, dir, 2502) == OK);
+    g_assert(ex_dir_cursor_next(&cursor, dir, &entry) == OK);
+    g_assert_cmpstr(entry.name, ==, "n02500");
+
+    ex_inode_put(dir);
+
+    // the cursor resumes after the last name while the directory changes
+    rv = ex_unlink("/tree/n02501");
+    g_assert(!rv);
+
+    rv = ex_unlink("/tree/n00010");
+    g_assert(!rv);
+
+    for (size_t i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "/tree/n02500-%03zu", i);
+        rv = ex_link("/file", name);
+        g_assert(!rv);
+    }
+
+    dir = ex_test_find("/tree");
+    g_assert(dir);
+
+    g_assert(ex_dir_cursor_seek(&cursor, dir, cursor.offset) == OK);
+    g_assert(ex_dir_cursor_next(&cursor, dir, &entry) == OK);
+    g_assert_cmpstr(entry.name, ==, "n02500-000");
+
+    for (size_t i = 1; i < 200; i++) {
+        g_assert(ex_dir_cursor_next(&cursor, dir, &entry) == OK);
+    }
+
+    g_assert(ex_dir_cursor_next(&cursor, dir, &entry) == OK);
+    g_assert_cmpstr(entry.name, ==, "n02502");
+
+    // a prefix scan returns only the matching range
+    ex_dir_reset_stats();
+    ex_dir_cursor_open(&cursor, dir, "n012");
+    count = 0;
+
+    while (ex_dir_cursor_next(&cursor, dir, &entry) == OK) {
+        snprintf(name, sizeof(name), "n012%02zu", count++);
+        g_assert_cmpstr(entry.name, ==, name);
+    }
+
+    g_assert_cmpuint(count, ==, 100);
+
+    struct ex_dir_stats stats;
+    ex_dir_get_stats(&stats);
+    g_assert_cmpuint(stats.block_reads, <=, 8);
+
+    ex_inode_put(dir);
+
+    g_assert_cmpuint(ex_test_count_entries("/tree"), ==,
+                     EX_TEST_BTREE_ENTRIES + 2 - 2 + 200);
+
+    // emptied directory can be removed
+    for (size_t i = 0; i < EX_TEST_BTREE_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "/tree/n%05zu", i);
+        rv = ex_unlink(name);
+        g_assert(i == 10 || i == 2501 ? rv == -ENOENT : !rv);
+    }
+
+    for (size_t i = 0; i < 200; i++) {
+        snprintf(name, sizeof(name), "/tree/n02500-%03zu", i);
+        rv = ex_unlink(name);
+        g_assert(!rv);
+    }
+
+    g_assert_cmpuint(ex_test_count_entries("/tree"), ==, 2);
+
+    rv = ex_rmdir("/tree");
+    g_assert(!rv);
+
+    ex_dir_set_format(EX_DIR_HASHED);
+    ex_deinit();
+}
+
+void test_dir_high_water(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_mkdir("/dir", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    struct ex_inode *dir = ex_test_find("/dir");
+    g_assert(dir);
+    g_assert_cmpuint(dir->dir_blocks, ==, 1);
+    g_assert_cmpuint(dir->dir_entries, ==, 2);
+
+    // a miss in the small directory reads only its first block
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "missing", 0), ==, 1);
+
+    // fill three blocks, "." and ".." are in the first one
+    const size_t count = 3 * EX_DIR_BLOCK_ENTRIES - 2;
+    char name[64];
+
+    for (size_t i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "/dir/entry-%03zu", i);
+        rv = ex_link("/file", name);
+        g_assert(!rv);
+    }
+
+    g_assert_cmpuint(dir->dir_blocks, ==, 3);
+    g_assert_cmpuint(dir->dir_entries, ==, count + 2);
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "missing", 0), ==, 3);
+
+    // the mark goes down when the trailing blocks are emptied
+    for (size_t i = EX_DIR_BLOCK_ENTRIES - 2; i < count; i++) {
+        snprintf(name, sizeof(name), "/dir/entry-%03zu", i);
+        rv = ex_unlink(name);
+        g_assert(!rv);
+    }
+
+    g_assert_cmpuint(dir->dir_blocks, ==, 1);
+    g_assert_cmpuint(dir->dir_entries, ==, EX_DIR_BLOCK_ENTRIES);
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "missing", 0), ==, 1);
+
+    // iteration stops at the mark too
+    ex_dir_reset_stats();
+    g_assert_cmpuint(ex_test_count_entries("/dir"), ==, EX_DIR_BLOCK_ENTRIES);
+
+    struct ex_dir_stats stats;
+    ex_dir_get_stats(&stats);
+    g_assert_cmpuint(stats.block_reads, ==, 1);
+
+    // the freed block after the mark is reused
+    rv = ex_link("/file", "/dir/again");
+    g_assert(!rv);
+
+    g_assert_cmpuint(dir->dir_blocks, ==, 2);
+    g_assert_cmpuint(ex_test_lookup_reads(dir, "again", 1), ==, 2);
+
+    // the counts are stored with the inode
+    struct ex_inode disk;
+    g_assert_cmpint(ex_inode_load(dir->address, &disk), ==, OK);
+    g_assert_cmpuint(disk.dir_blocks, ==, 2);
+    g_assert_cmpuint(disk.dir_entries, ==, EX_DIR_BLOCK_ENTRIES + 1);
+
+    ex_inode_put(dir);
+    ex_deinit();
+}
+
+/** Number of entries inserted to the linear directory. */
+#define EX_TEST_LINEAR_ENTRIES 2000
+
+void test_dir_free_slot(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+    ex_dir_set_format(EX_DIR_LINEAR);
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_mkdir("/dir", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    struct ex_inode *file = ex_test_find("/file");
+    struct ex_inode *dir = ex_test_find("/dir");
+    g_assert(file && dir);
+
+    char name[64];
+    struct ex_dir_stats stats;
+
+    // every insert reads at most the block of the free slot
+    ex_dir_reset_stats();
+
+    for (size_t i = 0; i < EX_TEST_LINEAR_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "entry-%05zu", i);
+        g_assert(ex_dir_insert(dir, name, file->address) == OK);
+    }
+
+    ex_dir_get_stats(&stats);
+    g_assert_cmpuint(stats.block_reads, <=, EX_TEST_LINEAR_ENTRIES);
+    g_assert_cmpuint(dir->dir_free, ==, EX_TEST_LINEAR_ENTRIES + 2);
+
+    // the removed slot is used by the next insert
+    g_assert(ex_dir_remove(dir, "entry-00100") == OK);
+    g_assert(ex_dir_remove(dir, "entry-00500") == OK);
+    g_assert_cmpuint(dir->dir_free, ==, 102);
+
+    ex_dir_reset_stats();
+    g_assert(ex_dir_insert(dir, "again", file->address) == OK);
+
+    ex_dir_get_stats(&stats);
+    g_assert_cmpuint(stats.block_reads, ==, 1);
+
+    struct ex_dir_entry entry;
+    block_address address;
+
+    g_assert(ex_dir_lookup(dir, "again", &entry, &address) == OK);
+    g_assert_cmpuint(address, ==,
+                     ex_inode_block_address(dir, 1) +
+                         (102 - EX_DIR_BLOCK_ENTRIES) * sizeof(entry));
+
+    // the hint is persisted with the directory
+    struct ex_inode disk;
+    g_assert_cmpint(ex_inode_load(dir->address, &disk), ==, OK);
+    g_assert_cmpuint(disk.dir_free, ==, 103);
+
+    g_assert(ex_dir_insert(dir, "next", file->address) == OK);
+    g_assert(ex_dir_lookup(dir, "next", &entry, &address) == OK);
+    g_assert_cmpuint(address, ==,
+                     ex_inode_block_address(dir, 7) +
+                         (502 - 7 * EX_DIR_BLOCK_ENTRIES) * sizeof(entry));
+
+    ex_inode_put(dir);
+    ex_inode_put(file);
+
+    ex_dir_set_format(EX_DIR_HASHED);
+    ex_deinit();
+}
+
+static void ex_test_stat(const char *pathname, size_t entries, size_t nlinks) {
+
+    struct stat st;
+    g_assert(!ex_getattr(pathname, &st));
+
+    g_assert_cmpuint(st.st_size, ==, entries * sizeof(struct ex_dir_entry));
+    g_assert_cmpuint(st.st_nlink, ==, nlinks);
+
+    size_t count = 0;
+    g_assert(!ex_count_entries(pathname, &count));
+    g_assert_cmpuint(count, ==, entries);
+}
+
+void test_dir_counts(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    ex_test_stat("/", 2, 2);
+
+    int rv = ex_mkdir("/a", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_mkdir("/b", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_create("/a/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_mkdir("/a/sub", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    ex_test_stat("/", 4, 4);
+    ex_test_stat("/a", 4, 3);
+    ex_test_stat("/b", 2, 2);
+
+    size_t count;
+    g_assert_cmpint(ex_count_entries("/a/file", &count), ==, -ENOTDIR);
+    g_assert_cmpint(ex_count_entries("/missing", &count), ==, -ENOENT);
+
+    // the empty check does not read entries, only the parent is read
+    struct ex_dir_stats stats;
+    ex_dir_reset_stats();
+
+    rv = ex_rmdir("/a");
+    g_assert_cmpint(rv, ==, -ENOTEMPTY);
+
+    ex_dir_get_stats(&stats);
+    g_assert_cmpuint(stats.block_reads, ==, 1);
+
+    // the moved directory links its new parent
+    rv = ex_rename("/a/sub", "/b/sub");
+    g_assert(!rv);
+
+    ex_test_stat("/a", 3, 2);
+    ex_test_stat("/b", 3, 3);
+
+    struct stat st, parent;
+    g_assert(!ex_getattr("/b/sub/..", &st));
+    g_assert(!ex_getattr("/b", &parent));
+    g_assert_cmpuint(st.st_ino, ==, parent.st_ino);
+
+    // only an empty directory can be replaced, only by a directory
+    rv = ex_rename("/b", "/a");
+    g_assert_cmpint(rv, ==, -ENOTEMPTY);
+
+    rv = ex_rename("/a/file", "/b/sub");
+    g_assert_cmpint(rv, ==, -EISDIR);
+
+    rv = ex_rename("/b/sub", "/a/file");
+    g_assert_cmpint(rv, ==, -ENOTDIR);
+
+    rv = ex_mkdir("/empty", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    ex_test_stat("/", 5, 5);
+
+    rv = ex_rename("/b/sub", "/empty");
+    g_assert(!rv);
+
+    ex_test_stat("/", 5, 5);
+    ex_test_stat("/b", 2, 2);
+    ex_test_stat("/empty", 2, 2);
+
+    rv = ex_unlink("/a/file");
+    g_assert(!rv);
+
+    rv = ex_rmdir("/a");
+    g_assert(!rv);
+
+    ex_test_stat("/", 4, 4);
+
+    // counts are persisted with the directory
+    struct ex_inode *root = ex_test_find("/");
+    g_assert(root);
+
+    struct ex_inode disk;
+    g_assert_cmpint(ex_inode_load(root->address, &disk), ==, OK);
+    g_assert_cmpuint(disk.dir_entries, ==, 4);
+    g_assert_cmpuint(disk.nlinks, ==, 4);
+    g_assert_cmpuint(disk.size, ==, 4 * sizeof(struct ex_dir_entry));
+
+    ex_inode_put(root);
+    ex_deinit();
+}
+
+void test_dir_convert_nospace(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_mkdir("/dir", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    // fill the linear directory up to the conversion
+    const size_t count = EX_DIR_INDEX_THRESHOLD * EX_DIR_BLOCK_ENTRIES - 2;
+    char name[64];
+
+    for (size_t i = 0; i < count; i++) {
+        snprintf(name, sizeof(name), "/dir/entry-%03zu", i);
+        rv = ex_link("/file", name);
+        g_assert(!rv);
+    }
+
+    // fill the device, only one block is left
+    rv = ex_create("/fill", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    static char chunk[256 * EX_BLOCK_SIZE];
+    size_t off = 0;
+
+    while (ex_test_free_blocks() > 2 * sizeof(chunk) / EX_BLOCK_SIZE) {
+        rv = ex_write("/fill", chunk, sizeof(chunk), off);
+        g_assert_cmpint(rv, ==, sizeof(chunk));
+        off += sizeof(chunk);
+    }
+
+    while (ex_test_free_blocks() > 1) {
+        rv = ex_write("/fill", chunk, EX_BLOCK_SIZE, off);
+        g_assert_cmpint(rv, ==, EX_BLOCK_SIZE);
+        off += EX_BLOCK_SIZE;
+    }
+
+    if (!ex_test_free_blocks()) {
+        off -= EX_BLOCK_SIZE;
+        rv = ex_truncate("/fill", off);
+        g_assert(!rv);
+    }
+
+    g_assert_cmpuint(ex_test_free_blocks(), ==, 1);
+
+    // the index needs two blocks, so the directory grows linearly
+    struct ex_dir_stats stats;
+    ex_dir_reset_stats();
+
+    rv = ex_link("/file", "/dir/last");
+    g_assert(!rv);
+
+    ex_dir_get_stats(&stats);
+    g_assert_cmpuint(stats.conversions, ==, 0);
+
+    struct ex_inode *dir = ex_test_find("/dir");
+    g_assert(dir);
+    g_assert(!(dir->flags & (EX_INODE_DIR_HASHED | EX_INODE_DIR_BTREE)));
+    g_assert_cmpuint(dir->dir_blocks, ==, EX_DIR_INDEX_THRESHOLD + 1);
+    ex_inode_put(dir);
+
+    // no entry was lost
+    g_assert_cmpuint(ex_test_count_entries("/dir"), ==, count + 3);
+
+    struct stat st;
+    rv = ex_getattr("/dir/entry-000", &st);
+    g_assert(!rv);
+
+    rv = ex_getattr("/dir/last", &st);
+    g_assert(!rv);
+
+    // the directory is converted once there is space
+    rv = ex_unlink("/fill");
+    g_assert(!rv);
+
+    for (size_t i = 0; i < EX_DIR_BLOCK_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "/dir/again-%03zu", i);
+        rv = ex_link("/file", name);
+        g_assert(!rv);
+    }
+
+    dir = ex_test_find("/dir");
+    g_assert(dir);
+    g_assert(dir->flags & EX_INODE_DIR_HASHED);
+    ex_inode_put(dir);
+
+    g_assert_cmpuint(ex_test_count_entries("/dir"), ==,
+                     count + 3 + EX_DIR_BLOCK_ENTRIES);
+
+    ex_deinit();
+}
@@ -31,7 +31,7 @@ void test_inode_find(void) {
     g_assert(inode);
 
     ex_path_free(path);
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
     path = ex_path_make("/a/b");
     inode = ex_inode_find(path);
@@ -39,7 +39,7 @@ void test_inode_find(void) {
     g_assert(inode);
 
     ex_path_free(path);
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
     path = ex_path_make("/");
     inode = ex_inode_find(path);
@@ -47,7 +47,7 @@ void test_inode_find(void) {
     g_assert(inode);
 
     ex_path_free(path);
-    ex_inode_free(inode);
+    ex_inode_put(inode);
 
     path = ex_path_make("/a/b/c/d");
     inode = ex_inode_find(path);
@@ -0,0 +1,13 @@
+#include "test_helpers.h"
+#include "../src/ex.h"
+
+#include <glib.h>
+#include <sys/statvfs.h>
+
+fsblkcnt_t ex_test_free_blocks(void) {
+
+    struct statvfs st;
+    g_assert(!ex_statfs(&st));
+
+    return st.f_bfree;
+}
@@ -0,0 +1,9 @@
+#ifndef EX_TEST_HELPERS_H
+#define EX_TEST_HELPERS_H
+
+#include <sys/statvfs.h>
+
+/** Get the number of free data blocks of the mounted device. */
+fsblkcnt_t ex_test_free_blocks(void);
+
+#endif /* EX_TEST_HELPERS_H */
@@ -0,0 +1,89 @@
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/icache.h"
+#include "../src/inode.h"
+
+#include <err.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+void test_icache_lookup_is_cached(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_mkdir("/a", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+    rv = ex_mkdir("/a/b", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+    rv = ex_create("/a/b/c", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    struct stat st;
+    rv = ex_getattr("/a/b/c", &st);
+    g_assert(!rv);
+
+    struct ex_icache_stats before;
+    ex_icache_get_stats(&before);
+
+    // all path components are already cached
+    for (size_t i = 0; i < 16; i++) {
+        rv = ex_getattr("/a/b/c", &st);
+        g_assert(!rv);
+    }
+
+    struct ex_icache_stats after;
+    ex_icache_get_stats(&after);
+
+    g_assert_cmpint(after.misses, ==, before.misses);
+    g_assert_cmpint(after.hits, ==, before.hits + 16 * 4);
+
+    // references returned by the lookup are shared
+    struct ex_path *path = ex_path_make("/a/b/c");
+    struct ex_inode *first = ex_inode_find(path);
+    struct ex_inode *second = ex_inode_find(path);
+
+    g_assert(first);
+    g_assert(first == second);
+
+    ex_inode_put(second);
+    ex_inode_put(first);
+    ex_path_free(path);
+
+    ex_deinit();
+}
+
+void test_icache_reused_inode(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_write("/file", "data", 4, 0);
+    g_assert_cmpint(rv, ==, 4);
+
+    struct stat st;
+    rv = ex_getattr("/file", &st);
+    g_assert(!rv);
+    g_assert_cmpint(st.st_size, ==, 4);
+
+    rv = ex_unlink("/file");
+    g_assert(!rv);
+
+    // the new directory gets the inode of the removed file, the cache must
+    // not return the stale inode
+    rv = ex_mkdir("/dir", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_getattr("/dir", &st);
+    g_assert(!rv);
+    g_assert(S_ISDIR(st.st_mode));
+    g_assert_cmpint(st.st_ino, ==, 1);
+
+    ex_deinit();
+}
@@ -0,0 +1,107 @@
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/inode.h"
+#include "test_helpers.h"
+
+#include <errno.h>
+#include <err.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+void test_inline_data_small_file(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    size_t nfree = ex_test_free_blocks();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    const char data[] = "key = value";
+
+    // the gap before the data is read as zeros
+    rv = ex_write("/file", data, sizeof(data), 16);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    // small file does not use any data block
+    g_assert_cmpint(ex_test_free_blocks(), ==, nfree);
+
+    char buffer[16 + sizeof(data)];
+    rv = ex_read("/file", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(buffer));
+
+    for (size_t i = 0; i < 16; i++) {
+        g_assert_cmpint(buffer[i], ==, '\0');
+    }
+
+    g_assert(!memcmp(buffer + 16, data, sizeof(data)));
+
+    // truncated data must not reappear when the file grows again
+    rv = ex_truncate("/file", 18);
+    g_assert(!rv);
+
+    rv = ex_truncate("/file", sizeof(buffer));
+    g_assert(!rv);
+
+    rv = ex_read("/file", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(buffer));
+    g_assert(!memcmp(buffer + 16, data, 2));
+
+    for (size_t i = 18; i < sizeof(buffer); i++) {
+        g_assert_cmpint(buffer[i], ==, '\0');
+    }
+
+    // symlink target is stored inline too
+    rv = ex_symlink("/file", "/link");
+    g_assert(!rv);
+    g_assert_cmpint(ex_test_free_blocks(), ==, nfree);
+
+    char target[32] = {0};
+    rv = ex_readlink("/link", target, sizeof(target));
+    g_assert(!rv);
+    g_assert_cmpstr(target, ==, "/file");
+
+    ex_deinit();
+}
+
+void test_inline_data_spill(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    size_t nfree = ex_test_free_blocks();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    static char data[EX_INODE_INLINE_DATA_SIZE + 1];
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = 'a' + i % 26;
+    }
+
+    rv = ex_write("/file", data, EX_INODE_INLINE_DATA_SIZE, 0);
+    g_assert_cmpint(rv, ==, EX_INODE_INLINE_DATA_SIZE);
+    g_assert_cmpint(ex_test_free_blocks(), ==, nfree);
+
+    // the data do not fit into the inode anymore, they are moved to a block
+    rv = ex_write("/file", data + EX_INODE_INLINE_DATA_SIZE, 1,
+                  EX_INODE_INLINE_DATA_SIZE);
+    g_assert_cmpint(rv, ==, 1);
+    g_assert_cmpint(ex_test_free_blocks(), ==, nfree - 1);
+
+    static char buffer[sizeof(data)];
+    rv = ex_read("/file", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(buffer));
+    g_assert(!memcmp(buffer, data, sizeof(data)));
+
+    rv = ex_unlink("/file");
+    g_assert(!rv);
+    g_assert_cmpint(ex_test_free_blocks(), ==, nfree);
+
+    ex_deinit();
+}
@@ -0,0 +1,99 @@
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/inode.h"
+
+#include <err.h>
+#include <glib.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+void test_inode_format_packed(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    char name[16];
+    const size_t nfiles = 2 * EX_INODES_PER_BLOCK;
+
+    for (size_t i = 0; i < nfiles; i++) {
+        snprintf(name, sizeof(name), "/file%zu", i);
+
+        int rv = ex_create(name, S_IRWXU, getgid(), getuid());
+        g_assert(!rv);
+    }
+
+    struct ex_path *path = ex_path_make("/");
+    struct ex_inode *root = ex_inode_find(path);
+    g_assert(root);
+
+    inode_address first = root->address;
+
+    ex_inode_put(root);
+    ex_path_free(path);
+
+    // inodes are packed next to each other in the inode table
+    for (size_t i = 0; i < nfiles; i++) {
+        snprintf(name, sizeof(name), "/file%zu", i);
+
+        path = ex_path_make(name);
+        struct ex_inode *inode = ex_inode_find(path);
+        g_assert(inode);
+
+        g_assert_cmpint(inode->address, ==,
+                        first + inode->number * EX_INODE_SIZE);
+
+        ex_inode_put(inode);
+        ex_path_free(path);
+    }
+
+    ex_deinit();
+}
+
+void test_inode_format_reload(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_write("/file", "data", 4, 0);
+    g_assert_cmpint(rv, ==, 4);
+
+    rv = ex_setxattr("/file", "user.name", "value", 5, 0);
+    g_assert(!rv);
+
+    struct stat before;
+    rv = ex_getattr("/file", &before);
+    g_assert(!rv);
+
+    // the inode and its attributes are loaded from the device again
+    ex_deinit();
+    rv = ex_init(EX_DEVICE);
+    g_assert_cmpint(rv, ==, OK);
+
+    struct stat after;
+    rv = ex_getattr("/file", &after);
+    g_assert(!rv);
+
+    g_assert_cmpint(after.st_ino, ==, before.st_ino);
+    g_assert_cmpint(after.st_mode, ==, before.st_mode);
+    g_assert_cmpint(after.st_size, ==, before.st_size);
+    g_assert_cmpint(after.st_mtim.tv_sec, ==, before.st_mtim.tv_sec);
+    g_assert_cmpint(after.st_mtim.tv_nsec, ==, before.st_mtim.tv_nsec);
+
+    char value[8] = {0};
+    rv = ex_getxattr("/file", "user.name", value, sizeof(value));
+    g_assert_cmpint(rv, ==, 5);
+    g_assert_cmpstr(value, ==, "value");
+
+    char data[4];
+    rv = ex_read("/file", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, 4);
+    g_assert(!memcmp(data, "data", 4));
+
+    ex_deinit();
+}
@@ -38,7 +38,42 @@ void test_read_with_invalid_args();
 void test_not_enough_space_for_inode();
 void test_partial_read(void);
 void test_truncate_invalid_arguments(void);
+void test_truncate_release_blocks(void);
 void test_read_empty_file(void);
+void test_read_across_blocks(void);
+void test_read_runs(void);
+void test_write_across_blocks(void);
+void test_write_sparse_extents(void);
+void test_write_into_read_hole(void);
+void test_write_from(void);
+void test_copy_range(void);
+void test_clone(void);
+void test_lz4_roundtrip(void);
+void test_compress(void);
+void test_hash128(void);
+void test_dedup(void);
+void test_sparse_file(void);
+void test_dir_index(void);
+void test_dir_btree(void);
+void test_dir_high_water(void);
+void test_dir_free_slot(void);
+void test_dir_counts(void);
+void test_dir_convert_nospace(void);
+void test_dcache_negative(void);
+void test_dcache_read_error(void);
+void test_readdir_stream(void);
+void test_readdir_plus(void);
+void test_inline_data_small_file(void);
+void test_inline_data_spill(void);
+void test_icache_lookup_is_cached(void);
+void test_icache_reused_inode(void);
+void test_inode_format_packed(void);
+void test_inode_format_reload(void);
+void test_writeback_deferred(void);
+void test_writeback_lazy_mtime(void);
+void test_atime_relatime(void);
+void test_atime_noatime(void);
+void test_atime_lazytime(void);
 
 int main(int argc, char **argv) {
     ex_set_log_level(fatal);
@@ -49,6 +84,8 @@ int main(int argc, char **argv) {
     g_test_add_func("/exfuse/test_truncate_file", test_truncate_file);
     g_test_add_func("/exfuse/test_truncate_invalid_arguments",
             test_truncate_invalid_arguments);
+    g_test_add_func("/exfuse/test_truncate_release_blocks",
+            test_truncate_release_blocks);
     g_test_add_func("/exfuse/test_unlink_file", test_unlink_file);
     g_test_add_func("/exfuse/test_repopulation_of_device",
                     test_repopulation_of_device);
@@ -80,6 +117,53 @@ int main(int argc, char **argv) {
     g_test_add_func("/exfuse/test_parial_read", test_partial_read);
     g_test_add_func("/exfuse/test_read_with_invalid_args", test_read_with_invalid_args);
     g_test_add_func("/exfuse/test_empty_read", test_read_empty_file);
+    g_test_add_func("/exfuse/test_read_across_blocks", test_read_across_blocks);
+    g_test_add_func("/exfuse/test_read_runs", test_read_runs);
+    g_test_add_func("/exfuse/test_write_across_blocks",
+            test_write_across_blocks);
+    g_test_add_func("/exfuse/test_write_sparse_extents",
+            test_write_sparse_extents);
+    g_test_add_func("/exfuse/test_write_into_read_hole",
+            test_write_into_read_hole);
+    g_test_add_func("/exfuse/test_write_from", test_write_from);
+    g_test_add_func("/exfuse/test_copy_range", test_copy_range);
+    g_test_add_func("/exfuse/test_clone", test_clone);
+    g_test_add_func("/exfuse/test_lz4_roundtrip", test_lz4_roundtrip);
+    g_test_add_func("/exfuse/test_compress", test_compress);
+    g_test_add_func("/exfuse/test_hash128", test_hash128);
+    g_test_add_func("/exfuse/test_dedup", test_dedup);
+    g_test_add_func("/exfuse/test_sparse_file", test_sparse_file);
+    g_test_add_func("/exfuse/test_dir_index", test_dir_index);
+    g_test_add_func("/exfuse/test_dir_btree", test_dir_btree);
+    g_test_add_func("/exfuse/test_dir_high_water", test_dir_high_water);
+    g_test_add_func("/exfuse/test_dir_free_slot", test_dir_free_slot);
+    g_test_add_func("/exfuse/test_dir_counts", test_dir_counts);
+    g_test_add_func("/exfuse/test_dir_convert_nospace",
+                    test_dir_convert_nospace);
+    g_test_add_func("/exfuse/test_dcache_negative", test_dcache_negative);
+    g_test_add_func("/exfuse/test_dcache_read_error",
+            test_dcache_read_error);
+    g_test_add_func("/exfuse/test_readdir_stream", test_readdir_stream);
+    g_test_add_func("/exfuse/test_readdir_plus", test_readdir_plus);
+    g_test_add_func("/exfuse/test_inline_data_small_file",
+            test_inline_data_small_file);
+    g_test_add_func("/exfuse/test_inline_data_spill",
+            test_inline_data_spill);
+    g_test_add_func("/exfuse/test_icache_lookup_is_cached",
+            test_icache_lookup_is_cached);
+    g_test_add_func("/exfuse/test_icache_reused_inode",
+            test_icache_reused_inode);
+    g_test_add_func("/exfuse/test_inode_format_packed",
+            test_inode_format_packed);
+    g_test_add_func("/exfuse/test_inode_format_reload",
+            test_inode_format_reload);
+    g_test_add_func("/exfuse/test_writeback_deferred",
+            test_writeback_deferred);
+    g_test_add_func("/exfuse/test_writeback_lazy_mtime",
+            test_writeback_lazy_mtime);
+    g_test_add_func("/exfuse/test_atime_relatime", test_atime_relatime);
+    g_test_add_func("/exfuse/test_atime_noatime", test_atime_noatime);
+    g_test_add_func("/exfuse/test_atime_lazytime", test_atime_lazytime);
     g_test_add_func("/exfuse/test_not_enough_space_for_inode",
             test_not_enough_space_for_inode);
     g_test_add_func("/exfuse/test_bitmap_flip",
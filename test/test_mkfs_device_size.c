@@ -26,10 +26,14 @@ void test_mkfs_device_size(void) {
     // the size of the super block an inode bitmap and a data bitmap rounded
     // to block size
     size_t expected_device_size = 3 * EX_BLOCK_SIZE;
-    // size for `ninodes` inodes
-    expected_device_size += EX_BLOCK_SIZE * ninodes;
+    // reference counts of all data blocks
+    expected_device_size += 2 * EX_BLOCK_SIZE;
+    // hash index entries of all data blocks
+    expected_device_size += 16 * EX_BLOCK_SIZE;
+    // size for `ninodes` inodes packed into the inode table
+    expected_device_size += EX_BLOCK_SIZE;
     // number of data blocks for `ninodes` inodes
-    expected_device_size += ex_inode_max_blocks() * ninodes * EX_BLOCK_SIZE;
+    expected_device_size += EX_DATA_BLOCKS_PER_INODE * ninodes * EX_BLOCK_SIZE;
     g_assert_cmpint(super_block->device_size, ==, expected_device_size);
 
     ex_deinit();
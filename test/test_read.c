@@ -114,3 +114,138 @@ void test_read_empty_file(void) {
 
     ex_deinit();
 }
+
+void test_read_across_blocks(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    // fill every block with a different pattern
+    static char data[4 * EX_BLOCK_SIZE];
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = 'a' + (i / EX_BLOCK_SIZE);
+    }
+
+    rv = ex_write("/file", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    // read the range which starts and ends in the middle of a block
+    static char buffer[2 * EX_BLOCK_SIZE + 2];
+    off_t offset = EX_BLOCK_SIZE - 1;
+
+    rv = ex_read("/file", buffer, sizeof(buffer), offset);
+    g_assert_cmpint(rv, ==, sizeof(buffer));
+
+    rv = memcmp(data + offset, buffer, sizeof(buffer));
+    g_assert_cmpint(rv, ==, 0);
+
+    ex_deinit();
+}
+
+/** Gather the data described by the runs like libfuse does. */
+static size_t gather_runs(struct ex_inode_run *runs, int nruns, char *buffer) {
+
+    size_t done = 0;
+
+    for (int i = 0; i < nruns; i++) {
+
+        if (runs[i].data) {
+            memcpy(buffer + done, runs[i].data, runs[i].length);
+            free(runs[i].data);
+        } else {
+            ssize_t readed = 0;
+            ex_status status = ex_device_read_to_buffer(
+                &readed, buffer + done, runs[i].address, runs[i].length);
+
+            g_assert_cmpint(status, ==, OK);
+            g_assert_cmpint(readed, ==, runs[i].length);
+        }
+
+        done += runs[i].length;
+    }
+
+    free(runs);
+
+    return done;
+}
+
+void test_read_runs(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    // inline data are copied
+    rv = ex_write("/file", "inline", 6, 0);
+    g_assert_cmpint(rv, ==, 6);
+
+    struct ex_inode_run *runs;
+    int nruns = ex_read_runs("/file", 16, 0, &runs);
+    g_assert_cmpint(nruns, ==, 1);
+
+    char buffer[4 * EX_BLOCK_SIZE];
+    g_assert_cmpint(gather_runs(runs, nruns, buffer), ==, 6);
+    g_assert(!memcmp(buffer, "inline", 6));
+
+    // the second block is a hole
+    static char data[4 * EX_BLOCK_SIZE];
+    memset(data, 'x', EX_BLOCK_SIZE);
+    memset(data + 2 * EX_BLOCK_SIZE, 'y', 2 * EX_BLOCK_SIZE);
+
+    rv = ex_write("/file", data, EX_BLOCK_SIZE, 0);
+    g_assert_cmpint(rv, ==, EX_BLOCK_SIZE);
+
+    rv = ex_write("/file", data + 2 * EX_BLOCK_SIZE, 2 * EX_BLOCK_SIZE,
+                  2 * EX_BLOCK_SIZE);
+    g_assert_cmpint(rv, ==, 2 * EX_BLOCK_SIZE);
+
+    // blocks may be released concurrently, so data are read into memory
+    g_assert(!ex_read_runs_are_stable());
+
+    nruns = ex_read_runs("/file", sizeof(buffer) - 10, 10, &runs);
+    g_assert_cmpint(nruns, >=, 3);
+
+    for (int i = 0; i < nruns; i++) {
+        g_assert(runs[i].data);
+    }
+
+    g_assert_cmpint(gather_runs(runs, nruns, buffer), ==, sizeof(buffer) - 10);
+    g_assert(!memcmp(buffer, data + 10, sizeof(buffer) - 10));
+
+    // blocks stay in place until the next request, they are not read
+    ex_set_single_threaded(1);
+    g_assert(ex_read_runs_are_stable());
+
+    nruns = ex_read_runs("/file", sizeof(buffer) - 10, 10, &runs);
+    g_assert_cmpint(nruns, >=, 3);
+    g_assert(!runs[0].data);
+    g_assert_cmpuint(runs[0].address, !=, EX_BLOCK_INVALID_ADDRESS);
+
+    g_assert_cmpint(gather_runs(runs, nruns, buffer), ==, sizeof(buffer) - 10);
+    g_assert(!memcmp(buffer, data + 10, sizeof(buffer) - 10));
+
+    // the writeback may move blocks of compressed files
+    ex_set_compression(1);
+    g_assert(!ex_read_runs_are_stable());
+
+    nruns = ex_read_runs("/file", sizeof(buffer) - 10, 10, &runs);
+    g_assert_cmpint(nruns, >=, 3);
+    g_assert(runs[0].data);
+
+    g_assert_cmpint(gather_runs(runs, nruns, buffer), ==, sizeof(buffer) - 10);
+
+    ex_set_compression(0);
+    ex_set_single_threaded(0);
+
+    // nothing is resolved past the end of the file
+    nruns = ex_read_runs("/file", 16, sizeof(data), &runs);
+    g_assert_cmpint(nruns, ==, 0);
+
+    ex_deinit();
+}
@@ -0,0 +1,228 @@
+#include "../src/dcache.h"
+#include "../src/dir.h"
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/inode.h"
+#include "../src/path.h"
+
+#include <errno.h>
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/** Number of entries of the listed directory. */
+#define EX_TEST_READDIR_ENTRIES 300
+
+/** Number of entries which fit into one readdir buffer. */
+#define EX_TEST_READDIR_BUFFER 50
+
+struct ex_test_readdir {
+    /** Number of entries added to the current buffer. */
+    size_t filled;
+    /** Offset of the entry after the last accepted one. */
+    off_t next;
+    /** How many times each entry was returned, "." and ".." are the last. */
+    size_t seen[EX_TEST_READDIR_ENTRIES + 2];
+};
+
+static int ex_test_fill(const struct ex_dir_entry *entry, off_t next,
+                        const struct stat *st, void *ctx) {
+
+    struct ex_test_readdir *readdir = ctx;
+
+    g_assert(!st);
+
+    if (readdir->filled == EX_TEST_READDIR_BUFFER) {
+        return 1;
+    }
+
+    size_t i;
+
+    if (!strcmp(entry->name, ".")) {
+        i = EX_TEST_READDIR_ENTRIES;
+    } else if (!strcmp(entry->name, "..")) {
+        i = EX_TEST_READDIR_ENTRIES + 1;
+    } else {
+        g_assert_cmpint(sscanf(entry->name, "entry-%zu", &i), ==, 1);
+        g_assert_cmpuint(i, <, EX_TEST_READDIR_ENTRIES);
+    }
+
+    readdir->seen[i]++;
+
+    readdir->filled++;
+    readdir->next = next;
+
+    return 0;
+}
+
+void test_readdir_stream(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_mkdir("/dir", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    char name[64];
+
+    for (size_t i = 0; i < EX_TEST_READDIR_ENTRIES; i++) {
+        snprintf(name, sizeof(name), "/dir/entry-%03zu", i);
+        rv = ex_link("/file", name);
+        g_assert(!rv);
+    }
+
+    struct ex_test_readdir readdir;
+    memset(&readdir, '\0', sizeof(readdir));
+    struct ex_dir_cursor cursor;
+    size_t calls = 0;
+
+    ex_dir_reset_stats();
+
+    // every call continues where the previous buffer was full
+    do {
+        readdir.filled = 0;
+        rv = ex_readdir_cursor("/dir", &cursor, readdir.next, 0,
+                               ex_test_fill, &readdir);
+        g_assert(!rv);
+        calls++;
+    } while (readdir.filled == EX_TEST_READDIR_BUFFER);
+
+    g_assert_cmpuint(calls, ==,
+                     (EX_TEST_READDIR_ENTRIES + 2) / EX_TEST_READDIR_BUFFER + 1);
+    g_assert_cmpuint(readdir.next, ==, EX_TEST_READDIR_ENTRIES + 2);
+
+    for (size_t i = 0; i < EX_TEST_READDIR_ENTRIES + 2; i++) {
+        g_assert_cmpuint(readdir.seen[i], ==, 1);
+    }
+
+    // the directory was read once, calls resumed from the cursor
+    struct ex_path *path = ex_path_make("/dir");
+    struct ex_inode *dir = ex_inode_find(path);
+    g_assert(dir);
+
+    struct ex_dir_stats stats;
+    ex_dir_get_stats(&stats);
+    g_assert_cmpuint(stats.block_reads, <=, dir->dir_blocks);
+
+    ex_inode_put(dir);
+    ex_path_free(path);
+
+    // any offset can be continued with a new cursor
+    memset(&cursor, '\0', sizeof(cursor));
+
+    readdir.filled = 0;
+    rv = ex_readdir_cursor("/dir", &cursor, 280, 0, ex_test_fill, &readdir);
+    g_assert(!rv);
+    g_assert_cmpuint(readdir.filled, ==, EX_TEST_READDIR_ENTRIES + 2 - 280);
+
+    // the offset zero starts again
+    readdir.filled = 0;
+    rv = ex_readdir_cursor("/dir", &cursor, 0, 0, ex_test_fill, &readdir);
+    g_assert(!rv);
+    g_assert_cmpuint(readdir.filled, ==, EX_TEST_READDIR_BUFFER);
+    g_assert_cmpuint(readdir.next, ==, EX_TEST_READDIR_BUFFER);
+
+    rv = ex_readdir_cursor("/file", &cursor, 0, 0, ex_test_fill, &readdir);
+    g_assert_cmpint(rv, ==, -ENOTDIR);
+
+    rv = ex_readdir_cursor("/missing", &cursor, 0, 0, ex_test_fill, &readdir);
+    g_assert_cmpint(rv, ==, -ENOENT);
+
+    ex_deinit();
+}
+
+/** Number of files of the directory listed with attributes. */
+#define EX_TEST_READDIR_FILES 150
+
+struct ex_test_readdir_plus {
+    /** Number of entries added to the current buffer. */
+    size_t filled;
+    /** Offset of the entry after the last accepted one. */
+    off_t next;
+    /** Number of all accepted entries. */
+    size_t count;
+};
+
+static int ex_test_fill_plus(const struct ex_dir_entry *entry, off_t next,
+                             const struct stat *st, void *ctx) {
+
+    struct ex_test_readdir_plus *readdir = ctx;
+
+    g_assert(st);
+
+    if (readdir->filled == EX_TEST_READDIR_BUFFER) {
+        return 1;
+    }
+
+    size_t i;
+
+    if (!strcmp(entry->name, ".") || !strcmp(entry->name, "..")) {
+        g_assert(S_ISDIR(st->st_mode));
+    } else {
+        g_assert_cmpint(sscanf(entry->name, "file-%zu", &i), ==, 1);
+        g_assert(!S_ISDIR(st->st_mode));
+        g_assert_cmpint(st->st_size, ==, i);
+        g_assert_cmpuint(st->st_nlink, ==, 1);
+    }
+
+    readdir->filled++;
+    readdir->count++;
+    readdir->next = next;
+
+    return 0;
+}
+
+void test_readdir_plus(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_mkdir("/dir", S_IRWXU | S_IFDIR, getgid(), getuid());
+    g_assert(!rv);
+
+    char name[64], data[EX_TEST_READDIR_FILES];
+    memset(data, 'x', sizeof(data));
+
+    for (size_t i = 0; i < EX_TEST_READDIR_FILES; i++) {
+        snprintf(name, sizeof(name), "/dir/file-%03zu", i);
+        rv = ex_create(name, S_IRWXU, getgid(), getuid());
+        g_assert(!rv);
+
+        rv = ex_write(name, data, i, 0);
+        g_assert_cmpint(rv, ==, i);
+    }
+
+    struct ex_test_readdir_plus readdir;
+    memset(&readdir, '\0', sizeof(readdir));
+
+    struct ex_dir_cursor cursor;
+    struct ex_dcache_stats stats;
+    size_t calls = 0;
+
+    ex_dcache_reset_stats();
+
+    // buffers end in the middle of batches
+    do {
+        readdir.filled = 0;
+        rv = ex_readdir_cursor("/dir", &cursor, readdir.next, 1,
+                               ex_test_fill_plus, &readdir);
+        g_assert(!rv);
+        calls++;
+    } while (readdir.filled == EX_TEST_READDIR_BUFFER);
+
+    g_assert_cmpuint(readdir.count, ==, EX_TEST_READDIR_FILES + 2);
+    g_assert_cmpuint(readdir.next, ==, EX_TEST_READDIR_FILES + 2);
+
+    // entries were not looked up by names, only the directory was
+    ex_dcache_get_stats(&stats);
+    g_assert_cmpuint(stats.hits + stats.misses, ==, calls);
+
+    ex_deinit();
+}
@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/super.h"
+#include "test_helpers.h"
+
+#include <errno.h>
+#include <err.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+void test_sparse_file(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/sparse", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    fsblkcnt_t baseline = ex_test_free_blocks();
+
+    static char data[EX_BLOCK_SIZE];
+    static char buffer[8 * EX_BLOCK_SIZE];
+    static const char zeros[8 * EX_BLOCK_SIZE];
+
+    memset(data, 'x', sizeof(data));
+
+    // data | 9 blocks of a hole | data
+    rv = ex_write("/sparse", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    rv = ex_write("/sparse", data, sizeof(data), 10 * EX_BLOCK_SIZE);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    // the gap is not allocated
+    g_assert_cmpuint(baseline - ex_test_free_blocks(), ==, 2);
+
+    struct stat st;
+    rv = ex_getattr("/sparse", &st);
+    g_assert(!rv);
+    g_assert_cmpint(st.st_size, ==, 11 * EX_BLOCK_SIZE);
+    g_assert_cmpint(st.st_blocks, ==, 2 * EX_BLOCK_SIZE / 512);
+
+    rv = ex_read("/sparse", buffer, sizeof(buffer), EX_BLOCK_SIZE);
+    g_assert_cmpint(rv, ==, sizeof(buffer));
+    g_assert(!memcmp(buffer, zeros, sizeof(buffer)));
+
+    g_assert_cmpint(ex_lseek("/sparse", 0, SEEK_DATA), ==, 0);
+    g_assert_cmpint(ex_lseek("/sparse", 10, SEEK_HOLE), ==, EX_BLOCK_SIZE);
+    g_assert_cmpint(ex_lseek("/sparse", EX_BLOCK_SIZE, SEEK_DATA), ==,
+                    10 * EX_BLOCK_SIZE);
+    g_assert_cmpint(ex_lseek("/sparse", 3 * EX_BLOCK_SIZE + 7, SEEK_HOLE),
+                    ==, 3 * EX_BLOCK_SIZE + 7);
+    g_assert_cmpint(ex_lseek("/sparse", 10 * EX_BLOCK_SIZE + 5, SEEK_DATA),
+                    ==, 10 * EX_BLOCK_SIZE + 5);
+
+    // the end of the file is a hole
+    g_assert_cmpint(ex_lseek("/sparse", 10 * EX_BLOCK_SIZE, SEEK_HOLE), ==,
+                    11 * EX_BLOCK_SIZE);
+    g_assert_cmpint(ex_lseek("/sparse", 11 * EX_BLOCK_SIZE, SEEK_DATA), ==,
+                    -ENXIO);
+    g_assert_cmpint(ex_lseek("/sparse", 11 * EX_BLOCK_SIZE, SEEK_HOLE), ==,
+                    -ENXIO);
+    g_assert_cmpint(ex_lseek("/sparse", 0, SEEK_SET), ==, -EINVAL);
+
+    // a file which ends by a hole has no data after the last block
+    rv = ex_truncate("/sparse", 20 * EX_BLOCK_SIZE);
+    g_assert(!rv);
+    g_assert_cmpint(ex_lseek("/sparse", 12 * EX_BLOCK_SIZE, SEEK_DATA), ==,
+                    -ENXIO);
+
+    // inline data have no holes
+    rv = ex_create("/small", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_write("/small", "small", 5, 0);
+    g_assert_cmpint(rv, ==, 5);
+
+    g_assert_cmpint(ex_lseek("/small", 2, SEEK_DATA), ==, 2);
+    g_assert_cmpint(ex_lseek("/small", 2, SEEK_HOLE), ==, 5);
+
+    rv = ex_getattr("/small", &st);
+    g_assert(!rv);
+    g_assert_cmpint(st.st_blocks, ==, 0);
+
+    g_assert_cmpint(ex_lseek("/none", 0, SEEK_DATA), ==, -ENOENT);
+
+    rv = ex_unlink("/sparse");
+    g_assert(!rv);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, baseline);
+
+    ex_deinit();
+}
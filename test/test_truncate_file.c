@@ -2,6 +2,7 @@
 #include "../src/mkfs.h"
 #include "../src/device.h"
 #include "../src/inode.h"
+#include "test_helpers.h"
 
 #include <err.h>
 #include <errno.h>
@@ -73,3 +74,95 @@ void test_truncate_invalid_arguments(void) {
 
     ex_deinit();
 }
+
+void test_truncate_release_blocks(void) {
+    // create a new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/log", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    fsblkcnt_t baseline = ex_test_free_blocks();
+
+    static char data[10 * EX_BLOCK_SIZE];
+    static char buffer[sizeof(data)];
+    static const char zeros[sizeof(data)];
+
+    memset(data, 'x', sizeof(data));
+
+    rv = ex_write("/log", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert_cmpuint(baseline - ex_test_free_blocks(), ==, 10);
+
+    // blocks past the new end are freed
+    const size_t size = 2 * EX_BLOCK_SIZE + 100;
+
+    rv = ex_truncate("/log", size);
+    g_assert(!rv);
+    g_assert_cmpuint(baseline - ex_test_free_blocks(), ==, 3);
+
+    // the file grows by a hole, old data are not exposed
+    rv = ex_truncate("/log", sizeof(data));
+    g_assert(!rv);
+    g_assert_cmpuint(baseline - ex_test_free_blocks(), ==, 3);
+
+    struct stat st;
+    rv = ex_getattr("/log", &st);
+    g_assert(!rv);
+    g_assert_cmpint(st.st_size, ==, sizeof(data));
+    g_assert_cmpint(st.st_blocks, ==, 3 * EX_BLOCK_SIZE / 512);
+
+    rv = ex_read("/log", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, size));
+    g_assert(!memcmp(buffer + size, zeros, sizeof(data) - size));
+
+    // a shared last block is copied before its tail is zeroed
+    rv = ex_create("/clone", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_clone_file("/log", "/clone");
+    g_assert(!rv);
+
+    rv = ex_truncate("/clone", EX_BLOCK_SIZE + 10);
+    g_assert(!rv);
+
+    rv = ex_read("/log", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, size));
+
+    rv = ex_unlink("/clone");
+    g_assert(!rv);
+
+    rv = ex_truncate("/log", 0);
+    g_assert(!rv);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, baseline);
+
+    // the compressed cluster which crosses the new end is decompressed
+    ex_set_compression(1);
+
+    rv = ex_write("/log", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!ex_sync());
+
+    rv = ex_truncate("/log", size);
+    g_assert(!rv);
+    g_assert_cmpuint(baseline - ex_test_free_blocks(), ==, 3);
+
+    rv = ex_truncate("/log", sizeof(data));
+    g_assert(!rv);
+
+    rv = ex_read("/log", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+    g_assert(!memcmp(buffer, data, size));
+    g_assert(!memcmp(buffer + size, zeros, sizeof(data) - size));
+
+    ex_set_compression(0);
+
+    rv = ex_unlink("/log");
+    g_assert(!rv);
+    g_assert_cmpuint(ex_test_free_blocks(), ==, baseline);
+
+    ex_deinit();
+}
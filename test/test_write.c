@@ -0,0 +1,214 @@
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/inode.h"
+#include "test_helpers.h"
+
+#include <errno.h>
+#include <err.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+void test_write_across_blocks(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    static char data[3 * EX_BLOCK_SIZE];
+    memset(data, 'x', sizeof(data));
+
+    rv = ex_write("/file", data, sizeof(data), 0);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    // overwrite the range which spans over the second block
+    static char patch[EX_BLOCK_SIZE + 2];
+    memset(patch, 'y', sizeof(patch));
+
+    off_t offset = EX_BLOCK_SIZE - 1;
+    rv = ex_write("/file", patch, sizeof(patch), offset);
+    g_assert_cmpint(rv, ==, sizeof(patch));
+
+    memcpy(data + offset, patch, sizeof(patch));
+
+    static char buffer[sizeof(data)];
+    rv = ex_read("/file", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(buffer));
+
+    rv = memcmp(data, buffer, sizeof(data));
+    g_assert_cmpint(rv, ==, 0);
+
+    // size of the file must not change
+    struct stat st;
+    rv = ex_getattr("/file", &st);
+    g_assert(!rv);
+    g_assert_cmpint(st.st_size, ==, sizeof(data));
+
+    ex_deinit();
+}
+
+void test_write_sparse_extents(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    fsblkcnt_t baseline = ex_test_free_blocks();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    // every other block is written, so no extents can be merged and the
+    // extent tree has to grow over multiple levels
+    const size_t nblocks = 1024;
+
+    for (size_t i = 0; i < nblocks; i += 2) {
+        char c = 'a' + i % 26;
+        rv = ex_write("/file", &c, 1, i * EX_BLOCK_SIZE);
+        g_assert_cmpint(rv, ==, 1);
+    }
+
+    static char buffer[2 * EX_BLOCK_SIZE];
+
+    for (size_t i = 0; i + 2 < nblocks; i += 2) {
+        rv = ex_read("/file", buffer, sizeof(buffer), i * EX_BLOCK_SIZE);
+        g_assert_cmpint(rv, ==, sizeof(buffer));
+
+        // rest of the written block and the hole are read as zeros
+        g_assert_cmpint(buffer[0], ==, 'a' + i % 26);
+
+        for (size_t j = 1; j < sizeof(buffer); j++) {
+            g_assert_cmpint(buffer[j], ==, '\0');
+        }
+    }
+
+    // all data and extent node blocks are deallocated with the file
+    rv = ex_unlink("/file");
+    g_assert(!rv);
+
+    g_assert_cmpuint(ex_test_free_blocks(), ==, baseline);
+
+    ex_deinit();
+}
+
+void test_write_into_read_hole(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    static char data[EX_BLOCK_SIZE];
+    memset(data, 'x', sizeof(data));
+
+    // the first four blocks are a hole
+    rv = ex_write("/file", data, sizeof(data), 4 * EX_BLOCK_SIZE);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    static char buffer[5 * EX_BLOCK_SIZE];
+    static char expected[5 * EX_BLOCK_SIZE];
+
+    memcpy(expected + 4 * EX_BLOCK_SIZE, data, sizeof(data));
+
+    rv = ex_read("/file", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(buffer));
+    g_assert(!memcmp(buffer, expected, sizeof(buffer)));
+
+    // the hole was resolved by the read, the write must not see it anymore
+    rv = ex_write("/file", data, sizeof(data), EX_BLOCK_SIZE);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    memcpy(expected + EX_BLOCK_SIZE, data, sizeof(data));
+
+    rv = ex_read("/file", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(buffer));
+    g_assert(!memcmp(buffer, expected, sizeof(buffer)));
+
+    ex_deinit();
+}
+
+/** Store the payload like libfuse does for write_buf. */
+static ssize_t copy_payload(const struct ex_inode_run *run, size_t pos,
+                            void *ctx) {
+
+    const char *payload = ctx;
+
+    if (run->data) {
+        memcpy(run->data, payload + pos, run->length);
+    } else if (ex_device_write(run->address, payload + pos, run->length) !=
+               OK) {
+        return -EIO;
+    }
+
+    return run->length;
+}
+
+void test_write_from(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    // leave garbage in the blocks which are allocated next
+    int rv = ex_create("/probe", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    static char garbage[8 * EX_BLOCK_SIZE];
+    rv = ex_write("/probe", garbage, EX_BLOCK_SIZE, 0);
+    g_assert_cmpint(rv, ==, EX_BLOCK_SIZE);
+
+    struct ex_path *path = ex_path_make("/probe");
+    struct ex_inode *probe = ex_inode_find(path);
+    g_assert(probe);
+
+    memset(garbage, 'z', sizeof(garbage));
+    g_assert_cmpint(ex_device_write(probe->extents.extents[0].physical +
+                                        EX_BLOCK_SIZE,
+                                    garbage, sizeof(garbage)),
+                    ==, OK);
+
+    ex_inode_put(probe);
+    ex_path_free(path);
+
+    rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    // small payload is stored to the inline data
+    rv = ex_write_from("/file", 5, 0, copy_payload, "small");
+    g_assert_cmpint(rv, ==, 5);
+
+    char small[5];
+    rv = ex_read("/file", small, sizeof(small), 0);
+    g_assert_cmpint(rv, ==, sizeof(small));
+    g_assert(!memcmp(small, "small", sizeof(small)));
+
+    // unaligned payload over newly allocated blocks
+    static char data[3 * EX_BLOCK_SIZE];
+    memset(data, 'x', sizeof(data));
+
+    off_t offset = 2 * EX_BLOCK_SIZE + 7;
+    rv = ex_write_from("/file", sizeof(data), offset, copy_payload, data);
+    g_assert_cmpint(rv, ==, sizeof(data));
+
+    static char expected[6 * EX_BLOCK_SIZE];
+    memcpy(expected, "small", 5);
+    memcpy(expected + offset, data, sizeof(data));
+
+    static char buffer[6 * EX_BLOCK_SIZE];
+    rv = ex_read("/file", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, offset + sizeof(data));
+    g_assert(!memcmp(buffer, expected, rv));
+
+    // the rest of the last block is zeroed
+    rv = ex_truncate("/file", 6 * EX_BLOCK_SIZE);
+    g_assert(!rv);
+
+    rv = ex_read("/file", buffer, sizeof(buffer), 0);
+    g_assert_cmpint(rv, ==, sizeof(buffer));
+    g_assert(!memcmp(buffer, expected, sizeof(buffer)));
+
+    ex_deinit();
+}
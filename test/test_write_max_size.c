@@ -3,8 +3,10 @@
 #include "../src/device.h"
 #include "../src/super.h"
 #include "../src/inode.h"
+#include "../src/path.h"
 
 #include <errno.h>
+#include <stdlib.h>
 #include <err.h>
 #include <glib.h>
 #include <sys/stat.h>
@@ -16,23 +18,73 @@ void test_write_max_size(void) {
     unlink(EX_DEVICE);
     ex_mkfs_test_init();
 
-    size_t max_size = EX_DIRECT_BLOCKS * EX_BLOCK_SIZE - 1;
-    char data[max_size];
+    size_t size = 4 * 1024 * 1024 + 1;
+    size_t blocks = (size + EX_BLOCK_SIZE - 1) / EX_BLOCK_SIZE;
+    char *data = malloc(size);
+    char *buffer = malloc(size);
 
-    memset(data, 'a', sizeof(data));
+    for (size_t i = 0; i < size; i++) {
+        data[i] = 'a' + i % 26;
+    }
 
     // create new file
     int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
     g_assert(!rv);
 
-    rv = ex_write("/file", data, max_size, 0);
-    g_assert_cmpint((size_t)rv, ==, max_size);
+    // odd blocks are written before even ones, so no two logically
+    // adjacent blocks are physically adjacent and every block needs its
+    // own extent, which is more than the root in the inode can hold
+    const size_t firsts[] = {1, 0};
 
-    rv = ex_write("/file", data, max_size + 1, 0);
+    for (size_t pass = 0; pass < 2; pass++) {
+        for (size_t i = firsts[pass]; i < blocks; i += 2) {
+            size_t offset = i * EX_BLOCK_SIZE;
+            size_t length = size - offset < EX_BLOCK_SIZE ? size - offset
+                                                          : EX_BLOCK_SIZE;
+
+            rv = ex_write("/file", data + offset, length, offset);
+            g_assert_cmpint((size_t)rv, ==, length);
+        }
+    }
+
+    struct ex_path *path = ex_path_make("/file");
+    struct ex_inode *inode = ex_inode_find(path);
+    g_assert(inode);
+    g_assert_cmpuint(inode->size, ==, size);
+    g_assert_cmpuint(inode->extents.header.depth, >, 0);
+    ex_inode_put(inode);
+    ex_path_free(path);
+
+    rv = ex_read("/file", buffer, size, 0);
+    g_assert_cmpint((size_t)rv, ==, size);
+    g_assert(!memcmp(data, buffer, size));
+
+    size_t max_size = ex_inode_max_blocks() * EX_BLOCK_SIZE;
+
+    // the write may end exactly at the maximum size
+    rv = ex_write("/file", "z", 1, max_size - 1);
+    g_assert_cmpint(rv, ==, 1);
+
+    rv = ex_read("/file", buffer, 2, max_size - 1);
+    g_assert_cmpint(rv, ==, 1);
+    g_assert_cmpint(buffer[0], ==, 'z');
+
+    struct stat st;
+    rv = ex_getattr("/file", &st);
+    g_assert(!rv);
+    g_assert_cmpuint(st.st_size, ==, max_size);
+
+    rv = ex_write("/file", data, 2, max_size - 1);
+    g_assert_cmpint(rv, ==, -EFBIG);
+
+    rv = ex_write("/file", data, 1, max_size);
     g_assert_cmpint(rv, ==, -EFBIG);
 
     rv = ex_write("/file", data, 0, max_size + 1);
     g_assert_cmpint(rv, ==, -EFBIG);
 
+    free(buffer);
+    free(data);
+
     ex_deinit();
 }
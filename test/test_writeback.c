@@ -0,0 +1,162 @@
+#include "../src/ex.h"
+#include "../src/mkfs.h"
+#include "../src/device.h"
+#include "../src/icache.h"
+#include "../src/inode.h"
+
+#include <err.h>
+#include <glib.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+static void assert_on_disk_atime(struct ex_inode *inode, int equal) {
+
+    struct ex_inode disk;
+    ex_status status = ex_inode_load(inode->address, &disk);
+    g_assert_cmpint(status, ==, OK);
+
+    int same = disk.atime.tv_sec == inode->atime.tv_sec &&
+               disk.atime.tv_nsec == inode->atime.tv_nsec;
+    g_assert_cmpint(same, ==, equal);
+}
+
+void test_writeback_deferred(void) {
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_write("/file", "data", 4, 0);
+    g_assert_cmpint(rv, ==, 4);
+
+    rv = ex_fsync("/file", 0);
+    g_assert(!rv);
+
+    struct ex_path *path = ex_path_make("/file");
+    struct ex_inode *inode = ex_inode_find(path);
+    g_assert(inode);
+
+    assert_on_disk_atime(inode, 1);
+
+    // repeated reads only update the cached inode
+    char buffer[4];
+
+    for (size_t i = 0; i < 8; i++) {
+        rv = ex_read("/file", buffer, sizeof(buffer), 0);
+        g_assert_cmpint(rv, ==, sizeof(buffer));
+    }
+
+    struct ex_icache_stats stats;
+    ex_icache_get_stats(&stats);
+    g_assert_cmpint(stats.dirty, ==, 1);
+
+    assert_on_disk_atime(inode, 0);
+
+    // the inode is not dirty long enough to be written by the writeback
+    ex_icache_writeback();
+    assert_on_disk_atime(inode, 0);
+
+    rv = ex_fsync("/file", 0);
+    g_assert(!rv);
+
+    assert_on_disk_atime(inode, 1);
+
+    ex_icache_get_stats(&stats);
+    g_assert_cmpint(stats.dirty, ==, 0);
+
+    // all dirty inodes are written on sync
+    rv = ex_chmod("/file", S_IRUSR);
+    g_assert(!rv);
+
+    ex_icache_get_stats(&stats);
+    g_assert_cmpint(stats.dirty, ==, 1);
+
+    rv = ex_sync();
+    g_assert(!rv);
+
+    ex_icache_get_stats(&stats);
+    g_assert_cmpint(stats.dirty, ==, 0);
+    g_assert_cmpint(stats.writebacks, ==, 1);
+
+    struct ex_inode disk;
+    g_assert_cmpint(ex_inode_load(inode->address, &disk), ==, OK);
+    g_assert_cmpint(disk.mode & 0777, ==, S_IRUSR);
+
+    ex_inode_put(inode);
+    ex_path_free(path);
+
+    ex_deinit();
+}
+
+static int same_mtime(const struct ex_inode *a, const struct ex_inode *b) {
+    return a->mtime.tv_sec == b->mtime.tv_sec &&
+           a->mtime.tv_nsec == b->mtime.tv_nsec;
+}
+
+void test_writeback_lazy_mtime(void) {
+
+    ex_set_atime_mode(EX_ATIME_NOATIME, 1);
+
+    // create new device
+    unlink(EX_DEVICE);
+    ex_mkfs_test_init();
+
+    int rv = ex_create("/file", S_IRWXU, getgid(), getuid());
+    g_assert(!rv);
+
+    rv = ex_write("/file", "data", 4, 0);
+    g_assert_cmpint(rv, ==, 4);
+
+    rv = ex_fsync("/file", 0);
+    g_assert(!rv);
+
+    struct ex_path *path = ex_path_make("/file");
+    struct ex_inode *inode = ex_inode_find(path);
+    g_assert(inode);
+
+    // an overwrite changes only the modification time
+    rv = ex_write("/file", "more", 4, 0);
+    g_assert_cmpint(rv, ==, 4);
+
+    struct ex_icache_stats stats;
+    ex_icache_get_stats(&stats);
+    g_assert_cmpint(stats.dirty, ==, 0);
+
+    struct ex_inode disk;
+    g_assert_cmpint(ex_inode_load(inode->address, &disk), ==, OK);
+    g_assert(!same_mtime(inode, &disk));
+
+    rv = ex_fsync("/file", 0);
+    g_assert(!rv);
+
+    g_assert_cmpint(ex_inode_load(inode->address, &disk), ==, OK);
+    g_assert(same_mtime(inode, &disk));
+
+    // a change of the size is written by the writeback
+    rv = ex_write("/file", "data", 4, 4);
+    g_assert_cmpint(rv, ==, 4);
+
+    ex_icache_get_stats(&stats);
+    g_assert_cmpint(stats.dirty, ==, 1);
+
+    // without lazytime the modification time alone makes the inode dirty
+    ex_set_atime_mode(EX_ATIME_NOATIME, 0);
+
+    rv = ex_fsync("/file", 0);
+    g_assert(!rv);
+
+    rv = ex_write("/file", "more", 4, 0);
+    g_assert_cmpint(rv, ==, 4);
+
+    ex_icache_get_stats(&stats);
+    g_assert_cmpint(stats.dirty, ==, 1);
+
+    ex_inode_put(inode);
+    ex_path_free(path);
+
+    ex_deinit();
+    ex_set_atime_mode(EX_ATIME_RELATIME, 0);
+}